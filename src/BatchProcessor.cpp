@@ -0,0 +1,180 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "BatchProcessor.h"
+#include "Node.h"
+#include "Environment.h"
+#include "ThreadPool.h"
+#include "ParseCache.h"
+
+#include <algorithm>
+
+
+using mathy::BatchProcessor;
+
+
+namespace
+{
+    //! number of lines collected before they are evaluated
+    const size_t batchSize = 4096;
+
+    //! number of lines evaluated by one task
+    const size_t linesPerTask = 64;
+}
+
+
+BatchProcessor::BatchProcessor(::FILE* in, ::FILE* out) :
+    InputProcessor(in, out), output(out)
+{
+}
+
+
+int BatchProcessor::run(void)
+{
+    Environment environment;
+    if (!initializeEnvironment(environment))
+        return 1;
+    ExpressionParser parser(this->in, parserBackend);
+    ParseCache cache(parseCacheCapacity);
+    if (parseCacheCapacity > 0)
+        parser.setCache(&cache);
+
+    while (true) {
+        ParseResult parsed = parser.parseStatement();
+        if (parsed.hasErrors()) {
+            // keeps the message in order with the results before it
+            Line line = { nullptr, nullptr, parsed.errors[0].getString(),
+                          false };
+            pending.push_back(line);
+        }
+
+        if (parser.isEndOfFile())
+            break;
+        if (parsed.expression == nullptr)
+            continue;
+
+        // rulestats prints directly and switches profiling
+        const ExpressionNode* expression = parsed.expression.get();
+        bool blocked = !isIndependent(expression) ||
+            printsDirectly(expression);
+        Line line = { parsed.expression, nullptr, "", blocked };
+        pending.push_back(line);
+        if (line.blocked || pending.size() >= batchSize)
+            flush(environment);
+    }
+    flush(environment);
+    finishEnvironment(environment);
+    output.endLine();
+    output.flush();
+    finishParseCache(cache);
+    return 0;
+}
+
+
+bool BatchProcessor::isIndependent(const ExpressionNode* expression)
+{
+    if (expression->getKind() == NodeKind::ASSIGNMENT)
+        return false;
+
+    for (size_t i = 0; i < expression->getChildCount(); i++) {
+        if (!isIndependent(expression->getChild(i).get()))
+            return false;
+    }
+    return true;
+}
+
+
+void BatchProcessor::evaluate(Environment& environment, Line& line)
+{
+    try {
+        line.result = environment.evaluateExpression(line.expression);
+    } catch(ReadOnlyException&) {
+        line.blocked = true;
+    } catch(std::exception& ex) {
+        line.error = ex.what();
+    }
+}
+
+
+void BatchProcessor::print(const Line& line)
+{
+    if (!line.error.empty()) {
+        // keeps the message in order with the results before it
+        output.flush();
+        printErrorMessage(line.error);
+    }
+    else {
+        output.appendExpression(*line.result);
+        output.endLine();
+    }
+}
+
+
+void BatchProcessor::flush(Environment& environment)
+{
+    ThreadPool& pool = ThreadPool::getDefault();
+    size_t start = 0;
+    while (start < pending.size()) {
+        // everything up to the first line known to change the environment
+        // runs in parallel
+        size_t end = start;
+        while (end < pending.size() && !pending[end].blocked)
+            end++;
+
+        environment.setReadOnly(true);
+        {
+            TaskGroup group(pool);
+            for (size_t first = start; first < end; first += linesPerTask) {
+                size_t last = std::min(first + linesPerTask, end);
+                group.run([this, &environment, first, last] {
+                    for (size_t i = first; i < last; i++) {
+                        if (pending[i].expression)
+                            evaluate(environment, pending[i]);
+                    }
+                });
+            }
+            group.wait();
+        }
+        environment.setReadOnly(false);
+
+        // lines after one that needs to change the environment may depend
+        // on the change, they are repeated afterwards
+        while (start < end && !pending[start].blocked)
+            print(pending[start++]);
+        if (start == pending.size())
+            break;
+
+        Line& line = pending[start++];
+        line.blocked = false;
+        line.result = nullptr;
+        if (printsDirectly(line.expression.get()))
+            output.flush();
+        evaluate(environment, line);
+        print(line);
+        for (size_t i = start; i < pending.size(); i++) {
+            if (pending[i].expression) {
+                pending[i].result = nullptr;
+                pending[i].error.clear();
+            }
+        }
+    }
+    pending.clear();
+}
@@ -0,0 +1,92 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef BATCHPROCESSOR_H_
+#define BATCHPROCESSOR_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+#include "ConsoleInterface.h"
+#include "OutputBuffer.h"
+
+
+class ExpressionNode;
+
+namespace mathy
+{
+    class BatchProcessor;
+}
+
+
+/*!
+ * \brief processes input like \link InputProcessor, but evaluates
+ *        independent lines in parallel
+ *
+ * Parsed lines are collected into batches, which the thread pool evaluates
+ * in a read-only environment. Results are written in input order. Lines
+ * that change the environment, like assignments, end a batch and are
+ * evaluated alone, so every line sees the same symbols as it would when
+ * evaluated one after another. If a line of a batch turns out to change
+ * the environment, e.g. by calling a function that assigns a variable, it
+ * is evaluated again on its own and the lines after it are repeated.
+ */
+class mathy::BatchProcessor : public InputProcessor
+{
+    struct Line
+    {
+        std::shared_ptr<ExpressionNode> expression;
+        std::shared_ptr<ExpressionNode> result;
+        std::string error;
+
+        //! the line needs to change the environment
+        bool blocked;
+    };
+
+    std::vector<Line> pending;
+
+    //! results are serialized here in input order
+    OutputBuffer output;
+public:
+    BatchProcessor(::FILE* in, ::FILE* out);
+
+    virtual int run(void);
+
+private:
+    /*!
+     * \return <code>false</code> if the expression is known to change
+     *         the environment
+     */
+    static bool isIndependent(const ExpressionNode* expression);
+
+    //! evaluates one line, recording the result or error
+    static void evaluate(Environment& environment, Line& line);
+
+    void print(const Line& line);
+
+    //! evaluates and prints all pending lines
+    void flush(Environment& environment);
+};
+
+
+#endif // BATCHPROCESSOR_H_
@@ -0,0 +1,454 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "BigInteger.h"
+#include "Node.h"
+
+#include <algorithm>
+#include <cstdio>
+
+
+/*!
+ * below this number of limbs, schoolbook multiplication is faster than
+ * karatsuba
+ */
+static const size_t karatsubaThreshold = 32;
+
+
+BigInteger::BigInteger(void) :
+    negative(false)
+{
+}
+
+
+BigInteger::BigInteger(long long value) :
+    negative(value < 0)
+{
+    unsigned long long magnitude = negative ?
+        0ULL - static_cast<unsigned long long>(value) :
+        static_cast<unsigned long long>(value);
+    while (magnitude != 0) {
+        limbs.push_back(static_cast<uint32_t>(magnitude));
+        magnitude >>= 32;
+    }
+}
+
+
+BigInteger BigInteger::fromUnsigned(unsigned long long value)
+{
+    BigInteger result;
+    while (value != 0) {
+        result.limbs.push_back(static_cast<uint32_t>(value));
+        value >>= 32;
+    }
+    return result;
+}
+
+
+BigInteger BigInteger::pow10(size_t exponent)
+{
+    BigInteger result(1);
+    BigInteger base(10);
+    while (exponent != 0) {
+        if (exponent & 1)
+            result = result * base;
+        exponent >>= 1;
+        if (exponent != 0)
+            base = base * base;
+    }
+    return result;
+}
+
+
+bool BigInteger::isZero(void) const
+{
+    return limbs.empty();
+}
+
+
+bool BigInteger::isNegative(void) const
+{
+    return negative;
+}
+
+
+bool BigInteger::toLongLong(long long& value) const
+{
+    if (limbs.size() > 2)
+        return false;
+    unsigned long long magnitude = 0;
+    for (size_t i = limbs.size(); i > 0; i--)
+        magnitude = (magnitude << 32) | limbs[i - 1];
+
+    // the most negative value has no positive counterpart
+    const unsigned long long limit = 1ULL << 63;
+    if (magnitude > (negative ? limit : limit - 1))
+        return false;
+    value = negative ? (long long) (0ULL - magnitude) : (long long) magnitude;
+    return true;
+}
+
+
+double BigInteger::toDouble(void) const
+{
+    double result = 0;
+    for (size_t i = limbs.size(); i > 0; i--)
+        result = result * 4294967296.0 + double(limbs[i - 1]);
+    return negative ? -result : result;
+}
+
+
+BigInteger BigInteger::operator + (const BigInteger& other) const
+{
+    BigInteger result;
+    if (negative == other.negative) {
+        result.limbs = addMagnitudes(limbs, other.limbs);
+        result.negative = negative;
+    }
+    else if (compareMagnitudes(limbs, other.limbs) >= 0) {
+        result.limbs = subtractMagnitudes(limbs, other.limbs);
+        result.negative = negative;
+    }
+    else {
+        result.limbs = subtractMagnitudes(other.limbs, limbs);
+        result.negative = other.negative;
+    }
+    if (result.limbs.empty())
+        result.negative = false;
+    return result;
+}
+
+
+BigInteger BigInteger::operator - (const BigInteger& other) const
+{
+    BigInteger negated = other;
+    if (!negated.isZero())
+        negated.negative = !negated.negative;
+    return *this + negated;
+}
+
+
+BigInteger BigInteger::operator * (const BigInteger& other) const
+{
+    BigInteger result;
+    result.limbs = multiplyMagnitudes(limbs, other.limbs);
+    result.negative = !result.limbs.empty() && (negative != other.negative);
+    return result;
+}
+
+
+BigInteger BigInteger::operator / (const BigInteger& other) const
+{
+    if (other.isZero())
+        throw ArithmeticException("division by zero");
+    BigInteger result;
+    result.limbs = divideMagnitudes(limbs, other.limbs);
+    result.negative = !result.limbs.empty() && (negative != other.negative);
+    return result;
+}
+
+
+BigInteger BigInteger::sqrt(void) const
+{
+    if (negative)
+        throw ArithmeticException("square root of negative number");
+    if (isZero())
+        return *this;
+
+    // start with a power of two that is certainly not below the root
+    size_t bits = (limbs.size() - 1) * 32;
+    for (uint32_t top = limbs.back(); top != 0; top >>= 1)
+        bits++;
+    size_t rootBits = (bits + 1) / 2;
+    BigInteger x;
+    x.limbs.resize(rootBits / 32 + 1, 0);
+    x.limbs[rootBits / 32] = uint32_t(1) << (rootBits % 32);
+
+    while (true) {
+        BigInteger y = x + *this / x;
+        divideMagnitude(y.limbs, 2);
+        trim(y.limbs);
+        if (compareMagnitudes(y.limbs, x.limbs) >= 0)
+            return x;
+        x = y;
+    }
+}
+
+
+BigInteger BigInteger::gcd(const BigInteger& a, const BigInteger& b)
+{
+    BigInteger x;
+    BigInteger y;
+    x.limbs = a.limbs;
+    y.limbs = b.limbs;
+    while (!y.isZero()) {
+        BigInteger remainder = x - (x / y) * y;
+        x = y;
+        y = remainder;
+    }
+    return x;
+}
+
+
+std::string BigInteger::getString(void) const
+{
+    if (isZero())
+        return "0";
+
+    std::vector<uint32_t> chunks;
+    Magnitude rest = limbs;
+    while (!rest.empty()) {
+        chunks.push_back(divideMagnitude(rest, 1000000000));
+        trim(rest);
+    }
+
+    std::string result = negative ? "-" : "";
+    char buffer[16];
+    ::snprintf(buffer, sizeof buffer, "%u", chunks.back());
+    result += buffer;
+    for (size_t i = chunks.size() - 1; i > 0; i--) {
+        ::snprintf(buffer, sizeof buffer, "%09u", chunks[i - 1]);
+        result += buffer;
+    }
+    return result;
+}
+
+
+int BigInteger::compareMagnitudes(const Magnitude& a, const Magnitude& b)
+{
+    if (a.size() != b.size())
+        return a.size() < b.size() ? -1 : 1;
+    for (size_t i = a.size(); i > 0; i--) {
+        if (a[i - 1] != b[i - 1])
+            return a[i - 1] < b[i - 1] ? -1 : 1;
+    }
+    return 0;
+}
+
+
+BigInteger::Magnitude BigInteger::addMagnitudes(const Magnitude& a,
+                                                const Magnitude& b)
+{
+    const Magnitude& longer = a.size() >= b.size() ? a : b;
+    const Magnitude& shorter = a.size() >= b.size() ? b : a;
+    Magnitude result(longer.size() + 1);
+    uint64_t carry = 0;
+    for (size_t i = 0; i < longer.size(); i++) {
+        uint64_t sum = uint64_t(longer[i]) + carry;
+        if (i < shorter.size())
+            sum += shorter[i];
+        result[i] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+    result[longer.size()] = static_cast<uint32_t>(carry);
+    trim(result);
+    return result;
+}
+
+
+BigInteger::Magnitude BigInteger::subtractMagnitudes(const Magnitude& a,
+                                                     const Magnitude& b)
+{
+    // assert: a >= b
+    Magnitude result(a.size());
+    int64_t borrow = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        int64_t diff = int64_t(a[i]) - borrow;
+        if (i < b.size())
+            diff -= b[i];
+        borrow = diff < 0 ? 1 : 0;
+        result[i] = static_cast<uint32_t>(diff);
+    }
+    trim(result);
+    return result;
+}
+
+
+static void addShifted(std::vector<uint32_t>& target,
+                       const std::vector<uint32_t>& value, size_t shift)
+{
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < value.size(); i++) {
+        uint64_t sum = uint64_t(target[i + shift]) + value[i] + carry;
+        target[i + shift] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+    for (; carry != 0 && i + shift < target.size(); i++) {
+        uint64_t sum = uint64_t(target[i + shift]) + carry;
+        target[i + shift] = static_cast<uint32_t>(sum);
+        carry = sum >> 32;
+    }
+}
+
+
+BigInteger::Magnitude BigInteger::multiplyMagnitudes(const Magnitude& a,
+                                                     const Magnitude& b)
+{
+    if (a.empty() || b.empty())
+        return Magnitude();
+
+    if (std::min(a.size(), b.size()) < karatsubaThreshold) {
+        Magnitude result(a.size() + b.size(), 0);
+        for (size_t i = 0; i < a.size(); i++) {
+            uint64_t carry = 0;
+            for (size_t j = 0; j < b.size(); j++) {
+                uint64_t product = uint64_t(a[i]) * b[j] +
+                    result[i + j] + carry;
+                result[i + j] = static_cast<uint32_t>(product);
+                carry = product >> 32;
+            }
+            result[i + b.size()] = static_cast<uint32_t>(carry);
+        }
+        trim(result);
+        return result;
+    }
+
+    const Magnitude& longer = a.size() >= b.size() ? a : b;
+    const Magnitude& shorter = a.size() >= b.size() ? b : a;
+    size_t half = (longer.size() + 1) / 2;
+
+    Magnitude result(a.size() + b.size() + 1, 0);
+    Magnitude l0(longer.begin(), longer.begin() + half);
+    Magnitude l1(longer.begin() + half, longer.end());
+    trim(l0);
+
+    if (shorter.size() <= half) {
+        // too unbalanced for karatsuba, just split the longer factor
+        addShifted(result, multiplyMagnitudes(l0, shorter), 0);
+        addShifted(result, multiplyMagnitudes(l1, shorter), half);
+    }
+    else {
+        Magnitude s0(shorter.begin(), shorter.begin() + half);
+        Magnitude s1(shorter.begin() + half, shorter.end());
+        trim(s0);
+
+        Magnitude z0 = multiplyMagnitudes(l0, s0);
+        Magnitude z2 = multiplyMagnitudes(l1, s1);
+        Magnitude z1 = multiplyMagnitudes(addMagnitudes(l0, l1),
+                                          addMagnitudes(s0, s1));
+        z1 = subtractMagnitudes(subtractMagnitudes(z1, z0), z2);
+
+        addShifted(result, z0, 0);
+        addShifted(result, z1, half);
+        addShifted(result, z2, 2 * half);
+    }
+    trim(result);
+    return result;
+}
+
+
+BigInteger::Magnitude BigInteger::divideMagnitudes(const Magnitude& a,
+                                                   const Magnitude& b)
+{
+    if (compareMagnitudes(a, b) < 0)
+        return Magnitude();
+
+    if (b.size() == 1) {
+        Magnitude quotient = a;
+        divideMagnitude(quotient, b[0]);
+        trim(quotient);
+        return quotient;
+    }
+
+    // knuth's algorithm D, see TAOCP vol. 2, 4.3.1
+    size_t n = b.size();
+    size_t m = a.size() - n;
+    int shift = 0;
+    for (uint32_t top = b[n - 1]; (top & 0x80000000u) == 0; top <<= 1)
+        shift++;
+
+    Magnitude vn(n);
+    Magnitude un(a.size() + 1);
+    for (size_t i = n - 1; i > 0; i--)
+        vn[i] = (b[i] << shift) |
+            (shift ? uint32_t(uint64_t(b[i - 1]) >> (32 - shift)) : 0);
+    vn[0] = b[0] << shift;
+    un[a.size()] = shift ? uint32_t(uint64_t(a[a.size() - 1]) >> (32 - shift))
+                         : 0;
+    for (size_t i = a.size() - 1; i > 0; i--)
+        un[i] = (a[i] << shift) |
+            (shift ? uint32_t(uint64_t(a[i - 1]) >> (32 - shift)) : 0);
+    un[0] = a[0] << shift;
+
+    const uint64_t base = uint64_t(1) << 32;
+    Magnitude quotient(m + 1, 0);
+    for (size_t j = m + 1; j > 0; j--) {
+        size_t k = j - 1;
+        uint64_t numerator = (uint64_t(un[k + n]) << 32) | un[k + n - 1];
+        uint64_t qhat = numerator / vn[n - 1];
+        uint64_t rhat = numerator % vn[n - 1];
+        while (qhat >= base ||
+               qhat * vn[n - 2] > ((rhat << 32) | un[k + n - 2])) {
+            qhat--;
+            rhat += vn[n - 1];
+            if (rhat >= base)
+                break;
+        }
+
+        int64_t borrow = 0;
+        uint64_t carry = 0;
+        for (size_t i = 0; i < n; i++) {
+            uint64_t product = qhat * vn[i] + carry;
+            carry = product >> 32;
+            int64_t diff = int64_t(un[i + k]) - borrow -
+                int64_t(product & 0xFFFFFFFFu);
+            un[i + k] = static_cast<uint32_t>(diff);
+            borrow = diff < 0 ? 1 : 0;
+        }
+        int64_t diff = int64_t(un[k + n]) - borrow - int64_t(carry);
+        un[k + n] = static_cast<uint32_t>(diff);
+
+        if (diff < 0) {
+            // qhat was one too large, add the divisor back
+            qhat--;
+            carry = 0;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t sum = uint64_t(un[i + k]) + vn[i] + carry;
+                un[i + k] = static_cast<uint32_t>(sum);
+                carry = sum >> 32;
+            }
+            un[k + n] += static_cast<uint32_t>(carry);
+        }
+        quotient[k] = static_cast<uint32_t>(qhat);
+    }
+    trim(quotient);
+    return quotient;
+}
+
+
+uint32_t BigInteger::divideMagnitude(Magnitude& a, uint32_t divisor)
+{
+    uint64_t remainder = 0;
+    for (size_t i = a.size(); i > 0; i--) {
+        uint64_t current = (remainder << 32) | a[i - 1];
+        a[i - 1] = static_cast<uint32_t>(current / divisor);
+        remainder = current % divisor;
+    }
+    return static_cast<uint32_t>(remainder);
+}
+
+
+void BigInteger::trim(Magnitude& m)
+{
+    while (!m.empty() && m.back() == 0)
+        m.pop_back();
+}
@@ -0,0 +1,111 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef BIGINTEGER_H_
+#define BIGINTEGER_H_
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+
+/*!
+ * \brief arbitrary precision signed integer
+ *
+ * The magnitude is stored as little endian 32 bit limbs. Multiplication
+ * switches to karatsuba for large operands, which makes the binary splitting
+ * series used for high precision constants fast enough.
+ */
+class BigInteger
+{
+    bool negative;
+    std::vector<uint32_t> limbs;
+public:
+    BigInteger(void);
+    BigInteger(long long value);
+
+    static BigInteger fromUnsigned(unsigned long long value);
+
+    /*!
+     * \brief computes 10^exponent
+     */
+    static BigInteger pow10(size_t exponent);
+
+    bool isZero(void) const;
+    bool isNegative(void) const;
+
+    /*!
+     * \brief writes the value to <code>value</code> if it fits into a
+     *        <code>long long</code>
+     *
+     * \return <code>true</code>, if the value fits
+     */
+    bool toLongLong(long long& value) const;
+
+    /*!
+     * \brief the value as floating point number, rounded if it has more
+     *        significant bits than a <code>double</code>
+     */
+    double toDouble(void) const;
+
+    BigInteger operator + (const BigInteger& other) const;
+    BigInteger operator - (const BigInteger& other) const;
+    BigInteger operator * (const BigInteger& other) const;
+
+    /*!
+     * \brief truncating division, like the built-in integer division
+     *
+     * \throws ArithmeticException if the divisor is zero
+     */
+    BigInteger operator / (const BigInteger& other) const;
+
+    /*!
+     * \brief computes floor(sqrt(this)) using newton iteration
+     */
+    BigInteger sqrt(void) const;
+
+    /*!
+     * \brief the greatest common divisor of the magnitudes, which is not
+     *        negative
+     */
+    static BigInteger gcd(const BigInteger& a, const BigInteger& b);
+
+    /*!
+     * \brief the decimal representation of this number
+     */
+    std::string getString(void) const;
+
+private:
+    typedef std::vector<uint32_t> Magnitude;
+
+    static int compareMagnitudes(const Magnitude& a, const Magnitude& b);
+    static Magnitude addMagnitudes(const Magnitude& a, const Magnitude& b);
+    static Magnitude subtractMagnitudes(const Magnitude& a,
+                                        const Magnitude& b);
+    static Magnitude multiplyMagnitudes(const Magnitude& a,
+                                        const Magnitude& b);
+    static Magnitude divideMagnitudes(const Magnitude& a, const Magnitude& b);
+    static uint32_t divideMagnitude(Magnitude& a, uint32_t divisor);
+    static void trim(Magnitude& m);
+};
+
+
+#endif // BIGINTEGER_H_
@@ -0,0 +1,609 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "CompiledExpression.h"
+#include "Natives.h"
+
+#include <cmath>
+#include <utility>
+#include <limits>
+#include <algorithm>
+
+
+namespace
+{
+    FloatVal integerPower(FloatVal base, long long exponent)
+    {
+        bool invert = exponent < 0;
+        unsigned long long e = invert ? -exponent : exponent;
+        FloatVal result = 1;
+        while (e != 0) {
+            if (e & 1)
+                result *= base;
+            base *= base;
+            e >>= 1;
+        }
+        return invert ? 1 / result : result;
+    }
+
+    //! exponents up to this size are computed by repeated squaring
+    const long long maxIntegerExponent = 64;
+
+
+    FloatVal negativeSin(FloatVal x)
+    {
+        return -std::sin(x);
+    }
+
+    FloatVal tanDerivative(FloatVal x)
+    {
+        return 1 / (std::cos(x) * std::cos(x));
+    }
+
+    FloatVal asinDerivative(FloatVal x)
+    {
+        return 1 / std::sqrt(1 - x * x);
+    }
+
+    FloatVal acosDerivative(FloatVal x)
+    {
+        return -1 / std::sqrt(1 - x * x);
+    }
+
+    FloatVal atanDerivative(FloatVal x)
+    {
+        return 1 / (1 + x * x);
+    }
+
+    FloatVal logDerivative(FloatVal x)
+    {
+        return 1 / x;
+    }
+
+    //! derivatives of the numeric natives
+    CompiledExpression::MathFunc getDerivative(
+            CompiledExpression::MathFunc function)
+    {
+        typedef CompiledExpression::MathFunc MathFunc;
+        static const std::pair<MathFunc, MathFunc> derivatives[] = {
+            { &::sin, &::cos },
+            { &::cos, &negativeSin },
+            { &::tan, &tanDerivative },
+            { &::asin, &asinDerivative },
+            { &::acos, &acosDerivative },
+            { &::atan, &atanDerivative },
+            { &::exp, &::exp },
+            { &::log, &logDerivative },
+            { &::sinh, &::cosh },
+            { &::cosh, &::sinh },
+        };
+        for (size_t i = 0; i < sizeof derivatives / sizeof derivatives[0];
+                i++) {
+            if (derivatives[i].first == function)
+                return derivatives[i].second;
+        }
+        return nullptr;
+    }
+
+
+    CompiledExpression::OpCode getComparisonCode(
+            ComparisonNode::Relation relation)
+    {
+        typedef CompiledExpression::OpCode OpCode;
+        typedef ComparisonNode::Relation Relation;
+        switch (relation) {
+        case Relation::LESS:            return OpCode::LESS;
+        case Relation::LESS_EQUAL:      return OpCode::LESS_EQUAL;
+        case Relation::GREATER:         return OpCode::GREATER;
+        case Relation::GREATER_EQUAL:   return OpCode::GREATER_EQUAL;
+        case Relation::EQUAL:           return OpCode::EQUAL;
+        default:                        return OpCode::NOT_EQUAL;
+        }
+    }
+
+
+    //! looks up unbound constants like <code>pi</code>
+    bool getConstant(const std::string& name, FloatVal& value)
+    {
+        const std::shared_ptr<ExpressionNode>& constant =
+            Constants::getConstant(name);
+        if (constant == nullptr)
+            return false;
+        if (constant->getKind() == NodeKind::REAL) {
+            value = static_cast<const RealNode*>(constant.get())->getValue();
+            return true;
+        }
+        if (constant->getKind() == NodeKind::INTEGER) {
+            value = FloatVal(
+                static_cast<const IntegerNode*>(constant.get())->getValue());
+            return true;
+        }
+        return false;
+    }
+}
+
+
+CompiledExpression::CompiledExpression(void) :
+    variableCount(0), stackSize(0)
+{
+}
+
+
+CompiledExpression CompiledExpression::compile(
+        const std::shared_ptr<ExpressionNode>& expression,
+        const std::vector<std::string>& variables)
+{
+    CompiledExpression compiled;
+    compiled.variableCount = variables.size();
+    compiled.compileNode(expression.get(), variables, 0);
+    return compiled;
+}
+
+
+void CompiledExpression::emit(OpCode code, size_t depth)
+{
+    Instruction instruction;
+    instruction.code = code;
+    instruction.value = 0;
+    instruction.index = 0;
+    instruction.function = nullptr;
+    instruction.derivative = nullptr;
+    this->code.push_back(instruction);
+    if (depth + 1 > stackSize)
+        stackSize = depth + 1;
+}
+
+
+/*!
+ * \brief appends code leaving the value of the node on the stack
+ *
+ * \param depth the number of values already on the stack
+ */
+void CompiledExpression::compileNode(const ExpressionNode* node,
+                                     const std::vector<std::string>& variables,
+                                     size_t depth)
+{
+    switch (node->getKind()) {
+    case NodeKind::INTEGER:
+        emit(OpCode::CONSTANT, depth);
+        code.back().value = FloatVal(
+            static_cast<const IntegerNode*>(node)->getValue());
+        return;
+    case NodeKind::REAL:
+        emit(OpCode::CONSTANT, depth);
+        code.back().value = static_cast<const RealNode*>(node)->getValue();
+        return;
+    case NodeKind::VARIABLE: {
+        const std::string& name =
+            static_cast<const VariableNode*>(node)->getName();
+        for (size_t i = 0; i < variables.size(); i++) {
+            if (variables[i] == name) {
+                emit(OpCode::VARIABLE, depth);
+                code.back().index = i;
+                return;
+            }
+        }
+        FloatVal constant;
+        if (getConstant(name, constant)) {
+            emit(OpCode::CONSTANT, depth);
+            code.back().value = constant;
+            return;
+        }
+        throw RuntimeException("unknown variable " + name);
+    }
+    case NodeKind::FUNCTION_CALL: {
+        const FunctionCallNode* call =
+            dynamic_cast<const FunctionCallNode*>(node);
+        const ExpressionNode* callee = call->getChild(0).get();
+
+        if (call->getArgumentCount() == 3 &&
+                (dynamic_cast<const If*>(callee) != nullptr ||
+                 (callee->getKind() == NodeKind::VARIABLE &&
+                  callee->getString() == "if"))) {
+            for (size_t i = 0; i < 3; i++)
+                compileNode(call->getArgument(i).get(), variables, depth + i);
+            emit(OpCode::SELECT, depth);
+            return;
+        }
+
+        const NativeNumFunction* function =
+            dynamic_cast<const NativeNumFunction*>(callee);
+
+        // the numeric functions are not necessarily bound to symbols, they
+        // are registered without argument count
+        if (function == nullptr && callee->getKind() == NodeKind::VARIABLE) {
+            function = dynamic_cast<const NativeNumFunction*>(
+                Functions::getNativeFunction(
+                    static_cast<const VariableNode*>(callee)->getName(), 0));
+        }
+        if (function == nullptr || call->getArgumentCount() != 1)
+            break;
+        compileNode(call->getArgument(0).get(), variables, depth);
+        emit(OpCode::CALL, depth);
+        code.back().function = function->getFunction();
+        code.back().derivative = getDerivative(function->getFunction());
+        return;
+    }
+    case NodeKind::ADDITION:
+    case NodeKind::SUBTRACTION:
+    case NodeKind::MULTIPLICATION:
+    case NodeKind::DIVISION:
+    case NodeKind::MODULO:
+    case NodeKind::POWER: {
+        const OperationNode* operation =
+            dynamic_cast<const OperationNode*>(node);
+        compileNode(operation->a.get(), variables, depth);
+
+        const IntegerNode* exponent =
+            dynamic_cast<const IntegerNode*>(operation->b.get());
+        if (node->getKind() == NodeKind::POWER && exponent != nullptr &&
+                std::abs(exponent->getValue()) <= maxIntegerExponent) {
+            emit(OpCode::INTEGER_POWER, depth);
+            code.back().index = exponent->getValue();
+            return;
+        }
+
+        compileNode(operation->b.get(), variables, depth + 1);
+        switch (node->getKind()) {
+        case NodeKind::ADDITION:        emit(OpCode::ADD, depth); break;
+        case NodeKind::SUBTRACTION:     emit(OpCode::SUBTRACT, depth); break;
+        case NodeKind::MULTIPLICATION:  emit(OpCode::MULTIPLY, depth); break;
+        case NodeKind::DIVISION:        emit(OpCode::DIVIDE, depth); break;
+        case NodeKind::MODULO:          emit(OpCode::MODULO, depth); break;
+        default:                        emit(OpCode::POWER, depth); break;
+        }
+        return;
+    }
+    case NodeKind::COMPARISON:
+    case NodeKind::AND:
+    case NodeKind::OR:
+    case NodeKind::XOR: {
+        compileNode(node->getChild(0).get(), variables, depth);
+        compileNode(node->getChild(1).get(), variables, depth + 1);
+        switch (node->getKind()) {
+        case NodeKind::AND:     emit(OpCode::AND, depth); break;
+        case NodeKind::OR:      emit(OpCode::OR, depth); break;
+        case NodeKind::XOR:     emit(OpCode::XOR, depth); break;
+        default:
+            emit(getComparisonCode(
+                dynamic_cast<const ComparisonNode*>(node)->getRelation()),
+                depth);
+            break;
+        }
+        return;
+    }
+    case NodeKind::NOT:
+        compileNode(node->getChild(0).get(), variables, depth);
+        emit(OpCode::NOT, depth);
+        return;
+    case NodeKind::SUM: {
+        const SumNode* sum = dynamic_cast<const SumNode*>(node);
+        const std::vector<SumNode::Summand>& summands = sum->getSummands();
+        bool empty = true;
+        if (sum->getConstant() != nullptr) {
+            compileNode(sum->getConstant().get(), variables, depth);
+            empty = false;
+        }
+        for (size_t i = 0; i < summands.size(); i++) {
+            if (empty) {
+                emit(OpCode::CONSTANT, depth);
+                empty = false;
+            }
+            compileNode(summands[i].value.get(), variables, depth + 1);
+            emit(summands[i].negative ? OpCode::SUBTRACT : OpCode::ADD,
+                 depth);
+        }
+        if (empty)
+            emit(OpCode::CONSTANT, depth);
+        return;
+    }
+    case NodeKind::PRODUCT: {
+        const ProductNode* product = dynamic_cast<const ProductNode*>(node);
+        const std::vector<std::shared_ptr<ExpressionNode> >& factors =
+            product->getFactors();
+        if (product->getCoefficient() != nullptr)
+            compileNode(product->getCoefficient().get(), variables, depth);
+        else {
+            emit(OpCode::CONSTANT, depth);
+            code.back().value = 1;
+        }
+        for (size_t i = 0; i < factors.size(); i++) {
+            compileNode(factors[i].get(), variables, depth + 1);
+            emit(OpCode::MULTIPLY, depth);
+        }
+        return;
+    }
+    default:
+        break;
+    }
+    throw RuntimeException("cannot compile " + node->getString());
+}
+
+
+FloatVal CompiledExpression::evaluate(const FloatVal* values) const
+{
+    FloatVal result;
+    evaluate(values, 1, &result);
+    return result;
+}
+
+
+void CompiledExpression::evaluate(const FloatVal* values, size_t count,
+                                  FloatVal* results) const
+{
+    // one row of count values per stack slot
+    thread_local std::vector<FloatVal> stack;
+    if (stack.size() < stackSize * count)
+        stack.resize(stackSize * count);
+
+    size_t depth = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        const Instruction& instruction = code[i];
+        FloatVal* top = stack.data() + depth * count;
+        FloatVal* second = depth > 0 ? top - count : top;
+        FloatVal* first = depth > 1 ? second - count : second;
+        FloatVal* condition = depth > 2 ? first - count : first;
+        switch (instruction.code) {
+        case OpCode::CONSTANT:
+            for (size_t j = 0; j < count; j++)
+                top[j] = instruction.value;
+            depth++;
+            break;
+        case OpCode::VARIABLE: {
+            const FloatVal* variable = values + instruction.index * count;
+            for (size_t j = 0; j < count; j++)
+                top[j] = variable[j];
+            depth++;
+            break;
+        }
+        case OpCode::ADD:
+            for (size_t j = 0; j < count; j++)
+                first[j] += second[j];
+            depth--;
+            break;
+        case OpCode::SUBTRACT:
+            for (size_t j = 0; j < count; j++)
+                first[j] -= second[j];
+            depth--;
+            break;
+        case OpCode::MULTIPLY:
+            for (size_t j = 0; j < count; j++)
+                first[j] *= second[j];
+            depth--;
+            break;
+        case OpCode::DIVIDE:
+            for (size_t j = 0; j < count; j++)
+                first[j] /= second[j];
+            depth--;
+            break;
+        case OpCode::MODULO:
+            for (size_t j = 0; j < count; j++)
+                first[j] = std::fmod(first[j], second[j]);
+            depth--;
+            break;
+        case OpCode::POWER:
+            for (size_t j = 0; j < count; j++)
+                first[j] = std::pow(first[j], second[j]);
+            depth--;
+            break;
+        case OpCode::INTEGER_POWER:
+            for (size_t j = 0; j < count; j++)
+                second[j] = integerPower(second[j], instruction.index);
+            break;
+        case OpCode::CALL:
+            for (size_t j = 0; j < count; j++)
+                second[j] = instruction.function(second[j]);
+            break;
+        case OpCode::LESS:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal(first[j] < second[j]);
+            depth--;
+            break;
+        case OpCode::LESS_EQUAL:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal(first[j] <= second[j]);
+            depth--;
+            break;
+        case OpCode::GREATER:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal(first[j] > second[j]);
+            depth--;
+            break;
+        case OpCode::GREATER_EQUAL:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal(first[j] >= second[j]);
+            depth--;
+            break;
+        case OpCode::EQUAL:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal(first[j] == second[j]);
+            depth--;
+            break;
+        case OpCode::NOT_EQUAL:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal(first[j] != second[j]);
+            depth--;
+            break;
+        case OpCode::AND:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal((first[j] != 0) & (second[j] != 0));
+            depth--;
+            break;
+        case OpCode::OR:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal((first[j] != 0) | (second[j] != 0));
+            depth--;
+            break;
+        case OpCode::XOR:
+            for (size_t j = 0; j < count; j++)
+                first[j] = FloatVal((first[j] != 0) ^ (second[j] != 0));
+            depth--;
+            break;
+        case OpCode::NOT:
+            for (size_t j = 0; j < count; j++)
+                second[j] = FloatVal(second[j] == 0);
+            break;
+        case OpCode::SELECT:
+            // written as a conditional move, so it is vectorized into a
+            // blend instead of branching
+            for (size_t j = 0; j < count; j++)
+                condition[j] = condition[j] != 0 ? first[j] : second[j];
+            depth -= 2;
+            break;
+        }
+    }
+
+    for (size_t j = 0; j < count; j++)
+        results[j] = stack[j];
+}
+
+
+FloatVal CompiledExpression::evaluate(const FloatVal* values, size_t variable,
+                                      FloatVal& derivative) const
+{
+    struct Dual
+    {
+        FloatVal value;
+        FloatVal derivative;
+    };
+
+    thread_local std::vector<Dual> stack;
+    if (stack.size() < stackSize)
+        stack.resize(stackSize);
+
+    size_t depth = 0;
+    for (size_t i = 0; i < code.size(); i++) {
+        const Instruction& instruction = code[i];
+        Dual* top = stack.data() + depth;
+        Dual& second = depth > 0 ? top[-1] : top[0];
+        Dual& first = depth > 1 ? top[-2] : second;
+        Dual& condition = depth > 2 ? top[-3] : first;
+        switch (instruction.code) {
+        case OpCode::CONSTANT:
+            top->value = instruction.value;
+            top->derivative = 0;
+            depth++;
+            break;
+        case OpCode::VARIABLE:
+            top->value = values[instruction.index];
+            top->derivative = size_t(instruction.index) == variable ? 1 : 0;
+            depth++;
+            break;
+        case OpCode::ADD:
+            first.value += second.value;
+            first.derivative += second.derivative;
+            depth--;
+            break;
+        case OpCode::SUBTRACT:
+            first.value -= second.value;
+            first.derivative -= second.derivative;
+            depth--;
+            break;
+        case OpCode::MULTIPLY:
+            first.derivative = first.derivative * second.value +
+                first.value * second.derivative;
+            first.value *= second.value;
+            depth--;
+            break;
+        case OpCode::DIVIDE:
+            first.value /= second.value;
+            first.derivative = (first.derivative -
+                first.value * second.derivative) / second.value;
+            depth--;
+            break;
+        case OpCode::MODULO: {
+            FloatVal quotient = std::trunc(first.value / second.value);
+            first.value = std::fmod(first.value, second.value);
+            first.derivative -= quotient * second.derivative;
+            depth--;
+            break;
+        }
+        case OpCode::POWER: {
+            FloatVal power = std::pow(first.value, second.value);
+            FloatVal d = second.value * std::pow(first.value,
+                second.value - 1) * first.derivative;
+            // the logarithm is only needed for variable exponents, which
+            // keeps negative bases with constant exponents differentiable
+            if (second.derivative != 0)
+                d += power * std::log(first.value) * second.derivative;
+            first.value = power;
+            first.derivative = d;
+            depth--;
+            break;
+        }
+        case OpCode::INTEGER_POWER: {
+            long long n = instruction.index;
+            second.derivative = n == 0 ? 0 : n * integerPower(second.value,
+                n - 1) * second.derivative;
+            second.value = integerPower(second.value, n);
+            break;
+        }
+        case OpCode::CALL: {
+            FloatVal x = second.value;
+            FloatVal slope;
+            if (instruction.derivative != nullptr)
+                slope = instruction.derivative(x);
+            else {
+                FloatVal h = std::cbrt(
+                    std::numeric_limits<FloatVal>::epsilon()) *
+                    std::max(FloatVal(1), std::abs(x));
+                slope = (instruction.function(x + h) -
+                         instruction.function(x - h)) / (2 * h);
+            }
+            second.value = instruction.function(x);
+            second.derivative *= slope;
+            break;
+        }
+        case OpCode::SELECT:
+            condition = condition.value != 0 ? first : second;
+            depth -= 2;
+            break;
+        case OpCode::NOT:
+            second.value = FloatVal(second.value == 0);
+            second.derivative = 0;
+            break;
+        default: {
+            // comparisons and logical operators are piecewise constant
+            FloatVal a = first.value;
+            FloatVal b = second.value;
+            bool result;
+            switch (instruction.code) {
+            case OpCode::LESS:          result = a < b; break;
+            case OpCode::LESS_EQUAL:    result = a <= b; break;
+            case OpCode::GREATER:       result = a > b; break;
+            case OpCode::GREATER_EQUAL: result = a >= b; break;
+            case OpCode::EQUAL:         result = a == b; break;
+            case OpCode::NOT_EQUAL:     result = a != b; break;
+            case OpCode::AND:           result = a != 0 && b != 0; break;
+            case OpCode::OR:            result = a != 0 || b != 0; break;
+            default:                    result = (a != 0) != (b != 0); break;
+            }
+            first.value = FloatVal(result);
+            first.derivative = 0;
+            depth--;
+            break;
+        }
+        }
+    }
+
+    derivative = stack[0].derivative;
+    return stack[0].value;
+}
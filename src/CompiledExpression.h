@@ -0,0 +1,160 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef COMPILEDEXPRESSION_H_
+#define COMPILEDEXPRESSION_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "Node.h"
+
+
+/*!
+ * \brief an expression translated into code for a small stack machine
+ *
+ * Numerical algorithms evaluate the same expression at many points.
+ * Walking the tree for every point costs a virtual call and an allocation
+ * per node; compiled code works on plain floating point values and can
+ * evaluate a whole batch of points per instruction.
+ *
+ * Only numbers, the given variables, the arithmetic, comparison and logical
+ * operations, <code>if</code> and the numeric native functions like
+ * <code>sin</code> can be compiled.
+ *
+ * Conditions do not branch: both operands of <code>and</code> and
+ * <code>or</code> and both alternatives of <code>if</code> are computed
+ * for all points, and the result is selected by a mask. This keeps the
+ * loops over a batch free of jumps.
+ */
+class CompiledExpression
+{
+public:
+    typedef FloatVal (*MathFunc)(FloatVal);
+
+    enum class OpCode
+    {
+        CONSTANT,
+        VARIABLE,
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        MODULO,
+        POWER,
+        INTEGER_POWER,
+        CALL,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        EQUAL,
+        NOT_EQUAL,
+        AND,
+        OR,
+        XOR,
+        NOT,
+
+        //! picks the second or third value depending on the first one
+        SELECT,
+    };
+
+    struct Instruction
+    {
+        OpCode code;
+
+        //! the constant of <code>CONSTANT</code>
+        FloatVal value;
+
+        //! the variable index, or the exponent of <code>INTEGER_POWER</code>
+        long long index;
+
+        //! the function of <code>CALL</code>
+        MathFunc function;
+
+        //! its derivative, <code>nullptr</code> if it is not known
+        MathFunc derivative;
+    };
+
+private:
+    std::vector<Instruction> code;
+    size_t variableCount;
+    size_t stackSize;
+
+public:
+    CompiledExpression(void);
+
+    /*!
+     * \brief compiles an evaluated expression
+     *
+     * \param variables the names of the free variables, the i-th one is
+     *        read from the i-th value passed to \link evaluate
+     *
+     * \throws RuntimeException if the expression contains something that
+     *         cannot be compiled, e.g. an unknown variable
+     */
+    static CompiledExpression compile(
+            const std::shared_ptr<ExpressionNode>& expression,
+            const std::vector<std::string>& variables);
+
+    inline const std::vector<Instruction>& getCode(void) const
+    { return code; }
+    inline size_t getVariableCount(void) const { return variableCount; }
+
+    /*!
+     * \param values one value for every variable
+     */
+    FloatVal evaluate(const FloatVal* values) const;
+
+    /*!
+     * \brief evaluates the expression at <code>count</code> points at once
+     *
+     * \param values the values of the first variable at all points,
+     *        followed by those of the second variable and so on
+     * \param results receives <code>count</code> values
+     */
+    void evaluate(const FloatVal* values, size_t count,
+                  FloatVal* results) const;
+
+    /*!
+     * \brief evaluates the expression and its derivative by automatic
+     *        differentiation
+     *
+     * Calls of functions with unknown derivative are differentiated
+     * numerically.
+     *
+     * \param variable the index of the variable to differentiate by
+     * \param derivative receives the value of the derivative
+     */
+    FloatVal evaluate(const FloatVal* values, size_t variable,
+                      FloatVal& derivative) const;
+
+private:
+    void compileNode(const ExpressionNode* node,
+                     const std::vector<std::string>& variables,
+                     size_t depth);
+    void emit(OpCode code, size_t depth);
+};
+
+
+#endif // COMPILEDEXPRESSION_H_
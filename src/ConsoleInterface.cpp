@@ -24,6 +24,9 @@
 #include <memory>
 #include "Node.h"
 #include "Environment.h"
+#include "RuleFile.h"
+#include "OutputBuffer.h"
+#include "ParseCache.h"
 #include <cstdio>
 /*
 #include <termios.h>
@@ -35,10 +38,6 @@
 #include <string.h>
 #include <time.h>
 */
-extern std::shared_ptr<ExpressionNode> expr;
-extern int yyparse(void);
-extern FILE* yyin;
-extern bool end_of_file;
 
 
 using mathy::InputProcessor;
@@ -46,7 +45,8 @@ using mathy::ConsoleInterface;
 
 
 InputProcessor::InputProcessor(::FILE* in, ::FILE* out) :
-    in(in), out(out)
+    in(in), out(out), parserBackend(ExpressionParser::Backend::PRATT),
+    parseCacheCapacity(4096), parseStatistics(false)
 {
 }
 
@@ -54,29 +54,41 @@ InputProcessor::InputProcessor(::FILE* in, ::FILE* out) :
 int InputProcessor::run(void)
 {
     Environment environment;
+    if (!initializeEnvironment(environment))
+        return 1;
+    OutputBuffer output(this->out);
+    ExpressionParser parser(this->in, parserBackend);
+    ParseCache cache(parseCacheCapacity);
+    if (parseCacheCapacity > 0)
+        parser.setCache(&cache);
 
     while (true) {
-        try {
-            ::yyin = this->in;
-            ::yyparse();
-        } catch(const char* ex) {
-            printErrorMessage(ex);
+        ParseResult parsed = parser.parseStatement();
+        if (parsed.hasErrors()) {
+            output.flush();
+            printErrorMessage(parsed.errors[0].getString());
         }
 
-        if (end_of_file)
+        if (parser.isEndOfFile())
             break;
-        if (::expr.get() != nullptr) {
+        if (parsed.expression != nullptr) {
             try {
+                if (printsDirectly(parsed.expression.get()))
+                    output.flush();
                 std::shared_ptr<ExpressionNode> evaluated =
-                        environment.evaluateExpression(::expr);
-                ::fprintf(this->out, "%s\n", evaluated->getString().c_str());
-                ::expr = std::shared_ptr<ExpressionNode>(nullptr);
+                        environment.evaluateExpression(parsed.expression);
+                output.appendExpression(*evaluated);
+                output.endLine();
             } catch(std::exception& ex) {
+                output.flush();
                 printErrorMessage(ex.what());
             }
         }
     }
-    ::fprintf(this->out, "\n");
+    finishEnvironment(environment);
+    output.endLine();
+    output.flush();
+    finishParseCache(cache);
     return 0;
 }
 
@@ -89,6 +101,81 @@ void InputProcessor::printErrorMessage(const std::string& message)
 }
 
 
+void InputProcessor::printWarningMessage(const std::string& message)
+{
+    using std::cerr;
+    cerr << "\x1B[33;1m" "warning:" "\x1b[0m" " " << message << "\n";
+    cerr.flush();
+}
+
+
+bool InputProcessor::printsDirectly(const ExpressionNode* expression)
+{
+    // rulestats prints the statistics to std::cout
+    if (expression->getKind() == NodeKind::FUNCTION_CALL) {
+        const ExpressionNode* function = expression->getChild(0).get();
+        if (function->getKind() == NodeKind::VARIABLE &&
+                function->getString() == "rulestats")
+            return true;
+    }
+
+    for (size_t i = 0; i < expression->getChildCount(); i++) {
+        if (printsDirectly(expression->getChild(i).get()))
+            return true;
+    }
+    return false;
+}
+
+
+bool InputProcessor::initializeEnvironment(Environment& environment)
+{
+    if (!rulesFile.empty()) {
+        std::vector<std::string> skipped;
+        try {
+            RuleFile::load(environment.getRewriter(), rulesFile, skipped);
+        } catch(std::exception& ex) {
+            printErrorMessage(ex.what());
+            return false;
+        }
+        for (size_t i = 0; i < skipped.size(); i++)
+            printWarningMessage(skipped[i]);
+    }
+
+    if (!ruleProfile.empty()) {
+        // a missing profile is created on exit
+        environment.getRewriter().applyProfile(ruleProfile);
+        environment.getRewriter().setProfiling(true);
+    }
+    return true;
+}
+
+
+void InputProcessor::finishEnvironment(Environment& environment)
+{
+    if (ruleProfile.empty())
+        return;
+
+    try {
+        environment.getRewriter().saveProfile(ruleProfile);
+    } catch(std::exception& ex) {
+        printErrorMessage(ex.what());
+    }
+}
+
+
+void InputProcessor::finishParseCache(const ParseCache& cache)
+{
+    if (!parseStatistics)
+        return;
+
+    const ParseCache::Statistics& st = cache.getStatistics();
+    ::fprintf(stderr, "parse cache: %llu hits, %llu misses, %llu evictions, "
+              "%.1f%% hit rate\n", (unsigned long long) st.hits,
+              (unsigned long long) st.misses,
+              (unsigned long long) st.evictions, cache.getHitRate() * 100.0);
+}
+
+
 ConsoleInterface::ConsoleInterface(::FILE* in, ::FILE* out) :
     InputProcessor(in, out)
 {
@@ -98,6 +185,13 @@ ConsoleInterface::ConsoleInterface(::FILE* in, ::FILE* out) :
 int ConsoleInterface::run(void)
 {
     Environment environment;
+    if (!initializeEnvironment(environment))
+        return 1;
+    OutputBuffer output(this->out);
+    ExpressionParser parser(this->in, parserBackend);
+    ParseCache cache(parseCacheCapacity);
+    if (parseCacheCapacity > 0)
+        parser.setCache(&cache);
 /*
     struct termios term, term2;
     tcgetattr(STDIN_FILENO, &term2);
@@ -129,35 +223,36 @@ int ConsoleInterface::run(void)
         else {
         }*/
 
-        try {
-            ::yyin = this->in;
-            ::yyparse();
-        } catch(const char* ex) {
-            printErrorMessage(ex);
-        }
+        ParseResult parsed = parser.parseStatement();
+        if (parsed.hasErrors())
+            printErrorMessage(parsed.errors[0].getString());
 
-        if (end_of_file) {
+        if (parser.isEndOfFile()) {
             break;
         }
 
-        if (::expr != 0) {
+        if (parsed.expression != 0) {
             try {
                 //int a = getch();
                 //printf("yaaay! %d\n", a);
                 std::shared_ptr<ExpressionNode> evaluated =
-                        environment.evaluateExpression(::expr);
-                ::fprintf(this->out, "\x1b[36m" " --> " "\x1b[32m" "%s"
-                        "\x1b[0m" "\n",
-                        evaluated->getString().c_str());
-                ::expr = std::shared_ptr<ExpressionNode>(nullptr);
+                        environment.evaluateExpression(parsed.expression);
+                output.append("\x1b[36m" " --> " "\x1b[32m");
+                output.appendExpression(*evaluated);
+                output.append("\x1b[0m");
+                output.endLine();
+                // the user waits for every result
+                output.flush();
             } catch(std::exception& ex) {
                 printErrorMessage(ex.what());
             }
         }
     }
     
-    ::fprintf(this->out, "\n");
-
+    finishEnvironment(environment);
+    output.endLine();
+    output.flush();
+    finishParseCache(cache);
 
     return 0;
 }
@@ -25,6 +25,11 @@
 #include <string>
 #include <cstdio>
 
+#include "ExpressionParser.h"
+
+class Environment;
+class ExpressionNode;
+
 namespace mathy
 {
     class InputProcessor;
@@ -39,9 +44,32 @@ protected:
     ::FILE* in;
     ::FILE* out;
 
+    //! rules loaded into the environment in addition to the built-in ones
+    std::string rulesFile;
+
+    //! rule statistics used to order the rules, updated on exit
+    std::string ruleProfile;
+
+    ExpressionParser::Backend parserBackend;
+
+    //! number of input lines whose statements are kept, 0 disables caching
+    size_t parseCacheCapacity;
+
+    //! print the hit rate of the parse cache on exit
+    bool parseStatistics;
+
 public:
     InputProcessor(::FILE* in, ::FILE* out);
 
+    inline void setRulesFile(const std::string& path) { rulesFile = path; }
+    inline void setRuleProfile(const std::string& path)
+    { ruleProfile = path; }
+    inline void setParserBackend(ExpressionParser::Backend backend)
+    { parserBackend = backend; }
+    inline void setParseCacheCapacity(size_t capacity)
+    { parseCacheCapacity = capacity; }
+    inline void setParseStatistics(bool print) { parseStatistics = print; }
+
     /*!
      * \brief run the input processing
      */
@@ -53,6 +81,39 @@ public:
      * \param message the error message to print
      */
     virtual void printErrorMessage(const std::string& message);
+
+    /*!
+     * \brief prints a warning to standard error output
+     */
+    virtual void printWarningMessage(const std::string& message);
+
+protected:
+    /*!
+     * \return <code>true</code> if evaluating the expression writes to the
+     *         standard output itself, so buffered results have to be
+     *         written before
+     */
+    static bool printsDirectly(const ExpressionNode* expression);
+
+    /*!
+     * \brief loads the rules file and the rule profile into a fresh
+     *        environment
+     *
+     * \return <code>false</code> if the rules file could not be loaded,
+     *         the error has been printed then
+     */
+    bool initializeEnvironment(Environment& environment);
+
+    /*!
+     * \brief saves the rule profile
+     */
+    void finishEnvironment(Environment& environment);
+
+    /*!
+     * \brief prints the hit rate of a parse cache to standard error output
+     *        if requested
+     */
+    void finishParseCache(const ParseCache& cache);
 };
 
 
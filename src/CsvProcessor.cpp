@@ -0,0 +1,363 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "CsvProcessor.h"
+#include "Node.h"
+#include "Environment.h"
+#include "CompiledExpression.h"
+#include "ThreadPool.h"
+#include "sys.h"
+#include "ExpressionParser.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <set>
+#include <algorithm>
+
+
+using mathy::CsvProcessor;
+
+
+namespace
+{
+    //! input bytes per chunk, small enough for the second level cache
+    const size_t chunkBytes = 256 * 1024;
+
+    const size_t unused = size_t(-1);
+
+    const FloatVal powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+    };
+
+    struct Chunk
+    {
+        const char* begin;
+        const char* end;
+    };
+
+    std::shared_ptr<ExpressionNode> parseExpression(const std::string& text)
+    {
+        mathy::ParseResult parsed = mathy::ExpressionParser::parse(text);
+        if (parsed.hasErrors() || !parsed.expression)
+            throw RuntimeException("syntax error in " + text);
+        return parsed.expression;
+    }
+
+    void collectVariables(const ExpressionNode* node,
+                          std::set<std::string>& names)
+    {
+        if (node->getKind() == NodeKind::VARIABLE)
+            names.insert(static_cast<const VariableNode*>(node)->getName());
+        for (size_t i = 0; i < node->getChildCount(); i++)
+            collectVariables(node->getChild(i).get(), names);
+    }
+
+    /*!
+     * \brief a line without its line break
+     */
+    const char* findLineEnd(const char* begin, const char* end)
+    {
+        const char* lineEnd = static_cast<const char*>(
+            ::memchr(begin, '\n', size_t(end - begin)));
+        lineEnd = lineEnd ? lineEnd : end;
+        if (lineEnd > begin && lineEnd[-1] == '\r')
+            lineEnd--;
+        return lineEnd;
+    }
+
+    const char* skipLine(const char* begin, const char* end)
+    {
+        const char* lineEnd = static_cast<const char*>(
+            ::memchr(begin, '\n', size_t(end - begin)));
+        return lineEnd ? lineEnd + 1 : end;
+    }
+
+    /*!
+     * \brief parses a number in place, the text is not terminated
+     *
+     * Numbers with at most 15 digits and a small exponent are converted
+     * exactly with one multiplication or division, everything else is
+     * left to <code>strtod</code>. Empty fields yield NaN.
+     *
+     * \return <code>false</code> if the field is not a number
+     */
+    bool parseNumber(const char* begin, const char* end, FloatVal& value)
+    {
+        while (begin < end && (*begin == ' ' || *begin == '\t'))
+            begin++;
+        while (end > begin && (end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        if (begin == end) {
+            value = std::numeric_limits<FloatVal>::quiet_NaN();
+            return true;
+        }
+
+        const char* p = begin;
+        bool negative = *p == '-';
+        if (*p == '-' || *p == '+')
+            p++;
+
+        uint64_t mantissa = 0;
+        int digits = 0;
+        int exponent = 0;
+        bool any = false;
+        for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + uint64_t(*p - '0');
+                digits += mantissa != 0;
+            }
+            else
+                exponent++;
+        }
+        if (p < end && *p == '.') {
+            for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+                if (digits < 19) {
+                    mantissa = mantissa * 10 + uint64_t(*p - '0');
+                    digits += mantissa != 0;
+                    exponent--;
+                }
+            }
+        }
+        if (any && p < end && (*p == 'e' || *p == 'E')) {
+            const char* e = p + 1;
+            bool negativeExponent = e < end && *e == '-';
+            if (e < end && (*e == '-' || *e == '+'))
+                e++;
+            int written = 0;
+            bool exponentDigits = false;
+            for (; e < end && *e >= '0' && *e <= '9'; e++) {
+                written = std::min(written * 10 + (*e - '0'), 10000);
+                exponentDigits = true;
+            }
+            if (exponentDigits) {
+                exponent += negativeExponent ? -written : written;
+                p = e;
+            }
+        }
+
+        if (any && p == end && digits <= 15 && exponent >= -22 &&
+                exponent <= 22) {
+            value = FloatVal(mantissa);
+            value = exponent < 0 ? value / powersOfTen[-exponent] :
+                                   value * powersOfTen[exponent];
+            value = negative ? -value : value;
+            return true;
+        }
+
+        // long numbers and special values like inf
+        char buffer[128];
+        size_t length = size_t(end - begin);
+        if (length >= sizeof buffer)
+            return false;
+        ::memcpy(buffer, begin, length);
+        buffer[length] = '\0';
+        char* parsed;
+        value = ::strtod(buffer, &parsed);
+        return parsed == buffer + length;
+    }
+
+    /*!
+     * \brief parses, evaluates and formats the rows of one chunk
+     *
+     * \param columns maps every column of the file to the variable it is
+     *        read into, or \link unused
+     */
+    void processChunk(const Chunk& chunk, const std::vector<size_t>& columns,
+                      size_t variableCount,
+                      const CompiledExpression& function,
+                      std::string& output)
+    {
+        size_t capacity = size_t(std::count(chunk.begin, chunk.end, '\n')) + 1;
+        std::vector<FloatVal> values(variableCount * capacity);
+        std::vector<Chunk> lines;
+        lines.reserve(capacity);
+
+        for (const char* line = chunk.begin; line < chunk.end;
+             line = skipLine(line, chunk.end)) {
+            const char* lineEnd = findLineEnd(line, chunk.end);
+            if (lineEnd == line)
+                continue;
+
+            size_t row = lines.size();
+            size_t column = 0;
+            size_t found = 0;
+            for (const char* field = line; ; column++) {
+                const char* fieldEnd = static_cast<const char*>(
+                    ::memchr(field, ',', size_t(lineEnd - field)));
+                fieldEnd = fieldEnd ? fieldEnd : lineEnd;
+
+                if (column < columns.size() && columns[column] != unused) {
+                    FloatVal& value = values[columns[column] * capacity + row];
+                    if (!parseNumber(field, fieldEnd, value)) {
+                        throw RuntimeException("not a number: " +
+                            std::string(field, fieldEnd));
+                    }
+                    found++;
+                }
+                if (fieldEnd == lineEnd)
+                    break;
+                field = fieldEnd + 1;
+            }
+            if (found < variableCount) {
+                throw RuntimeException("missing columns in line: " +
+                                       std::string(line, lineEnd));
+            }
+            Chunk text = { line, lineEnd };
+            lines.push_back(text);
+        }
+
+        // the compiled code expects the values of every variable
+        // contiguously, so empty lines leave gaps to close
+        size_t rows = lines.size();
+        for (size_t i = 1; i < variableCount && rows < capacity; i++) {
+            std::copy(values.begin() + i * capacity,
+                      values.begin() + i * capacity + rows,
+                      values.begin() + i * rows);
+        }
+        std::vector<FloatVal> results(rows);
+        function.evaluate(values.data(), rows, results.data());
+
+        output.clear();
+        output.reserve(size_t(chunk.end - chunk.begin) + rows * 26);
+        char number[32];
+        for (size_t i = 0; i < rows; i++) {
+            output.append(lines[i].begin, lines[i].end);
+            int length = ::snprintf(number, sizeof number, ",%.17g\n",
+                                    results[i]);
+            output.append(number, size_t(length));
+        }
+    }
+}
+
+
+CsvProcessor::CsvProcessor(const std::string& path,
+                           const std::string& expression, ::FILE* out) :
+    InputProcessor(nullptr, out), path(path), expression(expression)
+{
+}
+
+
+int CsvProcessor::run(void)
+{
+    Environment environment;
+    if (!initializeEnvironment(environment))
+        return 1;
+
+    mathy::sys::MappedFile file(path);
+    if (!file.isOpen()) {
+        printErrorMessage("cannot open " + path);
+        return 1;
+    }
+    const char* data = file.getData();
+    const char* end = data + file.getSize();
+
+    try {
+        std::shared_ptr<ExpressionNode> parsed = parseExpression(expression);
+        std::string resultName = "value";
+        if (parsed->getKind() == NodeKind::ASSIGNMENT) {
+            AssignmentNode* assignment =
+                dynamic_cast<AssignmentNode*>(parsed.get());
+            resultName = assignment->a->getString();
+            parsed = assignment->b;
+        }
+        std::shared_ptr<ExpressionNode> evaluated =
+            environment.evaluateExpression(parsed);
+
+        std::set<std::string> used;
+        collectVariables(evaluated.get(), used);
+
+        // only the columns the expression refers to are parsed
+        const char* headerEnd = findLineEnd(data, end);
+        std::vector<size_t> columns;
+        std::vector<std::string> variables;
+        for (const char* field = data; ; ) {
+            const char* fieldEnd = static_cast<const char*>(
+                ::memchr(field, ',', size_t(headerEnd - field)));
+            fieldEnd = fieldEnd ? fieldEnd : headerEnd;
+
+            std::string name(field, fieldEnd);
+            name.erase(0, name.find_first_not_of(" \t\""));
+            name.erase(name.find_last_not_of(" \t\"") + 1);
+            if (used.count(name) != 0 &&
+                    std::find(variables.begin(), variables.end(), name) ==
+                    variables.end()) {
+                columns.push_back(variables.size());
+                variables.push_back(name);
+            }
+            else
+                columns.push_back(unused);
+
+            if (fieldEnd == headerEnd)
+                break;
+            field = fieldEnd + 1;
+        }
+        CompiledExpression function =
+            CompiledExpression::compile(evaluated, variables);
+
+        std::string header(data, headerEnd);
+        header += "," + resultName + "\n";
+        ::fwrite(header.data(), 1, header.size(), this->out);
+
+        std::vector<Chunk> chunks;
+        for (const char* begin = skipLine(data, end); begin < end; ) {
+            const char* chunkEnd = begin + std::min(chunkBytes,
+                                                    size_t(end - begin));
+            chunkEnd = chunkEnd < end ? skipLine(chunkEnd, end) : end;
+            Chunk chunk = { begin, chunkEnd };
+            chunks.push_back(chunk);
+            begin = chunkEnd;
+        }
+
+        // a few chunks per worker are processed at a time, their output
+        // buffers are reused by the next ones
+        ThreadPool& pool = ThreadPool::getDefault();
+        size_t window = 4 * std::max<size_t>(pool.getThreadCount(), 1);
+        std::vector<std::string> buffers(std::min(window, chunks.size()));
+        for (size_t first = 0; first < chunks.size(); first += window) {
+            size_t last = std::min(first + window, chunks.size());
+            TaskGroup group(pool);
+            for (size_t i = first; i < last; i++) {
+                group.run([&, i] {
+                    processChunk(chunks[i], columns, variables.size(),
+                                 function, buffers[i - first]);
+                });
+            }
+            group.wait();
+
+            for (size_t i = first; i < last; i++) {
+                const std::string& buffer = buffers[i - first];
+                ::fwrite(buffer.data(), 1, buffer.size(), this->out);
+            }
+        }
+    } catch(std::exception& ex) {
+        printErrorMessage(ex.what());
+        finishEnvironment(environment);
+        return 1;
+    }
+
+    finishEnvironment(environment);
+    ::fflush(this->out);
+    return 0;
+}
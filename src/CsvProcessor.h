@@ -0,0 +1,63 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef CSVPROCESSOR_H_
+#define CSVPROCESSOR_H_
+
+#include <string>
+#include <cstdio>
+
+#include "ConsoleInterface.h"
+
+
+namespace mathy
+{
+    class CsvProcessor;
+}
+
+
+/*!
+ * \brief evaluates an expression for every row of a csv file
+ *
+ * The first line of the file names the columns, which become variables of
+ * the expression. Every row is written to the output with the value of the
+ * expression appended as new column. If the expression is an assignment
+ * like <code>total := price * count</code>, the new column is named after
+ * the variable, otherwise it is called <code>value</code>.
+ *
+ * The file is mapped into memory and cut into chunks of whole lines that
+ * fit into the cache. The thread pool parses the numbers of the used
+ * columns straight from the mapping, evaluates the compiled expression on
+ * the chunk and formats the output lines, which are written in order.
+ */
+class mathy::CsvProcessor : public InputProcessor
+{
+    std::string path;
+    std::string expression;
+public:
+    CsvProcessor(const std::string& path, const std::string& expression,
+                 ::FILE* out);
+
+    virtual int run(void);
+};
+
+
+#endif // CSVPROCESSOR_H_
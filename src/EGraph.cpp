@@ -0,0 +1,362 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "EGraph.h"
+
+#include <chrono>
+#include <limits>
+#include <functional>
+
+
+EGraph::Limits::Limits(void) :
+    maxNodes(10000),
+    maxIterations(30),
+    maxMilliseconds(200),
+    profiling(false)
+{
+}
+
+
+size_t EGraph::ENodeHash::operator () (const ENode& node) const
+{
+    size_t h = DiscriminationTree::KeyHash()(node.key);
+    for (size_t i = 0; i < node.children.size(); i++)
+        h ^= node.children[i] + 0x9e3779b9 + (h << 6) + (h >> 2);
+    return h;
+}
+
+
+bool EGraph::ENodeEqual::operator () (const ENode& a, const ENode& b) const
+{
+    return a.key == b.key && a.children == b.children;
+}
+
+
+EGraph::ClassId EGraph::add(const std::shared_ptr<ExpressionNode>& expression)
+{
+    ENode node;
+    node.prototype = expression;
+    node.key = DiscriminationTree::getKey(expression.get());
+    node.children.reserve(node.key.arity);
+    for (size_t i = 0; i < node.key.arity; i++)
+        node.children.push_back(add(expression->getChild(i)));
+    return addNode(node);
+}
+
+
+EGraph::ClassId EGraph::find(ClassId id)
+{
+    ClassId root = id;
+    while (parents[root] != root)
+        root = parents[root];
+    while (parents[id] != root) {
+        ClassId next = parents[id];
+        parents[id] = root;
+        id = next;
+    }
+    return root;
+}
+
+
+bool EGraph::merge(ClassId a, ClassId b)
+{
+    a = find(a);
+    b = find(b);
+    if (a == b)
+        return false;
+
+    if (classes[a].size() < classes[b].size())
+        std::swap(a, b);
+    parents[b] = a;
+    classes[a].insert(classes[a].end(), classes[b].begin(), classes[b].end());
+    std::vector<ENode>().swap(classes[b]);
+    return true;
+}
+
+
+void EGraph::rebuild(void)
+{
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        memo.clear();
+        std::vector<std::pair<ClassId, ClassId> > congruent;
+
+        for (ClassId c = 0; c < classes.size(); c++) {
+            if (parents[c] != c)
+                continue;
+
+            std::vector<ENode> unique;
+            unique.reserve(classes[c].size());
+            for (size_t i = 0; i < classes[c].size(); i++) {
+                ENode& node = classes[c][i];
+                canonicalize(node);
+                auto inserted = memo.insert(std::make_pair(node, c));
+                if (inserted.second)
+                    unique.push_back(node);
+                else if (inserted.first->second != c)
+                    congruent.push_back(std::make_pair(c,
+                                                inserted.first->second));
+            }
+            classes[c].swap(unique);
+        }
+
+        for (size_t i = 0; i < congruent.size(); i++)
+            merged = merge(congruent[i].first, congruent[i].second) || merged;
+    }
+}
+
+
+EGraph::StopReason EGraph::saturate(const std::vector<RewriteRule*>& rules,
+                                    const Limits& limits)
+{
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point deadline = Clock::now() +
+        std::chrono::milliseconds(limits.maxMilliseconds);
+
+    struct Match
+    {
+        const RewriteRule* rule;
+        ClassId id;
+        Bindings bindings;
+    };
+
+    for (size_t iteration = 0; iteration < limits.maxIterations;
+         iteration++) {
+        // search all rules first, so the rule order does not matter
+        std::vector<Match> matches;
+        std::vector<Bindings> results;
+        for (size_t r = 0; r < rules.size(); r++) {
+            Clock::time_point start = Clock::now();
+            size_t attempts = 0;
+            size_t found = matches.size();
+            for (ClassId c = 0; c < classes.size(); c++) {
+                if (parents[c] != c)
+                    continue;
+                attempts++;
+                results.clear();
+                match(rules[r]->getPattern().get(), c, Bindings(), results);
+                for (size_t i = 0; i < results.size(); i++) {
+                    Match m = { rules[r], c, results[i] };
+                    matches.push_back(m);
+                }
+            }
+
+            Clock::time_point now = Clock::now();
+            if (limits.profiling) {
+                rules[r]->record(attempts, matches.size() - found,
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        now - start).count());
+            }
+            if (now > deadline)
+                return StopReason::TIME_LIMIT;
+        }
+
+        size_t classCount = classes.size();
+        bool changed = false;
+        for (size_t i = 0; i < matches.size(); i++) {
+            ClassId replaced = instantiate(matches[i].rule->getReplacement(),
+                                           matches[i].bindings);
+            changed = merge(matches[i].id, replaced) || changed;
+            if (memo.size() > limits.maxNodes)
+                break;
+        }
+        changed = changed || classes.size() != classCount;
+        rebuild();
+
+        if (!changed)
+            return StopReason::SATURATED;
+        if (memo.size() > limits.maxNodes)
+            return StopReason::NODE_LIMIT;
+        if (Clock::now() > deadline)
+            return StopReason::TIME_LIMIT;
+    }
+    return StopReason::ITERATION_LIMIT;
+}
+
+
+std::shared_ptr<ExpressionNode> EGraph::extract(ClassId id, CostModel model)
+{
+    const double infinity = std::numeric_limits<double>::infinity();
+    std::vector<double> costs(classes.size(), infinity);
+    std::vector<const ENode*> best(classes.size(), nullptr);
+
+    // costs only decrease, so this reaches a fixed point
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (ClassId c = 0; c < classes.size(); c++) {
+            if (parents[c] != c)
+                continue;
+            for (size_t i = 0; i < classes[c].size(); i++) {
+                const ENode& node = classes[c][i];
+                double cost = getNodeCost(node, model);
+                for (size_t j = 0; j < node.children.size(); j++)
+                    cost += costs[find(node.children[j])];
+                if (cost < costs[c]) {
+                    costs[c] = cost;
+                    best[c] = &node;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    std::vector<std::shared_ptr<ExpressionNode> > built(classes.size());
+    std::function<std::shared_ptr<ExpressionNode> (ClassId)> build =
+        [&] (ClassId c) -> std::shared_ptr<ExpressionNode> {
+            c = find(c);
+            if (built[c])
+                return built[c];
+            const ENode* node = best[c];
+            if (node->children.empty())
+                return built[c] = node->prototype;
+
+            std::vector<std::shared_ptr<ExpressionNode> > children;
+            children.reserve(node->children.size());
+            for (size_t i = 0; i < node->children.size(); i++)
+                children.push_back(build(node->children[i]));
+            return built[c] = node->prototype->replaceChildren(children);
+        };
+    return build(id);
+}
+
+
+EGraph::ClassId EGraph::addNode(ENode node)
+{
+    canonicalize(node);
+    auto found = memo.find(node);
+    if (found != memo.end())
+        return find(found->second);
+
+    ClassId id = classes.size();
+    parents.push_back(id);
+    classes.push_back(std::vector<ENode>(1, node));
+    memo.insert(std::make_pair(node, id));
+    return id;
+}
+
+
+void EGraph::canonicalize(ENode& node)
+{
+    for (size_t i = 0; i < node.children.size(); i++)
+        node.children[i] = find(node.children[i]);
+}
+
+
+void EGraph::match(const ExpressionNode* pattern, ClassId id,
+                   const Bindings& bindings, std::vector<Bindings>& results)
+{
+    id = find(id);
+    if (RewriteRule::isPatternVariable(pattern)) {
+        const std::string& name =
+            static_cast<const VariableNode*>(pattern)->getName();
+        for (size_t i = 0; i < bindings.size(); i++) {
+            if (bindings[i].first == name) {
+                if (find(bindings[i].second) == id)
+                    results.push_back(bindings);
+                return;
+            }
+        }
+        results.push_back(bindings);
+        results.back().push_back(std::make_pair(name, id));
+        return;
+    }
+
+    DiscriminationTree::Key key = DiscriminationTree::getKey(pattern);
+    const std::vector<ENode>& nodes = classes[id];
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].key == key)
+            matchChildren(pattern, nodes[i], 0, bindings, results);
+    }
+}
+
+
+void EGraph::matchChildren(const ExpressionNode* pattern, const ENode& node,
+                           size_t i, const Bindings& bindings,
+                           std::vector<Bindings>& results)
+{
+    if (i == node.children.size()) {
+        results.push_back(bindings);
+        return;
+    }
+
+    std::vector<Bindings> partial;
+    match(pattern->getChild(i).get(), node.children[i], bindings, partial);
+    for (size_t j = 0; j < partial.size(); j++)
+        matchChildren(pattern, node, i + 1, partial[j], results);
+}
+
+
+EGraph::ClassId EGraph::instantiate(
+        const std::shared_ptr<ExpressionNode>& pattern,
+        const Bindings& bindings)
+{
+    if (RewriteRule::isPatternVariable(pattern.get())) {
+        const std::string& name =
+            static_cast<const VariableNode*>(pattern.get())->getName();
+        for (size_t i = 0; i < bindings.size(); i++) {
+            if (bindings[i].first == name)
+                return bindings[i].second;
+        }
+        throw RuntimeException("unbound pattern variable " + name);
+    }
+
+    ENode node;
+    node.prototype = pattern;
+    node.key = DiscriminationTree::getKey(pattern.get());
+    node.children.reserve(node.key.arity);
+    for (size_t i = 0; i < node.key.arity; i++)
+        node.children.push_back(instantiate(pattern->getChild(i), bindings));
+    return addNode(node);
+}
+
+
+double EGraph::getNodeCost(const ENode& node, CostModel model)
+{
+    if (model == CostModel::NODE_COUNT)
+        return 1;
+
+    switch (node.key.kind) {
+    case NodeKind::INTEGER:
+    case NodeKind::REAL:
+    case NodeKind::VARIABLE:
+        return 1;
+    case NodeKind::ADDITION:
+    case NodeKind::SUBTRACTION:
+    case NodeKind::MULTIPLICATION:
+        return 2;
+    case NodeKind::SUM:
+    case NodeKind::PRODUCT:
+        return node.children.size() > 1 ?
+            2 * double(node.children.size() - 1) : 1;
+    case NodeKind::DIVISION:
+    case NodeKind::MODULO:
+        return 8;
+    case NodeKind::POWER:
+        return 20;
+    case NodeKind::FUNCTION_CALL:
+        return 40;
+    default:
+        return 10;
+    }
+}
+
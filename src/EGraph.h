@@ -0,0 +1,173 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef EGRAPH_H_
+#define EGRAPH_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include "Node.h"
+#include "Rewriter.h"
+
+
+/*!
+ * \brief equality graph for simplification by equality saturation
+ *
+ * An e-graph stores many equivalent expressions at once. Expressions are
+ * split into e-nodes, whose operands are not nodes but e-classes, i.e. sets
+ * of e-nodes known to be equal. Applying a rewrite rule does not replace
+ * anything but merges the e-class of the match with the e-class of the
+ * replacement, so no rule application can lose a simpler form. After the
+ * rules have been applied until nothing changes anymore (or the budget is
+ * exhausted), the cheapest expression is extracted.
+ */
+class EGraph
+{
+public:
+    typedef size_t ClassId;
+
+    /*!
+     * \brief bounds the work of \link saturate
+     */
+    struct Limits
+    {
+        size_t maxNodes;
+        size_t maxIterations;
+        long maxMilliseconds;
+
+        //! record the rule statistics while searching
+        bool profiling;
+
+        Limits(void);
+    };
+
+    enum class StopReason
+    {
+        SATURATED,
+        ITERATION_LIMIT,
+        NODE_LIMIT,
+        TIME_LIMIT
+    };
+
+    enum class CostModel
+    {
+        //! every node costs the same
+        NODE_COUNT,
+
+        //! estimates the time needed to evaluate the expression
+        EVALUATION_COST
+    };
+
+    struct ENode
+    {
+        //! a node of this shape, used to rebuild an expression
+        std::shared_ptr<ExpressionNode> prototype;
+        DiscriminationTree::Key key;
+        std::vector<ClassId> children;
+    };
+
+private:
+    struct ENodeHash
+    {
+        size_t operator () (const ENode& node) const;
+    };
+    struct ENodeEqual
+    {
+        bool operator () (const ENode& a, const ENode& b) const;
+    };
+
+    typedef std::vector<std::pair<std::string, ClassId> > Bindings;
+
+    //! union-find forest over the e-classes
+    std::vector<ClassId> parents;
+
+    //! the e-nodes of each class, only valid for canonical ids
+    std::vector<std::vector<ENode> > classes;
+
+    std::unordered_map<ENode, ClassId, ENodeHash, ENodeEqual> memo;
+
+public:
+    EGraph(void) = default;
+    EGraph(const EGraph&) = delete;
+    EGraph& operator = (const EGraph&) = delete;
+
+    /*!
+     * \brief adds an expression and all its subexpressions
+     *
+     * \return the e-class containing the expression
+     */
+    ClassId add(const std::shared_ptr<ExpressionNode>& expression);
+
+    /*!
+     * \return the canonical id of an e-class
+     */
+    ClassId find(ClassId id);
+
+    /*!
+     * \brief records that two e-classes are equal
+     *
+     * The congruence invariant is restored only by \link rebuild.
+     *
+     * \return <code>true</code> if the classes were not equal before
+     */
+    bool merge(ClassId a, ClassId b);
+
+    /*!
+     * \brief merges e-classes containing e-nodes that became equal
+     *        because their operands were merged
+     */
+    void rebuild(void);
+
+    inline size_t getNodeCount(void) const { return memo.size(); }
+
+    /*!
+     * \brief applies rules until no rule adds new information or the
+     *        limits are reached
+     */
+    StopReason saturate(const std::vector<RewriteRule*>& rules,
+                        const Limits& limits);
+
+    /*!
+     * \brief builds the cheapest expression in an e-class
+     */
+    std::shared_ptr<ExpressionNode> extract(ClassId id, CostModel model);
+
+private:
+    ClassId addNode(ENode node);
+    void canonicalize(ENode& node);
+
+    void match(const ExpressionNode* pattern, ClassId id,
+               const Bindings& bindings, std::vector<Bindings>& results);
+    void matchChildren(const ExpressionNode* pattern, const ENode& node,
+                       size_t i, const Bindings& bindings,
+                       std::vector<Bindings>& results);
+    ClassId instantiate(const std::shared_ptr<ExpressionNode>& pattern,
+                        const Bindings& bindings);
+
+    static double getNodeCost(const ENode& node, CostModel model);
+};
+
+
+#endif // EGRAPH_H_
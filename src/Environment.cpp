@@ -66,7 +66,8 @@ int FunctionParameter::getIndex(void) const
 }
 
 
-Environment::Environment(void)
+Environment::Environment(void) :
+    version(createStamp()), readOnly(false)
 {
     VariableSymbol* vs = new VariableSymbol("cos",
             std::make_shared<Cos>());
@@ -75,6 +76,78 @@ Environment::Environment(void)
     vs = new VariableSymbol("if",
             std::make_shared<If>());
     addSymbol(vs);
+
+    vs = new VariableSymbol("digits",
+            std::make_shared<Digits>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("expand",
+            std::make_shared<Expand>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("collect",
+            std::make_shared<Collect>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("simplify",
+            std::make_shared<Simplify>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("normalize",
+            std::make_shared<Normalize>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("rulestats",
+            std::make_shared<RuleStats>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("integrate",
+            std::make_shared<Integrate>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("solve",
+            std::make_shared<Solve>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("findroot",
+            std::make_shared<FindRoot>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("memo",
+            std::make_shared<Memo>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("sum",
+            std::make_shared<RangeReduction>(false));
+    addSymbol(vs);
+
+    vs = new VariableSymbol("prod",
+            std::make_shared<RangeReduction>(true));
+    addSymbol(vs);
+
+    vs = new VariableSymbol("tabulate",
+            std::make_shared<Tabulate>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("matmul",
+            std::make_shared<MatMul>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("transpose",
+            std::make_shared<Transpose>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("total",
+            std::make_shared<Total>());
+    addSymbol(vs);
+
+    vs = new VariableSymbol("min",
+            std::make_shared<Extremum>(false));
+    addSymbol(vs);
+
+    vs = new VariableSymbol("max",
+            std::make_shared<Extremum>(true));
+    addSymbol(vs);
 }
 
 
@@ -92,7 +165,12 @@ std::shared_ptr<ExpressionNode> Environment::evaluateExpression(
 
 void Environment::addSymbol(Symbol* s)
 {
+    if (readOnly) {
+        delete s;
+        throw ReadOnlyException();
+    }
     symbols.push_back(s);
+    version = createStamp();
 }
 
 
@@ -108,6 +186,22 @@ VariableSymbol* Environment::getVariable(const std::string& name)
 }
 
 
+void Environment::setVariable(const std::string& name,
+                              const std::shared_ptr<ExpressionNode>& value)
+{
+    if (readOnly)
+        throw ReadOnlyException();
+
+    VariableSymbol* vs = getVariable(name);
+    if (vs) {
+        vs->setValue(value);
+        version = createStamp();
+    }
+    else
+        addSymbol(new VariableSymbol(name, value));
+}
+
+
 AssignmentException::AssignmentException(const std::string& message) :
     message(message)
 {
@@ -124,3 +218,8 @@ const char* AssignmentException::what(void) const throw()
     return message.c_str();
 }
 
+
+const char* ReadOnlyException::what(void) const throw()
+{
+    return "the environment cannot be changed while it is shared";
+}
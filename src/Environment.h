@@ -23,6 +23,7 @@
 #define ENVIRONMENT_H_
 
 #include "Node.h"
+#include "Rewriter.h"
 #include <vector>
 #include <memory>
 #include <exception>
@@ -74,6 +75,15 @@ class Environment
 {
     // TODO implement this as a hash table
     std::vector<Symbol*> symbols;
+
+    //! the rules used by <code>simplify</code>
+    Rewriter rewriter;
+
+    //! changes whenever a symbol is added or redefined
+    uint64_t version;
+
+    //! set while several threads evaluate in this environment
+    bool readOnly;
 public:
 
     Environment(void);
@@ -84,6 +94,29 @@ public:
 
     void addSymbol(Symbol* s);
     VariableSymbol* getVariable(const std::string& name);
+
+    /*!
+     * \brief defines a variable or changes its value
+     *
+     * Symbols must be changed through the environment, otherwise nodes
+     * evaluated before would keep their old values.
+     */
+    void setVariable(const std::string& name,
+                     const std::shared_ptr<ExpressionNode>& value);
+
+    inline uint64_t getVersion(void) const { return version; }
+
+    /*!
+     * \brief forbids or allows changing symbols
+     *
+     * Evaluating in a read-only environment is safe from several threads,
+     * an expression that tries to change a symbol throws a
+     * \link ReadOnlyException.
+     */
+    inline void setReadOnly(bool readOnly) { this->readOnly = readOnly; }
+    inline bool isReadOnly(void) const { return readOnly; }
+
+    inline Rewriter& getRewriter(void) { return rewriter; }
 };
 
 
@@ -97,5 +130,12 @@ public:
     const char* what(void) const throw();
 };
 
+class ReadOnlyException :
+        public std::exception
+{
+public:
+    const char* what(void) const throw();
+};
+
 #endif // ENVIRONMENT_H_
 
@@ -0,0 +1,193 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "ExpressionParser.h"
+#include "PrattParser.h"
+#include "ParseCache.h"
+#include "Node.h"
+#include "FunctionNode.h"
+#include "parser.h"
+
+
+using mathy::ParseError;
+using mathy::ParseResult;
+using mathy::ExpressionParser;
+
+
+std::string ParseError::getString(void) const
+{
+    return "line " + std::to_string(line) + ", column " +
+        std::to_string(column) + ": " + message;
+}
+
+
+ExpressionParser::ExpressionParser(::FILE* in, Backend backend) :
+    backend(backend), in(in), cache(nullptr), nextPending(0)
+{
+    if (backend == Backend::PRATT)
+        pratt.reset(new PrattParser());
+    else
+        scanner.reset(new Scanner(in));
+}
+
+
+ExpressionParser::ExpressionParser(const char* data, size_t length,
+                                   Backend backend) :
+    backend(backend), in(nullptr), cache(nullptr), nextPending(0)
+{
+    if (backend == Backend::PRATT)
+        pratt.reset(new PrattParser(data, length));
+    else
+        scanner.reset(new Scanner(data, length));
+}
+
+
+ExpressionParser::~ExpressionParser(void)
+{
+}
+
+
+ParseResult ExpressionParser::parseStatement(void)
+{
+    if (backend == Backend::PRATT) {
+        if (nextPending < pending.size())
+            return std::move(pending[nextPending++]);
+        if (in != nullptr && pratt->isExhausted() && !pratt->isEndOfFile()) {
+            readLine();
+            // the last line is left to the parser if it has no newline,
+            // which marks the end of the file
+            if (cache != nullptr && !text.empty() && text.back() == '\n') {
+                parseLine();
+                return std::move(pending[nextPending++]);
+            }
+        }
+        return pratt->parseStatement();
+    }
+
+    ParseResult result;
+    ::yyparse(scanner->getHandle(), result, nullptr);
+    if (result.hasErrors()) {
+        result.expression = nullptr;
+        scanner->skipStatement();
+    }
+    return result;
+}
+
+
+std::vector<ParseResult> ExpressionParser::parseStatements(size_t limit)
+{
+    if (backend == Backend::PRATT) {
+        std::vector<ParseResult> statements;
+        while (statements.size() < limit && !isEndOfFile()) {
+            ParseResult parsed = parseStatement();
+            if (isEndOfFile() && parsed.expression == nullptr &&
+                    !parsed.hasErrors())
+                break;
+            statements.push_back(std::move(parsed));
+        }
+        return statements;
+    }
+
+    StatementList list;
+    list.limit = limit;
+    if (limit == 0 || scanner->isEndOfFile())
+        return list.statements;
+
+    ParseResult current;
+    scanner->setScriptMode(true);
+    ::yyparse_script(scanner->getHandle(), current, &list);
+    scanner->setScriptMode(false);
+
+    // only happens if the parser had to give up, like on a stack overflow
+    if (current.hasErrors()) {
+        scanner->skipStatement();
+        list.statements.push_back(std::move(current));
+    }
+    return list.statements;
+}
+
+
+bool ExpressionParser::isEndOfFile(void) const
+{
+    if (backend == Backend::PRATT)
+        return pratt->isEndOfFile();
+    return scanner->isEndOfFile();
+}
+
+
+ParseResult ExpressionParser::parse(const std::string& text, Backend backend)
+{
+    // the scanner stops at the end of the line
+    std::string input = text + "\n";
+    ExpressionParser parser(input.c_str(), input.size(), backend);
+    return parser.parseStatement();
+}
+
+
+void ExpressionParser::readLine(void)
+{
+    // clear() keeps the memory, so reading does not allocate per line
+    text.clear();
+    char chunk[4096];
+    while (::fgets(chunk, sizeof chunk, in) != nullptr) {
+        text.append(chunk);
+        size_t length = text.size();
+        if (text[length - 1] != '\n')
+            continue;
+        // a line ending in " _" continues on the next one
+        if (length >= 3 && text[length - 2] == '_' && text[length - 3] == ' ')
+            continue;
+        break;
+    }
+    pratt->reset(text.data(), text.size());
+}
+
+
+void ExpressionParser::parseLine(void)
+{
+    pending.clear();
+    nextPending = 0;
+    ParseCache::normalize(text.data(), text.size(), key);
+
+    std::shared_ptr<const ParseCache::Statements> statements =
+        cache->find(key);
+    if (statements != nullptr) {
+        // keeps the line numbers of later errors right
+        pratt->skip();
+        pending.resize(statements->size());
+        for (size_t i = 0; i < statements->size(); i++)
+            pending[i].expression = (*statements)[i];
+        return;
+    }
+
+    std::shared_ptr<ParseCache::Statements> parsed =
+        std::make_shared<ParseCache::Statements>();
+    bool valid = true;
+    do {
+        pending.push_back(pratt->parseStatement());
+        valid = valid && !pending.back().hasErrors();
+        parsed->push_back(pending.back().expression);
+    } while (!pratt->isExhausted());
+
+    // error messages contain line numbers, so they cannot be reused
+    if (valid)
+        cache->insert(key, parsed);
+}
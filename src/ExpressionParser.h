@@ -0,0 +1,204 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef EXPRESSIONPARSER_H_
+#define EXPRESSIONPARSER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdio>
+
+#include "Scanner.h"
+
+
+class ExpressionNode;
+
+namespace mathy
+{
+    struct ParseError;
+    struct ParseResult;
+    struct StatementList;
+
+    class ExpressionParser;
+    class PrattParser;
+    class ParseCache;
+}
+
+
+/*!
+ * \brief a syntax error found by the parser
+ */
+struct mathy::ParseError
+{
+    std::string message;
+
+    //! position of the offending token, counting from 1
+    size_t line;
+    size_t column;
+
+    /*!
+     * \return the message prefixed with the position
+     */
+    std::string getString(void) const;
+};
+
+
+/*!
+ * \brief the outcome of parsing one statement
+ *
+ * Serves as the context of the generated parser, which stores the root
+ * node and the errors here instead of in global variables.
+ */
+struct mathy::ParseResult
+{
+    //! the parsed statement, <code>nullptr</code> for empty statements
+    std::shared_ptr<ExpressionNode> expression;
+
+    std::vector<ParseError> errors;
+
+    inline bool hasErrors(void) const { return !errors.empty(); }
+};
+
+
+/*!
+ * \brief the context of the generated parser when it reads a whole script
+ */
+struct mathy::StatementList
+{
+    //! the statements in input order, each with its own errors
+    std::vector<ParseResult> statements;
+
+    //! the parser returns once it has read this many statements
+    size_t limit;
+};
+
+
+/*!
+ * \brief parses statements with the hand-written \link PrattParser or the
+ *        bison parser generated from parser.y
+ *
+ * Both build the same trees, the generated parser is kept as reference.
+ * Each instance owns its input and all parser state, so any number of
+ * parsers can be used from different threads at once.
+ */
+class mathy::ExpressionParser
+{
+public:
+    enum class Backend
+    {
+        PRATT,
+        BISON
+    };
+private:
+    Backend backend;
+
+    //! the file the hand-written parser reads, statement by statement
+    ::FILE* in;
+    std::string text;
+
+    std::unique_ptr<PrattParser> pratt;
+    std::unique_ptr<Scanner> scanner;
+
+    ParseCache* cache;
+    std::string key;
+
+    //! the statements of a line taken from or added to the cache
+    std::vector<ParseResult> pending;
+    size_t nextPending;
+public:
+    /*!
+     * \brief parses the statements of a file
+     */
+    ExpressionParser(::FILE* in, Backend backend = Backend::PRATT);
+
+    /*!
+     * \brief parses the statements in an in-memory buffer
+     *
+     * The hand-written parser reads the buffer in place, so it has to stay
+     * valid while parsing. The generated one works on a copy.
+     */
+    ExpressionParser(const char* data, size_t length,
+                     Backend backend = Backend::PRATT);
+    ~ExpressionParser(void);
+
+    /*!
+     * \brief parses the next statement
+     *
+     * After an error, the rest of the statement is skipped, so the next
+     * call continues with the following one.
+     */
+    ParseResult parseStatement(void);
+
+    /*!
+     * \brief parses the following statements in one pass
+     *
+     * The generated parser reads all of them in a single call instead of
+     * being started again for every statement. After an error, it skips
+     * to the end of the statement and continues with the next one. The
+     * statement ended by the end of the input is included, but not if it
+     * is empty.
+     *
+     * \param limit the maximal number of statements to read, which bounds
+     *        the memory used for long scripts
+     * \return the statements in input order, an empty list once the input
+     *         is exhausted
+     */
+    std::vector<ParseResult> parseStatements(size_t limit = size_t(-1));
+
+    //! <code>true</code> once the whole input has been read
+    bool isEndOfFile(void) const;
+
+    /*!
+     * \brief looks up the lines read from the file in a cache before
+     *        parsing them
+     *
+     * Only used by the hand-written parser. The cache is not owned and
+     * has to outlive the parser, it may be shared between threads.
+     */
+    inline void setCache(ParseCache* cache) { this->cache = cache; }
+
+    /*!
+     * \brief parses a single statement from a string
+     *
+     * Safe to call from any number of threads at once.
+     */
+    static ParseResult parse(const std::string& text,
+                             Backend backend = Backend::PRATT);
+
+private:
+    /*!
+     * \brief reads the next line, including continued lines, for the
+     *        hand-written parser
+     */
+    void readLine(void);
+
+    /*!
+     * \brief fills \link pending with the statements of the line just read
+     *
+     * Lines found in the cache are not parsed at all, others are parsed
+     * completely and added to the cache if they contain no errors.
+     */
+    void parseLine(void);
+};
+
+
+#endif // EXPRESSIONPARSER_H_
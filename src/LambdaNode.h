@@ -0,0 +1,57 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef LAMBDANODE_H_
+#define LAMBDANODE_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "FunctionNode.h"
+
+
+/*!
+ * \brief a function written in the input, like <code>!(x) -> x^2</code>
+ *
+ * Remembers the names of its parameters, so natives working on the
+ * definition of a function can talk about it in the user's terms.
+ */
+class LambdaNode :
+    public FunctionNode
+{
+    std::vector<std::string> parameters;
+public:
+    inline LambdaNode(
+            const std::vector<std::shared_ptr<VariableNode> >& arguments,
+            const std::shared_ptr<ExpressionNode>& equation) :
+        FunctionNode(arguments, equation)
+    {
+        for (size_t i = 0; i < arguments.size(); i++)
+            parameters.push_back(arguments[i]->getName());
+    }
+
+    inline const std::vector<std::string>& getParameters(void) const
+    { return parameters; }
+};
+
+
+#endif // LAMBDANODE_H_
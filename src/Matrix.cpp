@@ -0,0 +1,770 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "Matrix.h"
+#include "OutputBuffer.h"
+
+#include <cmath>
+#include <algorithm>
+#include <numeric>
+
+
+namespace
+{
+    //! edge length of the square tiles the blocked kernels work on
+    const size_t blockSize = 64;
+
+    struct Add
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return a + b; }
+    };
+
+    struct Subtract
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return a - b; }
+    };
+
+    struct Multiply
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return a * b; }
+    };
+
+    struct Divide
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return a / b; }
+    };
+
+    struct Power
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return ::pow(a, b); }
+    };
+
+    template<ComparisonNode::Relation relation>
+    struct Compare
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return ComparisonNode::holds(relation, a, b) ? 1 : 0; }
+    };
+
+    struct And
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return a != 0 && b != 0 ? 1 : 0; }
+    };
+
+    struct Or
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return a != 0 || b != 0 ? 1 : 0; }
+    };
+
+    struct Xor
+    {
+        inline FloatVal operator () (FloatVal a, FloatVal b) const
+        { return (a != 0) != (b != 0) ? 1 : 0; }
+    };
+
+    typedef ComparisonNode::Relation Relation;
+
+    template<typename Op>
+    void combineArrays(const FloatVal* __restrict a,
+                       const FloatVal* __restrict b,
+                       FloatVal* __restrict result, size_t n)
+    {
+        Op op;
+        for (size_t i = 0; i < n; i++)
+            result[i] = op(a[i], b[i]);
+    }
+
+    template<typename Op>
+    void combineNumber(const FloatVal* __restrict a, FloatVal number,
+                       bool numberFirst, FloatVal* __restrict result,
+                       size_t n)
+    {
+        Op op;
+        if (numberFirst) {
+            for (size_t i = 0; i < n; i++)
+                result[i] = op(number, a[i]);
+        }
+        else {
+            for (size_t i = 0; i < n; i++)
+                result[i] = op(a[i], number);
+        }
+    }
+
+    bool getNumber(const ExpressionNode* node, FloatVal& value)
+    {
+        if (node->getKind() == NodeKind::INTEGER) {
+            value = FloatVal(static_cast<const IntegerNode*>(node)->getValue());
+            return true;
+        }
+        if (const RealNode* real = dynamic_cast<const RealNode*>(node)) {
+            value = real->getValue();
+            return true;
+        }
+        return false;
+    }
+
+    /*!
+     * \brief builds a list or matrix from evaluated list elements
+     *
+     * \return <code>nullptr</code> if the elements are neither all numbers
+     *         nor all lists of numbers of equal length
+     */
+    std::shared_ptr<ExpressionNode> createMatrix(
+            const std::vector<std::shared_ptr<ExpressionNode> >& elements)
+    {
+        Matrix list = Matrix::createList(elements.size());
+        size_t i = 0;
+        while (i < elements.size() &&
+               getNumber(elements[i].get(), list.getData()[i]))
+            i++;
+        if (i == elements.size())
+            return std::make_shared<MatrixNode>(std::move(list));
+        if (i > 0)
+            return nullptr;
+
+        size_t columns = 0;
+        for (i = 0; i < elements.size(); i++) {
+            const MatrixNode* row =
+                dynamic_cast<const MatrixNode*>(elements[i].get());
+            if (row == nullptr || !row->getMatrix().isList() ||
+                    (i > 0 && row->getMatrix().getColumns() != columns))
+                return nullptr;
+            columns = row->getMatrix().getColumns();
+        }
+
+        Matrix matrix(elements.size(), columns);
+        for (i = 0; i < elements.size(); i++) {
+            const Matrix& row =
+                dynamic_cast<const MatrixNode*>(elements[i].get())->
+                getMatrix();
+            std::copy(row.getData(), row.getData() + columns,
+                      &matrix.at(i, 0));
+        }
+        return std::make_shared<MatrixNode>(std::move(matrix));
+    }
+}
+
+
+Matrix::Matrix(size_t rows, size_t columns) :
+    rows(rows), columns(columns), list(false), data(rows * columns)
+{
+}
+
+
+Matrix Matrix::createList(size_t length)
+{
+    Matrix matrix(1, length);
+    matrix.list = true;
+    return matrix;
+}
+
+
+Matrix Matrix::createLike(void) const
+{
+    Matrix matrix(rows, columns);
+    matrix.list = list;
+    return matrix;
+}
+
+
+Matrix::Operation Matrix::getOperation(ComparisonNode::Relation relation)
+{
+    switch (relation) {
+    case Relation::LESS:            return Operation::LESS;
+    case Relation::LESS_EQUAL:      return Operation::LESS_EQUAL;
+    case Relation::GREATER:         return Operation::GREATER;
+    case Relation::GREATER_EQUAL:   return Operation::GREATER_EQUAL;
+    case Relation::EQUAL:           return Operation::EQUAL;
+    default:                        return Operation::NOT_EQUAL;
+    }
+}
+
+
+Matrix Matrix::combine(Operation operation, const Matrix& other) const
+{
+    if (list != other.list && operation == Operation::MULTIPLY)
+        throw ArithmeticException("* multiplies element by element, use "
+                                  "matmul to multiply a matrix and a list");
+    if (rows != other.rows || columns != other.columns ||
+            list != other.list)
+        throw ArithmeticException("operands have different dimensions");
+
+    Matrix result = createLike();
+    const FloatVal* a = data.data();
+    const FloatVal* b = other.data.data();
+    FloatVal* r = result.data.data();
+    size_t n = data.size();
+    switch (operation) {
+    case Operation::ADD:
+        combineArrays<Add>(a, b, r, n);
+        break;
+    case Operation::SUBTRACT:
+        combineArrays<Subtract>(a, b, r, n);
+        break;
+    case Operation::MULTIPLY:
+        combineArrays<Multiply>(a, b, r, n);
+        break;
+    case Operation::DIVIDE:
+        combineArrays<Divide>(a, b, r, n);
+        break;
+    case Operation::POWER:
+        combineArrays<Power>(a, b, r, n);
+        break;
+    case Operation::LESS:
+        combineArrays<Compare<Relation::LESS> >(a, b, r, n);
+        break;
+    case Operation::LESS_EQUAL:
+        combineArrays<Compare<Relation::LESS_EQUAL> >(a, b, r, n);
+        break;
+    case Operation::GREATER:
+        combineArrays<Compare<Relation::GREATER> >(a, b, r, n);
+        break;
+    case Operation::GREATER_EQUAL:
+        combineArrays<Compare<Relation::GREATER_EQUAL> >(a, b, r, n);
+        break;
+    case Operation::EQUAL:
+        combineArrays<Compare<Relation::EQUAL> >(a, b, r, n);
+        break;
+    case Operation::NOT_EQUAL:
+        combineArrays<Compare<Relation::NOT_EQUAL> >(a, b, r, n);
+        break;
+    case Operation::AND:
+        combineArrays<And>(a, b, r, n);
+        break;
+    case Operation::OR:
+        combineArrays<Or>(a, b, r, n);
+        break;
+    case Operation::XOR:
+        combineArrays<Xor>(a, b, r, n);
+        break;
+    }
+    return result;
+}
+
+
+Matrix Matrix::combine(Operation operation, FloatVal number,
+                       bool numberFirst) const
+{
+    Matrix result = createLike();
+    const FloatVal* a = data.data();
+    FloatVal* r = result.data.data();
+    size_t n = data.size();
+    switch (operation) {
+    case Operation::ADD:
+        combineNumber<Add>(a, number, numberFirst, r, n);
+        break;
+    case Operation::SUBTRACT:
+        combineNumber<Subtract>(a, number, numberFirst, r, n);
+        break;
+    case Operation::MULTIPLY:
+        combineNumber<Multiply>(a, number, numberFirst, r, n);
+        break;
+    case Operation::DIVIDE:
+        combineNumber<Divide>(a, number, numberFirst, r, n);
+        break;
+    case Operation::POWER:
+        combineNumber<Power>(a, number, numberFirst, r, n);
+        break;
+    case Operation::LESS:
+        combineNumber<Compare<Relation::LESS> >(a, number, numberFirst, r, n);
+        break;
+    case Operation::LESS_EQUAL:
+        combineNumber<Compare<Relation::LESS_EQUAL> >(a, number, numberFirst,
+                                                      r, n);
+        break;
+    case Operation::GREATER:
+        combineNumber<Compare<Relation::GREATER> >(a, number, numberFirst,
+                                                   r, n);
+        break;
+    case Operation::GREATER_EQUAL:
+        combineNumber<Compare<Relation::GREATER_EQUAL> >(a, number,
+                                                         numberFirst, r, n);
+        break;
+    case Operation::EQUAL:
+        combineNumber<Compare<Relation::EQUAL> >(a, number, numberFirst, r, n);
+        break;
+    case Operation::NOT_EQUAL:
+        combineNumber<Compare<Relation::NOT_EQUAL> >(a, number, numberFirst,
+                                                     r, n);
+        break;
+    case Operation::AND:
+        combineNumber<And>(a, number, numberFirst, r, n);
+        break;
+    case Operation::OR:
+        combineNumber<Or>(a, number, numberFirst, r, n);
+        break;
+    case Operation::XOR:
+        combineNumber<Xor>(a, number, numberFirst, r, n);
+        break;
+    }
+    return result;
+}
+
+
+Matrix Matrix::multiply(const Matrix& other) const
+{
+    // a list has the same layout as a column vector
+    size_t n = list ? 1 : rows;
+    size_t m = columns;
+    size_t p = other.list ? 1 : other.columns;
+    if ((other.list ? other.columns : other.rows) != m)
+        throw ArithmeticException("matrix dimensions do not match");
+
+    Matrix result = (list || other.list) ? createList(n * p) : Matrix(n, p);
+    const FloatVal* __restrict a = data.data();
+    const FloatVal* __restrict b = other.data.data();
+    FloatVal* __restrict c = result.data.data();
+
+    // the innermost loop runs along rows of b and c, and the tiles of all
+    // three matrices stay in cache while they are used
+    for (size_t i0 = 0; i0 < n; i0 += blockSize) {
+        size_t iEnd = std::min(i0 + blockSize, n);
+        for (size_t k0 = 0; k0 < m; k0 += blockSize) {
+            size_t kEnd = std::min(k0 + blockSize, m);
+            for (size_t j0 = 0; j0 < p; j0 += blockSize) {
+                size_t jEnd = std::min(j0 + blockSize, p);
+                for (size_t i = i0; i < iEnd; i++) {
+                    FloatVal* __restrict row = c + i * p;
+                    for (size_t k = k0; k < kEnd; k++) {
+                        FloatVal factor = a[i * m + k];
+                        const FloatVal* __restrict bRow = b + k * p;
+                        for (size_t j = j0; j < jEnd; j++)
+                            row[j] += factor * bRow[j];
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+
+Matrix Matrix::transpose(void) const
+{
+    if (list)
+        return *this;
+
+    Matrix result(columns, rows);
+    const FloatVal* __restrict a = data.data();
+    FloatVal* __restrict t = result.data.data();
+
+    // smaller tiles than for the product, two of them have to fit into
+    // the first level cache at once
+    const size_t tile = blockSize / 2;
+    for (size_t i0 = 0; i0 < rows; i0 += tile) {
+        size_t iEnd = std::min(i0 + tile, rows);
+        for (size_t j0 = 0; j0 < columns; j0 += tile) {
+            size_t jEnd = std::min(j0 + tile, columns);
+            for (size_t i = i0; i < iEnd; i++) {
+                for (size_t j = j0; j < jEnd; j++)
+                    t[j * rows + i] = a[i * columns + j];
+            }
+        }
+    }
+    return result;
+}
+
+
+FloatVal Matrix::total(void) const
+{
+    // independent partial sums let the additions overlap
+    FloatVal partial[4] = { 0, 0, 0, 0 };
+    const FloatVal* a = data.data();
+    size_t n = data.size();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        partial[0] += a[i];
+        partial[1] += a[i + 1];
+        partial[2] += a[i + 2];
+        partial[3] += a[i + 3];
+    }
+    for (; i < n; i++)
+        partial[0] += a[i];
+    return (partial[0] + partial[1]) + (partial[2] + partial[3]);
+}
+
+
+FloatVal Matrix::minimum(void) const
+{
+    if (data.empty())
+        throw ArithmeticException("minimum of an empty list");
+    return *std::min_element(data.begin(), data.end());
+}
+
+
+FloatVal Matrix::maximum(void) const
+{
+    if (data.empty())
+        throw ArithmeticException("maximum of an empty list");
+    return *std::max_element(data.begin(), data.end());
+}
+
+
+Matrix Matrix::columnTotals(void) const
+{
+    Matrix result = createList(columns);
+    FloatVal* __restrict r = result.data.data();
+    for (size_t i = 0; i < rows; i++) {
+        const FloatVal* __restrict row = data.data() + i * columns;
+        for (size_t j = 0; j < columns; j++)
+            r[j] += row[j];
+    }
+    return result;
+}
+
+
+Matrix Matrix::rowTotals(void) const
+{
+    Matrix result = createList(rows);
+    for (size_t i = 0; i < rows; i++) {
+        const FloatVal* row = data.data() + i * columns;
+        result.data[i] = std::accumulate(row, row + columns, FloatVal(0));
+    }
+    return result;
+}
+
+
+bool Matrix::equals(const Matrix& other) const
+{
+    return rows == other.rows && columns == other.columns &&
+        list == other.list && data == other.data;
+}
+
+
+std::string Matrix::getString(void) const
+{
+    OutputBuffer buffer;
+    write(buffer);
+    return buffer.getContents();
+}
+
+
+void Matrix::write(OutputBuffer& out) const
+{
+    out.append('[');
+    for (size_t i = 0; i < rows; i++) {
+        if (i > 0)
+            out.append(", ", 2);
+        if (!list)
+            out.append('[');
+        for (size_t j = 0; j < columns; j++) {
+            if (j > 0)
+                out.append(", ", 2);
+            out.appendReal(at(i, j));
+        }
+        if (!list)
+            out.append(']');
+    }
+    out.append(']');
+}
+
+
+MatrixNode::MatrixNode(const std::shared_ptr<const Matrix>& matrix) :
+    matrix(matrix)
+{
+}
+
+
+MatrixNode::MatrixNode(Matrix&& matrix) :
+    matrix(std::make_shared<const Matrix>(std::move(matrix)))
+{
+}
+
+
+/*!
+ * \brief fills a matrix with an evaluated operand, which is a number or a
+ *        matrix of the same shape
+ *
+ * \return <code>false</code> if the operand is neither
+ */
+static bool expand(const ExpressionNode* operand, Matrix& target)
+{
+    FloatVal number;
+    if (getNumber(operand, number)) {
+        std::fill(target.getData(), target.getData() + target.getSize(),
+                  number);
+        return true;
+    }
+
+    const MatrixNode* matrix = dynamic_cast<const MatrixNode*>(operand);
+    if (matrix == nullptr)
+        return false;
+    const Matrix& source = matrix->getMatrix();
+    if (source.getRows() != target.getRows() ||
+            source.getColumns() != target.getColumns() ||
+            source.isList() != target.isList())
+        throw ArithmeticException("operands have different dimensions");
+    std::copy(source.getData(), source.getData() + source.getSize(),
+              target.getData());
+    return true;
+}
+
+
+static std::shared_ptr<ExpressionNode> makeNumber(FloatVal value)
+{
+    if (value == ::floor(value) && ::fabs(value) < 9007199254740992.0)
+        return std::make_shared<IntegerNode>((long long int) value);
+    return std::make_shared<RealNode>(value);
+}
+
+
+/*!
+ * \brief divides element by element, leaving divisions by zero symbolic
+ *        like the scalar <code>1 / 0</code>
+ *
+ * \return the quotient as list of expressions, or <code>nullptr</code> if
+ *         no integer is divided by zero or an operand is neither a matrix
+ *         nor a number
+ */
+static std::shared_ptr<ExpressionNode> divide(
+        const std::shared_ptr<ExpressionNode>& left,
+        const std::shared_ptr<ExpressionNode>& right)
+{
+    const MatrixNode* shape = dynamic_cast<const MatrixNode*>(left.get());
+    if (shape == nullptr)
+        shape = static_cast<const MatrixNode*>(right.get());
+    Matrix dividends = shape->getMatrix().createLike();
+    Matrix divisors = shape->getMatrix().createLike();
+    if (!expand(left.get(), dividends) || !expand(right.get(), divisors))
+        return nullptr;
+
+    std::vector<std::shared_ptr<ExpressionNode> > rows;
+    bool symbolic = false;
+    for (size_t i = 0; i < dividends.getRows(); i++) {
+        std::vector<std::shared_ptr<ExpressionNode> > row;
+        for (size_t j = 0; j < dividends.getColumns(); j++) {
+            FloatVal x = dividends.at(i, j);
+            FloatVal y = divisors.at(i, j);
+            std::shared_ptr<ExpressionNode> dividend = makeNumber(x);
+            // like scalars, only integers divided by zero stay symbolic
+            if (y == 0 && dividend->getKind() == NodeKind::INTEGER) {
+                row.push_back(std::make_shared<DivisionNode>(dividend,
+                    std::make_shared<IntegerNode>(0)));
+                symbolic = true;
+            }
+            else {
+                row.push_back(makeNumber(x / y));
+            }
+        }
+        rows.push_back(std::make_shared<ListNode>(row));
+    }
+    if (!symbolic)
+        return nullptr;
+    return dividends.isList() ? rows[0] : std::make_shared<ListNode>(rows);
+}
+
+
+std::shared_ptr<ExpressionNode> MatrixNode::combine(
+        Matrix::Operation operation,
+        const std::shared_ptr<ExpressionNode>& left,
+        const std::shared_ptr<ExpressionNode>& right)
+{
+    const MatrixNode* mLeft = dynamic_cast<const MatrixNode*>(left.get());
+    const MatrixNode* mRight = dynamic_cast<const MatrixNode*>(right.get());
+    FloatVal number;
+
+    if (operation == Matrix::Operation::DIVIDE &&
+            (mLeft != nullptr || mRight != nullptr)) {
+        std::shared_ptr<ExpressionNode> quotient = divide(left, right);
+        if (quotient)
+            return quotient;
+    }
+
+    if (mLeft != nullptr && mRight != nullptr) {
+        return std::make_shared<MatrixNode>(
+            mLeft->matrix->combine(operation, *mRight->matrix));
+    }
+    if (mLeft != nullptr && getNumber(right.get(), number)) {
+        return std::make_shared<MatrixNode>(
+            mLeft->matrix->combine(operation, number, false));
+    }
+    if (mRight != nullptr && getNumber(left.get(), number)) {
+        return std::make_shared<MatrixNode>(
+            mRight->matrix->combine(operation, number, true));
+    }
+    return nullptr;
+}
+
+
+std::shared_ptr<ExpressionNode> MatrixNode::select(
+        const std::shared_ptr<ExpressionNode>& mask,
+        const std::shared_ptr<ExpressionNode>& ifTrue,
+        const std::shared_ptr<ExpressionNode>& ifFalse)
+{
+    const MatrixNode* m = dynamic_cast<const MatrixNode*>(mask.get());
+    if (m == nullptr)
+        return nullptr;
+
+    Matrix result = m->matrix->createLike();
+    Matrix other = m->matrix->createLike();
+    if (!expand(ifTrue.get(), result) || !expand(ifFalse.get(), other))
+        return nullptr;
+
+    const FloatVal* condition = m->matrix->getData();
+    FloatVal* r = result.getData();
+    const FloatVal* o = other.getData();
+    for (size_t i = 0; i < result.getSize(); i++) {
+        if (condition[i] == 0)
+            r[i] = o[i];
+    }
+    return std::make_shared<MatrixNode>(std::move(result));
+}
+
+
+std::string MatrixNode::getString(void) const
+{
+    return matrix->getString();
+}
+
+
+void MatrixNode::write(OutputBuffer& out) const
+{
+    matrix->write(out);
+}
+
+
+std::shared_ptr<ExpressionNode> MatrixNode::evaluate(Environment*)
+{
+    return shared_from_this();
+}
+
+
+bool MatrixNode::equals(const ExpressionNode* other) const
+{
+    if (ExpressionNode::equals(other))
+        return true;
+
+    const MatrixNode* type = dynamic_cast<const MatrixNode*>(other);
+    return type != nullptr &&
+        (type->matrix == matrix || type->matrix->equals(*matrix));
+}
+
+
+NodeKind MatrixNode::getKind(void) const
+{
+    return NodeKind::MATRIX;
+}
+
+
+ListNode::ListNode(
+        const std::vector<std::shared_ptr<ExpressionNode> >& elements) :
+    elements(elements)
+{
+}
+
+
+std::string ListNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void ListNode::write(OutputBuffer& out) const
+{
+    out.append('[');
+    for (size_t i = 0; i < elements.size(); i++) {
+        if (i > 0)
+            out.append(", ", 2);
+        elements[i]->write(out);
+    }
+    out.append(']');
+}
+
+
+std::shared_ptr<ExpressionNode> ListNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::vector<std::shared_ptr<ExpressionNode> > evaluated;
+    evaluated.reserve(elements.size());
+    bool unchanged = true;
+    for (size_t i = 0; i < elements.size(); i++) {
+        evaluated.push_back(elements[i]->evaluate(e));
+        unchanged = unchanged && evaluated.back() == elements[i];
+    }
+
+    std::shared_ptr<ExpressionNode> matrix = createMatrix(evaluated);
+    if (matrix)
+        return matrix;
+    if (unchanged)
+        return markEvaluated(shared_from_this(), e);
+    return markEvaluated(std::make_shared<ListNode>(evaluated), e);
+}
+
+
+std::shared_ptr<ExpressionNode> ListNode::substitute(
+        const std::vector<SubstituteRule*>& rules)
+{
+    std::vector<std::shared_ptr<ExpressionNode> > substituted;
+    substituted.reserve(elements.size());
+    for (size_t i = 0; i < elements.size(); i++)
+        substituted.push_back(elements[i]->substitute(rules));
+    return std::make_shared<ListNode>(substituted);
+}
+
+
+bool ListNode::equals(const ExpressionNode* other) const
+{
+    if (ExpressionNode::equals(other))
+        return true;
+
+    const ListNode* type = dynamic_cast<const ListNode*>(other);
+    if (type == nullptr || type->elements.size() != elements.size())
+        return false;
+    for (size_t i = 0; i < elements.size(); i++) {
+        if (!elements[i]->equals(type->elements[i].get()))
+            return false;
+    }
+    return true;
+}
+
+
+NodeKind ListNode::getKind(void) const
+{
+    return NodeKind::LIST;
+}
+
+
+size_t ListNode::getChildCount(void) const
+{
+    return elements.size();
+}
+
+
+const std::shared_ptr<ExpressionNode>& ListNode::getChild(size_t i) const
+{
+    return elements[i];
+}
+
+
+std::shared_ptr<ExpressionNode> ListNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >& children)
+{
+    return std::make_shared<ListNode>(children);
+}
@@ -0,0 +1,284 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef MATRIX_H_
+#define MATRIX_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+
+#include "Node.h"
+
+
+/*!
+ * \brief allocator returning memory aligned to a multiple of
+ *        <code>Alignment</code> bytes
+ *
+ * Aligning rows to cache lines keeps the vectorized kernels from splitting
+ * loads across two lines.
+ */
+template<typename T, size_t Alignment>
+class AlignedAllocator
+{
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind
+    {
+        typedef AlignedAllocator<U, Alignment> other;
+    };
+
+    AlignedAllocator(void) = default;
+    template<typename U>
+    inline AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n)
+    {
+        // the pointer returned by operator new is stored right in front of
+        // the aligned block
+        size_t bytes = n * sizeof(T) + Alignment + sizeof(void*);
+        char* raw = static_cast<char*>(::operator new(bytes));
+        uintptr_t address = reinterpret_cast<uintptr_t>(raw + sizeof(void*));
+        address = (address + Alignment - 1) & ~uintptr_t(Alignment - 1);
+        reinterpret_cast<void**>(address)[-1] = raw;
+        return reinterpret_cast<T*>(address);
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+
+    template<typename U>
+    inline bool operator == (const AlignedAllocator<U, Alignment>&) const
+    { return true; }
+    template<typename U>
+    inline bool operator != (const AlignedAllocator<U, Alignment>&) const
+    { return false; }
+};
+
+
+/*!
+ * \brief dense matrix of floating point numbers in row major order
+ *
+ * A list is stored as a matrix with a single row, but keeps a flag so it
+ * prints and multiplies like a vector.
+ */
+class Matrix
+{
+public:
+    typedef std::vector<FloatVal, AlignedAllocator<FloatVal, 64> > Storage;
+
+    enum class Operation
+    {
+        ADD,
+        SUBTRACT,
+        MULTIPLY,
+        DIVIDE,
+        POWER,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        EQUAL,
+        NOT_EQUAL,
+        AND,
+        OR,
+        XOR,
+    };
+
+    /*!
+     * \brief the element-wise operation of a comparison
+     */
+    static Operation getOperation(ComparisonNode::Relation relation);
+
+private:
+    size_t rows;
+    size_t columns;
+    bool list;
+    Storage data;
+
+public:
+    //! creates a matrix filled with zeros
+    Matrix(size_t rows, size_t columns);
+
+    //! creates a list of zeros
+    static Matrix createList(size_t length);
+
+    inline size_t getRows(void) const { return rows; }
+    inline size_t getColumns(void) const { return columns; }
+    inline size_t getSize(void) const { return data.size(); }
+    inline bool isList(void) const { return list; }
+
+    inline FloatVal* getData(void) { return data.data(); }
+    inline const FloatVal* getData(void) const { return data.data(); }
+
+    inline FloatVal& at(size_t row, size_t column)
+    { return data[row * columns + column]; }
+    inline FloatVal at(size_t row, size_t column) const
+    { return data[row * columns + column]; }
+
+    /*!
+     * \brief combines two lists or matrices of the same shape element by
+     *        element
+     *
+     * \throws ArithmeticException if the shapes differ
+     */
+    Matrix combine(Operation operation, const Matrix& other) const;
+
+    /*!
+     * \brief combines every element with a number
+     *
+     * \param numberFirst <code>true</code> if the number is the left operand
+     */
+    Matrix combine(Operation operation, FloatVal number,
+                   bool numberFirst) const;
+
+    /*!
+     * \brief matrix product
+     *
+     * A list on the left is treated as row vector, a list on the right as
+     * column vector. The result is a list if one of the operands is a list.
+     * The product of two lists is a list holding their dot product.
+     *
+     * \throws ArithmeticException if the inner dimensions differ
+     */
+    Matrix multiply(const Matrix& other) const;
+
+    /*!
+     * \brief the transposed matrix. A list stays unchanged.
+     */
+    Matrix transpose(void) const;
+
+    FloatVal total(void) const;
+    FloatVal minimum(void) const;
+    FloatVal maximum(void) const;
+
+    //! the totals of every column as list
+    Matrix columnTotals(void) const;
+    //! the totals of every row as list
+    Matrix rowTotals(void) const;
+
+    bool equals(const Matrix& other) const;
+    std::string getString(void) const;
+    void write(OutputBuffer& out) const;
+
+    //! a matrix of zeros with the same shape
+    Matrix createLike(void) const;
+};
+
+
+/*!
+ * \brief a list or matrix of numbers
+ *
+ * Values are immutable, so nodes can share their matrix. The arithmetic
+ * nodes combine lists and matrices element by element and broadcast
+ * numbers over them.
+ */
+class MatrixNode :
+    public ExpressionNode
+{
+    std::shared_ptr<const Matrix> matrix;
+public:
+    MatrixNode(const std::shared_ptr<const Matrix>& matrix);
+    MatrixNode(Matrix&& matrix);
+
+    inline const Matrix& getMatrix(void) const { return *matrix; }
+    inline const std::shared_ptr<const Matrix>& getShared(void) const
+    { return matrix; }
+
+    /*!
+     * \brief applies an element-wise operation to two evaluated operands
+     *
+     * Comparisons and logic operations yield masks of zeros and ones. If an
+     * integer is divided by zero, the quotient is a \link ListNode in which
+     * that division stays symbolic, like it does for scalars.
+     *
+     * \return the result, or <code>nullptr</code> if none of the operands
+     *         is a matrix or the other one is not a number
+     */
+    static std::shared_ptr<ExpressionNode> combine(
+            Matrix::Operation operation,
+            const std::shared_ptr<ExpressionNode>& left,
+            const std::shared_ptr<ExpressionNode>& right);
+
+    /*!
+     * \brief picks every element from one of two evaluated operands,
+     *        depending on whether the element of a mask is not zero
+     *
+     * Operands that are numbers are used for every element.
+     *
+     * \return the result, or <code>nullptr</code> if the mask is not a
+     *         matrix or an operand is neither a matrix nor a number
+     * \throws ArithmeticException if the shapes differ
+     */
+    static std::shared_ptr<ExpressionNode> select(
+            const std::shared_ptr<ExpressionNode>& mask,
+            const std::shared_ptr<ExpressionNode>& ifTrue,
+            const std::shared_ptr<ExpressionNode>& ifFalse);
+
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual bool equals(const ExpressionNode* other) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+/*!
+ * \brief a list literal like <code>[1, x, 3]</code>
+ *
+ * Evaluates to a \link MatrixNode if all elements are numbers, or all are
+ * lists of numbers of the same length, which makes them the rows of a
+ * matrix. Otherwise the list stays symbolic.
+ */
+class ListNode :
+    public ParentNode
+{
+    std::vector<std::shared_ptr<ExpressionNode> > elements;
+public:
+    ListNode(const std::vector<std::shared_ptr<ExpressionNode> >& elements);
+
+    inline const std::vector<std::shared_ptr<ExpressionNode> >&
+    getElements(void) const { return elements; }
+
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<ExpressionNode> substitute(
+            const std::vector<SubstituteRule*>& rules);
+    virtual bool equals(const ExpressionNode* other) const;
+    virtual NodeKind getKind(void) const;
+
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
+};
+
+
+#endif // MATRIX_H_
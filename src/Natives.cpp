@@ -27,15 +27,160 @@
 
 #include "Node.h"
 #include "Environment.h"
+#include "BigInteger.h"
+#include "Polynomial.h"
+#include "EGraph.h"
+#include "CompiledExpression.h"
+#include "Quadrature.h"
+#include "RootFinder.h"
+#include "ThreadPool.h"
+#include "Matrix.h"
+#include "Series.h"
+#include "Tabulation.h"
+#include "LambdaNode.h"
 
 std::map<std::string, std::shared_ptr<ExpressionNode> > Constants::constants;
-bool Constants::initialized = false;
+std::map<std::string, std::string> Constants::digitCache;
+std::mutex Constants::digitMutex;
+std::once_flag Constants::initialized;
 
 
 void Constants::initialize(void)
 {
     add("pi", std::make_shared<RealNode>(3.141592653589793238462643383279));
     add("e", std::make_shared<RealNode>(2.718281828459045235360287471352));
+    add("ln2", std::make_shared<RealNode>(0.693147180559945309417232121458));
+    add("sqrt2", std::make_shared<RealNode>(1.414213562373095048801688724209));
+}
+
+
+/*!
+ * \brief a hypergeometric series sum_k a(k) * prod_{j=1}^{k} p(j) / q(j)
+ */
+struct HypergeometricSeries
+{
+    BigInteger (*p)(long long k);
+    BigInteger (*q)(long long k);
+    BigInteger (*a)(long long k);
+};
+
+
+struct SplitResult
+{
+    BigInteger p;
+    BigInteger q;
+    BigInteger t;
+};
+
+
+/*!
+ * \brief sums the terms [from, to) of a series by binary splitting
+ *
+ * The sum of the terms equals t / q. Splitting the range in halves keeps
+ * the operands of the big multiplications balanced, which is what makes
+ * karatsuba pay off.
+ */
+static SplitResult binarySplit(const HypergeometricSeries& series,
+                               long long from, long long to)
+{
+    SplitResult result;
+    if (to - from == 1) {
+        result.p = from == 0 ? BigInteger(1) : series.p(from);
+        result.q = from == 0 ? BigInteger(1) : series.q(from);
+        result.t = series.a(from) * result.p;
+        return result;
+    }
+
+    long long middle = from + (to - from) / 2;
+    SplitResult left = binarySplit(series, from, middle);
+    SplitResult right = binarySplit(series, middle, to);
+    result.p = left.p * right.p;
+    result.q = left.q * right.q;
+    result.t = left.t * right.q + left.p * right.t;
+    return result;
+}
+
+
+static BigInteger one(long long)
+{
+    return BigInteger(1);
+}
+
+
+static BigInteger chudnovskyP(long long k)
+{
+    return BigInteger(-(6 * k - 5)) * BigInteger(2 * k - 1) *
+        BigInteger(6 * k - 1);
+}
+
+
+static BigInteger chudnovskyQ(long long k)
+{
+    // 640320^3 / 24
+    return BigInteger(k) * BigInteger(k) * BigInteger(k) *
+        BigInteger(10939058860032000LL);
+}
+
+
+static BigInteger chudnovskyA(long long k)
+{
+    return BigInteger(13591409LL + 545140134LL * k);
+}
+
+
+static BigInteger identity(long long k)
+{
+    return BigInteger(k);
+}
+
+
+static BigInteger ln2P(long long k)
+{
+    return BigInteger(-k);
+}
+
+
+static BigInteger ln2Q(long long k)
+{
+    return BigInteger(8 * k + 4);
+}
+
+
+/*!
+ * \brief computes floor(constant * 10^digits)
+ */
+static BigInteger computeScaledConstant(const std::string& name,
+                                        size_t digits)
+{
+    if (name == "pi") {
+        // chudnovsky: each term adds about 14.18 digits
+        HypergeometricSeries series = { &chudnovskyP, &chudnovskyQ,
+                                        &chudnovskyA };
+        SplitResult sum = binarySplit(series, 0, digits / 14 + 2);
+        BigInteger root = (BigInteger(10005) *
+                           BigInteger::pow10(2 * digits)).sqrt();
+        return BigInteger(426880) * root * sum.q / sum.t;
+    }
+    else if (name == "e") {
+        // sum of 1 / k!
+        long long terms = 1;
+        for (double log10Factorial = 0; log10Factorial < digits + 2; terms++)
+            log10Factorial += ::log10(double(terms));
+        HypergeometricSeries series = { &one, &identity, &one };
+        SplitResult sum = binarySplit(series, 0, terms + 1);
+        return sum.t * BigInteger::pow10(digits) / sum.q;
+    }
+    else if (name == "ln2") {
+        // ln 2 = 3/4 * sum (-1)^k (k!)^2 / (2^k (2k + 1)!)
+        HypergeometricSeries series = { &ln2P, &ln2Q, &one };
+        SplitResult sum = binarySplit(series, 0, digits * 10 / 9 + 2);
+        return BigInteger(3) * sum.t * BigInteger::pow10(digits) /
+            (BigInteger(4) * sum.q);
+    }
+    else if (name == "sqrt2") {
+        return (BigInteger(2) * BigInteger::pow10(2 * digits)).sqrt();
+    }
+    return BigInteger();
 }
 
 
@@ -50,6 +195,45 @@ void Constants::add(const std::string& name,
 }
 
 
+std::string Constants::getDigits(const std::string& name, size_t digits)
+{
+    // batch mode evaluates lines concurrently, so the cache is only touched
+    // under the lock while the series are summed outside of it
+    std::string decimal;
+    {
+        std::lock_guard<std::mutex> lock(digitMutex);
+        std::map<std::string, std::string>::const_iterator cached =
+            digitCache.find(name);
+        if (cached != digitCache.end() &&
+                cached->second.size() - cached->second.find('.') - 1 >= digits)
+            decimal = cached->second;
+    }
+
+    if (decimal.empty()) {
+        // a few guard digits absorb the truncation errors of the series
+        const size_t guard = 10;
+        BigInteger scaled = computeScaledConstant(name, digits + guard);
+        if (scaled.isZero())
+            return "";
+
+        decimal = scaled.getString();
+        if (decimal.size() <= digits + guard)
+            decimal.insert(0, digits + guard + 1 - decimal.size(), '0');
+        decimal.insert(decimal.size() - digits - guard, ".");
+
+        std::lock_guard<std::mutex> lock(digitMutex);
+        std::string& cached = digitCache[name];
+        if (cached.size() < decimal.size())
+            cached = decimal;
+    }
+
+    size_t point = decimal.find('.');
+    if (digits == 0)
+        return decimal.substr(0, point);
+    return decimal.substr(0, point + 1 + digits);
+}
+
+
 NativeFunction::NativeFunction(const std::string& name, size_t argumentCount) :
     name(name)
 {
@@ -57,6 +241,12 @@ NativeFunction::NativeFunction(const std::string& name, size_t argumentCount) :
 }
 
 
+std::string NativeFunction::getString(void) const
+{
+    return name;
+}
+
+
 std::shared_ptr<ExpressionNode> If::evaluate(
         Environment* e,
         const std::vector<std::shared_ptr<ExpressionNode> >& args)
@@ -75,10 +265,647 @@ std::shared_ptr<ExpressionNode> If::evaluate(
             return args[2].get()->evaluate(e);
         }
     }
+
+    // a mask of a list comparison picks element by element
+    if (eval->getKind() == NodeKind::MATRIX) {
+        std::shared_ptr<ExpressionNode> picked = MatrixNode::select(eval,
+            args[1]->evaluate(e), args[2]->evaluate(e));
+        if (picked)
+            return picked;
+    }
     return std::make_shared<FunctionCallNode>(shared_from_this(), args);
 }
 
 
+std::shared_ptr<ExpressionNode> Digits::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 2) {
+        throw RuntimeException("Need to specify 2 arguments for digits");
+    }
+    VariableNode* constant = dynamic_cast<VariableNode*>(args[0].get());
+    std::shared_ptr<ExpressionNode> eval = args[1]->evaluate(e);
+    IntegerNode* count = dynamic_cast<IntegerNode*>(eval.get());
+
+    if (constant == nullptr || count == nullptr || count->getValue() < 0) {
+        throw RuntimeException("digits expects a constant and a "
+                               "non-negative number of digits");
+    }
+
+    std::string decimal = Constants::getDigits(constant->getString(),
+                                               count->getValue());
+    if (decimal.empty()) {
+        throw RuntimeException("unknown constant " + constant->getString());
+    }
+    return std::make_shared<DecimalNode>(decimal);
+}
+
+
+std::shared_ptr<ExpressionNode> Expand::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1) {
+        throw RuntimeException("Need to specify 1 argument for expand");
+    }
+    std::shared_ptr<ExpressionNode> eval = args[0]->evaluate(e);
+    std::shared_ptr<PolynomialRing> ring = PolynomialRing::create(eval);
+    return Polynomial::fromExpression(eval, ring).toExpression();
+}
+
+
+std::shared_ptr<ExpressionNode> Collect::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 2) {
+        throw RuntimeException("Need to specify 2 arguments for collect");
+    }
+    std::shared_ptr<ExpressionNode> eval = args[0]->evaluate(e);
+    std::shared_ptr<ExpressionNode> variable = args[1]->evaluate(e);
+    std::shared_ptr<PolynomialRing> ring = PolynomialRing::create(eval);
+    Polynomial polynomial = Polynomial::fromExpression(eval, ring);
+
+    size_t atom = ring->findAtom(variable.get());
+    if (atom == PolynomialRing::npos)
+        return polynomial.toExpression();
+
+    std::vector<Polynomial> coefficients = polynomial.collect(atom);
+    std::shared_ptr<SumNode> result = std::make_shared<SumNode>();
+    for (size_t i = coefficients.size(); i > 0; i--) {
+        size_t exponent = i - 1;
+        if (coefficients[exponent].getTerms().empty())
+            continue;
+
+        std::shared_ptr<ExpressionNode> term =
+            coefficients[exponent].toExpression();
+        if (exponent > 0) {
+            std::shared_ptr<ExpressionNode> power = variable;
+            if (exponent > 1)
+                power = std::make_shared<PowerNode>(variable,
+                    std::make_shared<IntegerNode>((long long int) exponent));
+
+            IntegerNode* one = dynamic_cast<IntegerNode*>(term.get());
+            if (one != nullptr && one->getValue() == 1)
+                term = power;
+            else
+                term = std::make_shared<MultiplicationNode>(term, power);
+        }
+        result->addSummand(term, false);
+    }
+
+    if (result->getSummands().empty())
+        return std::make_shared<IntegerNode>(0);
+    if (result->getSummands().size() == 1)
+        return result->getSummands()[0].value;
+    return result;
+}
+
+
+std::shared_ptr<ExpressionNode> Simplify::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1 && args.size() != 3) {
+        throw RuntimeException("Need to specify 1 or 3 arguments for "
+                               "simplify");
+    }
+    std::shared_ptr<ExpressionNode> eval = args[0]->evaluate(e);
+
+    EGraph::Limits limits;
+    if (args.size() == 3) {
+        std::shared_ptr<ExpressionNode> nodes = args[1]->evaluate(e);
+        std::shared_ptr<ExpressionNode> time = args[2]->evaluate(e);
+        IntegerNode* maxNodes = dynamic_cast<IntegerNode*>(nodes.get());
+        IntegerNode* maxTime = dynamic_cast<IntegerNode*>(time.get());
+        if (maxNodes == nullptr || maxTime == nullptr ||
+                maxNodes->getValue() <= 0 || maxTime->getValue() <= 0) {
+            throw RuntimeException("simplify expects a positive node count "
+                                   "and time in milliseconds");
+        }
+        limits.maxNodes = size_t(maxNodes->getValue());
+        limits.maxMilliseconds = long(maxTime->getValue());
+    }
+
+    limits.profiling = e->getRewriter().isProfiling();
+
+    EGraph graph;
+    EGraph::ClassId root = graph.add(eval);
+    graph.saturate(e->getRewriter().getRules(), limits);
+    return graph.extract(root, EGraph::CostModel::NODE_COUNT);
+}
+
+
+std::shared_ptr<ExpressionNode> Normalize::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1) {
+        throw RuntimeException("Need to specify 1 argument for normalize");
+    }
+    std::shared_ptr<ExpressionNode> eval = args[0]->evaluate(e);
+    return e->getRewriter().normalize(eval);
+}
+
+
+std::shared_ptr<ExpressionNode> RuleStats::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    Rewriter& rewriter = e->getRewriter();
+    if (args.size() == 1) {
+        std::shared_ptr<ExpressionNode> eval = args[0]->evaluate(e);
+        IntegerNode* enable = dynamic_cast<IntegerNode*>(eval.get());
+        if (enable == nullptr) {
+            throw RuntimeException("rulestats expects 0 or 1");
+        }
+        rewriter.setProfiling(enable->getValue() != 0);
+        return eval;
+    }
+    else if (!args.empty()) {
+        throw RuntimeException("Need to specify 0 or 1 arguments for "
+                               "rulestats");
+    }
+
+    rewriter.printStatistics(std::cout);
+    std::cout.flush();
+    return std::make_shared<IntegerNode>(
+        (long long int) rewriter.getRules().size());
+}
+
+
+namespace
+{
+    bool getNumber(const std::shared_ptr<ExpressionNode>& node,
+                   FloatVal& value)
+    {
+        if (IntegerNode* integer = dynamic_cast<IntegerNode*>(node.get())) {
+            value = FloatVal(integer->getValue());
+            return true;
+        }
+        if (RealNode* real = dynamic_cast<RealNode*>(node.get())) {
+            value = real->getValue();
+            return true;
+        }
+        if (node->getKind() == NodeKind::VARIABLE) {
+            const std::shared_ptr<ExpressionNode>& constant =
+                Constants::getConstant(node->getString());
+            return constant != nullptr && getNumber(constant, value);
+        }
+        return false;
+    }
+
+
+    /*!
+     * \brief an error about a definition, with the variable standing for
+     *        the argument replaced by the name of the parameter
+     */
+    RuntimeException renamePlaceholder(const RuntimeException& error,
+                                       const std::string& native,
+                                       const std::string& parameter)
+    {
+        std::string message = error.what();
+        std::string placeholder = "'" + native;
+        size_t position = message.find(placeholder);
+        while (position != std::string::npos) {
+            message.replace(position, placeholder.size(), parameter);
+            position = message.find(placeholder, position + parameter.size());
+        }
+        return RuntimeException(message);
+    }
+
+
+    /*!
+     * \brief the definition of a function of one argument
+     *
+     * The function is called with a free variable, which yields its
+     * definition with all other symbols resolved. The variable is named
+     * after the native and is not a valid identifier, so it cannot clash
+     * with a user variable.
+     *
+     * \param parameter set to the name the function gives its argument,
+     *        errors show it instead of the variable
+     */
+    std::shared_ptr<ExpressionNode> getDefinition(
+            Environment* e,
+            const std::shared_ptr<ExpressionNode>& function,
+            const std::string& native,
+            std::string& parameter)
+    {
+        std::shared_ptr<ExpressionNode> eval = function->evaluate(e);
+        if (dynamic_cast<FunctionNode*>(eval.get()) == nullptr &&
+                eval->getKind() != NodeKind::VARIABLE) {
+            throw RuntimeException(native + " expects a function");
+        }
+
+        const LambdaNode* lambda = dynamic_cast<const LambdaNode*>(eval.get());
+        if (lambda != nullptr && lambda->getParameters().size() == 1)
+            parameter = lambda->getParameters()[0];
+        else
+            parameter = "x";
+
+        try {
+            return std::make_shared<FunctionCallNode>(eval,
+                std::vector<std::shared_ptr<ExpressionNode> > {
+                    std::make_shared<VariableNode>("'" + native) })->evaluate(e);
+        } catch (RuntimeException& ex) {
+            throw renamePlaceholder(ex, native, parameter);
+        }
+    }
+
+
+    /*!
+     * \brief the definition of an expression in a variable, like the
+     *        summand of <code>sum(k^2, k, 1, n)</code>
+     *
+     * The expression is turned into a function of the variable, so a
+     * variable that also exists in the environment is shadowed. A lambda or
+     * the name of a function is used as the function itself, e.g.
+     * <code>tabulate(!(t) -> t^2, x, 0, 1, 10, "f.csv")</code>.
+     */
+    std::shared_ptr<ExpressionNode> getDefinition(
+            Environment* e,
+            const std::shared_ptr<ExpressionNode>& expression,
+            const std::shared_ptr<ExpressionNode>& variable,
+            const std::string& native,
+            std::string& parameter)
+    {
+        std::shared_ptr<VariableNode> argument =
+            std::dynamic_pointer_cast<VariableNode>(variable);
+        if (argument == nullptr)
+            throw RuntimeException(native + " expects a variable name");
+
+        // only names are evaluated up front, other expressions may not
+        // evaluate without the variable
+        if (dynamic_cast<const LambdaNode*>(expression.get()) != nullptr ||
+                (expression->getKind() == NodeKind::VARIABLE &&
+                 dynamic_cast<FunctionNode*>(
+                     expression->evaluate(e).get()) != nullptr))
+            return getDefinition(e, expression, native, parameter);
+
+        return getDefinition(e, std::make_shared<LambdaNode>(
+            std::vector<std::shared_ptr<VariableNode> > { argument },
+            expression), native, parameter);
+    }
+
+
+    //! compiles a definition returned by getDefinition
+    CompiledExpression compileDefinition(
+            const std::shared_ptr<ExpressionNode>& definition,
+            const std::string& native,
+            const std::string& parameter)
+    {
+        try {
+            return CompiledExpression::compile(definition,
+                std::vector<std::string> { "'" + native });
+        } catch (RuntimeException& ex) {
+            throw renamePlaceholder(ex, native, parameter);
+        }
+    }
+
+
+    //! compiles a function of one argument
+    CompiledExpression compileFunction(
+            Environment* e,
+            const std::shared_ptr<ExpressionNode>& function,
+            const std::string& native)
+    {
+        std::string parameter;
+        std::shared_ptr<ExpressionNode> definition =
+            getDefinition(e, function, native, parameter);
+        return compileDefinition(definition, native, parameter);
+    }
+}
+
+
+std::shared_ptr<ExpressionNode> Integrate::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 3 && args.size() != 4) {
+        throw RuntimeException("Need to specify 3 or 4 arguments for "
+                               "integrate");
+    }
+
+    FloatVal a;
+    FloatVal b;
+    FloatVal tolerance = 1e-10;
+    if (!getNumber(args[1]->evaluate(e), a) ||
+            !getNumber(args[2]->evaluate(e), b)) {
+        throw RuntimeException("integrate expects numeric bounds");
+    }
+    if (args.size() == 4 && (!getNumber(args[3]->evaluate(e), tolerance) ||
+                             !(tolerance > 0))) {
+        throw RuntimeException("integrate expects a positive tolerance");
+    }
+
+    CompiledExpression function = compileFunction(e, args[0], "integrate");
+    Quadrature::Result result = Quadrature::integrate(function, a, b,
+        tolerance, ThreadPool::getDefault());
+    if (!result.converged) {
+        throw ArithmeticException("integral does not converge, estimated "
+            "error " + std::to_string(result.error));
+    }
+    return std::make_shared<RealNode>(result.value);
+}
+
+
+std::shared_ptr<ExpressionNode> Solve::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 2 && args.size() != 3) {
+        throw RuntimeException("Need to specify 2 or 3 arguments for solve");
+    }
+
+    FloatVal start;
+    FloatVal tolerance = 1e-12;
+    if (!getNumber(args[1]->evaluate(e), start))
+        throw RuntimeException("solve expects a numeric starting point");
+    if (args.size() == 3 && (!getNumber(args[2]->evaluate(e), tolerance) ||
+                             !(tolerance > 0))) {
+        throw RuntimeException("solve expects a positive tolerance");
+    }
+
+    CompiledExpression function = compileFunction(e, args[0], "solve");
+    RootFinder::Result result = RootFinder::newton(function, start,
+                                                   tolerance);
+    return std::make_shared<RealNode>(result.root);
+}
+
+
+std::shared_ptr<ExpressionNode> FindRoot::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 3 && args.size() != 4) {
+        throw RuntimeException("Need to specify 3 or 4 arguments for "
+                               "findroot");
+    }
+
+    FloatVal a;
+    FloatVal b;
+    FloatVal tolerance = 1e-12;
+    if (!getNumber(args[1]->evaluate(e), a) ||
+            !getNumber(args[2]->evaluate(e), b)) {
+        throw RuntimeException("findroot expects numeric bounds");
+    }
+    if (args.size() == 4 && (!getNumber(args[3]->evaluate(e), tolerance) ||
+                             !(tolerance > 0))) {
+        throw RuntimeException("findroot expects a positive tolerance");
+    }
+
+    CompiledExpression function = compileFunction(e, args[0], "findroot");
+    RootFinder::Result result = RootFinder::brent(function, a, b, tolerance);
+    return std::make_shared<RealNode>(result.root);
+}
+
+
+MemoizedFunction::MemoizedFunction(
+        const std::shared_ptr<FunctionNode>& function) :
+    function(function), version(0)
+{
+}
+
+
+std::string MemoizedFunction::getString(void) const
+{
+    return "memo(" + function->getString() + ")";
+}
+
+
+std::shared_ptr<ExpressionNode> MemoizedFunction::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    std::vector<std::shared_ptr<ExpressionNode> > evaluated;
+    evaluated.reserve(args.size());
+    std::string key;
+    for (size_t i = 0; i < args.size(); i++) {
+        evaluated.push_back(args[i]->evaluate(e));
+        if (i > 0)
+            key += ", ";
+        key += evaluated.back()->getString();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (version != e->getVersion()) {
+            results.clear();
+            version = e->getVersion();
+        }
+        auto found = results.find(key);
+        if (found != results.end())
+            return found->second;
+    }
+
+    // not locked, the function will call itself. Its tail calls are left
+    // to the running trampoline, so a tail recursive function stays in
+    // constant stack space, and the result is recorded once they are done.
+    std::shared_ptr<MemoizedFunction> self =
+        std::dynamic_pointer_cast<MemoizedFunction>(shared_from_this());
+    return FunctionCallNode::callInTailPosition(e, function, evaluated,
+        [self, e, key] (const std::shared_ptr<ExpressionNode>& result) {
+            std::lock_guard<std::mutex> lock(self->mutex);
+            if (self->version == e->getVersion())
+                self->results[key] = result;
+        });
+}
+
+
+std::shared_ptr<ExpressionNode> Memo::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1) {
+        throw RuntimeException("Need to specify 1 argument for memo");
+    }
+    std::shared_ptr<FunctionNode> function =
+        std::dynamic_pointer_cast<FunctionNode>(args[0]->evaluate(e));
+    if (function == nullptr)
+        throw RuntimeException("memo expects a function");
+    return std::make_shared<MemoizedFunction>(function);
+}
+
+
+std::shared_ptr<ExpressionNode> RangeReduction::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    const std::string& name = getName();
+    if (args.size() != 4) {
+        throw RuntimeException("Need to specify 4 arguments for " + name);
+    }
+    std::string parameter;
+    std::shared_ptr<ExpressionNode> body =
+        getDefinition(e, args[0], args[1], name, parameter);
+    std::shared_ptr<ExpressionNode> from = args[2]->evaluate(e);
+    std::shared_ptr<ExpressionNode> to = args[3]->evaluate(e);
+    std::shared_ptr<VariableNode> variable =
+        std::make_shared<VariableNode>("'" + name);
+
+    if (!product) {
+        std::shared_ptr<ExpressionNode> closed =
+            Series::closedSum(body, variable, from, to);
+        if (closed)
+            return closed;
+    }
+
+    FloatVal a;
+    FloatVal b;
+    if (!getNumber(from, a) || !getNumber(to, b))
+        throw RuntimeException(name + " expects numeric bounds");
+    if (a != ::floor(a) || b != ::floor(b))
+        throw RuntimeException(name + " expects integer bounds");
+    FloatVal terms = b - a + 1;
+    if (!(terms < FloatVal(1ULL << 53)))
+        throw RuntimeException(name + " has too many terms");
+
+    CompiledExpression function = compileDefinition(body, name, parameter);
+    Series::Reduction reduction =
+        product ? Series::Reduction::PRODUCT : Series::Reduction::SUM;
+    size_t count = terms > 0 ? size_t(terms) : 0;
+
+    // integer terms are combined exactly, as long as the result fits
+    auto term = [&] (long long k, long long& value) {
+        SubstituteRule rule(variable.get(), std::make_shared<IntegerNode>(k));
+        std::shared_ptr<ExpressionNode> evaluated = body->substitute(
+            std::vector<SubstituteRule*> { &rule })->evaluate(e);
+        if (evaluated->getKind() != NodeKind::INTEGER)
+            return false;
+        value = static_cast<const IntegerNode*>(evaluated.get())->getValue();
+        return true;
+    };
+    long long exact;
+    if (Series::reduceExactly(function, term, reduction, (long long) a,
+                              count, exact))
+        return std::make_shared<IntegerNode>(exact);
+
+    FloatVal result = Series::reduce(function, reduction, a, count,
+                                     ThreadPool::getDefault());
+    return std::make_shared<RealNode>(result);
+}
+
+
+std::shared_ptr<ExpressionNode> Tabulate::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 6) {
+        throw RuntimeException("Need to specify 6 arguments for tabulate");
+    }
+    std::string parameter;
+    std::shared_ptr<ExpressionNode> body =
+        getDefinition(e, args[0], args[1], "tabulate", parameter);
+
+    FloatVal from;
+    FloatVal to;
+    FloatVal count;
+    if (!getNumber(args[2]->evaluate(e), from) ||
+            !getNumber(args[3]->evaluate(e), to)) {
+        throw RuntimeException("tabulate expects numeric bounds");
+    }
+    if (!getNumber(args[4]->evaluate(e), count) || count < 1 ||
+            count != ::floor(count) || !(count < FloatVal(1ULL << 53))) {
+        throw RuntimeException("tabulate expects a positive number of "
+                               "points");
+    }
+    std::shared_ptr<ExpressionNode> file = args[5]->evaluate(e);
+    if (file->getKind() != NodeKind::STRING)
+        throw RuntimeException("tabulate expects a file name");
+    const std::string& fileName =
+        static_cast<const StringNode*>(file.get())->getValue();
+
+    CompiledExpression function =
+        compileDefinition(body, "tabulate", parameter);
+    Tabulation::write(function, from, to, size_t(count), fileName,
+        Tabulation::getFormat(fileName), ThreadPool::getDefault());
+    return std::make_shared<IntegerNode>((long long int) count);
+}
+
+
+/*!
+ * \brief evaluates an argument that has to be a list or matrix
+ */
+static std::shared_ptr<const Matrix> getMatrixArgument(
+        Environment* e, const std::shared_ptr<ExpressionNode>& arg,
+        const std::string& nativeName)
+{
+    std::shared_ptr<ExpressionNode> value = arg->evaluate(e);
+    const MatrixNode* matrix = dynamic_cast<const MatrixNode*>(value.get());
+    if (matrix == nullptr)
+        throw RuntimeException(nativeName + " expects a list or matrix");
+    return matrix->getShared();
+}
+
+
+std::shared_ptr<ExpressionNode> MatMul::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 2) {
+        throw RuntimeException("Need to specify 2 arguments for matmul");
+    }
+    std::shared_ptr<const Matrix> a = getMatrixArgument(e, args[0], "matmul");
+    std::shared_ptr<const Matrix> b = getMatrixArgument(e, args[1], "matmul");
+    Matrix product = a->multiply(*b);
+    if (a->isList() && b->isList())
+        return std::make_shared<RealNode>(product.getData()[0]);
+    return std::make_shared<MatrixNode>(std::move(product));
+}
+
+
+std::shared_ptr<ExpressionNode> Transpose::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1) {
+        throw RuntimeException("Need to specify 1 argument for transpose");
+    }
+    std::shared_ptr<const Matrix> matrix =
+        getMatrixArgument(e, args[0], "transpose");
+    return std::make_shared<MatrixNode>(matrix->transpose());
+}
+
+
+std::shared_ptr<ExpressionNode> Total::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1 && args.size() != 2) {
+        throw RuntimeException("Need to specify 1 or 2 arguments for total");
+    }
+    std::shared_ptr<const Matrix> matrix =
+        getMatrixArgument(e, args[0], "total");
+    if (args.size() == 1)
+        return std::make_shared<RealNode>(matrix->total());
+
+    FloatVal axis;
+    if (!getNumber(args[1]->evaluate(e), axis) || (axis != 1 && axis != 2))
+        throw RuntimeException("total expects 1 or 2 as axis");
+    if (matrix->isList())
+        return std::make_shared<RealNode>(matrix->total());
+    if (axis == 1)
+        return std::make_shared<MatrixNode>(matrix->columnTotals());
+    return std::make_shared<MatrixNode>(matrix->rowTotals());
+}
+
+
+std::shared_ptr<ExpressionNode> Extremum::evaluate(
+        Environment* e,
+        const std::vector<std::shared_ptr<ExpressionNode> >& args)
+{
+    if (args.size() != 1) {
+        throw RuntimeException("Need to specify 1 argument for " + getName());
+    }
+    std::shared_ptr<const Matrix> matrix =
+        getMatrixArgument(e, args[0], getName());
+    return std::make_shared<RealNode>(maximum ? matrix->maximum() :
+                                                matrix->minimum());
+}
+
+
 NativeNumFunction::NativeNumFunction(const std::string& name,
                                      MathFunc function,
                                      NativeNumFunction* derivative) :
@@ -124,7 +951,12 @@ std::shared_ptr<ExpressionNode> NativeNumFunction::evaluate(
         FloatVal arg = real->getValue();
         return std::make_shared<RealNode> (evaluate(arg));
     }
-    return shared_from_this();
+    else if (intN != nullptr) {
+        FloatVal arg = FloatVal(intN->getValue());
+        return std::make_shared<RealNode> (evaluate(arg));
+    }
+    return std::make_shared<FunctionCallNode> (shared_from_this(),
+        std::vector<std::shared_ptr<ExpressionNode> > { eval });
 }
 
 
@@ -209,6 +1041,41 @@ std::shared_ptr<ExpressionNode> DerivativeFunction::getDerivative(
         }
     }
     
+    SumNode* sum = dynamic_cast<SumNode*>(value.get());
+    if (sum != 0) {
+        std::vector<SumNode::Summand> derivatives;
+        for (size_t i = 0; i < sum->getSummands().size(); i++) {
+            const SumNode::Summand& summand = sum->getSummands()[i];
+            SumNode::Summand derivative = {
+                getDerivative(e, summand.value, variable), summand.negative
+            };
+            if (!derivative.value)
+                return nullptr;
+            derivatives.push_back(derivative);
+        }
+        return std::make_shared<SumNode>(derivatives, nullptr)->evaluate(e);
+    }
+
+    ProductNode* product = dynamic_cast<ProductNode*>(value.get());
+    if (product != 0) {
+        // d/dx (c * f_1 * ... * f_n) = c * sum_i f_1 * ... * f_i' * ... * f_n
+        std::vector<SumNode::Summand> summands;
+        for (size_t i = 0; i < product->getFactors().size(); i++) {
+            std::vector<std::shared_ptr<ExpressionNode> > factors =
+                product->getFactors();
+            factors[i] = getDerivative(e, factors[i], variable);
+            if (!factors[i])
+                return nullptr;
+            SumNode::Summand summand = {
+                std::make_shared<ProductNode>(factors,
+                                              product->getCoefficient()),
+                false
+            };
+            summands.push_back(summand);
+        }
+        return std::make_shared<SumNode>(summands, nullptr)->evaluate(e);
+    }
+
     OperationNode* addsub = dynamic_cast<AdditionNode*>(value.get());
     if (addsub == 0)
         addsub = dynamic_cast<SubtractionNode*>(&*value);
@@ -335,10 +1202,7 @@ std::shared_ptr<ExpressionNode> DerivativeFunction::getDerivative(
 const std::shared_ptr<ExpressionNode>&
 Constants::getConstant(const std::string& name)
 {
-    if (!initialized) {
-        initialize();
-        initialized = true;
-    }
+    std::call_once(initialized, &initialize);
     if (constants.find(name) != constants.end())
         return constants[name];
     else {
@@ -350,7 +1214,7 @@ Constants::getConstant(const std::string& name)
 
 std::map<std::pair<std::string, size_t>, NativeFunction*>
     Functions::functions;
-bool Functions::initialized = false;
+std::once_flag Functions::initialized;
 
 
 void Functions::initialize(void)
@@ -397,10 +1261,7 @@ void Functions::add(NativeFunction* value)
 
 NativeFunction* Functions::getNativeFunction(const std::string& name, int nArgs)
 {
-    if (!initialized) {
-        initialize();
-        initialized = true;
-    }
+    std::call_once(initialized, &initialize);
 
     //std::cout << "looking for: " << name << " with " << nArgs << " args" << std::endl;
     //std::cout << "list has " << functions.size() << " entries." << std::endl;
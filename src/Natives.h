@@ -25,6 +25,8 @@
 #include <memory>
 #include <unordered_map>
 #include <map>
+#include <mutex>
+#include <cstdint>
 
 #include "FunctionNode.h"
 //#include "Function.h"
@@ -35,13 +37,32 @@ class Environment;
 class Constants
 {
     static std::map<std::string, std::shared_ptr<ExpressionNode> > constants;
-    static bool initialized;
+
+    //! highest precision decimal expansion computed so far for each constant
+    static std::map<std::string, std::string> digitCache;
+    static std::mutex digitMutex;
+    static std::once_flag initialized;
     static void initialize(void);
 public:
     static void add(const std::string& name,
                     const std::shared_ptr<ExpressionNode>& value);
     static const std::shared_ptr<ExpressionNode>& getConstant(
             const std::string& name);
+
+    /*!
+     * \brief computes the decimal expansion of a constant
+     *
+     * The digits of pi, e, ln2 and sqrt2 are calculated with binary
+     * splitting series on first use. Results are cached, so requesting
+     * the same or a lower precision again costs nothing.
+     *
+     * \param name the name of the constant
+     * \param digits the number of digits after the decimal point
+     *
+     * \return the truncated decimal expansion, or an empty string if there
+     *         is no constant with the given name
+     */
+    static std::string getDigits(const std::string& name, size_t digits);
 };
 
 
@@ -53,6 +74,11 @@ public:
     NativeFunction(const std::string& name, size_t argumentCount);
     
     inline const std::string& getName(void) const { return name; }
+
+    /*!
+     * \return the name the function is bound to
+     */
+    virtual std::string getString(void) const;
     /*virtual std::shared_ptr<ExpressionNode> eval(
         Environment* e,
         const std::vector<std::shared_ptr<ExpressionNode> >& args) const;*/
@@ -71,6 +97,328 @@ public:
 };
 
 
+/*!
+ * \brief <code>digits(pi, 100)</code> evaluates a constant to the given
+ *        number of decimal places
+ */
+class Digits :
+    public NativeFunction
+{
+public:
+    inline Digits(void) : NativeFunction("digits", 2) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>expand(expr)</code> multiplies out all products and powers
+ *        of sums and collects equal terms
+ *
+ * Integer coefficients are computed exactly, they only become floating
+ * point numbers if a real number is involved. The expression may contain
+ * at most 32 different variables or other atoms like <code>sin(x)</code>.
+ */
+class Expand :
+    public NativeFunction
+{
+public:
+    inline Expand(void) : NativeFunction("expand", 1) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>collect(expr, x)</code> expands an expression and groups it
+ *        by powers of x
+ *
+ * Like \link Expand, it supports at most 32 atoms.
+ */
+class Collect :
+    public NativeFunction
+{
+public:
+    inline Collect(void) : NativeFunction("collect", 2) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>simplify(expr)</code> searches for the simplest equivalent
+ *        expression using the rules of the environment
+ *
+ * <code>simplify(expr, nodes, milliseconds)</code> limits the size of the
+ * e-graph and the time spent.
+ */
+class Simplify :
+    public NativeFunction
+{
+public:
+    inline Simplify(void) : NativeFunction("simplify", 1) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>normalize(expr)</code> applies the rules of the environment
+ *        to all subexpressions, bottom-up, until none matches
+ */
+class Normalize :
+    public NativeFunction
+{
+public:
+    inline Normalize(void) : NativeFunction("normalize", 1) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>rulestats()</code> prints how often each rule was tried and
+ *        matched and the time spent on it
+ *
+ * <code>rulestats(1)</code> starts recording, <code>rulestats(0)</code>
+ * stops it. Recording is also started by the
+ * <code>--rule-profile</code> option.
+ */
+class RuleStats :
+    public NativeFunction
+{
+public:
+    inline RuleStats(void) : NativeFunction("rulestats", 0) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>integrate(f, a, b)</code> numerically integrates a function
+ *        of one argument from a to b
+ *
+ * An optional fourth argument sets the tolerance, by default
+ * <code>1e-10</code>.
+ */
+class Integrate :
+    public NativeFunction
+{
+public:
+    inline Integrate(void) : NativeFunction("integrate", 3) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>solve(f, x0)</code> finds a zero of a function near x0
+ *        with newton's method
+ *
+ * An optional third argument sets the tolerance, by default
+ * <code>1e-12</code>.
+ */
+class Solve :
+    public NativeFunction
+{
+public:
+    inline Solve(void) : NativeFunction("solve", 2) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>findroot(f, a, b)</code> finds a zero of a function between
+ *        a and b, where it must change its sign
+ *
+ * An optional fourth argument sets the tolerance, by default
+ * <code>1e-12</code>.
+ */
+class FindRoot :
+    public NativeFunction
+{
+public:
+    inline FindRoot(void) : NativeFunction("findroot", 3) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief a function remembering its results
+ *
+ * Results are looked up by the evaluated arguments. Redefining any symbol
+ * clears the table, since the function may depend on it. The wrapped
+ * function is called in tail position, so a tail recursive function does
+ * not use any stack when memoized either.
+ */
+class MemoizedFunction :
+    public FunctionNode
+{
+    std::shared_ptr<FunctionNode> function;
+    std::unordered_map<std::string, std::shared_ptr<ExpressionNode> > results;
+
+    //! environment version the results were computed in
+    uint64_t version;
+    std::mutex mutex;
+public:
+    MemoizedFunction(const std::shared_ptr<FunctionNode>& function);
+
+    virtual std::string getString(void) const;
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>memo(f)</code> makes a function remember its results
+ *
+ * Only for functions without side effects, e.g.
+ * <code>fib := memo(!(n) -> if(n > 2, fib(n - 1) + fib(n - 2), 1))</code>.
+ */
+class Memo :
+    public NativeFunction
+{
+public:
+    inline Memo(void) : NativeFunction("memo", 1) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>sum(expr, k, from, to)</code> and
+ *        <code>prod(expr, k, from, to)</code> combine the values of an
+ *        expression for <code>k = from, from + 1, ..., to</code>
+ *
+ * Sums of polynomials in k are computed in closed form, which also works
+ * for symbolic bounds. Everything else is compiled and evaluated in a loop
+ * over integer bounds. Integer terms are combined exactly as long as the
+ * result fits into an integer.
+ */
+class RangeReduction :
+    public NativeFunction
+{
+    bool product;
+public:
+    inline RangeReduction(bool product) :
+        NativeFunction(product ? "prod" : "sum", 4), product(product) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>tabulate(f, x, from, to, n, "file")</code> writes the values
+ *        of an expression in x at n evenly spaced points to a file
+ *
+ * Files ending in <code>.csv</code> get one line <code>x,f</code> per
+ * point, all other files pairs of binary doubles. Returns the number of
+ * points.
+ */
+class Tabulate :
+    public NativeFunction
+{
+public:
+    inline Tabulate(void) : NativeFunction("tabulate", 6) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>matmul(a, b)</code> computes the matrix product
+ *
+ * Lists are treated as row vectors on the left and as column vectors on
+ * the right side, so the product of two lists is their dot product.
+ */
+class MatMul :
+    public NativeFunction
+{
+public:
+    inline MatMul(void) : NativeFunction("matmul", 2) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+class Transpose :
+    public NativeFunction
+{
+public:
+    inline Transpose(void) : NativeFunction("transpose", 1) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>total(m)</code> adds up all elements of a list or matrix
+ *
+ * <code>total(m, 1)</code> returns the totals of the columns and
+ * <code>total(m, 2)</code> the totals of the rows of a matrix.
+ */
+class Total :
+    public NativeFunction
+{
+public:
+    inline Total(void) : NativeFunction("total", 1) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
+/*!
+ * \brief <code>min(m)</code> and <code>max(m)</code> find the smallest and
+ *        the largest element of a list or matrix
+ */
+class Extremum :
+    public NativeFunction
+{
+    bool maximum;
+public:
+    inline Extremum(bool maximum) :
+        NativeFunction(maximum ? "max" : "min", 1), maximum(maximum) {}
+
+    virtual std::shared_ptr<ExpressionNode> evaluate(
+            Environment* e,
+            const std::vector<std::shared_ptr<ExpressionNode> >& args);
+};
+
+
 class NativeNumFunction :
     public NativeFunction
 {
@@ -95,6 +443,8 @@ public:
 
     FloatVal evaluate(FloatVal args) const;
 
+    inline MathFunc getFunction(void) const { return function; }
+
     virtual std::shared_ptr<ExpressionNode> evaluate(
             Environment* e,
             const std::vector<std::shared_ptr<ExpressionNode> >& args);
@@ -149,7 +499,7 @@ class Functions
 private:
     static std::map<std::pair<std::string, size_t>, NativeFunction*>
         functions;
-    static bool initialized;
+    static std::once_flag initialized;
     static void initialize(void);
 public:
     static void add(NativeFunction* value);
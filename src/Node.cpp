@@ -26,10 +26,33 @@
 #include <cmath>
 #include <sstream>
 #include <cstdio>
+#include <algorithm>
 
 #include "Environment.h"
 #include "Natives.h"
 #include "Rewriter.h"
+#include "Matrix.h"
+#include "OutputBuffer.h"
+
+
+uint64_t createStamp(void)
+{
+    static std::atomic<uint64_t> last(0);
+    return ++last;
+}
+
+
+ExpressionNode::ExpressionNode(void) :
+    evaluatedIn(0), normalFor(0)
+{
+}
+
+
+ExpressionNode::ExpressionNode(const ExpressionNode&) :
+    std::enable_shared_from_this<ExpressionNode>(),
+    evaluatedIn(0), normalFor(0)
+{
+}
 
 
 ExpressionNode::~ExpressionNode(void)
@@ -37,6 +60,39 @@ ExpressionNode::~ExpressionNode(void)
 }
 
 
+bool ExpressionNode::isEvaluatedIn(const Environment* e) const
+{
+    return evaluatedIn.load(std::memory_order_relaxed) == e->getVersion();
+}
+
+
+std::shared_ptr<ExpressionNode> ExpressionNode::markEvaluated(
+        const std::shared_ptr<ExpressionNode>& node, const Environment* e)
+{
+    if (node)
+        node->evaluatedIn.store(e->getVersion(), std::memory_order_relaxed);
+    return node;
+}
+
+
+bool ExpressionNode::isNormalFor(uint64_t rules) const
+{
+    return normalFor.load(std::memory_order_relaxed) == rules;
+}
+
+
+void ExpressionNode::markNormal(uint64_t rules) const
+{
+    normalFor.store(rules, std::memory_order_relaxed);
+}
+
+
+void ExpressionNode::write(OutputBuffer& out) const
+{
+    out.append(getString());
+}
+
+
 std::shared_ptr<ExpressionNode> ExpressionNode::evaluate(Environment*)
 {
     return shared_from_this();
@@ -65,6 +121,99 @@ bool ExpressionNode::equals(const ExpressionNode* other) const
 }
 
 
+NodeKind ExpressionNode::getKind(void) const
+{
+    return NodeKind::OTHER;
+}
+
+
+size_t ExpressionNode::getChildCount(void) const
+{
+    return 0;
+}
+
+
+const std::shared_ptr<ExpressionNode>& ExpressionNode::getChild(size_t) const
+{
+    throw RuntimeException("node has no children");
+}
+
+
+std::shared_ptr<ExpressionNode> ExpressionNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >&)
+{
+    return shared_from_this();
+}
+
+
+/*!
+ * \return how tightly the operator of a node binds its operands, 0 for the
+ *         loosest
+ */
+static int getBooleanPrecedence(const ExpressionNode* node)
+{
+    switch (node->getKind()) {
+    case NodeKind::OR:
+    case NodeKind::XOR:
+        return 0;
+    case NodeKind::AND:
+        return 1;
+    case NodeKind::NOT:
+        return 2;
+    case NodeKind::COMPARISON:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+
+/*!
+ * \return <code>true</code>, if the node has to be put in parentheses when
+ *         it is an operand of an arithmetic operator
+ */
+static bool isBoolean(const ExpressionNode* node)
+{
+    return getBooleanPrecedence(node) < 4;
+}
+
+
+/*!
+ * \return <code>true</code>, if the node has to be put in parentheses when
+ *         it is an operand of a product
+ */
+static bool isSum(const ExpressionNode* node)
+{
+    return dynamic_cast<const PlusMinus*>(node) != nullptr ||
+        dynamic_cast<const SumNode*>(node) != nullptr || isBoolean(node);
+}
+
+
+/*!
+ * \return <code>true</code>, if the node has to be put in parentheses when
+ *         it is an operand of a power
+ */
+static bool isProduct(const ExpressionNode* node)
+{
+    return dynamic_cast<const MultDivMod*>(node) != nullptr ||
+        dynamic_cast<const ProductNode*>(node) != nullptr;
+}
+
+
+/*!
+ * \brief writes a node, in parentheses if requested
+ */
+static void writeOperand(OutputBuffer& out, const ExpressionNode* node,
+                         bool brackets)
+{
+    if (brackets)
+        out.append('(');
+    node->write(out);
+    if (brackets)
+        out.append(')');
+}
+
+
 const IntegerNode IntegerNode::ZERO(0);
 
 
@@ -88,9 +237,13 @@ long long int IntegerNode::getValue(void) const
 
 std::string IntegerNode::getString(void) const
 {
-    std::stringstream ss;
-    ss << value;
-    return ss.str();
+    return OutputBuffer::toString(*this);
+}
+
+
+void IntegerNode::write(OutputBuffer& out) const
+{
+    out.appendInteger(value);
 }
 
 
@@ -116,6 +269,12 @@ bool IntegerNode::equals(const ExpressionNode* other) const
 }
 
 
+NodeKind IntegerNode::getKind(void) const
+{
+    return NodeKind::INTEGER;
+}
+
+
 RealNode::RealNode(FloatVal value) :
     value(value)
 {
@@ -136,9 +295,13 @@ FloatVal RealNode::getValue(void) const
 
 std::string RealNode::getString(void) const
 {
-    std::stringstream ss;
-    ss << value;
-    return ss.str();
+    return OutputBuffer::toString(*this);
+}
+
+
+void RealNode::write(OutputBuffer& out) const
+{
+    out.appendReal(value);
 }
 
 
@@ -163,6 +326,30 @@ bool RealNode::equals(const ExpressionNode* other) const
 }
 
 
+NodeKind RealNode::getKind(void) const
+{
+    return NodeKind::REAL;
+}
+
+
+DecimalNode::DecimalNode(const std::string& digits) :
+    RealNode(digits), digits(digits)
+{
+}
+
+
+std::string DecimalNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void DecimalNode::write(OutputBuffer& out) const
+{
+    out.append(digits);
+}
+
+
 VariableNode::VariableNode(const std::string& name) :
     name(name)
 {
@@ -172,19 +359,28 @@ VariableNode::VariableNode(const std::string& name) :
 
 std::string VariableNode::getString(void) const
 {
-    return name;
+    return OutputBuffer::toString(*this);
+}
+
+
+void VariableNode::write(OutputBuffer& out) const
+{
+    out.append(name);
 }
 
 
 std::shared_ptr<ExpressionNode> VariableNode::evaluate(Environment* e)
 {
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
     VariableSymbol* vs = 0;
     if ((vs = e->getVariable(name))) {  // double parantheses because
                                         // compiler is a smartass otherwise
         return vs->getValue()->evaluate(e); 
     }
     else
-        return shared_from_this();
+        return markEvaluated(shared_from_this(), e);
 }
 
 
@@ -214,9 +410,51 @@ bool VariableNode::equals(const ExpressionNode* en) const
     else
         return false;
 }
+
+
+NodeKind VariableNode::getKind(void) const
+{
+    return NodeKind::VARIABLE;
+}
+
+
+StringNode::StringNode(const std::string& value) :
+    value(value)
+{
+}
+
+
+std::string StringNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void StringNode::write(OutputBuffer& out) const
+{
+    out.append('"');
+    out.append(value);
+    out.append('"');
+}
+
+
+bool StringNode::equals(const ExpressionNode* other) const
+{
+    const StringNode* type = dynamic_cast<const StringNode*>(other);
+    return type != nullptr && type->value == value;
+}
+
+
+NodeKind StringNode::getKind(void) const
+{
+    return NodeKind::STRING;
+}
+
+
+
 FunctionCallNode::FunctionCallNode(
         const std::shared_ptr<ExpressionNode>& function) :
-            function(function)
+            function(function), tailCall(false)
 {
     printf("yess\n");
 }
@@ -225,7 +463,7 @@ FunctionCallNode::FunctionCallNode(
 FunctionCallNode::FunctionCallNode(
         const std::shared_ptr<ExpressionNode>& function,
         const std::vector<std::shared_ptr<ExpressionNode> >& arguments) :
-    function(function), arguments(arguments)
+    function(function), arguments(arguments), tailCall(false)
 {
 }
 
@@ -244,27 +482,194 @@ void FunctionCallNode::addArgument(const std::shared_ptr<ExpressionNode>& argume
 
 std::string FunctionCallNode::getString(void) const
 {
-    std::string ret;
-    if (dynamic_cast<VariableNode*> (function.get()) != nullptr)
-        ret = function.get()->getString() + "(";
-    else
-        ret = "(" + function.get()->getString() + ")(";
+    return OutputBuffer::toString(*this);
+}
 
-    //printf("chelloo: %d\n", arguments.size());
+
+void FunctionCallNode::write(OutputBuffer& out) const
+{
+    bool named = dynamic_cast<VariableNode*> (function.get()) != nullptr ||
+            dynamic_cast<NativeFunction*> (function.get()) != nullptr;
+    writeOperand(out, function.get(), !named);
+    out.append('(');
     for (size_t i = 0; i < arguments.size(); i++) {
-        ret += arguments[i]->getString();
-        if (i < arguments.size() - 1) {
-            ret += ", ";
+        if (i > 0)
+            out.append(", ", 2);
+        arguments[i]->write(out);
+    }
+    out.append(')');
+}
+
+
+namespace
+{
+    //! number of active \link FunctionCallNode::call in this thread
+    thread_local size_t trampolineDepth = 0;
+
+    //! stack position of the outermost call
+    thread_local uintptr_t stackBase = 0;
+
+    //! deeper recursion is reported instead of overflowing the stack
+#ifdef _WIN32
+    const size_t maxStackUsage = 768 * 1024;
+#else
+    const size_t maxStackUsage = 6 * 1024 * 1024;
+#endif
+
+
+    /*!
+     * \brief a tail call returned by a function body instead of being
+     *        performed
+     */
+    class PendingCallNode :
+        public ExpressionNode
+    {
+        std::shared_ptr<FunctionNode> function;
+        std::vector<std::shared_ptr<ExpressionNode> > arguments;
+
+        //! wait for the result of the whole chain of tail calls
+        std::vector<FunctionCallNode::ResultHandler> handlers;
+    public:
+        PendingCallNode(const std::shared_ptr<FunctionNode>& function,
+                const std::vector<std::shared_ptr<ExpressionNode> >& arguments) :
+            function(function), arguments(arguments)
+        {
+        }
+
+        inline const std::shared_ptr<FunctionNode>& getFunction(void) const
+        { return function; }
+        inline const std::vector<std::shared_ptr<ExpressionNode> >&
+        getArguments(void) const { return arguments; }
+
+        inline void addHandler(const FunctionCallNode::ResultHandler& handler)
+        { handlers.push_back(handler); }
+
+        /*!
+         * \brief hands the waiting handlers on to the call that replaces
+         *        this one, or gives them its result
+         */
+        void forward(const std::shared_ptr<ExpressionNode>& result)
+        {
+            if (handlers.empty())
+                return;
+            PendingCallNode* next =
+                dynamic_cast<PendingCallNode*>(result.get());
+            if (next != nullptr) {
+                // chains can be long, only the few handlers of the new call
+                // are copied
+                handlers.insert(handlers.end(), next->handlers.begin(),
+                                next->handlers.end());
+                next->handlers.swap(handlers);
+            }
+            else {
+                for (size_t i = 0; i < handlers.size(); i++)
+                    handlers[i](result);
+            }
+            handlers.clear();
+        }
+
+        virtual std::string getString(void) const
+        {
+            return FunctionCallNode(function, arguments).getString();
         }
+
+        //! only reached if a native called a function directly
+        virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e)
+        {
+            return FunctionCallNode::call(e, function, arguments);
+        }
+    };
+
+
+    struct TrampolineScope
+    {
+        TrampolineScope(void)
+        {
+            // the stack grows downwards on all supported platforms
+            char marker;
+            uintptr_t position = reinterpret_cast<uintptr_t>(&marker);
+            if (trampolineDepth == 0)
+                stackBase = position;
+            else if (stackBase > position &&
+                     stackBase - position > maxStackUsage)
+                throw RuntimeException("maximum recursion depth exceeded");
+            trampolineDepth++;
+        }
+
+        ~TrampolineScope(void)
+        {
+            trampolineDepth--;
+        }
+    };
+}
+
+
+void FunctionCallNode::markTailCalls(
+        const std::shared_ptr<ExpressionNode>& body)
+{
+    FunctionCallNode* call = dynamic_cast<FunctionCallNode*>(body.get());
+    if (call == nullptr)
+        return;
+
+    call->tailCall = true;
+    VariableNode* callee = dynamic_cast<VariableNode*>(call->function.get());
+    if (callee != nullptr && callee->getName() == "if" &&
+            call->arguments.size() == 3) {
+        markTailCalls(call->arguments[1]);
+        markTailCalls(call->arguments[2]);
     }
-    ret += ")";
-    return ret;
+}
+
+
+std::shared_ptr<ExpressionNode> FunctionCallNode::call(
+        Environment* e,
+        const std::shared_ptr<FunctionNode>& function,
+        const std::vector<std::shared_ptr<ExpressionNode> >& arguments)
+{
+    TrampolineScope scope;
+    std::shared_ptr<ExpressionNode> result = function->evaluate(e, arguments);
+
+    PendingCallNode* pending;
+    while ((pending = dynamic_cast<PendingCallNode*>(result.get()))) {
+        std::shared_ptr<ExpressionNode> keep = result;
+        result = pending->getFunction()->evaluate(e,
+                                                  pending->getArguments());
+        pending->forward(result);
+    }
+    return result;
+}
+
+
+std::shared_ptr<ExpressionNode> FunctionCallNode::callInTailPosition(
+        Environment* e,
+        const std::shared_ptr<FunctionNode>& function,
+        const std::vector<std::shared_ptr<ExpressionNode> >& arguments,
+        const ResultHandler& handler)
+{
+    std::shared_ptr<ExpressionNode> result;
+    if (trampolineDepth == 0) {
+        // nobody would resolve a pending call
+        result = call(e, function, arguments);
+        handler(result);
+        return result;
+    }
+
+    result = function->evaluate(e, arguments);
+    PendingCallNode* pending = dynamic_cast<PendingCallNode*>(result.get());
+    if (pending != nullptr)
+        pending->addHandler(handler);
+    else
+        handler(result);
+    return result;
 }
 
 
 #include <iostream>
 std::shared_ptr<ExpressionNode> FunctionCallNode::evaluate(Environment* e)
 {
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
     //std::cout << "needs: " << function->getName() << "\n";
     /*if (function.get() != nullptr) {
         std::shared_ptr<ExpressionNode> ev = nullptr; // function->eval(e, arguments);
@@ -277,7 +682,10 @@ std::shared_ptr<ExpressionNode> FunctionCallNode::evaluate(Environment* e)
         std::dynamic_pointer_cast<FunctionNode> (func);
 
     if (realFunc.get() != nullptr) {
-        return realFunc.get()->evaluate(e, arguments);
+        // let the enclosing call do the work, so the stack does not grow
+        if (tailCall && trampolineDepth > 0)
+            return std::make_shared<PendingCallNode>(realFunc, arguments);
+        return call(e, realFunc, arguments);
     }
 
     //std::shared_ptr<ExpressionNode> eval = arguments[0]->evaluate(e);
@@ -292,11 +700,14 @@ std::shared_ptr<ExpressionNode> FunctionCallNode::evaluate(Environment* e)
         newArguments.push_back(en);
     }*/
   
+    if (func == function)
+        return markEvaluated(shared_from_this(), e);
+
     std::shared_ptr<FunctionCallNode> fn =
             std::make_shared<FunctionCallNode>(func, arguments);
 
 
-    return fn;
+    return markEvaluated(fn, e);
 }
 
 
@@ -321,8 +732,10 @@ std::shared_ptr<ExpressionNode> FunctionCallNode::substitute(
         newArguments.push_back(arguments[i].get()->substitute(rules));
     }
 
-    std::shared_ptr<ExpressionNode> newFunc = std::make_shared<FunctionCallNode>
-        (function.get()->substitute(rules), newArguments);
+    std::shared_ptr<FunctionCallNode> newFunc =
+        std::make_shared<FunctionCallNode>(function.get()->substitute(rules),
+                                           newArguments);
+    newFunc->tailCall = tailCall;
     return newFunc;
 }
 
@@ -358,7 +771,7 @@ bool FunctionCallNode::equals(const ExpressionNode* en) const
     const FunctionCallNode* type = dynamic_cast<const FunctionCallNode*> (en);
     
     if (type != 0) {
-        bool eq = type->function == this->function;
+        bool eq = type->function->equals(this->function.get());
         if (!eq)
             return false;
         if (arguments.size() != type->arguments.size())
@@ -375,6 +788,34 @@ bool FunctionCallNode::equals(const ExpressionNode* en) const
 }
 
 
+NodeKind FunctionCallNode::getKind(void) const
+{
+    return NodeKind::FUNCTION_CALL;
+}
+
+
+size_t FunctionCallNode::getChildCount(void) const
+{
+    return arguments.size() + 1;
+}
+
+
+const std::shared_ptr<ExpressionNode>& FunctionCallNode::getChild(
+        size_t i) const
+{
+    return i == 0 ? function : arguments[i - 1];
+}
+
+
+std::shared_ptr<ExpressionNode> FunctionCallNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >& children)
+{
+    return std::make_shared<FunctionCallNode>(children[0],
+        std::vector<std::shared_ptr<ExpressionNode> >(children.begin() + 1,
+                                                      children.end()));
+}
+
+
 OperationNode::OperationNode(const std::shared_ptr<ExpressionNode>& a,
                              const std::shared_ptr<ExpressionNode>& b) :
     a(a), b(b)
@@ -389,7 +830,17 @@ OperationNode::~OperationNode(void)
 
 std::string OperationNode::getString(void) const
 {
-    return a->getString() + " " + getOperator() + " " + b->getString();
+    return OutputBuffer::toString(*this);
+}
+
+
+void OperationNode::write(OutputBuffer& out) const
+{
+    a->write(out);
+    out.append(' ');
+    out.append(getOperator());
+    out.append(' ');
+    b->write(out);
 }
 
 
@@ -403,6 +854,28 @@ std::shared_ptr<ExpressionNode> OperationNode::substitute(
 }
 
 
+size_t OperationNode::getChildCount(void) const
+{
+    return 2;
+}
+
+
+const std::shared_ptr<ExpressionNode>& OperationNode::getChild(size_t i) const
+{
+    return i == 0 ? a : b;
+}
+
+
+std::shared_ptr<ExpressionNode> OperationNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >& children)
+{
+    std::shared_ptr<OperationNode> ret = clone();
+    ret->a = children[0];
+    ret->b = children[1];
+    return ret;
+}
+
+
 AssignmentNode::AssignmentNode(const std::shared_ptr<ExpressionNode>& a,
                                const std::shared_ptr<ExpressionNode>& b) :
     OperationNode(a, b)
@@ -418,7 +891,17 @@ std::string AssignmentNode::getOperator(void) const
 
 std::string AssignmentNode::getString(void) const
 {
-    return a->getString() + " " + getOperator() + " " + b->getString();
+    return OutputBuffer::toString(*this);
+}
+
+
+void AssignmentNode::write(OutputBuffer& out) const
+{
+    a->write(out);
+    out.append(' ');
+    out.append(getOperator());
+    out.append(' ');
+    b->write(out);
 }
 
 
@@ -434,12 +917,7 @@ std::shared_ptr<ExpressionNode> AssignmentNode::evaluate(Environment* e)
 
 
     if (var) {
-        const std::string varName = var->getString();
-        VariableSymbol* vs = e->getVariable(varName);
-        if (vs)
-            vs->setValue(newValue);
-        else
-            e->addSymbol(new VariableSymbol(var->getString(), newValue));
+        e->setVariable(var->getString(), newValue);
     }
     else {
         throw ArithmeticException("left side of assignment must be a variable");
@@ -454,6 +932,12 @@ return std::make_shared<AssignmentNode>(a, b);
 }
 
 
+NodeKind AssignmentNode::getKind(void) const
+{
+    return NodeKind::ASSIGNMENT;
+}
+
+
 AdditionNode::AdditionNode(const std::shared_ptr<ExpressionNode>& a,
                            const std::shared_ptr<ExpressionNode>& b) :
     PlusMinus(a, b)
@@ -507,7 +991,9 @@ std::shared_ptr<ExpressionNode> AdditionNode::evaluate(Environment* e)
             return left;
         }*/
         
-        return std::make_shared<AdditionNode>(left, right);
+        SumNode::Summand summands[] = { { left, false }, { right, false } };
+        return markEvaluated(SumNode::create(
+            std::vector<SumNode::Summand>(summands, summands + 2)), e);
     }
 }
 
@@ -518,6 +1004,12 @@ std::shared_ptr<OperationNode> AdditionNode::clone(void) const
 }
 
 
+NodeKind AdditionNode::getKind(void) const
+{
+    return NodeKind::ADDITION;
+}
+
+
 SubtractionNode::SubtractionNode(const std::shared_ptr<ExpressionNode>& a,
                                  const std::shared_ptr<ExpressionNode>& b) :
     PlusMinus(a, b)
@@ -527,19 +1019,22 @@ SubtractionNode::SubtractionNode(const std::shared_ptr<ExpressionNode>& a,
 
 std::string SubtractionNode::getString(void) const
 {
-    bool zero = false;
-    IntegerNode* in;
-    if ((in = dynamic_cast<IntegerNode*>(a.get())) != 0) {
-        if (in->getValue() == 0)
-            zero = true;
-    }
-    if (dynamic_cast<PlusMinus*> (b.get()) != 0) {
-        return (!zero ? (a->getString() + " ") : "") + getOperator() +
-            (zero ? "" : " ") + "(" + b->getString() + ")";
+    return OutputBuffer::toString(*this);
+}
+
+
+void SubtractionNode::write(OutputBuffer& out) const
+{
+    IntegerNode* in = dynamic_cast<IntegerNode*>(a.get());
+    bool zero = in != nullptr && in->getValue() == 0;
+    if (!zero) {
+        a->write(out);
+        out.append(' ');
     }
-    else
-        return (!zero ? (a->getString() + " ") : "") + getOperator() +
-            (zero ? "" : " ") + b->getString();
+    out.append(getOperator());
+    if (!zero)
+        out.append(' ');
+    writeOperand(out, b.get(), isSum(b.get()));
 }
 
 
@@ -586,7 +1081,9 @@ std::shared_ptr<ExpressionNode> SubtractionNode::evaluate(Environment* e)
         if (iRight != 0 && iRight->getValue() == 0) {
             return left;
         }
-        return std::make_shared<SubtractionNode> (left, right);
+        SumNode::Summand summands[] = { { left, false }, { right, true } };
+        return markEvaluated(SumNode::create(
+            std::vector<SumNode::Summand>(summands, summands + 2)), e);
     }
 }
 
@@ -597,25 +1094,25 @@ std::shared_ptr<OperationNode> SubtractionNode::clone(void) const
 }
 
 
+NodeKind SubtractionNode::getKind(void) const
+{
+    return NodeKind::SUBTRACTION;
+}
+
+
 std::string MultDivMod::getString(void) const
 {
-    bool addA = dynamic_cast<PlusMinus*> (&*a);
-    bool addB = dynamic_cast<PlusMinus*> (&*b);
-    
-    std::string left;
-    std::string right;
-    
-    if (addA)
-        left = "(" + a->getString() + ")";
-    else
-        left = a->getString();
-    
-    if (addB)
-        right = "(" + b->getString() + ")";
-    else
-        right = b->getString();
-    
-    return left + " " + getOperator() + " " + right;
+    return OutputBuffer::toString(*this);
+}
+
+
+void MultDivMod::write(OutputBuffer& out) const
+{
+    writeOperand(out, a.get(), isSum(a.get()));
+    out.append(' ');
+    out.append(getOperator());
+    out.append(' ');
+    writeOperand(out, b.get(), isSum(b.get()));
 }
 
 
@@ -679,7 +1176,10 @@ std::shared_ptr<ExpressionNode> MultiplicationNode::evaluate(Environment* e)
         if (iRight != 0 && iRight->getValue() == 0) {
             return std::make_shared<IntegerNode>(0);
         }
-        return std::make_shared<MultiplicationNode>(left, right);
+        std::shared_ptr<ExpressionNode> factors[] = { left, right };
+        return markEvaluated(ProductNode::create(
+            std::vector<std::shared_ptr<ExpressionNode> >(factors,
+                                                          factors + 2)), e);
     }
 }
 
@@ -690,6 +1190,12 @@ std::shared_ptr<OperationNode> MultiplicationNode::clone(void) const
 }
 
 
+NodeKind MultiplicationNode::getKind(void) const
+{
+    return NodeKind::MULTIPLICATION;
+}
+
+
 ModuloNode::ModuloNode(const std::shared_ptr<ExpressionNode>& a,
                        const std::shared_ptr<ExpressionNode>& b) :
     MultDivMod(a, b)
@@ -705,6 +1211,9 @@ std::string ModuloNode::getOperator(void) const
 
 std::shared_ptr<ExpressionNode> ModuloNode::evaluate(Environment* e)
 {
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
     std::shared_ptr<ExpressionNode> left = a->evaluate(e);
     std::shared_ptr<ExpressionNode> right = b->evaluate(e);
     ConstantNode* cLeft = dynamic_cast<ConstantNode*>(&*left);
@@ -722,7 +1231,9 @@ std::shared_ptr<ExpressionNode> ModuloNode::evaluate(Environment* e)
         }
         throw ArithmeticException("modulo operator only defined for integer operands!");
     } else {
-        return std::make_shared<ModuloNode>(left, right);
+        if (left == a && right == b)
+            return markEvaluated(shared_from_this(), e);
+        return markEvaluated(std::make_shared<ModuloNode>(left, right), e);
     }
 }
 
@@ -733,6 +1244,12 @@ std::shared_ptr<OperationNode> ModuloNode::clone(void) const
 }
 
 
+NodeKind ModuloNode::getKind(void) const
+{
+    return NodeKind::MODULO;
+}
+
+
 
 DivisionNode::DivisionNode(const std::shared_ptr<ExpressionNode>& a,
                            const std::shared_ptr<ExpressionNode>& b) :
@@ -749,8 +1266,16 @@ std::string DivisionNode::getOperator(void) const
 
 std::shared_ptr<ExpressionNode> DivisionNode::evaluate(Environment* e)
 {
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
     std::shared_ptr<ExpressionNode> left = a->evaluate(e);
     std::shared_ptr<ExpressionNode> right = b->evaluate(e);
+    std::shared_ptr<ExpressionNode> elementwise =
+        MatrixNode::combine(Matrix::Operation::DIVIDE, left, right);
+    if (elementwise)
+        return elementwise;
+
     ConstantNode* cLeft = dynamic_cast<ConstantNode*>(&*left);
     ConstantNode* cRight = dynamic_cast<ConstantNode*>(&*right);
     
@@ -778,7 +1303,9 @@ std::shared_ptr<ExpressionNode> DivisionNode::evaluate(Environment* e)
         
         return 0;
     } else {
-        return std::make_shared<DivisionNode>(left, right);
+        if (left == a && right == b)
+            return markEvaluated(shared_from_this(), e);
+        return markEvaluated(std::make_shared<DivisionNode>(left, right), e);
     }
 }
 
@@ -789,6 +1316,12 @@ std::shared_ptr<OperationNode> DivisionNode::clone(void) const
 }
 
 
+NodeKind DivisionNode::getKind(void) const
+{
+    return NodeKind::DIVISION;
+}
+
+
 PowerNode::PowerNode(const std::shared_ptr<ExpressionNode>& a,
                      const std::shared_ptr<ExpressionNode>& b) :
     OperationNode(a, b)
@@ -804,33 +1337,32 @@ std::string PowerNode::getOperator(void) const
 
 std::string PowerNode::getString(void) const
 {
-    bool addA = dynamic_cast<PlusMinus*> (&*a);
-    bool addB = dynamic_cast<PlusMinus*> (&*b);
-    
-    addA |= dynamic_cast<MultDivMod*> (&*a) != 0;
-    addB |= dynamic_cast<MultDivMod*> (&*b) != 0;
-    
-    std::string left;
-    std::string right;
-    
-    if (addA)
-        left = "(" + a->getString() + ")";
-    else
-        left = a->getString();
-    
-    if (addB)
-        right = "(" + b->getString() + ")";
-    else
-        right = b->getString();
-    
-    return left + " " + getOperator() + " " + right;
+    return OutputBuffer::toString(*this);
+}
+
+
+void PowerNode::write(OutputBuffer& out) const
+{
+    writeOperand(out, a.get(), isSum(a.get()) || isProduct(a.get()));
+    out.append(' ');
+    out.append(getOperator());
+    out.append(' ');
+    writeOperand(out, b.get(), isSum(b.get()) || isProduct(b.get()));
 }
 
 
 std::shared_ptr<ExpressionNode> PowerNode::evaluate(Environment* e)
 {
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
     std::shared_ptr<ExpressionNode> left = a->evaluate(e);
     std::shared_ptr<ExpressionNode> right = b->evaluate(e);
+    std::shared_ptr<ExpressionNode> elementwise =
+        MatrixNode::combine(Matrix::Operation::POWER, left, right);
+    if (elementwise)
+        return elementwise;
+
     ConstantNode* cLeft = dynamic_cast<ConstantNode*>(&*left);
     ConstantNode* cRight = dynamic_cast<ConstantNode*>(&*right);
     
@@ -868,7 +1400,9 @@ std::shared_ptr<ExpressionNode> PowerNode::evaluate(Environment* e)
         if (iRight != 0 && iRight->getValue() == 1) {
             return left;
         }
-        return std::make_shared<PowerNode>(left, right);
+        if (left == a && right == b)
+            return markEvaluated(shared_from_this(), e);
+        return markEvaluated(std::make_shared<PowerNode>(left, right), e);
     }
 }
 
@@ -879,6 +1413,913 @@ std::shared_ptr<OperationNode> PowerNode::clone(void) const
 }
 
 
+NodeKind PowerNode::getKind(void) const
+{
+    return NodeKind::POWER;
+}
+
+
+std::string BooleanNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void BooleanNode::write(OutputBuffer& out) const
+{
+    int precedence = getBooleanPrecedence(this);
+
+    // comparisons cannot be chained
+    bool bracketA = getBooleanPrecedence(a.get()) < precedence ||
+        (getKind() == NodeKind::COMPARISON &&
+         a->getKind() == NodeKind::COMPARISON);
+    bool bracketB = getBooleanPrecedence(b.get()) <= precedence;
+
+    writeOperand(out, a.get(), bracketA);
+    out.append(' ');
+    out.append(getOperator());
+    out.append(' ');
+    writeOperand(out, b.get(), bracketB);
+}
+
+
+bool BooleanNode::getTruth(const ExpressionNode* value, bool& truth)
+{
+    if (const IntegerNode* integer = dynamic_cast<const IntegerNode*>(value)) {
+        truth = integer->getValue() != 0;
+        return true;
+    }
+    if (const RealNode* real = dynamic_cast<const RealNode*>(value)) {
+        truth = real->getValue() != 0;
+        return true;
+    }
+    return false;
+}
+
+
+std::shared_ptr<ExpressionNode> BooleanNode::fromTruth(bool truth)
+{
+    return std::make_shared<IntegerNode>(truth ? 1 : 0);
+}
+
+
+ComparisonNode::ComparisonNode(Relation relation,
+                               const std::shared_ptr<ExpressionNode>& a,
+                               const std::shared_ptr<ExpressionNode>& b) :
+    BooleanNode(a, b), relation(relation)
+{
+}
+
+
+std::string ComparisonNode::getOperator(void) const
+{
+    switch (relation) {
+    case Relation::LESS:            return "<";
+    case Relation::LESS_EQUAL:      return "<=";
+    case Relation::GREATER:         return ">";
+    case Relation::GREATER_EQUAL:   return ">=";
+    case Relation::EQUAL:           return "==";
+    default:                        return "!=";
+    }
+}
+
+
+std::shared_ptr<ExpressionNode> ComparisonNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::shared_ptr<ExpressionNode> left = a->evaluate(e);
+    std::shared_ptr<ExpressionNode> right = b->evaluate(e);
+    IntegerNode* iLeft = dynamic_cast<IntegerNode*>(left.get());
+    IntegerNode* iRight = dynamic_cast<IntegerNode*>(right.get());
+    RealNode* rLeft = dynamic_cast<RealNode*>(left.get());
+    RealNode* rRight = dynamic_cast<RealNode*>(right.get());
+
+    if (iLeft != nullptr && iRight != nullptr)
+        return fromTruth(holds(relation, iLeft->getValue(),
+                               iRight->getValue()));
+    if ((iLeft != nullptr || rLeft != nullptr) &&
+            (iRight != nullptr || rRight != nullptr)) {
+        FloatVal x = iLeft ? FloatVal(iLeft->getValue()) : rLeft->getValue();
+        FloatVal y = iRight ? FloatVal(iRight->getValue()) :
+            rRight->getValue();
+        return fromTruth(holds(relation, x, y));
+    }
+
+    std::shared_ptr<ExpressionNode> mask = MatrixNode::combine(
+        Matrix::getOperation(relation), left, right);
+    if (mask)
+        return mask;
+
+    // equal expressions are equal whatever their value is
+    if ((relation == Relation::EQUAL || relation == Relation::NOT_EQUAL) &&
+            left->equals(right.get())) {
+        return fromTruth(relation == Relation::EQUAL);
+    }
+
+    if (left == a && right == b)
+        return markEvaluated(shared_from_this(), e);
+    return markEvaluated(std::make_shared<ComparisonNode>(relation, left,
+                                                          right), e);
+}
+
+
+std::shared_ptr<OperationNode> ComparisonNode::clone(void) const
+{
+    return std::make_shared<ComparisonNode>(relation, a, b);
+}
+
+
+NodeKind ComparisonNode::getKind(void) const
+{
+    return NodeKind::COMPARISON;
+}
+
+
+AndNode::AndNode(const std::shared_ptr<ExpressionNode>& a,
+                 const std::shared_ptr<ExpressionNode>& b) :
+    BooleanNode(a, b)
+{
+}
+
+
+std::string AndNode::getOperator(void) const
+{
+    return "and";
+}
+
+
+std::shared_ptr<ExpressionNode> AndNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::shared_ptr<ExpressionNode> left = a->evaluate(e);
+    bool leftTruth;
+    bool leftKnown = getTruth(left.get(), leftTruth);
+    if (leftKnown && !leftTruth)
+        return fromTruth(false);
+
+    std::shared_ptr<ExpressionNode> right = b->evaluate(e);
+    std::shared_ptr<ExpressionNode> mask =
+        MatrixNode::combine(Matrix::Operation::AND, left, right);
+    if (mask)
+        return mask;
+
+    bool rightTruth;
+    bool rightKnown = getTruth(right.get(), rightTruth);
+    if (rightKnown && (leftKnown || !rightTruth))
+        return fromTruth(rightTruth);
+
+    if (left == a && right == b)
+        return markEvaluated(shared_from_this(), e);
+    return markEvaluated(std::make_shared<AndNode>(left, right), e);
+}
+
+
+std::shared_ptr<OperationNode> AndNode::clone(void) const
+{
+    return std::make_shared<AndNode>(a, b);
+}
+
+
+NodeKind AndNode::getKind(void) const
+{
+    return NodeKind::AND;
+}
+
+
+OrNode::OrNode(const std::shared_ptr<ExpressionNode>& a,
+               const std::shared_ptr<ExpressionNode>& b) :
+    BooleanNode(a, b)
+{
+}
+
+
+std::string OrNode::getOperator(void) const
+{
+    return "or";
+}
+
+
+std::shared_ptr<ExpressionNode> OrNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::shared_ptr<ExpressionNode> left = a->evaluate(e);
+    bool leftTruth;
+    bool leftKnown = getTruth(left.get(), leftTruth);
+    if (leftKnown && leftTruth)
+        return fromTruth(true);
+
+    std::shared_ptr<ExpressionNode> right = b->evaluate(e);
+    std::shared_ptr<ExpressionNode> mask =
+        MatrixNode::combine(Matrix::Operation::OR, left, right);
+    if (mask)
+        return mask;
+
+    bool rightTruth;
+    bool rightKnown = getTruth(right.get(), rightTruth);
+    if (rightKnown && (leftKnown || rightTruth))
+        return fromTruth(rightTruth);
+
+    if (left == a && right == b)
+        return markEvaluated(shared_from_this(), e);
+    return markEvaluated(std::make_shared<OrNode>(left, right), e);
+}
+
+
+std::shared_ptr<OperationNode> OrNode::clone(void) const
+{
+    return std::make_shared<OrNode>(a, b);
+}
+
+
+NodeKind OrNode::getKind(void) const
+{
+    return NodeKind::OR;
+}
+
+
+XorNode::XorNode(const std::shared_ptr<ExpressionNode>& a,
+                 const std::shared_ptr<ExpressionNode>& b) :
+    BooleanNode(a, b)
+{
+}
+
+
+std::string XorNode::getOperator(void) const
+{
+    return "xor";
+}
+
+
+std::shared_ptr<ExpressionNode> XorNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::shared_ptr<ExpressionNode> left = a->evaluate(e);
+    std::shared_ptr<ExpressionNode> right = b->evaluate(e);
+    bool leftTruth;
+    bool rightTruth;
+    if (getTruth(left.get(), leftTruth) && getTruth(right.get(), rightTruth))
+        return fromTruth(leftTruth != rightTruth);
+    std::shared_ptr<ExpressionNode> mask =
+        MatrixNode::combine(Matrix::Operation::XOR, left, right);
+    if (mask)
+        return mask;
+
+    if (left == a && right == b)
+        return markEvaluated(shared_from_this(), e);
+    return markEvaluated(std::make_shared<XorNode>(left, right), e);
+}
+
+
+std::shared_ptr<OperationNode> XorNode::clone(void) const
+{
+    return std::make_shared<XorNode>(a, b);
+}
+
+
+NodeKind XorNode::getKind(void) const
+{
+    return NodeKind::XOR;
+}
+
+
+NotNode::NotNode(const std::shared_ptr<ExpressionNode>& operand) :
+    operand(operand)
+{
+}
+
+
+std::string NotNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void NotNode::write(OutputBuffer& out) const
+{
+    out.append("not ", 4);
+    writeOperand(out, operand.get(),
+        getBooleanPrecedence(operand.get()) < getBooleanPrecedence(this));
+}
+
+
+std::shared_ptr<ExpressionNode> NotNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::shared_ptr<ExpressionNode> value = operand->evaluate(e);
+    bool truth;
+    if (BooleanNode::getTruth(value.get(), truth))
+        return BooleanNode::fromTruth(!truth);
+    std::shared_ptr<ExpressionNode> mask = MatrixNode::combine(
+        Matrix::Operation::EQUAL, value, BooleanNode::fromTruth(false));
+    if (mask)
+        return mask;
+
+    if (value == operand)
+        return markEvaluated(shared_from_this(), e);
+    return markEvaluated(std::make_shared<NotNode>(value), e);
+}
+
+
+std::shared_ptr<ExpressionNode> NotNode::substitute(
+        const std::vector<SubstituteRule*>& rules)
+{
+    return std::make_shared<NotNode>(operand->substitute(rules));
+}
+
+
+NodeKind NotNode::getKind(void) const
+{
+    return NodeKind::NOT;
+}
+
+
+size_t NotNode::getChildCount(void) const
+{
+    return 1;
+}
+
+
+const std::shared_ptr<ExpressionNode>& NotNode::getChild(size_t) const
+{
+    return operand;
+}
+
+
+std::shared_ptr<ExpressionNode> NotNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >& children)
+{
+    return std::make_shared<NotNode>(children[0]);
+}
+
+
+/*!
+ * \brief adds a numeric node to a running sum or product
+ *
+ * The result stays an integer until the first real number is encountered.
+ *
+ * \return <code>false</code>, if the node is not a number
+ */
+static bool foldNumber(const ExpressionNode* node, bool multiply,
+                       bool negate, long long int& integer, FloatVal& real,
+                       bool& isReal)
+{
+    const IntegerNode* intN = dynamic_cast<const IntegerNode*>(node);
+    if (intN != nullptr) {
+        long long int value = negate ? -intN->getValue() : intN->getValue();
+        if (multiply)
+            integer *= value;
+        else
+            integer += value;
+        return true;
+    }
+    const RealNode* realN = dynamic_cast<const RealNode*>(node);
+    if (realN != nullptr) {
+        FloatVal value = negate ? -realN->getValue() : realN->getValue();
+        if (multiply)
+            real *= value;
+        else
+            real += value;
+        isReal = true;
+        return true;
+    }
+    return false;
+}
+
+
+/*!
+ * \brief combines a list or matrix element-wise with the ones found before
+ *        in the same sum or product
+ *
+ * \return <code>false</code>, if the node is not a list or matrix
+ */
+static bool foldMatrix(const ExpressionNode* node,
+                       Matrix::Operation operation, bool negate,
+                       std::shared_ptr<const Matrix>& folded)
+{
+    const MatrixNode* matrixN = dynamic_cast<const MatrixNode*>(node);
+    if (matrixN == nullptr)
+        return false;
+
+    if (!folded && !negate)
+        folded = matrixN->getShared();
+    else if (!folded)
+        folded = std::make_shared<const Matrix>(matrixN->getMatrix().combine(
+            Matrix::Operation::SUBTRACT, 0, true));
+    else
+        folded = std::make_shared<const Matrix>(folded->combine(
+            negate ? Matrix::Operation::SUBTRACT : operation,
+            matrixN->getMatrix()));
+    return true;
+}
+
+
+/*!
+ * \brief the sort key of the canonical term order
+ */
+struct CanonicalKey
+{
+    std::string string;
+    size_t index;
+
+    inline bool operator < (const CanonicalKey& other) const
+    {
+        return string < other.string ||
+            (string == other.string && index < other.index);
+    }
+};
+
+
+/*!
+ * \brief sorts terms into canonical order
+ *
+ * The order only depends on the terms themselves, so equal sums end up
+ * with equal term lists.
+ */
+template <typename T, typename KeyFunc>
+static void sortCanonical(std::vector<T>& terms, KeyFunc key)
+{
+    if (terms.size() < 2)
+        return;
+    std::vector<CanonicalKey> keys(terms.size());
+    for (size_t i = 0; i < terms.size(); i++) {
+        keys[i].string = key(terms[i]);
+        keys[i].index = i;
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<T> sorted;
+    sorted.reserve(terms.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        sorted.push_back(terms[keys[i].index]);
+    terms.swap(sorted);
+}
+
+
+SumNode::SumNode(void) :
+    canonical(false)
+{
+}
+
+
+SumNode::SumNode(const std::vector<Summand>& summands,
+                 const std::shared_ptr<ExpressionNode>& constant) :
+    summands(summands), constant(constant), canonical(false)
+{
+}
+
+
+SumNode* SumNode::join(ExpressionNode* left, ExpressionNode* right,
+                       bool subtract)
+{
+    SumNode* sum = dynamic_cast<SumNode*>(left);
+    if (sum == nullptr) {
+        sum = new SumNode();
+        sum->addSummand(std::shared_ptr<ExpressionNode>(left), false);
+    }
+
+    SumNode* rightSum = dynamic_cast<SumNode*>(right);
+    if (rightSum != nullptr) {
+        for (size_t i = 0; i < rightSum->summands.size(); i++) {
+            const Summand& s = rightSum->summands[i];
+            sum->addSummand(s.value, s.negative != subtract);
+        }
+        if (rightSum->constant)
+            sum->addSummand(rightSum->constant, subtract);
+        delete rightSum;
+    }
+    else {
+        sum->addSummand(std::shared_ptr<ExpressionNode>(right), subtract);
+    }
+    return sum;
+}
+
+
+std::shared_ptr<ExpressionNode> SumNode::create(
+        const std::vector<Summand>& evaluated)
+{
+    std::vector<Summand> flat;
+    flat.reserve(evaluated.size());
+    long long int integer = 0;
+    FloatVal real = 0;
+    bool isReal = false;
+    std::shared_ptr<const Matrix> matrix;
+
+    for (size_t i = 0; i < evaluated.size(); i++) {
+        const Summand& s = evaluated[i];
+        if (foldNumber(s.value.get(), false, s.negative, integer, real,
+                       isReal))
+            continue;
+        if (foldMatrix(s.value.get(), Matrix::Operation::ADD, s.negative,
+                       matrix))
+            continue;
+
+        const SumNode* inner = dynamic_cast<const SumNode*>(s.value.get());
+        if (inner != nullptr) {
+            for (size_t j = 0; j < inner->summands.size(); j++) {
+                Summand flipped = inner->summands[j];
+                flipped.negative = flipped.negative != s.negative;
+                if (!foldMatrix(flipped.value.get(), Matrix::Operation::ADD,
+                                flipped.negative, matrix))
+                    flat.push_back(flipped);
+            }
+            if (inner->constant)
+                foldNumber(inner->constant.get(), false, s.negative,
+                           integer, real, isReal);
+        }
+        else {
+            flat.push_back(s);
+        }
+    }
+
+    std::shared_ptr<ExpressionNode> constant;
+    if (isReal && real + integer != 0)
+        constant = std::make_shared<RealNode>(real + integer);
+    else if (!isReal && integer != 0)
+        constant = std::make_shared<IntegerNode>(integer);
+
+    if (matrix) {
+        // numbers are added to every element
+        if (constant) {
+            matrix = std::make_shared<const Matrix>(matrix->combine(
+                Matrix::Operation::ADD, isReal ? real + integer : integer,
+                false));
+            constant = nullptr;
+        }
+        Summand s = { std::make_shared<MatrixNode>(matrix), false };
+        flat.push_back(s);
+    }
+
+    if (flat.empty())
+        return constant ? constant : std::make_shared<IntegerNode>(0);
+    if (flat.size() == 1 && !constant && !flat[0].negative)
+        return flat[0].value;
+
+    sortCanonical(flat, [] (const Summand& s) {
+        return s.value->getString();
+    });
+    std::shared_ptr<SumNode> sum = std::make_shared<SumNode>(flat, constant);
+    sum->canonical = true;
+    return sum;
+}
+
+
+void SumNode::addSummand(const std::shared_ptr<ExpressionNode>& value,
+                         bool negative)
+{
+    Summand s = { value, negative };
+    summands.push_back(s);
+}
+
+
+std::string SumNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void SumNode::write(OutputBuffer& out) const
+{
+    size_t start = out.getSize();
+    for (size_t i = 0; i < summands.size(); i++) {
+        const Summand& s = summands[i];
+        if (i == 0) {
+            if (s.negative)
+                out.append('-');
+        }
+        else
+            out.append(s.negative ? " - " : " + ", 3);
+        writeOperand(out, s.value.get(),
+            (s.negative && isSum(s.value.get())) || isBoolean(s.value.get()));
+    }
+
+    if (constant) {
+        if (out.getSize() == start)
+            constant->write(out);
+        else {
+            size_t sign = out.getSize() + 1;
+            out.append(" + ", 3);
+            constant->write(out);
+            // a negative constant is subtracted instead
+            if (out[sign + 2] == '-') {
+                out[sign] = '-';
+                out.erase(sign + 2, 1);
+            }
+        }
+    }
+    if (out.getSize() == start)
+        out.append('0');
+}
+
+
+std::shared_ptr<ExpressionNode> SumNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::vector<Summand> evaluated;
+    evaluated.reserve(summands.size() + 1);
+    bool unchanged = canonical;
+    for (size_t i = 0; i < summands.size(); i++) {
+        Summand s = { summands[i].value->evaluate(e), summands[i].negative };
+        unchanged = unchanged && s.value == summands[i].value;
+        evaluated.push_back(s);
+    }
+    if (unchanged)
+        return markEvaluated(shared_from_this(), e);
+    if (constant) {
+        Summand s = { constant, false };
+        evaluated.push_back(s);
+    }
+    return markEvaluated(create(evaluated), e);
+}
+
+
+std::shared_ptr<ExpressionNode> SumNode::substitute(
+        const std::vector<SubstituteRule*>& rules)
+{
+    std::vector<Summand> substituted;
+    substituted.reserve(summands.size());
+    for (size_t i = 0; i < summands.size(); i++) {
+        Summand s = { summands[i].value->substitute(rules),
+                      summands[i].negative };
+        substituted.push_back(s);
+    }
+    return std::make_shared<SumNode>(substituted, constant);
+}
+
+
+bool SumNode::equals(const ExpressionNode* other) const
+{
+    if (ExpressionNode::equals(other))
+        return true;
+
+    const SumNode* type = dynamic_cast<const SumNode*> (other);
+    if (type == 0 || type->summands.size() != summands.size())
+        return false;
+    if (!constant != !type->constant ||
+            (constant && !constant->equals(type->constant.get())))
+        return false;
+    for (size_t i = 0; i < summands.size(); i++) {
+        if (summands[i].negative != type->summands[i].negative ||
+                !summands[i].value->equals(type->summands[i].value.get()))
+            return false;
+    }
+    return true;
+}
+
+
+NodeKind SumNode::getKind(void) const
+{
+    return NodeKind::SUM;
+}
+
+
+size_t SumNode::getChildCount(void) const
+{
+    return summands.size() + (constant ? 1 : 0);
+}
+
+
+const std::shared_ptr<ExpressionNode>& SumNode::getChild(size_t i) const
+{
+    return i < summands.size() ? summands[i].value : constant;
+}
+
+
+std::shared_ptr<ExpressionNode> SumNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >& children)
+{
+    std::vector<Summand> replaced;
+    replaced.reserve(children.size());
+    for (size_t i = 0; i < children.size(); i++) {
+        Summand s = { children[i],
+                      i < summands.size() && summands[i].negative };
+        replaced.push_back(s);
+    }
+    return create(replaced);
+}
+
+
+ProductNode::ProductNode(void) :
+    canonical(false)
+{
+}
+
+
+ProductNode::ProductNode(
+        const std::vector<std::shared_ptr<ExpressionNode> >& factors,
+        const std::shared_ptr<ExpressionNode>& coefficient) :
+    factors(factors), coefficient(coefficient), canonical(false)
+{
+}
+
+
+ProductNode* ProductNode::join(ExpressionNode* left, ExpressionNode* right)
+{
+    ProductNode* product = dynamic_cast<ProductNode*>(left);
+    if (product == nullptr) {
+        product = new ProductNode();
+        product->addFactor(std::shared_ptr<ExpressionNode>(left));
+    }
+
+    ProductNode* rightProduct = dynamic_cast<ProductNode*>(right);
+    if (rightProduct != nullptr) {
+        for (size_t i = 0; i < rightProduct->factors.size(); i++)
+            product->addFactor(rightProduct->factors[i]);
+        if (rightProduct->coefficient)
+            product->addFactor(rightProduct->coefficient);
+        delete rightProduct;
+    }
+    else {
+        product->addFactor(std::shared_ptr<ExpressionNode>(right));
+    }
+    return product;
+}
+
+
+std::shared_ptr<ExpressionNode> ProductNode::create(
+        const std::vector<std::shared_ptr<ExpressionNode> >& evaluated)
+{
+    std::vector<std::shared_ptr<ExpressionNode> > flat;
+    flat.reserve(evaluated.size());
+    long long int integer = 1;
+    FloatVal real = 1;
+    bool isReal = false;
+    std::shared_ptr<const Matrix> matrix;
+
+    for (size_t i = 0; i < evaluated.size(); i++) {
+        const ExpressionNode* factor = evaluated[i].get();
+        if (foldNumber(factor, true, false, integer, real, isReal))
+            continue;
+        if (foldMatrix(factor, Matrix::Operation::MULTIPLY, false, matrix))
+            continue;
+
+        const ProductNode* inner = dynamic_cast<const ProductNode*>(factor);
+        if (inner != nullptr) {
+            for (size_t j = 0; j < inner->factors.size(); j++) {
+                if (!foldMatrix(inner->factors[j].get(),
+                                Matrix::Operation::MULTIPLY, false, matrix))
+                    flat.push_back(inner->factors[j]);
+            }
+            if (inner->coefficient)
+                foldNumber(inner->coefficient.get(), true, false,
+                           integer, real, isReal);
+        }
+        else {
+            flat.push_back(evaluated[i]);
+        }
+    }
+
+    std::shared_ptr<ExpressionNode> coefficient;
+    if (isReal)
+        coefficient = std::make_shared<RealNode>(real * integer);
+    else if (integer != 1)
+        coefficient = std::make_shared<IntegerNode>(integer);
+
+    if (matrix) {
+        // lists and matrices are multiplied element by element, numbers
+        // scale every element
+        if (coefficient) {
+            matrix = std::make_shared<const Matrix>(matrix->combine(
+                Matrix::Operation::MULTIPLY,
+                isReal ? real * integer : integer, false));
+            coefficient = nullptr;
+        }
+        flat.push_back(std::make_shared<MatrixNode>(matrix));
+    }
+
+    if (flat.empty())
+        return coefficient ? coefficient : std::make_shared<IntegerNode>(1);
+    if (!matrix &&
+            ((isReal && real * integer == 0) || (!isReal && integer == 0)))
+        return coefficient;
+    if (flat.size() == 1 && !coefficient)
+        return flat[0];
+
+    sortCanonical(flat, [] (const std::shared_ptr<ExpressionNode>& f) {
+        return f->getString();
+    });
+    std::shared_ptr<ProductNode> product =
+        std::make_shared<ProductNode>(flat, coefficient);
+    product->canonical = true;
+    return product;
+}
+
+
+void ProductNode::addFactor(const std::shared_ptr<ExpressionNode>& factor)
+{
+    factors.push_back(factor);
+}
+
+
+std::string ProductNode::getString(void) const
+{
+    return OutputBuffer::toString(*this);
+}
+
+
+void ProductNode::write(OutputBuffer& out) const
+{
+    size_t start = out.getSize();
+    if (coefficient)
+        coefficient->write(out);
+    for (size_t i = 0; i < factors.size(); i++) {
+        const ExpressionNode* factor = factors[i].get();
+        if (out.getSize() != start)
+            out.append(" * ", 3);
+        writeOperand(out, factor, isSum(factor) ||
+                     dynamic_cast<const ModuloNode*>(factor) != 0);
+    }
+    if (out.getSize() == start)
+        out.append('1');
+}
+
+
+std::shared_ptr<ExpressionNode> ProductNode::evaluate(Environment* e)
+{
+    if (isEvaluatedIn(e))
+        return shared_from_this();
+
+    std::vector<std::shared_ptr<ExpressionNode> > evaluated;
+    evaluated.reserve(factors.size() + 1);
+    bool unchanged = canonical;
+    for (size_t i = 0; i < factors.size(); i++) {
+        evaluated.push_back(factors[i]->evaluate(e));
+        unchanged = unchanged && evaluated.back() == factors[i];
+    }
+    if (unchanged)
+        return markEvaluated(shared_from_this(), e);
+    if (coefficient)
+        evaluated.push_back(coefficient);
+    return markEvaluated(create(evaluated), e);
+}
+
+
+std::shared_ptr<ExpressionNode> ProductNode::substitute(
+        const std::vector<SubstituteRule*>& rules)
+{
+    std::vector<std::shared_ptr<ExpressionNode> > substituted;
+    substituted.reserve(factors.size());
+    for (size_t i = 0; i < factors.size(); i++)
+        substituted.push_back(factors[i]->substitute(rules));
+    return std::make_shared<ProductNode>(substituted, coefficient);
+}
+
+
+bool ProductNode::equals(const ExpressionNode* other) const
+{
+    if (ExpressionNode::equals(other))
+        return true;
+
+    const ProductNode* type = dynamic_cast<const ProductNode*> (other);
+    if (type == 0 || type->factors.size() != factors.size())
+        return false;
+    if (!coefficient != !type->coefficient ||
+            (coefficient && !coefficient->equals(type->coefficient.get())))
+        return false;
+    for (size_t i = 0; i < factors.size(); i++) {
+        if (!factors[i]->equals(type->factors[i].get()))
+            return false;
+    }
+    return true;
+}
+
+
+NodeKind ProductNode::getKind(void) const
+{
+    return NodeKind::PRODUCT;
+}
+
+
+size_t ProductNode::getChildCount(void) const
+{
+    return factors.size() + (coefficient ? 1 : 0);
+}
+
+
+const std::shared_ptr<ExpressionNode>& ProductNode::getChild(size_t i) const
+{
+    return i < factors.size() ? factors[i] : coefficient;
+}
+
+
+std::shared_ptr<ExpressionNode> ProductNode::replaceChildren(
+        const std::vector<std::shared_ptr<ExpressionNode> >& children)
+{
+    return create(children);
+}
+
+
 ArithmeticException::ArithmeticException(const std::string& whatStr) :
     whatStr(whatStr)
 {
@@ -26,15 +26,59 @@
 #include <vector>
 #include <memory>
 #include <exception>
+#include <atomic>
+#include <functional>
+#include <cstdint>
 
 
 
 class ExpressionNode;
 class Environment;
 class SubstituteRule;
+class FunctionNode;
+class OutputBuffer;
 
 typedef double FloatVal;
 
+
+/*!
+ * \brief identifies the type of a node without a chain of dynamic_casts
+ */
+enum class NodeKind
+{
+    OTHER,
+    INTEGER,
+    REAL,
+    VARIABLE,
+    FUNCTION_CALL,
+    ASSIGNMENT,
+    ADDITION,
+    SUBTRACTION,
+    MULTIPLICATION,
+    MODULO,
+    DIVISION,
+    POWER,
+    SUM,
+    PRODUCT,
+    COMPARISON,
+    AND,
+    OR,
+    XOR,
+    NOT,
+    LIST,
+    MATRIX,
+    STRING
+};
+
+/*!
+ * \brief creates a number that was never returned before
+ *
+ * Environments and rule sets take a new stamp on every change, nodes record
+ * the stamp they were evaluated or normalized with. Stamps are never 0.
+ */
+uint64_t createStamp(void);
+
+
 /*!
  * \brief base class for any object parsed
  *
@@ -45,7 +89,16 @@ typedef double FloatVal;
 class ExpressionNode :
         public std::enable_shared_from_this<ExpressionNode>
 {
+    //! environment version in which this node evaluates to itself
+    mutable std::atomic<uint64_t> evaluatedIn;
+
+    //! rule set version for which this node is in normal form
+    mutable std::atomic<uint64_t> normalFor;
 public:
+    ExpressionNode(void);
+
+    //! the copy is not marked as evaluated or normalized
+    ExpressionNode(const ExpressionNode& other);
     virtual ~ExpressionNode(void);
     
     /*!
@@ -56,6 +109,15 @@ public:
      */
     virtual std::string getString(void) const = 0;
 
+    /*!
+     * \brief serializes the expression into an output buffer
+     *
+     * Produces the same text as \link getString without building
+     * temporary strings. The default implementation appends the result of
+     * \link getString.
+     */
+    virtual void write(OutputBuffer& out) const;
+
     /*!
      * \brief evaluates the expression as far as possible
      *
@@ -66,6 +128,28 @@ public:
      */
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
 
+    /*!
+     * \return <code>true</code> if this node is known to evaluate to itself
+     *         in the current version of the environment
+     */
+    bool isEvaluatedIn(const Environment* e) const;
+
+    /*!
+     * \brief records that a node evaluates to itself in the current version
+     *        of an environment, so evaluating it again returns immediately
+     *
+     * \return the node
+     */
+    static std::shared_ptr<ExpressionNode> markEvaluated(
+            const std::shared_ptr<ExpressionNode>& node, const Environment* e);
+
+    /*!
+     * \return <code>true</code> if no rule of the given rule set version
+     *         applies to this node or any of its subexpressions
+     */
+    bool isNormalFor(uint64_t rules) const;
+    void markNormal(uint64_t rules) const;
+
     /*!
      * \brief returns a simplified version of this Expression
      */
@@ -100,6 +184,28 @@ public:
      *         the two expressions display the same expression.
      */
     virtual bool equals(const ExpressionNode* other) const;
+
+    /*!
+     * \return the type of this node
+     */
+    virtual NodeKind getKind(void) const;
+
+    /*!
+     * \brief generic access to the operands of a node
+     *
+     * Used by the rewriter, which has to walk trees of any shape.
+     */
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+
+    /*!
+     * \brief creates a node of the same type with other operands
+     *
+     * \param children the new operands, as many as
+     *        \link getChildCount() returns
+     */
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
 };
 
 
@@ -130,9 +236,11 @@ public:
     long long int getValue(void) const;
     
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment*);
     
     virtual bool equals(const ExpressionNode* other) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -147,9 +255,29 @@ public:
     FloatVal getValue(void) const;
     
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment*);
     
     virtual bool equals(const ExpressionNode* other) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+/*!
+ * \brief a real number that carries more digits than a \link FloatVal can
+ *
+ * Arithmetic is done with the rounded value, but the node prints all digits
+ * it was created with.
+ */
+class DecimalNode :
+    public RealNode
+{
+    std::string digits;
+public:
+    DecimalNode(const std::string& digits);
+
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
 };
 
 
@@ -159,18 +287,45 @@ class VariableNode :
     std::string name;
 public:
     VariableNode(const std::string& name);
+
+    inline const std::string& getName(void) const { return name; }
     
     /*!
      * \brief getString
      * \return the name of this variable
      */
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     
     virtual std::shared_ptr<ExpressionNode> substitute(
             const std::vector<SubstituteRule*>& rules);
     
     virtual bool equals(const ExpressionNode*) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+/*!
+ * \brief a string literal like <code>"table.csv"</code>
+ *
+ * Strings only serve as arguments of native functions, e.g. file names.
+ */
+class StringNode :
+    public ExpressionNode
+{
+    std::string value;
+public:
+    StringNode(const std::string& value);
+
+    inline const std::string& getValue(void) const { return value; }
+
+    //! the value in double quotes
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+
+    virtual bool equals(const ExpressionNode* other) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -189,6 +344,9 @@ class FunctionCallNode :
     std::shared_ptr<ExpressionNode> function;
     std::vector<std::shared_ptr<ExpressionNode> > arguments;
 
+    //! the result of the call is the result of the enclosing function
+    bool tailCall;
+
 public:
 
     FunctionCallNode(const std::shared_ptr<ExpressionNode>& function);
@@ -198,7 +356,53 @@ public:
 
     void addArgument(const std::shared_ptr<ExpressionNode>& argument);
 
+    inline bool isTailCall(void) const { return tailCall; }
+
+    /*!
+     * \brief marks the calls whose result is the result of a function body
+     *
+     * These are the body itself and the branches of an <code>if</code>
+     * in tail position. Tail calls do not call the function themselves but
+     * leave that to the caller of the body, so tail recursion runs in
+     * constant stack space.
+     */
+    static void markTailCalls(const std::shared_ptr<ExpressionNode>& body);
+
+    /*!
+     * \brief calls a function and all tail calls it returns
+     *
+     * Natives calling functions must use this instead of
+     * <code>FunctionNode::evaluate</code>.
+     *
+     * \throws RuntimeException if calls are nested too deeply
+     */
+    static std::shared_ptr<ExpressionNode> call(
+            Environment* e,
+            const std::shared_ptr<FunctionNode>& function,
+            const std::vector<std::shared_ptr<ExpressionNode> >& arguments);
+
+    typedef std::function<void (const std::shared_ptr<ExpressionNode>&)>
+        ResultHandler;
+
+    /*!
+     * \brief calls a function from within a function, leaving its tail
+     *        calls to the \link call that is already running
+     *
+     * Unlike \link call, this does not use any stack for tail calls, so a
+     * function wrapping another one, like a memoized function, can be tail
+     * recursive as well. The result may be a pending tail call, which has to
+     * be returned to the caller.
+     *
+     * \param handler is given the result once all tail calls are done
+     */
+    static std::shared_ptr<ExpressionNode> callInTailPosition(
+            Environment* e,
+            const std::shared_ptr<FunctionNode>& function,
+            const std::vector<std::shared_ptr<ExpressionNode> >& arguments,
+            const ResultHandler& handler);
+
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
 
     virtual size_t getArgumentCount(void) const;
@@ -213,6 +417,14 @@ public:
     virtual std::shared_ptr<ExpressionNode> getDerivative(size_t i) const;
 
     virtual bool equals(const ExpressionNode*) const;
+
+    virtual NodeKind getKind(void) const;
+
+    //! the called function is child 0, followed by the arguments
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
 };
 
 
@@ -228,6 +440,7 @@ protected:
                   const std::shared_ptr<ExpressionNode>& b);
     virtual ~OperationNode(void);
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::string getOperator(void) const = 0;
     virtual std::shared_ptr<OperationNode> clone(void) const = 0;
     
@@ -236,6 +449,11 @@ public:
     inline const std::shared_ptr<ExpressionNode>& getRight(void) { return b; }
     virtual std::shared_ptr<ExpressionNode> substitute(
             const std::vector<SubstituteRule*>& rules);
+
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
 };
 
 
@@ -248,8 +466,10 @@ public:
                    const std::shared_ptr<ExpressionNode>& b);
     virtual std::string getOperator(void) const;
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -272,6 +492,7 @@ public:
     virtual std::string getOperator(void) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -283,9 +504,11 @@ public:
                     const std::shared_ptr<ExpressionNode>& b);
     
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
     virtual std::string getOperator(void) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -297,6 +520,7 @@ public:
                       const std::shared_ptr<ExpressionNode>& b) :
         OperationNode(a, b) {}
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
 };
 
 
@@ -310,6 +534,7 @@ public:
     virtual std::string getOperator(void) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -323,6 +548,7 @@ public:
     virtual std::string getOperator(void) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -336,6 +562,7 @@ public:
     virtual std::string getOperator(void) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
 };
 
 
@@ -349,9 +576,283 @@ public:
     virtual std::string getOperator(void) const;
     virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+    virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+/*!
+ * \brief base class of the operators yielding a truth value
+ *
+ * True is represented by the integer 1 and false by 0. Operands count as
+ * true if they are nonzero numbers.
+ */
+class BooleanNode :
+    public OperationNode
+{
+protected:
+    inline BooleanNode(const std::shared_ptr<ExpressionNode>& a,
+                       const std::shared_ptr<ExpressionNode>& b) :
+        OperationNode(a, b) {}
+public:
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+
+    /*!
+     * \brief determines the truth value of an evaluated operand
+     *
+     * \return <code>false</code> if the operand is not a number
+     */
+    static bool getTruth(const ExpressionNode* value, bool& truth);
+
+    static std::shared_ptr<ExpressionNode> fromTruth(bool truth);
+};
+
+
+class ComparisonNode :
+    public BooleanNode
+{
+public:
+    enum class Relation
+    {
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        EQUAL,
+        NOT_EQUAL
+    };
+private:
+    Relation relation;
+public:
+    ComparisonNode(Relation relation,
+                   const std::shared_ptr<ExpressionNode>& a,
+                   const std::shared_ptr<ExpressionNode>& b);
+
+    inline Relation getRelation(void) const { return relation; }
+
+    template<typename T>
+    static inline bool holds(Relation relation, T a, T b)
+    {
+        switch (relation) {
+        case Relation::LESS:            return a < b;
+        case Relation::LESS_EQUAL:      return a <= b;
+        case Relation::GREATER:         return a > b;
+        case Relation::GREATER_EQUAL:   return a >= b;
+        case Relation::EQUAL:           return a == b;
+        default:                        return a != b;
+        }
+    }
+
+    virtual std::string getOperator(void) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
     virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+/*!
+ * \brief logical conjunction, the second operand is only evaluated if the
+ *        first one is not false
+ */
+class AndNode :
+    public BooleanNode
+{
+public:
+    AndNode(const std::shared_ptr<ExpressionNode>& a,
+            const std::shared_ptr<ExpressionNode>& b);
+
+    virtual std::string getOperator(void) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+/*!
+ * \brief logical disjunction, the second operand is only evaluated if the
+ *        first one is not true
+ */
+class OrNode :
+    public BooleanNode
+{
+public:
+    OrNode(const std::shared_ptr<ExpressionNode>& a,
+           const std::shared_ptr<ExpressionNode>& b);
+
+    virtual std::string getOperator(void) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+class XorNode :
+    public BooleanNode
+{
+public:
+    XorNode(const std::shared_ptr<ExpressionNode>& a,
+            const std::shared_ptr<ExpressionNode>& b);
+
+    virtual std::string getOperator(void) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<OperationNode> clone(void) const;
+    virtual NodeKind getKind(void) const;
+};
+
+
+class NotNode :
+    public ParentNode
+{
+    std::shared_ptr<ExpressionNode> operand;
+public:
+    NotNode(const std::shared_ptr<ExpressionNode>& operand);
+
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<ExpressionNode> substitute(
+            const std::vector<SubstituteRule*>& rules);
+    virtual NodeKind getKind(void) const;
+
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
+};
+
+
+/*!
+ * \brief n-ary sum
+ *
+ * The parser flattens chains of additions and subtractions into one node,
+ * so even sums with a huge number of terms stay shallow. Evaluation folds
+ * all numeric summands into a single constant and sorts the remaining ones
+ * into a canonical order.
+ */
+class SumNode :
+    public ParentNode
+{
+public:
+    struct Summand
+    {
+        std::shared_ptr<ExpressionNode> value;
+        bool negative;
+    };
+private:
+    std::vector<Summand> summands;
+
+    //! folded numeric part, <code>nullptr</code> if zero
+    std::shared_ptr<ExpressionNode> constant;
+
+    //! set if built by \link create, which leaves nothing to normalize
+    bool canonical;
+public:
+    SumNode(void);
+    SumNode(const std::vector<Summand>& summands,
+            const std::shared_ptr<ExpressionNode>& constant);
+
+    /*!
+     * \brief creates the sum of two parsed expressions
+     *
+     * Takes ownership of both arguments. If one of them is a
+     * <code>SumNode</code> itself, its summands are spliced in.
+     */
+    static SumNode* join(ExpressionNode* left, ExpressionNode* right,
+                         bool subtract);
+
+    /*!
+     * \brief builds the normalized sum of already evaluated summands
+     *
+     * \return the sum, or a simpler node if the sum degenerates
+     */
+    static std::shared_ptr<ExpressionNode> create(
+            const std::vector<Summand>& evaluated);
+
+    void addSummand(const std::shared_ptr<ExpressionNode>& value,
+                    bool negative);
+
+    inline const std::vector<Summand>& getSummands(void) const
+    { return summands; }
+    inline const std::shared_ptr<ExpressionNode>& getConstant(void) const
+    { return constant; }
+
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<ExpressionNode> substitute(
+            const std::vector<SubstituteRule*>& rules);
+    virtual bool equals(const ExpressionNode* other) const;
+
+    virtual NodeKind getKind(void) const;
+
+    //! the folded number, if any, is the last child
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
 };
 
+
+/*!
+ * \brief n-ary product
+ *
+ * Like \link SumNode, numeric factors are folded into one coefficient and
+ * the other factors are kept in canonical order.
+ */
+class ProductNode :
+    public ParentNode
+{
+    std::vector<std::shared_ptr<ExpressionNode> > factors;
+
+    //! folded numeric coefficient, <code>nullptr</code> if one
+    std::shared_ptr<ExpressionNode> coefficient;
+
+    //! set if built by \link create, which leaves nothing to normalize
+    bool canonical;
+public:
+    ProductNode(void);
+    ProductNode(const std::vector<std::shared_ptr<ExpressionNode> >& factors,
+                const std::shared_ptr<ExpressionNode>& coefficient);
+
+    /*!
+     * \brief creates the product of two parsed expressions
+     *
+     * Takes ownership of both arguments.
+     */
+    static ProductNode* join(ExpressionNode* left, ExpressionNode* right);
+
+    /*!
+     * \brief builds the normalized product of already evaluated factors
+     */
+    static std::shared_ptr<ExpressionNode> create(
+            const std::vector<std::shared_ptr<ExpressionNode> >& evaluated);
+
+    void addFactor(const std::shared_ptr<ExpressionNode>& factor);
+
+    inline const std::vector<std::shared_ptr<ExpressionNode> >&
+    getFactors(void) const { return factors; }
+    inline const std::shared_ptr<ExpressionNode>& getCoefficient(void) const
+    { return coefficient; }
+
+    virtual std::string getString(void) const;
+    virtual void write(OutputBuffer& out) const;
+    virtual std::shared_ptr<ExpressionNode> evaluate(Environment* e);
+    virtual std::shared_ptr<ExpressionNode> substitute(
+            const std::vector<SubstituteRule*>& rules);
+    virtual bool equals(const ExpressionNode* other) const;
+
+    virtual NodeKind getKind(void) const;
+
+    //! the folded number, if any, is the last child
+    virtual size_t getChildCount(void) const;
+    virtual const std::shared_ptr<ExpressionNode>& getChild(size_t i) const;
+    virtual std::shared_ptr<ExpressionNode> replaceChildren(
+            const std::vector<std::shared_ptr<ExpressionNode> >& children);
+};
+
+
 class RuntimeException :
     public std::exception
 {
@@ -0,0 +1,101 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "OutputBuffer.h"
+#include <cstring>
+
+
+OutputBuffer::OutputBuffer(void) :
+    out(nullptr), capacity(0)
+{
+}
+
+
+OutputBuffer::OutputBuffer(::FILE* out, size_t capacity) :
+    out(out), capacity(capacity)
+{
+    // leave room for the line that overflows the capacity
+    buffer.reserve(capacity + capacity / 4);
+}
+
+
+OutputBuffer::~OutputBuffer(void)
+{
+    flush();
+}
+
+
+void OutputBuffer::append(const char* string)
+{
+    buffer.append(string, ::strlen(string));
+}
+
+
+void OutputBuffer::appendInteger(long long value)
+{
+    char digits[24];
+    char* end = digits + sizeof digits;
+    char* begin = end;
+    unsigned long long magnitude = value < 0 ?
+        0ULL - (unsigned long long) value : (unsigned long long) value;
+    do {
+        *--begin = char('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    if (value < 0)
+        *--begin = '-';
+    buffer.append(begin, end - begin);
+}
+
+
+void OutputBuffer::appendReal(FloatVal value)
+{
+    char digits[32];
+    int length = ::snprintf(digits, sizeof digits, "%g", value);
+    buffer.append(digits, length);
+}
+
+
+void OutputBuffer::endLine(void)
+{
+    buffer.push_back('\n');
+    if (out != nullptr && buffer.size() >= capacity)
+        flush();
+}
+
+
+void OutputBuffer::flush(void)
+{
+    if (out == nullptr || buffer.empty())
+        return;
+    ::fwrite(buffer.data(), 1, buffer.size(), out);
+    ::fflush(out);
+    // clear() keeps the capacity, so the buffer is allocated only once
+    buffer.clear();
+}
+
+
+std::string OutputBuffer::toString(const ExpressionNode& expression)
+{
+    OutputBuffer buffer;
+    expression.write(buffer);
+    return std::move(buffer.buffer);
+}
@@ -0,0 +1,103 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef OUTPUTBUFFER_H_
+#define OUTPUTBUFFER_H_
+
+#include <string>
+#include <cstdio>
+
+#include "Node.h"
+
+
+/*!
+ * \brief collects output in one reusable block of memory and writes it
+ *        with few large writes
+ *
+ * Expressions serialize themselves directly into the buffer through
+ * \link ExpressionNode::write, so printing a result does not build any
+ * temporary strings. The buffer is written to the file when a line ends
+ * and more than the capacity has been collected, when \link flush is
+ * called and on destruction. A buffer without a file only collects.
+ *
+ * Content is never written in the middle of a line, so nodes may look
+ * back at and modify what they have written so far.
+ */
+class OutputBuffer
+{
+    ::FILE* out;
+    std::string buffer;
+    size_t capacity;
+public:
+    static const size_t defaultCapacity = 1 << 16;
+
+    /*!
+     * \brief creates a buffer that only collects, see \link getContents
+     */
+    OutputBuffer(void);
+    OutputBuffer(::FILE* out, size_t capacity = defaultCapacity);
+    ~OutputBuffer(void);
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator = (const OutputBuffer&) = delete;
+
+    inline void append(char c) { buffer.push_back(c); }
+    inline void append(const char* data, size_t length)
+    { buffer.append(data, length); }
+    inline void append(const std::string& string) { buffer.append(string); }
+    void append(const char* string);
+
+    void appendInteger(long long value);
+
+    /*!
+     * \brief writes a number the same way <code>std::ostream</code> does
+     *        with its default format
+     */
+    void appendReal(FloatVal value);
+
+    inline void appendExpression(const ExpressionNode& expression)
+    { expression.write(*this); }
+
+    /*!
+     * \brief ends a line, writing the buffer to the file if it is full
+     */
+    void endLine(void);
+
+    /*!
+     * \brief writes everything collected to the file
+     */
+    void flush(void);
+
+    inline size_t getSize(void) const { return buffer.size(); }
+    inline char& operator [] (size_t index) { return buffer[index]; }
+    inline void erase(size_t index, size_t length)
+    { buffer.erase(index, length); }
+
+    inline const std::string& getContents(void) const { return buffer; }
+
+    /*!
+     * \brief serializes an expression into a new string
+     */
+    static std::string toString(const ExpressionNode& expression);
+};
+
+
+#endif // OUTPUTBUFFER_H_
@@ -0,0 +1,132 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "ParseCache.h"
+
+#include <algorithm>
+#include <functional>
+
+using mathy::ParseCache;
+
+
+ParseCache::ParseCache(size_t capacity, size_t maxLength) :
+    capacity(capacity), maxLength(maxLength), seen(capacity, 0)
+{
+    statistics.hits = 0;
+    statistics.misses = 0;
+    statistics.evictions = 0;
+}
+
+
+void ParseCache::normalize(const char* text, size_t length, std::string& key)
+{
+    key.clear();
+    const char* end = text + length;
+    while (text != end) {
+        char c = *text++;
+        if (c == ' ' || c == '\t') {
+            while (text != end && (*text == ' ' || *text == '\t'))
+                c = *text++;
+            key += c;
+        }
+        else if (c == '"') {
+            // the scanner does not look for blanks inside strings
+            key += c;
+            while (text != end && *text != '"' && *text != '\n')
+                key += *text++;
+        }
+        else
+            key += c;
+    }
+}
+
+
+std::shared_ptr<const ParseCache::Statements> ParseCache::find(
+        const std::string& key)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto found = index.find(key);
+    if (found == index.end()) {
+        statistics.misses++;
+        return nullptr;
+    }
+    statistics.hits++;
+    entries.splice(entries.begin(), entries, found->second);
+    return found->second->second;
+}
+
+
+void ParseCache::insert(const std::string& key,
+                        const std::shared_ptr<const Statements>& statements)
+{
+    if (capacity == 0 || key.size() > maxLength)
+        return;
+
+    size_t hash = std::hash<std::string>()(key);
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t& slot = seen[hash % seen.size()];
+    if (slot != hash) {
+        slot = hash;
+        return;
+    }
+
+    auto found = index.find(key);
+    if (found != index.end()) {
+        // another thread parsed the same line in the meantime
+        entries.splice(entries.begin(), entries, found->second);
+        return;
+    }
+
+    if (index.size() >= capacity) {
+        index.erase(entries.back().first);
+        entries.pop_back();
+        statistics.evictions++;
+    }
+    entries.push_front(Entry(key, statements));
+    index[key] = entries.begin();
+}
+
+
+size_t ParseCache::getSize(void) const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+
+double ParseCache::getHitRate(void) const
+{
+    uint64_t hits = statistics.hits;
+    uint64_t lookups = hits + statistics.misses;
+    return lookups == 0 ? 0.0 : double(hits) / double(lookups);
+}
+
+
+void ParseCache::clear(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    index.clear();
+    entries.clear();
+    std::fill(seen.begin(), seen.end(), 0);
+    statistics.hits = 0;
+    statistics.misses = 0;
+    statistics.evictions = 0;
+}
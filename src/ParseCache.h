@@ -0,0 +1,140 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef PARSECACHE_H_
+#define PARSECACHE_H_
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+
+class ExpressionNode;
+
+namespace mathy
+{
+    class ParseCache;
+}
+
+
+/*!
+ * \brief least recently used map from input lines to their parsed
+ *        statements
+ *
+ * Lines are looked up in normalized form, so lines that only differ in
+ * the amount of blanks share one entry. The cached trees are shared by
+ * everyone who looks them up and are never modified, evaluation only
+ * records its stamps in them. All methods may be called from any number
+ * of threads at once.
+ */
+class mathy::ParseCache
+{
+public:
+    //! the statements of one line, <code>nullptr</code> for empty ones
+    typedef std::vector<std::shared_ptr<ExpressionNode> > Statements;
+
+    struct Statistics
+    {
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+        std::atomic<uint64_t> evictions;
+    };
+
+private:
+    typedef std::pair<std::string, std::shared_ptr<const Statements> > Entry;
+
+    //! most recently used entries first
+    std::list<Entry> entries;
+    std::unordered_map<std::string, std::list<Entry>::iterator> index;
+    mutable std::mutex mutex;
+
+    size_t capacity;
+    size_t maxLength;
+
+    /*!
+     * \brief hashes of lines seen once, indexed by the hash itself
+     *
+     * A line is only cached when it is seen a second time. Lines that never
+     * repeat would otherwise push out the ones that do, and keeping their
+     * trees alive costs more than parsing them.
+     */
+    std::vector<size_t> seen;
+
+    mutable Statistics statistics;
+public:
+    /*!
+     * \param capacity the number of lines kept
+     * \param maxLength longer lines are not cached, they are unlikely to
+     *        repeat and would only push out the short ones
+     */
+    explicit ParseCache(size_t capacity = 4096, size_t maxLength = 1024);
+    ParseCache(const ParseCache&) = delete;
+    ParseCache& operator = (const ParseCache&) = delete;
+
+    /*!
+     * \brief writes the normalized form of a line to <code>key</code>
+     *
+     * Every run of blanks is replaced by its last character, which keeps
+     * the <code>" _"</code> line continuation intact. String literals are
+     * copied unchanged.
+     */
+    static void normalize(const char* text, size_t length, std::string& key);
+
+    /*!
+     * \return the statements of a normalized line, or <code>nullptr</code>
+     *         if the line is not cached
+     */
+    std::shared_ptr<const Statements> find(const std::string& key);
+
+    /*!
+     * \brief adds the statements of a normalized line, evicting the least
+     *        recently used line if the cache is full
+     *
+     * The first time a line is offered, it is only remembered as seen.
+     */
+    void insert(const std::string& key,
+                const std::shared_ptr<const Statements>& statements);
+
+    size_t getSize(void) const;
+    inline size_t getCapacity(void) const { return capacity; }
+    inline size_t getMaxLength(void) const { return maxLength; }
+
+    inline const Statistics& getStatistics(void) const { return statistics; }
+
+    /*!
+     * \return the share of lookups that were found, between 0 and 1
+     */
+    double getHitRate(void) const;
+
+    /*!
+     * \brief removes all lines and resets the statistics
+     */
+    void clear(void);
+};
+
+
+#endif // PARSECACHE_H_
@@ -0,0 +1,115 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "ParserComparison.h"
+#include "Node.h"
+
+
+using mathy::ParserComparison;
+using mathy::ParseResult;
+using mathy::ExpressionParser;
+
+
+namespace
+{
+    void describe(const ExpressionNode* node, std::string& description)
+    {
+        description += std::to_string(int(node->getKind()));
+        size_t count = node->getChildCount();
+        if (count == 0) {
+            description += ':';
+            description += node->getString();
+            return;
+        }
+        description += '(';
+        for (size_t i = 0; i < count; i++) {
+            if (i > 0)
+                description += ", ";
+            describe(node->getChild(i).get(), description);
+        }
+        description += ')';
+    }
+
+    std::string getSummary(const ParseResult& result)
+    {
+        if (result.hasErrors())
+            return result.errors[0].getString();
+        if (!result.expression)
+            return "empty statement";
+        return result.expression->getString();
+    }
+}
+
+
+ParserComparison::ParserComparison(::FILE* in, ::FILE* out) :
+    InputProcessor(in, out)
+{
+}
+
+
+int ParserComparison::run(void)
+{
+    std::string input;
+    char chunk[1 << 16];
+    size_t length;
+    while ((length = ::fread(chunk, 1, sizeof chunk, in)) > 0)
+        input.append(chunk, length);
+
+    ExpressionParser pratt(input.data(), input.size(),
+                           ExpressionParser::Backend::PRATT);
+    ExpressionParser bison(input.data(), input.size(),
+                           ExpressionParser::Backend::BISON);
+    size_t statements = 0;
+    size_t differences = 0;
+    while (!pratt.isEndOfFile() || !bison.isEndOfFile()) {
+        ParseResult a = pratt.parseStatement();
+        ParseResult b = bison.parseStatement();
+        statements++;
+
+        bool same = a.hasErrors() == b.hasErrors() &&
+            !a.expression == !b.expression;
+        if (same && a.expression) {
+            same = describe(a.expression.get()) ==
+                describe(b.expression.get()) &&
+                a.expression->getString() == b.expression->getString();
+        }
+        else if (same && a.hasErrors()) {
+            same = a.errors[0].getString() == b.errors[0].getString();
+        }
+        if (!same) {
+            differences++;
+            ::fprintf(this->out, "statement %zu:\n  pratt: %s\n  bison: %s\n",
+                      statements, getSummary(a).c_str(),
+                      getSummary(b).c_str());
+        }
+    }
+    ::fprintf(this->out, "%zu statements, %zu differences\n", statements,
+              differences);
+    return differences == 0 ? 0 : 1;
+}
+
+
+std::string ParserComparison::describe(const ExpressionNode* node)
+{
+    std::string description;
+    ::describe(node, description);
+    return description;
+}
@@ -0,0 +1,62 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef PARSERCOMPARISON_H_
+#define PARSERCOMPARISON_H_
+
+#include <string>
+#include <cstdio>
+
+#include "ConsoleInterface.h"
+
+
+namespace mathy
+{
+    class ParserComparison;
+}
+
+
+/*!
+ * \brief checks the hand-written parser against the generated one
+ *
+ * The whole input is parsed by both parsers, statement by statement.
+ * Statements on which they disagree, either about the tree built or about
+ * whether the statement is valid, are reported. Nothing is evaluated.
+ */
+class mathy::ParserComparison : public InputProcessor
+{
+public:
+    ParserComparison(::FILE* in, ::FILE* out);
+
+    /*!
+     * \return 0 if the parsers agree on every statement, 1 otherwise
+     */
+    virtual int run(void);
+
+    /*!
+     * \brief describes the structure of a tree, so two trees have the same
+     *        description only if they consist of the same nodes
+     */
+    static std::string describe(const ExpressionNode* node);
+};
+
+
+#endif // PARSERCOMPARISON_H_
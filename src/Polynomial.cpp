@@ -0,0 +1,795 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "Polynomial.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+/*!
+ * below this number of coefficients, schoolbook multiplication is faster
+ * than karatsuba
+ */
+static const size_t karatsubaThreshold = 32;
+
+/*!
+ * largest coefficient vector used for kronecker substitution
+ */
+static const double maxDenseSize = double(1 << 22);
+
+
+/*!
+ * \brief determines whether a node is split up further when converting to a
+ *        polynomial
+ *
+ * \return <code>true</code>, if the node is an atom
+ */
+static bool isAtom(const ExpressionNode* node)
+{
+    if (dynamic_cast<const ConstantNode*>(node) != nullptr)
+        return false;
+    if (dynamic_cast<const AdditionNode*>(node) != nullptr ||
+            dynamic_cast<const SubtractionNode*>(node) != nullptr ||
+            dynamic_cast<const MultiplicationNode*>(node) != nullptr ||
+            dynamic_cast<const SumNode*>(node) != nullptr ||
+            dynamic_cast<const ProductNode*>(node) != nullptr)
+        return false;
+
+    const DivisionNode* div = dynamic_cast<const DivisionNode*>(node);
+    if (div != nullptr) {
+        // division by a number is just a scaling
+        const ConstantNode* c =
+            dynamic_cast<const ConstantNode*>(div->b.get());
+        return c == nullptr;
+    }
+
+    const PowerNode* pow = dynamic_cast<const PowerNode*>(node);
+    if (pow != nullptr) {
+        const IntegerNode* exponent =
+            dynamic_cast<const IntegerNode*>(pow->b.get());
+        return exponent == nullptr || exponent->getValue() < 0;
+    }
+    return true;
+}
+
+
+static Coefficient getCoefficient(const ExpressionNode* node)
+{
+    const IntegerNode* intN = dynamic_cast<const IntegerNode*>(node);
+    if (intN != nullptr)
+        return Coefficient(intN->getValue());
+    const RealNode* real = dynamic_cast<const RealNode*>(node);
+    if (real != nullptr)
+        return Coefficient::fromReal(real->getValue());
+    throw ArithmeticException("not a number: " + node->getString());
+}
+
+
+static std::shared_ptr<ExpressionNode> makeNumber(FloatVal value)
+{
+    if (value == ::floor(value) && ::fabs(value) < 9007199254740992.0)
+        return std::make_shared<IntegerNode>((long long int) value);
+    return std::make_shared<RealNode>(value);
+}
+
+
+Coefficient::Coefficient(void) :
+    exact(true), real(0)
+{
+}
+
+
+Coefficient::Coefficient(long long value) :
+    exact(true), integer(value), real(0)
+{
+}
+
+
+Coefficient::Coefficient(const BigInteger& value) :
+    exact(true), integer(value), real(0)
+{
+}
+
+
+Coefficient Coefficient::fromReal(FloatVal value)
+{
+    Coefficient result;
+    result.exact = false;
+    result.real = value;
+    return result;
+}
+
+
+FloatVal Coefficient::getReal(void) const
+{
+    return exact ? integer.toDouble() : real;
+}
+
+
+bool Coefficient::isZero(void) const
+{
+    return exact ? integer.isZero() : real == 0;
+}
+
+
+bool Coefficient::isOne(void) const
+{
+    long long value;
+    if (exact)
+        return integer.toLongLong(value) && value == 1;
+    return real == 1;
+}
+
+
+bool Coefficient::isNegative(void) const
+{
+    return exact ? integer.isNegative() : real < 0;
+}
+
+
+Coefficient Coefficient::operator - (void) const
+{
+    if (exact)
+        return Coefficient(BigInteger() - integer);
+    return fromReal(-real);
+}
+
+
+Coefficient Coefficient::operator + (const Coefficient& other) const
+{
+    if (exact && other.exact)
+        return Coefficient(integer + other.integer);
+    return fromReal(getReal() + other.getReal());
+}
+
+
+Coefficient Coefficient::operator - (const Coefficient& other) const
+{
+    if (exact && other.exact)
+        return Coefficient(integer - other.integer);
+    return fromReal(getReal() - other.getReal());
+}
+
+
+Coefficient Coefficient::operator * (const Coefficient& other) const
+{
+    if (exact && other.exact)
+        return Coefficient(integer * other.integer);
+    return fromReal(getReal() * other.getReal());
+}
+
+
+Coefficient& Coefficient::operator += (const Coefficient& other)
+{
+    return *this = *this + other;
+}
+
+
+std::shared_ptr<ExpressionNode> Coefficient::toExpression(void) const
+{
+    if (!exact)
+        return makeNumber(real);
+    long long value;
+    if (integer.toLongLong(value))
+        return std::make_shared<IntegerNode>(value);
+    return std::make_shared<DecimalNode>(integer.getString());
+}
+
+
+PolynomialRing::PolynomialRing(void) :
+    bitsPerAtom(64), guardMask(0)
+{
+}
+
+
+std::shared_ptr<PolynomialRing> PolynomialRing::create(
+        const std::shared_ptr<ExpressionNode>& expression)
+{
+    std::shared_ptr<PolynomialRing> ring(new PolynomialRing());
+    ring->collectAtoms(expression);
+
+    size_t count = ring->atoms.size();
+    if (count > maxAtoms)
+        throw ArithmeticException("too many indeterminates in polynomial, "
+            "at most " + std::to_string(maxAtoms) + " are supported");
+    ring->bitsPerAtom = count == 0 ? 64 : unsigned(64 / count);
+    for (size_t i = 0; i < count; i++)
+        ring->guardMask |= uint64_t(1) <<
+            (i * ring->bitsPerAtom + ring->bitsPerAtom - 1);
+    return ring;
+}
+
+
+void PolynomialRing::collectAtoms(
+        const std::shared_ptr<ExpressionNode>& expression)
+{
+    ExpressionNode* node = expression.get();
+    if (dynamic_cast<ConstantNode*>(node) != nullptr)
+        return;
+    if (!isAtom(node)) {
+        SumNode* sum = dynamic_cast<SumNode*>(node);
+        ProductNode* product = dynamic_cast<ProductNode*>(node);
+        OperationNode* op = dynamic_cast<OperationNode*>(node);
+        if (sum != nullptr) {
+            for (size_t i = 0; i < sum->getSummands().size(); i++)
+                collectAtoms(sum->getSummands()[i].value);
+        }
+        else if (product != nullptr) {
+            for (size_t i = 0; i < product->getFactors().size(); i++)
+                collectAtoms(product->getFactors()[i]);
+        }
+        else {
+            collectAtoms(op->a);
+            collectAtoms(op->b);
+        }
+        return;
+    }
+
+    std::string key = node->getString();
+    if (atomIndices.find(key) == atomIndices.end()) {
+        atomIndices[key] = atoms.size();
+        atoms.push_back(expression);
+    }
+}
+
+
+size_t PolynomialRing::getAtomCount(void) const
+{
+    return atoms.size();
+}
+
+
+const std::shared_ptr<ExpressionNode>& PolynomialRing::getAtom(
+        size_t index) const
+{
+    return atoms[index];
+}
+
+
+size_t PolynomialRing::findAtom(const ExpressionNode* atom) const
+{
+    std::map<std::string, size_t>::const_iterator it =
+        atomIndices.find(atom->getString());
+    return it != atomIndices.end() ? it->second : npos;
+}
+
+
+uint64_t PolynomialRing::makeMonomial(size_t atom,
+                                      unsigned long long exponent) const
+{
+    if (exponent >= (uint64_t(1) << (bitsPerAtom - 1)))
+        throw ArithmeticException("exponent too large for polynomial");
+    return uint64_t(exponent) << (atom * bitsPerAtom);
+}
+
+
+unsigned long long PolynomialRing::getExponent(uint64_t monomial,
+                                               size_t atom) const
+{
+    uint64_t mask = (uint64_t(1) << (bitsPerAtom - 1)) - 1;
+    return (monomial >> (atom * bitsPerAtom)) & mask;
+}
+
+
+unsigned long long PolynomialRing::getTotalDegree(uint64_t monomial) const
+{
+    unsigned long long degree = 0;
+    for (size_t i = 0; i < atoms.size(); i++)
+        degree += getExponent(monomial, i);
+    return degree;
+}
+
+
+uint64_t PolynomialRing::multiply(uint64_t a, uint64_t b) const
+{
+    // the fields never carry into each other, an overflow sets a guard bit
+    uint64_t product = a + b;
+    if ((product & guardMask) != 0)
+        throw ArithmeticException("exponent too large for polynomial");
+    return product;
+}
+
+
+size_t Polynomial::MonomialHash::operator () (uint64_t monomial) const
+{
+    monomial ^= monomial >> 33;
+    monomial *= 0xFF51AFD7ED558CCDULL;
+    monomial ^= monomial >> 33;
+    return size_t(monomial);
+}
+
+
+Polynomial::Polynomial(const std::shared_ptr<const PolynomialRing>& ring) :
+    ring(ring)
+{
+}
+
+
+Polynomial Polynomial::fromExpression(
+        const std::shared_ptr<ExpressionNode>& expression,
+        const std::shared_ptr<const PolynomialRing>& ring)
+{
+    ExpressionNode* node = expression.get();
+    if (dynamic_cast<ConstantNode*>(node) != nullptr)
+        return constant(ring, getCoefficient(node));
+
+    if (isAtom(node)) {
+        size_t index = ring->findAtom(node);
+        if (index == PolynomialRing::npos)
+            throw ArithmeticException("unknown atom " + node->getString());
+        Polynomial result(ring);
+        result.addTerm(ring->makeMonomial(index, 1), 1);
+        return result;
+    }
+
+    SumNode* sum = dynamic_cast<SumNode*>(node);
+    if (sum != nullptr) {
+        Polynomial result = sum->getConstant() ?
+            fromExpression(sum->getConstant(), ring) : Polynomial(ring);
+        for (size_t i = 0; i < sum->getSummands().size(); i++) {
+            const SumNode::Summand& summand = sum->getSummands()[i];
+            Polynomial term = fromExpression(summand.value, ring);
+            // add in place, the sum may have a lot of summands
+            for (TermMap::const_iterator it = term.terms.begin();
+                    it != term.terms.end(); it++)
+                result.addTerm(it->first,
+                               summand.negative ? -it->second : it->second);
+        }
+        return result;
+    }
+
+    ProductNode* product = dynamic_cast<ProductNode*>(node);
+    if (product != nullptr) {
+        Polynomial result = product->getCoefficient() ?
+            fromExpression(product->getCoefficient(), ring) :
+            constant(ring, 1);
+        for (size_t i = 0; i < product->getFactors().size(); i++)
+            result = result * fromExpression(product->getFactors()[i], ring);
+        return result;
+    }
+
+    OperationNode* op = dynamic_cast<OperationNode*>(node);
+    Polynomial left = fromExpression(op->a, ring);
+
+    if (dynamic_cast<DivisionNode*>(node) != nullptr) {
+        Coefficient divisor = getCoefficient(op->b.get());
+        if (divisor.isZero())
+            throw ArithmeticException("division by zero");
+        return left.divide(divisor);
+    }
+    if (dynamic_cast<PowerNode*>(node) != nullptr) {
+        return left.pow(dynamic_cast<IntegerNode*>(op->b.get())->getValue());
+    }
+
+    Polynomial right = fromExpression(op->b, ring);
+    if (dynamic_cast<AdditionNode*>(node) != nullptr)
+        return left + right;
+    else if (dynamic_cast<SubtractionNode*>(node) != nullptr)
+        return left - right;
+    else
+        return left * right;
+}
+
+
+Polynomial Polynomial::constant(
+        const std::shared_ptr<const PolynomialRing>& ring,
+        const Coefficient& value)
+{
+    Polynomial result(ring);
+    if (!value.isZero())
+        result.terms[0] = value;
+    return result;
+}
+
+
+void Polynomial::addTerm(uint64_t monomial, const Coefficient& coefficient)
+{
+    if (coefficient.isZero())
+        return;
+    TermMap::iterator it = terms.find(monomial);
+    if (it == terms.end()) {
+        terms.insert(std::make_pair(monomial, coefficient));
+    }
+    else {
+        it->second += coefficient;
+        if (it->second.isZero())
+            terms.erase(it);
+    }
+}
+
+
+Polynomial Polynomial::operator + (const Polynomial& other) const
+{
+    Polynomial result = *this;
+    for (TermMap::const_iterator it = other.terms.begin();
+            it != other.terms.end(); it++)
+        result.addTerm(it->first, it->second);
+    return result;
+}
+
+
+Polynomial Polynomial::operator - (const Polynomial& other) const
+{
+    Polynomial result = *this;
+    for (TermMap::const_iterator it = other.terms.begin();
+            it != other.terms.end(); it++)
+        result.addTerm(it->first, -it->second);
+    return result;
+}
+
+
+Polynomial Polynomial::operator * (const Polynomial& other) const
+{
+    Polynomial result(ring);
+    if (terms.empty() || other.terms.empty())
+        return result;
+    if (multiplyDense(other, result))
+        return result;
+    return multiplySparse(other);
+}
+
+
+Polynomial Polynomial::multiplySparse(const Polynomial& other) const
+{
+    Polynomial result(ring);
+    result.terms.reserve(std::min(terms.size() * other.terms.size(),
+                                  size_t(1) << 20));
+    for (TermMap::const_iterator a = terms.begin(); a != terms.end(); a++) {
+        for (TermMap::const_iterator b = other.terms.begin();
+                b != other.terms.end(); b++) {
+            result.terms[ring->multiply(a->first, b->first)] +=
+                a->second * b->second;
+        }
+    }
+
+    for (TermMap::iterator it = result.terms.begin();
+            it != result.terms.end();) {
+        if (it->second.isZero())
+            it = result.terms.erase(it);
+        else
+            it++;
+    }
+    return result;
+}
+
+
+/*!
+ * maps both polynomials to univariate ones by kronecker substitution,
+ * i.e. x_i -> y^(d_0 * ... * d_(i-1)) where d_j exceeds the degree of x_j in
+ * the product. The univariate product can then be unpacked without
+ * ambiguity.
+ */
+bool Polynomial::multiplyDense(const Polynomial& other,
+                               Polynomial& result) const
+{
+    size_t atomCount = ring->getAtomCount();
+    if (atomCount == 0)
+        return false;
+
+    std::vector<unsigned long long> degrees(atomCount, 0);
+    for (TermMap::const_iterator it = terms.begin(); it != terms.end(); it++)
+        for (size_t i = 0; i < atomCount; i++)
+            degrees[i] = std::max(degrees[i],
+                                  ring->getExponent(it->first, i));
+    std::vector<unsigned long long> otherDegrees(atomCount, 0);
+    for (TermMap::const_iterator it = other.terms.begin();
+            it != other.terms.end(); it++)
+        for (size_t i = 0; i < atomCount; i++)
+            otherDegrees[i] = std::max(otherDegrees[i],
+                                       ring->getExponent(it->first, i));
+
+    std::vector<size_t> dimensions(atomCount);
+    std::vector<size_t> strides(atomCount);
+    double size = 1;
+    for (size_t i = 0; i < atomCount; i++) {
+        dimensions[i] = size_t(degrees[i] + otherDegrees[i] + 1);
+        strides[i] = size_t(size);
+        size *= double(dimensions[i]);
+        if (size > maxDenseSize)
+            return false;
+    }
+
+    // karatsuba on the dense vectors must beat the sparse product
+    if (::pow(size, 1.585) > 8.0 * double(terms.size()) *
+            double(other.terms.size()))
+        return false;
+
+    const Polynomial* factors[] = { this, &other };
+    bool allExact[] = { true, true };
+    bool allReal[] = { true, true };
+    double norms[] = { 0, 0 };
+    for (int f = 0; f < 2; f++) {
+        const TermMap& factorTerms = factors[f]->terms;
+        for (TermMap::const_iterator it = factorTerms.begin();
+                it != factorTerms.end(); it++) {
+            if (it->second.isExact())
+                allReal[f] = false;
+            else
+                allExact[f] = false;
+            norms[f] += ::fabs(it->second.getReal());
+        }
+    }
+
+    // every partial sum of the product of two integer polynomials is
+    // bounded by the product of their sums of absolute values, below 2^53
+    // the floating point product is exact. Factors that mix exact and real
+    // terms are left to the sparse product, which keeps track of each term.
+    bool exact = allExact[0] && allExact[1];
+    if (exact ? norms[0] * norms[1] >= 4503599627370496.0 :
+            !allReal[0] && !allReal[1])
+        return false;
+
+    std::vector<FloatVal> a;
+    std::vector<FloatVal> b;
+    std::vector<FloatVal>* dense[] = { &a, &b };
+    for (int f = 0; f < 2; f++) {
+        const TermMap& factorTerms = factors[f]->terms;
+        std::vector<FloatVal>& coefficients = *dense[f];
+        for (TermMap::const_iterator it = factorTerms.begin();
+                it != factorTerms.end(); it++) {
+            size_t index = 0;
+            for (size_t i = 0; i < atomCount; i++)
+                index += size_t(ring->getExponent(it->first, i)) * strides[i];
+            if (index >= coefficients.size())
+                coefficients.resize(index + 1, 0);
+            coefficients[index] = it->second.getReal();
+        }
+    }
+
+    DensePolynomial product = DensePolynomial(a) * DensePolynomial(b);
+    const std::vector<FloatVal>& coefficients = product.getCoefficients();
+    for (size_t index = 0; index < coefficients.size(); index++) {
+        if (coefficients[index] == 0)
+            continue;
+        uint64_t monomial = 0;
+        for (size_t i = 0; i < atomCount; i++)
+            monomial |= ring->makeMonomial(i,
+                (index / strides[i]) % dimensions[i]);
+        result.terms.insert(std::make_pair(monomial, exact ?
+            Coefficient((long long) coefficients[index]) :
+            Coefficient::fromReal(coefficients[index])));
+    }
+    return true;
+}
+
+
+Polynomial Polynomial::scale(FloatVal factor) const
+{
+    Polynomial result(ring);
+    if (factor == 0)
+        return result;
+    result.terms = terms;
+    for (TermMap::iterator it = result.terms.begin();
+            it != result.terms.end(); it++)
+        it->second = it->second * Coefficient::fromReal(factor);
+    return result;
+}
+
+
+Polynomial Polynomial::divide(const Coefficient& divisor) const
+{
+    Polynomial result(ring);
+    for (TermMap::const_iterator it = terms.begin(); it != terms.end(); it++) {
+        const Coefficient& dividend = it->second;
+        if (dividend.isExact() && divisor.isExact()) {
+            const BigInteger& d = divisor.getInteger();
+            BigInteger quotient = dividend.getInteger() / d;
+            if ((dividend.getInteger() - quotient * d).isZero()) {
+                result.terms.insert(std::make_pair(it->first,
+                                                   Coefficient(quotient)));
+                continue;
+            }
+        }
+        result.terms.insert(std::make_pair(it->first,
+            Coefficient::fromReal(dividend.getReal() / divisor.getReal())));
+    }
+    return result;
+}
+
+
+Polynomial Polynomial::pow(unsigned long long exponent) const
+{
+    Polynomial result = constant(ring, 1);
+    Polynomial base = *this;
+    while (exponent != 0) {
+        if (exponent & 1)
+            result = result * base;
+        exponent >>= 1;
+        if (exponent != 0)
+            base = base * base;
+    }
+    return result;
+}
+
+
+std::vector<Polynomial> Polynomial::collect(size_t atom) const
+{
+    std::vector<Polynomial> result;
+    for (TermMap::const_iterator it = terms.begin(); it != terms.end(); it++) {
+        unsigned long long exponent = ring->getExponent(it->first, atom);
+        while (result.size() <= exponent)
+            result.push_back(Polynomial(ring));
+        uint64_t rest = it->first - ring->makeMonomial(atom, exponent);
+        result[exponent].addTerm(rest, it->second);
+    }
+    return result;
+}
+
+
+std::shared_ptr<ExpressionNode> Polynomial::toExpression(void) const
+{
+    return toExpression(BigInteger(1));
+}
+
+
+std::shared_ptr<ExpressionNode> Polynomial::toExpression(
+        const BigInteger& denominator) const
+{
+    typedef std::pair<uint64_t, Coefficient> Term;
+    std::vector<Term> sorted(terms.begin(), terms.end());
+    const PolynomialRing* r = ring.get();
+    std::sort(sorted.begin(), sorted.end(),
+        [r] (const Term& x, const Term& y) {
+            unsigned long long dx = r->getTotalDegree(x.first);
+            unsigned long long dy = r->getTotalDegree(y.first);
+            if (dx != dy)
+                return dx > dy;
+            for (size_t i = 0; i < r->getAtomCount(); i++) {
+                unsigned long long ex = r->getExponent(x.first, i);
+                unsigned long long ey = r->getExponent(y.first, i);
+                if (ex != ey)
+                    return ex > ey;
+            }
+            return false;
+        }
+    );
+
+    std::vector<SumNode::Summand> summands;
+    std::shared_ptr<ExpressionNode> constantTerm;
+    for (size_t t = 0; t < sorted.size(); t++) {
+        Coefficient coefficient = sorted[t].second;
+        BigInteger divisor = denominator;
+        if (coefficient.isExact()) {
+            BigInteger common =
+                BigInteger::gcd(coefficient.getInteger(), denominator);
+            coefficient = Coefficient(coefficient.getInteger() / common);
+            divisor = divisor / common;
+        }
+        else {
+            coefficient = Coefficient::fromReal(
+                coefficient.getReal() / denominator.toDouble());
+            divisor = 1;
+        }
+        long long divisorValue;
+        bool divided = !divisor.toLongLong(divisorValue) || divisorValue != 1;
+
+        if (sorted[t].first == 0 && !divided) {
+            constantTerm = coefficient.toExpression();
+            continue;
+        }
+
+        std::vector<std::shared_ptr<ExpressionNode> > factors;
+        for (size_t i = 0; i < ring->getAtomCount(); i++) {
+            unsigned long long exponent = ring->getExponent(sorted[t].first, i);
+            if (exponent == 0)
+                continue;
+            std::shared_ptr<ExpressionNode> factor = ring->getAtom(i);
+            if (exponent != 1)
+                factor = std::make_shared<PowerNode>(factor,
+                    std::make_shared<IntegerNode>((long long int) exponent));
+            factors.push_back(factor);
+        }
+
+        SumNode::Summand summand;
+        summand.negative = coefficient.isNegative();
+        Coefficient magnitude = summand.negative ? -coefficient : coefficient;
+        if (factors.empty())
+            summand.value = magnitude.toExpression();
+        else if (factors.size() == 1 && magnitude.isOne())
+            summand.value = factors[0];
+        else
+            summand.value = std::make_shared<ProductNode>(factors,
+                magnitude.isOne() ? nullptr : magnitude.toExpression());
+        if (divided)
+            summand.value = std::make_shared<DivisionNode>(summand.value,
+                Coefficient(divisor).toExpression());
+        summands.push_back(summand);
+    }
+
+    if (summands.empty())
+        return constantTerm ? constantTerm : std::make_shared<IntegerNode>(0);
+    if (summands.size() == 1 && !constantTerm && !summands[0].negative)
+        return summands[0].value;
+    return std::make_shared<SumNode>(summands, constantTerm);
+}
+
+
+DensePolynomial::DensePolynomial(const std::vector<FloatVal>& coefficients) :
+    coefficients(coefficients)
+{
+}
+
+
+static std::vector<FloatVal> multiplyCoefficients(const FloatVal* a, size_t n,
+                                                  const FloatVal* b, size_t m)
+{
+    if (n < m) {
+        std::swap(a, b);
+        std::swap(n, m);
+    }
+    std::vector<FloatVal> result(n + m - 1, 0);
+
+    if (m < karatsubaThreshold) {
+        for (size_t i = 0; i < n; i++)
+            for (size_t j = 0; j < m; j++)
+                result[i + j] += a[i] * b[j];
+        return result;
+    }
+
+    size_t half = (n + 1) / 2;
+    if (m <= half) {
+        // too unbalanced for karatsuba, just split the longer factor
+        std::vector<FloatVal> low = multiplyCoefficients(a, half, b, m);
+        std::vector<FloatVal> high = multiplyCoefficients(a + half, n - half,
+                                                          b, m);
+        for (size_t i = 0; i < low.size(); i++)
+            result[i] += low[i];
+        for (size_t i = 0; i < high.size(); i++)
+            result[i + half] += high[i];
+        return result;
+    }
+
+    std::vector<FloatVal> z0 = multiplyCoefficients(a, half, b, half);
+    std::vector<FloatVal> z2 = multiplyCoefficients(a + half, n - half,
+                                                    b + half, m - half);
+    std::vector<FloatVal> sumA(a, a + half);
+    std::vector<FloatVal> sumB(b, b + half);
+    for (size_t i = half; i < n; i++)
+        sumA[i - half] += a[i];
+    for (size_t i = half; i < m; i++)
+        sumB[i - half] += b[i];
+    std::vector<FloatVal> z1 = multiplyCoefficients(&sumA[0], half,
+                                                    &sumB[0], half);
+    for (size_t i = 0; i < z0.size(); i++)
+        z1[i] -= z0[i];
+    for (size_t i = 0; i < z2.size(); i++)
+        z1[i] -= z2[i];
+
+    for (size_t i = 0; i < z0.size(); i++)
+        result[i] += z0[i];
+    for (size_t i = 0; i < z1.size(); i++)
+        result[i + half] += z1[i];
+    for (size_t i = 0; i < z2.size(); i++)
+        result[i + 2 * half] += z2[i];
+    return result;
+}
+
+
+DensePolynomial DensePolynomial::operator * (
+        const DensePolynomial& other) const
+{
+    if (coefficients.empty() || other.coefficients.empty())
+        return DensePolynomial();
+    return DensePolynomial(multiplyCoefficients(
+        &coefficients[0], coefficients.size(),
+        &other.coefficients[0], other.coefficients.size()));
+}
@@ -0,0 +1,244 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef POLYNOMIAL_H_
+#define POLYNOMIAL_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <cstdint>
+
+#include "Node.h"
+#include "BigInteger.h"
+
+
+/*!
+ * \brief the set of indeterminates a group of polynomials is built from
+ *
+ * An atom is a variable or any subexpression that is not a sum, product or
+ * integer power, e.g. <code>sin(x)</code>. The exponents of all atoms of a
+ * term are packed into one 64 bit word, each atom getting an equally sized
+ * bit field. The highest bit of every field is kept free to detect
+ * exponent overflow, so a ring holds at most 32 atoms.
+ */
+class PolynomialRing
+{
+    std::vector<std::shared_ptr<ExpressionNode> > atoms;
+    std::map<std::string, size_t> atomIndices;
+    unsigned bitsPerAtom;
+    uint64_t guardMask;
+public:
+    static const size_t npos = size_t(-1);
+
+    //! the largest number of atoms that fit into the packed exponents
+    static const size_t maxAtoms = 32;
+
+    /*!
+     * \brief creates a ring containing every atom of an expression
+     *
+     * \throws ArithmeticException if the expression has more than
+     *         \link maxAtoms atoms
+     */
+    static std::shared_ptr<PolynomialRing> create(
+            const std::shared_ptr<ExpressionNode>& expression);
+
+    size_t getAtomCount(void) const;
+    const std::shared_ptr<ExpressionNode>& getAtom(size_t index) const;
+
+    /*!
+     * \return the index of the atom, or \link npos if it is not part of
+     *         this ring
+     */
+    size_t findAtom(const ExpressionNode* atom) const;
+
+    uint64_t makeMonomial(size_t atom, unsigned long long exponent) const;
+    unsigned long long getExponent(uint64_t monomial, size_t atom) const;
+    unsigned long long getTotalDegree(uint64_t monomial) const;
+
+    /*!
+     * \brief multiplies two monomials by adding their exponents
+     *
+     * \throws ArithmeticException if an exponent does not fit into its
+     *         bit field
+     */
+    uint64_t multiply(uint64_t a, uint64_t b) const;
+
+private:
+    PolynomialRing(void);
+    void collectAtoms(const std::shared_ptr<ExpressionNode>& expression);
+};
+
+
+/*!
+ * \brief coefficient of a polynomial term
+ *
+ * Coefficients built from integers only are exact, so high powers do not
+ * lose digits. As soon as a real number is involved, the coefficient is a
+ * \link FloatVal.
+ */
+class Coefficient
+{
+    bool exact;
+    BigInteger integer;
+    FloatVal real;
+public:
+    Coefficient(void);
+    Coefficient(long long value);
+    Coefficient(const BigInteger& value);
+
+    static Coefficient fromReal(FloatVal value);
+
+    inline bool isExact(void) const { return exact; }
+    inline const BigInteger& getInteger(void) const { return integer; }
+    FloatVal getReal(void) const;
+
+    bool isZero(void) const;
+    bool isOne(void) const;
+    bool isNegative(void) const;
+
+    Coefficient operator - (void) const;
+    Coefficient operator + (const Coefficient& other) const;
+    Coefficient operator - (const Coefficient& other) const;
+    Coefficient operator * (const Coefficient& other) const;
+    Coefficient& operator += (const Coefficient& other);
+
+    /*!
+     * \brief converts the coefficient to a number node
+     *
+     * Exact values too large for an \link IntegerNode are printed with
+     * all their digits.
+     */
+    std::shared_ptr<ExpressionNode> toExpression(void) const;
+};
+
+
+/*!
+ * \brief sparse multivariate polynomial
+ *
+ * Terms are collected in a hash map from packed exponent vectors to
+ * coefficients. Products of reasonably dense polynomials are mapped to
+ * dense univariate ones by kronecker substitution and multiplied with
+ * karatsuba's algorithm, as long as floating point arithmetic gives the
+ * exact result for integer coefficients.
+ */
+class Polynomial
+{
+public:
+    struct MonomialHash
+    {
+        size_t operator () (uint64_t monomial) const;
+    };
+    typedef std::unordered_map<uint64_t, Coefficient, MonomialHash> TermMap;
+
+private:
+    std::shared_ptr<const PolynomialRing> ring;
+    TermMap terms;
+
+public:
+    Polynomial(const std::shared_ptr<const PolynomialRing>& ring);
+
+    /*!
+     * \brief expands an expression into a polynomial
+     *
+     * \param ring a ring containing every atom of the expression
+     */
+    static Polynomial fromExpression(
+            const std::shared_ptr<ExpressionNode>& expression,
+            const std::shared_ptr<const PolynomialRing>& ring);
+
+    static Polynomial constant(
+            const std::shared_ptr<const PolynomialRing>& ring,
+            const Coefficient& value);
+
+    inline const TermMap& getTerms(void) const { return terms; }
+    inline const std::shared_ptr<const PolynomialRing>& getRing(void) const
+    { return ring; }
+
+    Polynomial operator + (const Polynomial& other) const;
+    Polynomial operator - (const Polynomial& other) const;
+    Polynomial operator * (const Polynomial& other) const;
+    Polynomial scale(FloatVal factor) const;
+
+    /*!
+     * \brief divides every coefficient by a number
+     *
+     * Exact coefficients stay exact if the divisor divides all of them.
+     */
+    Polynomial divide(const Coefficient& divisor) const;
+    Polynomial pow(unsigned long long exponent) const;
+
+    /*!
+     * \brief groups the terms by the exponent of one atom
+     *
+     * \return the coefficient polynomials, the i-th entry belonging to
+     *         <code>atom ^ i</code>. They do not contain the atom anymore.
+     */
+    std::vector<Polynomial> collect(size_t atom) const;
+
+    /*!
+     * \brief converts the polynomial back to an expression tree
+     *
+     * Terms are ordered by descending total degree.
+     */
+    std::shared_ptr<ExpressionNode> toExpression(void) const;
+
+    /*!
+     * \brief converts the polynomial divided by a positive integer back to
+     *        an expression tree
+     *
+     * Exact coefficients become reduced fractions, so dividing
+     * <code>2n^3 + 3n^2 + n</code> by 6 yields
+     * <code>n^3/3 + n^2/2 + n/6</code>.
+     */
+    std::shared_ptr<ExpressionNode> toExpression(
+            const BigInteger& denominator) const;
+
+private:
+    void addTerm(uint64_t monomial, const Coefficient& coefficient);
+    Polynomial multiplySparse(const Polynomial& other) const;
+    bool multiplyDense(const Polynomial& other, Polynomial& result) const;
+};
+
+
+/*!
+ * \brief univariate polynomial stored as dense coefficient vector
+ */
+class DensePolynomial
+{
+    std::vector<FloatVal> coefficients;
+public:
+    DensePolynomial(void) = default;
+    DensePolynomial(const std::vector<FloatVal>& coefficients);
+
+    inline const std::vector<FloatVal>& getCoefficients(void) const
+    { return coefficients; }
+
+    /*!
+     * \brief multiplies with karatsuba's algorithm for large operands
+     */
+    DensePolynomial operator * (const DensePolynomial& other) const;
+};
+
+
+#endif // POLYNOMIAL_H_
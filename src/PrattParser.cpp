@@ -0,0 +1,652 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "PrattParser.h"
+#include "Node.h"
+#include "FunctionNode.h"
+#include "LambdaNode.h"
+#include "Matrix.h"
+
+#include <cstring>
+#include <cstdint>
+
+
+using mathy::PrattParser;
+using mathy::ParseResult;
+
+
+namespace
+{
+    /*
+     * binding strength of the operators as declared in parser.y, 0 means
+     * the token is no infix operator
+     */
+    const int assignmentPrecedence = 1;
+    const int orPrecedence = 2;
+    const int andPrecedence = 3;
+    const int notPrecedence = 4;
+    const int relationPrecedence = 5;
+    const int equalityPrecedence = 6;
+    const int additionPrecedence = 7;
+    const int multiplicationPrecedence = 8;
+    const int powerPrecedence = 9;
+
+    //! the precedence used for whole expressions
+    const int lowestPrecedence = assignmentPrecedence;
+
+    //! the size bison's stack is limited to, YYMAXDEPTH
+    const size_t maxDepth = 10000;
+
+    //! states on bison's stack before the first token of a statement
+    const size_t initialDepth = 2;
+
+    //! small stacks run out before bison would, they are checked as well
+#ifdef _WIN32
+    const size_t maxStackUsage = 768 * 1024;
+#else
+    const size_t maxStackUsage = 6 * 1024 * 1024;
+#endif
+
+    typedef PrattParser::TokenType TokenType;
+
+    int getPrecedence(TokenType type)
+    {
+        switch (type) {
+        case TokenType::ASSIGNMENT:
+            return assignmentPrecedence;
+        case TokenType::OR:
+        case TokenType::XOR:
+            return orPrecedence;
+        case TokenType::AND:
+            return andPrecedence;
+        case TokenType::LESS:
+        case TokenType::LESS_EQUAL:
+        case TokenType::GREATER:
+        case TokenType::GREATER_EQUAL:
+            return relationPrecedence;
+        case TokenType::EQUAL:
+        case TokenType::NOT_EQUAL:
+            return equalityPrecedence;
+        case TokenType::PLUS:
+        case TokenType::MINUS:
+            return additionPrecedence;
+        case TokenType::MUL:
+        case TokenType::DIV:
+        case TokenType::MOD:
+            return multiplicationPrecedence;
+        case TokenType::POW:
+            return powerPrecedence;
+        default:
+            return 0;
+        }
+    }
+
+    //! comparisons cannot be chained
+    bool isNonAssociative(int precedence)
+    {
+        return precedence == relationPrecedence ||
+            precedence == equalityPrecedence;
+    }
+
+    inline bool isDigit(char c)
+    {
+        return c >= '0' && c <= '9';
+    }
+
+    inline bool isLetter(char c)
+    {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+    }
+
+    inline bool isWord(const char* text, size_t length, const char* word)
+    {
+        return ::strlen(word) == length && ::memcmp(text, word, length) == 0;
+    }
+
+    inline std::shared_ptr<ExpressionNode> share(
+            std::unique_ptr<ExpressionNode> node)
+    {
+        return std::shared_ptr<ExpressionNode>(std::move(node));
+    }
+}
+
+
+PrattParser::PrattParser(void) :
+    position(nullptr), end(nullptr), line(1), lineStart(nullptr),
+    endOfFile(false), depth(0), stackBase(0)
+{
+}
+
+
+PrattParser::PrattParser(const char* data, size_t length) :
+    position(data), end(data + length), line(1), lineStart(data),
+    endOfFile(false), depth(0), stackBase(0)
+{
+}
+
+
+void PrattParser::reset(const char* data, size_t length)
+{
+    position = data;
+    end = data + length;
+    lineStart = data;
+}
+
+
+ParseResult PrattParser::parseStatement(void)
+{
+    ParseResult result;
+    depth = initialDepth;
+    char marker;
+    stackBase = reinterpret_cast<uintptr_t>(&marker);
+    try {
+        advance();
+        if (current.type != TokenType::END) {
+            // bison reduces the empty statement first and then only
+            // accepts its end
+            if (!startsExpression(current.type))
+                throw unexpected(current, getName(TokenType::END));
+            std::unique_ptr<ExpressionNode> expression =
+                parseExpression(lowestPrecedence);
+            if (current.type != TokenType::END)
+                throw unexpected(current, getName(TokenType::END));
+            result.expression = share(std::move(expression));
+        }
+    } catch(SyntaxError& error) {
+        result.errors.push_back(error.error);
+        while (current.type != TokenType::END)
+            advance();
+    }
+    return result;
+}
+
+
+void PrattParser::skip(void)
+{
+    for (; position != end; position++) {
+        if (*position == '\n') {
+            line++;
+            lineStart = position + 1;
+        }
+    }
+}
+
+
+PrattParser::Token PrattParser::scan(void)
+{
+    while (position != end) {
+        if (*position == ' ' && end - position >= 3 &&
+                position[1] == '_' && position[2] == '\n') {
+            // line break inside a statement
+            position += 3;
+            line++;
+            lineStart = position;
+        }
+        else if (*position == ' ' || *position == '\t')
+            position++;
+        else
+            break;
+    }
+
+    Token token = {
+        TokenType::END, position, 1, line, size_t(position - lineStart) + 1
+    };
+    if (position == end) {
+        token.length = 0;
+        endOfFile = true;
+        return token;
+    }
+
+    const char* start = position;
+    char c = *position++;
+    char next = position != end ? *position : '\0';
+    switch (c) {
+    case '\n':
+        line++;
+        lineStart = position;
+        break;
+    case ';':
+    case '\0':
+        break;
+    case '+': token.type = TokenType::PLUS; break;
+    case '*': token.type = TokenType::MUL; break;
+    case '/': token.type = TokenType::DIV; break;
+    case '^': token.type = TokenType::POW; break;
+    case '%': token.type = TokenType::MOD; break;
+    case '\\': token.type = TokenType::BACKSLASH; break;
+    case '(': token.type = TokenType::LPAREN; break;
+    case ')': token.type = TokenType::RPAREN; break;
+    case '{': token.type = TokenType::LBRACE; break;
+    case '}': token.type = TokenType::RBRACE; break;
+    case '[': token.type = TokenType::LBRACKET; break;
+    case ']': token.type = TokenType::RBRACKET; break;
+    case '.': token.type = TokenType::DOT; break;
+    case ',': token.type = TokenType::COMMA; break;
+    case '-':
+        token.type = next == '>' ? TokenType::ARROW : TokenType::MINUS;
+        break;
+    case ':':
+        token.type = next == '=' ? TokenType::ASSIGNMENT : TokenType::COLON;
+        break;
+    case '<':
+        token.type = next == '=' ? TokenType::LESS_EQUAL : TokenType::LESS;
+        break;
+    case '>':
+        token.type = next == '=' ?
+            TokenType::GREATER_EQUAL : TokenType::GREATER;
+        break;
+    case '!':
+        token.type = next == '=' ?
+            TokenType::NOT_EQUAL : TokenType::EXCLAMATION;
+        break;
+    case '=':
+        token.type = next == '=' ? TokenType::EQUAL : TokenType::ERROR;
+        break;
+    case '"': {
+        const char* close = position;
+        while (close != end && *close != '"' && *close != '\n')
+            close++;
+        if (close != end && *close == '"') {
+            token.type = TokenType::STRING;
+            position = close + 1;
+        }
+        else
+            token.type = TokenType::ERROR;
+        break;
+    }
+    default:
+        if (isDigit(c)) {
+            while (position != end && isDigit(*position))
+                position++;
+            token.type = TokenType::INTEGER;
+            if (position != end && *position == '.') {
+                position++;
+                while (position != end && isDigit(*position))
+                    position++;
+                token.type = TokenType::REAL;
+            }
+        }
+        else if (isLetter(c)) {
+            while (position != end &&
+                   (isLetter(*position) || isDigit(*position)))
+                position++;
+            size_t length = position - start;
+            token.type = TokenType::IDENTIFIER;
+            if (isWord(start, length, "div"))
+                token.type = TokenType::DIV;
+            else if (isWord(start, length, "mod"))
+                token.type = TokenType::MOD;
+            else if (isWord(start, length, "or"))
+                token.type = TokenType::OR;
+            else if (isWord(start, length, "xor"))
+                token.type = TokenType::XOR;
+            else if (isWord(start, length, "and"))
+                token.type = TokenType::AND;
+            else if (isWord(start, length, "not"))
+                token.type = TokenType::NOT;
+        }
+        else
+            token.type = TokenType::ERROR;
+    }
+
+    // the two character operators
+    if (token.type == TokenType::ARROW || token.type == TokenType::ASSIGNMENT ||
+            token.type == TokenType::LESS_EQUAL ||
+            token.type == TokenType::GREATER_EQUAL ||
+            token.type == TokenType::NOT_EQUAL ||
+            token.type == TokenType::EQUAL)
+        position++;
+
+    token.length = position - start;
+    return token;
+}
+
+
+void PrattParser::advance(void)
+{
+    current = scan();
+}
+
+
+void PrattParser::shift(void)
+{
+    // consumes the token like bison pushes it, the parse functions set the
+    // depth back when they reduce what they have read to a single symbol
+    char marker;
+    uintptr_t stackPosition = reinterpret_cast<uintptr_t>(&marker);
+    if (++depth >= maxDepth || stackBase - stackPosition > maxStackUsage) {
+        SyntaxError error = {
+            { "memory exhausted", current.line, current.column }
+        };
+        throw error;
+    }
+    advance();
+}
+
+
+void PrattParser::expect(TokenType type)
+{
+    if (current.type != type)
+        throw unexpected(current, getName(type));
+    shift();
+}
+
+
+PrattParser::SyntaxError PrattParser::unexpected(const Token& token,
+                                                 const char* expected) const
+{
+    std::string message = "syntax error, unexpected ";
+    message += getName(token.type);
+    if (expected != nullptr) {
+        message += ", expecting ";
+        message += expected;
+    }
+    SyntaxError error = { { message, token.line, token.column } };
+    return error;
+}
+
+
+std::unique_ptr<ExpressionNode> PrattParser::parseExpression(
+        int minPrecedence)
+{
+    size_t base = depth;
+    std::unique_ptr<ExpressionNode> left = parsePrefix();
+    while (true) {
+        // bison always shifts the parenthesis, so calls bind tightest
+        if (current.type == TokenType::LPAREN) {
+            shift();
+            std::vector<std::shared_ptr<ExpressionNode> > arguments =
+                parseList(TokenType::RPAREN);
+            left.reset(new FunctionCallNode(share(std::move(left)),
+                                            arguments));
+            depth = base + 1;
+            continue;
+        }
+
+        TokenType operation = current.type;
+        int precedence = getPrecedence(operation);
+        if (precedence == 0 || precedence < minPrecedence)
+            break;
+        shift();
+
+        // only the assignment is right associative
+        std::unique_ptr<ExpressionNode> right = parseExpression(
+            operation == TokenType::ASSIGNMENT ? precedence : precedence + 1);
+        left = combine(operation, std::move(left), std::move(right));
+        depth = base + 1;
+
+        if (isNonAssociative(precedence) &&
+                getPrecedence(current.type) == precedence)
+            throw unexpected(current, nullptr);
+    }
+    return left;
+}
+
+
+std::unique_ptr<ExpressionNode> PrattParser::parsePrefix(void)
+{
+    size_t base = depth;
+    Token token = current;
+    switch (token.type) {
+    case TokenType::INTEGER:
+        shift();
+        return std::unique_ptr<ExpressionNode>(
+            new IntegerNode(std::string(token.text, token.length)));
+    case TokenType::REAL:
+        shift();
+        return std::unique_ptr<ExpressionNode>(
+            new RealNode(std::string(token.text, token.length)));
+    case TokenType::IDENTIFIER:
+        shift();
+        return std::unique_ptr<ExpressionNode>(
+            new VariableNode(std::string(token.text, token.length)));
+    case TokenType::STRING:
+        shift();
+        // strip the quotes
+        return std::unique_ptr<ExpressionNode>(
+            new StringNode(std::string(token.text + 1, token.length - 2)));
+    case TokenType::LPAREN: {
+        shift();
+        std::unique_ptr<ExpressionNode> inner =
+            parseExpression(lowestPrecedence);
+        // an operator could follow just as well, so bison names nothing
+        if (current.type != TokenType::RPAREN)
+            throw unexpected(current, nullptr);
+        shift();
+        depth = base + 1;
+        return inner;
+    }
+    case TokenType::LBRACKET: {
+        shift();
+        std::unique_ptr<ExpressionNode> list(
+            new ListNode(parseList(TokenType::RBRACKET)));
+        depth = base + 1;
+        return list;
+    }
+    case TokenType::MINUS: {
+        shift();
+        std::unique_ptr<ExpressionNode> operand =
+            parseExpression(additionPrecedence + 1);
+        depth = base + 1;
+        return std::unique_ptr<ExpressionNode>(new SubtractionNode(
+            std::make_shared<IntegerNode>(0), share(std::move(operand))));
+    }
+    case TokenType::NOT: {
+        shift();
+        std::unique_ptr<ExpressionNode> operand =
+            parseExpression(notPrecedence + 1);
+        depth = base + 1;
+        return std::unique_ptr<ExpressionNode>(
+            new NotNode(share(std::move(operand))));
+    }
+    case TokenType::EXCLAMATION:
+        return parseLambda();
+    default:
+        throw unexpected(token, nullptr);
+    }
+}
+
+
+std::unique_ptr<ExpressionNode> PrattParser::parseLambda(void)
+{
+    // bison keeps the !, the arguments and the arrow on its stack
+    size_t base = depth;
+    shift();
+    expect(TokenType::LPAREN);
+    std::vector<std::shared_ptr<VariableNode> > arguments;
+    if (current.type == TokenType::RPAREN)
+        shift();
+    else {
+        while (true) {
+            if (current.type != TokenType::IDENTIFIER) {
+                throw unexpected(current, arguments.empty() ?
+                                 "identifier or )" : "identifier");
+            }
+            arguments.push_back(std::make_shared<VariableNode>(
+                std::string(current.text, current.length)));
+            shift();
+            depth = base + 2;
+            if (current.type == TokenType::RPAREN) {
+                shift();
+                break;
+            }
+            if (current.type != TokenType::COMMA)
+                throw unexpected(current, ") or comma");
+            shift();
+        }
+    }
+    depth = base + 2;
+    expect(TokenType::ARROW);
+
+    // the body extends as far as possible
+    std::shared_ptr<ExpressionNode> body =
+        share(parseExpression(lowestPrecedence));
+    FunctionCallNode::markTailCalls(body);
+    depth = base + 1;
+    return std::unique_ptr<ExpressionNode>(new LambdaNode(arguments, body));
+}
+
+
+std::vector<std::shared_ptr<ExpressionNode> > PrattParser::parseList(
+        TokenType close)
+{
+    size_t base = depth;
+    std::vector<std::shared_ptr<ExpressionNode> > elements;
+    if (current.type == close) {
+        shift();
+        return elements;
+    }
+    while (true) {
+        elements.push_back(share(parseExpression(lowestPrecedence)));
+        depth = base + 1;
+        if (current.type == close) {
+            shift();
+            return elements;
+        }
+        if (current.type != TokenType::COMMA) {
+            throw unexpected(current, close == TokenType::RPAREN ?
+                             ") or comma" : "comma or ]");
+        }
+        shift();
+    }
+}
+
+
+std::unique_ptr<ExpressionNode> PrattParser::combine(
+        TokenType operation, std::unique_ptr<ExpressionNode> left,
+        std::unique_ptr<ExpressionNode> right)
+{
+    typedef ComparisonNode::Relation Relation;
+    ExpressionNode* node;
+    switch (operation) {
+    case TokenType::PLUS:
+    case TokenType::MINUS:
+        // sums and products are flattened like in parser.y
+        node = SumNode::join(left.release(), right.release(),
+                             operation == TokenType::MINUS);
+        break;
+    case TokenType::MUL:
+        node = ProductNode::join(left.release(), right.release());
+        break;
+    case TokenType::DIV:
+        node = new DivisionNode(share(std::move(left)),
+                                share(std::move(right)));
+        break;
+    case TokenType::MOD:
+        node = new ModuloNode(share(std::move(left)), share(std::move(right)));
+        break;
+    case TokenType::POW:
+        node = new PowerNode(share(std::move(left)), share(std::move(right)));
+        break;
+    case TokenType::AND:
+        node = new AndNode(share(std::move(left)), share(std::move(right)));
+        break;
+    case TokenType::OR:
+        node = new OrNode(share(std::move(left)), share(std::move(right)));
+        break;
+    case TokenType::XOR:
+        node = new XorNode(share(std::move(left)), share(std::move(right)));
+        break;
+    case TokenType::ASSIGNMENT:
+        node = new AssignmentNode(share(std::move(left)),
+                                  share(std::move(right)));
+        break;
+    default: {
+        Relation relation;
+        switch (operation) {
+        case TokenType::LESS: relation = Relation::LESS; break;
+        case TokenType::LESS_EQUAL: relation = Relation::LESS_EQUAL; break;
+        case TokenType::GREATER: relation = Relation::GREATER; break;
+        case TokenType::GREATER_EQUAL:
+            relation = Relation::GREATER_EQUAL;
+            break;
+        case TokenType::EQUAL: relation = Relation::EQUAL; break;
+        default: relation = Relation::NOT_EQUAL; break;
+        }
+        node = new ComparisonNode(relation, share(std::move(left)),
+                                  share(std::move(right)));
+    }
+    }
+    return std::unique_ptr<ExpressionNode>(node);
+}
+
+
+bool PrattParser::startsExpression(TokenType type)
+{
+    switch (type) {
+    case TokenType::INTEGER:
+    case TokenType::REAL:
+    case TokenType::IDENTIFIER:
+    case TokenType::STRING:
+    case TokenType::LPAREN:
+    case TokenType::LBRACKET:
+    case TokenType::MINUS:
+    case TokenType::NOT:
+    case TokenType::EXCLAMATION:
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+const char* PrattParser::getName(TokenType type)
+{
+    // the same names parser.y uses in its messages
+    switch (type) {
+    case TokenType::END: return "end of statement";
+    case TokenType::IDENTIFIER: return "identifier";
+    case TokenType::INTEGER: return "integer";
+    case TokenType::REAL: return "number";
+    case TokenType::STRING: return "string";
+    case TokenType::ERROR: return "invalid character";
+    case TokenType::LPAREN: return "(";
+    case TokenType::RPAREN: return ")";
+    case TokenType::LBRACE: return "{";
+    case TokenType::RBRACE: return "}";
+    case TokenType::LBRACKET: return "[";
+    case TokenType::RBRACKET: return "]";
+    case TokenType::COMMA: return "comma";
+    case TokenType::DOT: return ".";
+    case TokenType::COLON: return ":";
+    case TokenType::BACKSLASH: return "\\";
+    case TokenType::EXCLAMATION: return "!";
+    case TokenType::ARROW: return "->";
+    case TokenType::ASSIGNMENT: return ":=";
+    case TokenType::OR: return "or";
+    case TokenType::XOR: return "xor";
+    case TokenType::AND: return "and";
+    case TokenType::NOT: return "not";
+    case TokenType::LESS: return "<";
+    case TokenType::LESS_EQUAL: return "<=";
+    case TokenType::GREATER: return ">";
+    case TokenType::GREATER_EQUAL: return ">=";
+    case TokenType::EQUAL: return "==";
+    case TokenType::NOT_EQUAL: return "!=";
+    case TokenType::PLUS: return "+";
+    case TokenType::MINUS: return "-";
+    case TokenType::MUL: return "*";
+    case TokenType::DIV: return "/";
+    case TokenType::MOD: return "mod";
+    case TokenType::POW: return "^";
+    }
+    return "";
+}
@@ -0,0 +1,189 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef PRATTPARSER_H_
+#define PRATTPARSER_H_
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+
+#include "ExpressionParser.h"
+
+
+class ExpressionNode;
+class VariableNode;
+
+namespace mathy
+{
+    class PrattParser;
+}
+
+
+/*!
+ * \brief hand-written single pass parser for the grammar in parser.y
+ *
+ * Tokens are read directly from the text as pointer and length, without
+ * copying them into strings, and operators are parsed by precedence
+ * climbing. The precedences and associativities are the ones declared in
+ * parser.y, including the way bison resolves its shift/reduce conflicts:
+ * calls bind tighter than any operator, and a lambda body or the operand
+ * of <code>-</code> and <code>not</code> extends as far as it would with
+ * bison. The trees built are the same as those of the generated parser.
+ *
+ * Statements end at a newline, at <code>;</code> and at the end of the
+ * text, just like with the scanner.
+ */
+class mathy::PrattParser
+{
+public:
+    enum class TokenType
+    {
+        END,
+        IDENTIFIER,
+        INTEGER,
+        REAL,
+        STRING,
+        ERROR,
+        LPAREN,
+        RPAREN,
+        LBRACE,
+        RBRACE,
+        LBRACKET,
+        RBRACKET,
+        COMMA,
+        DOT,
+        COLON,
+        BACKSLASH,
+        EXCLAMATION,
+        ARROW,
+        ASSIGNMENT,
+        OR,
+        XOR,
+        AND,
+        NOT,
+        LESS,
+        LESS_EQUAL,
+        GREATER,
+        GREATER_EQUAL,
+        EQUAL,
+        NOT_EQUAL,
+        PLUS,
+        MINUS,
+        MUL,
+        DIV,
+        MOD,
+        POW
+    };
+
+    struct Token
+    {
+        TokenType type;
+        const char* text;
+        size_t length;
+        size_t line;
+        size_t column;
+    };
+
+private:
+    const char* position;
+    const char* end;
+
+    //! line of the next character and the position where it starts
+    size_t line;
+    const char* lineStart;
+
+    //! the token after the ones consumed so far
+    Token current;
+
+    bool endOfFile;
+
+    /*!
+     * \brief the number of states the generated parser would have on its
+     *        stack at this point of the statement
+     *
+     * Bison gives up with "memory exhausted" once its stack is full.
+     * Counting the same way stops the recursion here at the same token with
+     * the same error, long before the C++ stack overflows.
+     */
+    size_t depth;
+
+    //! stack position at the start of the statement
+    uintptr_t stackBase;
+
+    struct SyntaxError
+    {
+        ParseError error;
+    };
+public:
+    PrattParser(void);
+    PrattParser(const char* data, size_t length);
+
+    /*!
+     * \brief continues with another piece of text
+     *
+     * Line numbers keep counting, so a file can be parsed in chunks of
+     * whole statements.
+     */
+    void reset(const char* data, size_t length);
+
+    /*!
+     * \brief parses the next statement
+     *
+     * After an error, the rest of the statement is skipped.
+     */
+    ParseResult parseStatement(void);
+
+    /*!
+     * \brief skips the rest of the text, counting its lines
+     */
+    void skip(void);
+
+    //! <code>true</code> if a statement was ended by the end of the text
+    inline bool isEndOfFile(void) const { return endOfFile; }
+
+    //! <code>true</code> if all of the text has been parsed
+    inline bool isExhausted(void) const { return position == end; }
+
+private:
+    Token scan(void);
+    void advance(void);
+    void shift(void);
+    void expect(TokenType type);
+    SyntaxError unexpected(const Token& token, const char* expected) const;
+
+    std::unique_ptr<ExpressionNode> parseExpression(int minPrecedence);
+    std::unique_ptr<ExpressionNode> parsePrefix(void);
+    std::unique_ptr<ExpressionNode> parseLambda(void);
+    std::vector<std::shared_ptr<ExpressionNode> > parseList(
+            TokenType close);
+    std::unique_ptr<ExpressionNode> combine(
+            TokenType operation, std::unique_ptr<ExpressionNode> left,
+            std::unique_ptr<ExpressionNode> right);
+
+    static bool startsExpression(TokenType type);
+    static const char* getName(TokenType type);
+};
+
+
+#endif // PRATTPARSER_H_
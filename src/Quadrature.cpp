@@ -0,0 +1,253 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "Quadrature.h"
+
+#include <cmath>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <limits>
+
+
+namespace
+{
+    // abscissae of the 15 point Kronrod rule, the odd ones belong to the
+    // 7 point Gauss rule
+    const FloatVal kronrodNodes[8] = {
+        0.991455371120812639206854697526329,
+        0.949107912342758524526189684047851,
+        0.864864423359769072789712788640926,
+        0.741531185599394439863864773280788,
+        0.586087235467691130294144845693013,
+        0.405845151377397166906606412076961,
+        0.207784955007898467600689403773245,
+        0.000000000000000000000000000000000,
+    };
+
+    const FloatVal kronrodWeights[8] = {
+        0.022935322010529224963732008058970,
+        0.063092092629978553290700663189204,
+        0.104790010322250183839876322541518,
+        0.140653259715525918745189590510238,
+        0.169004726639267902826583426598550,
+        0.190350578064785409913256402421014,
+        0.204432940075298892414161999234649,
+        0.209482141084727828012999174891714,
+    };
+
+    const FloatVal gaussWeights[4] = {
+        0.129484966168869693270611432679082,
+        0.279705391489276667901467771423780,
+        0.381830050505118944950369775488975,
+        0.417959183673469387755102040816327,
+    };
+
+    //! intervals are not split further than this
+    const int maxDepth = 60;
+
+    //! limits the total number of intervals
+    const size_t maxIntervals = size_t(1) << 20;
+
+    //! intervals this deep are not handed to other threads anymore
+    const int parallelDepth = 16;
+
+
+    struct Interval
+    {
+        FloatVal a;
+        FloatVal b;
+        FloatVal value;
+        FloatVal error;
+        int depth;
+
+        bool operator < (const Interval& other) const { return a < other.a; }
+    };
+
+
+    Interval gaussKronrod(const CompiledExpression& function,
+                          FloatVal a, FloatVal b, int depth)
+    {
+        FloatVal center = (a + b) / 2;
+        FloatVal halfLength = (b - a) / 2;
+
+        FloatVal points[15];
+        for (int i = 0; i < 7; i++) {
+            points[i] = center - halfLength * kronrodNodes[i];
+            points[14 - i] = center + halfLength * kronrodNodes[i];
+        }
+        points[7] = center;
+
+        FloatVal values[15];
+        function.evaluate(points, 15, values);
+
+        FloatVal kronrod = kronrodWeights[7] * values[7];
+        FloatVal gauss = gaussWeights[3] * values[7];
+        for (int i = 0; i < 7; i++) {
+            FloatVal pair = values[i] + values[14 - i];
+            kronrod += kronrodWeights[i] * pair;
+            if (i % 2 == 1)
+                gauss += gaussWeights[i / 2] * pair;
+        }
+
+        if (!std::isfinite(kronrod))
+            throw ArithmeticException("integrand is not finite");
+
+        Interval interval;
+        interval.a = a;
+        interval.b = b;
+        interval.value = kronrod * halfLength;
+        interval.error = std::abs((kronrod - gauss) * halfLength);
+        interval.depth = depth;
+        return interval;
+    }
+
+
+    class Integration
+    {
+        const CompiledExpression& function;
+        FloatVal length;
+        FloatVal tolerance;
+
+        std::atomic<size_t> intervalCount;
+
+        std::mutex mutex;
+        std::vector<Interval> accepted;
+
+        //! declared last, so running tasks are waited for first
+        TaskGroup group;
+    public:
+        Integration(const CompiledExpression& function, FloatVal length,
+                    FloatVal tolerance, ThreadPool& pool) :
+            function(function), length(length), tolerance(tolerance),
+            intervalCount(1), group(pool)
+        {
+        }
+
+        Quadrature::Result run(const Interval& whole)
+        {
+            process(whole);
+            group.wait();
+
+            // the accepted intervals do not depend on the scheduling, so
+            // summing them in order gives reproducible results
+            std::sort(accepted.begin(), accepted.end());
+            Quadrature::Result result;
+            result.value = 0;
+            result.error = 0;
+            for (size_t i = 0; i < accepted.size(); i++) {
+                result.value += accepted[i].value;
+                result.error += accepted[i].error;
+            }
+            result.intervals = accepted.size();
+            result.converged = result.error <= tolerance;
+            return result;
+        }
+
+    private:
+        /*!
+         * \brief refines an interval until it is accurate enough
+         *
+         * One half of every split interval is processed in this thread,
+         * the other one is offered to the pool while it is large.
+         */
+        void process(const Interval& interval)
+        {
+            std::vector<Interval> pending(1, interval);
+            std::vector<Interval> done;
+
+            while (!pending.empty()) {
+                Interval current = pending.back();
+                pending.pop_back();
+
+                // every interval gets a share of the tolerance matching its
+                // length
+                FloatVal allowed = tolerance * (current.b - current.a) /
+                    length;
+                if (current.error <= allowed) {
+                    done.push_back(current);
+                    continue;
+                }
+
+                // near singularities the share of the tolerance can become
+                // too small; those intervals are kept and the total error
+                // decides
+                FloatVal middle = (current.a + current.b) / 2;
+                if (current.depth >= maxDepth || middle <= current.a ||
+                        middle >= current.b ||
+                        intervalCount.fetch_add(1) >= maxIntervals) {
+                    done.push_back(current);
+                    continue;
+                }
+
+                Interval left = gaussKronrod(function, current.a, middle,
+                                             current.depth + 1);
+                Interval right = gaussKronrod(function, middle, current.b,
+                                              current.depth + 1);
+                if (current.depth < parallelDepth)
+                    group.run([this, right] { process(right); });
+                else
+                    pending.push_back(right);
+                pending.push_back(left);
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            accepted.insert(accepted.end(), done.begin(), done.end());
+        }
+    };
+}
+
+
+Quadrature::Result Quadrature::integrate(const CompiledExpression& function,
+                                         FloatVal a, FloatVal b,
+                                         FloatVal tolerance,
+                                         ThreadPool& pool)
+{
+    if (!std::isfinite(a) || !std::isfinite(b))
+        throw ArithmeticException("integration bounds must be finite");
+
+    Result result;
+    if (a == b) {
+        result.value = 0;
+        result.error = 0;
+        result.intervals = 0;
+        result.converged = true;
+        return result;
+    }
+
+    bool swapped = b < a;
+    if (swapped)
+        std::swap(a, b);
+
+    Interval whole = gaussKronrod(function, a, b, 0);
+    FloatVal absolute = tolerance * std::max(FloatVal(1),
+                                             std::abs(whole.value));
+    // leave some room for rounding errors in the sum
+    absolute = std::max(absolute, std::abs(whole.value) *
+        std::numeric_limits<FloatVal>::epsilon() * 50);
+
+    Integration integration(function, b - a, absolute, pool);
+    result = integration.run(whole);
+    if (swapped)
+        result.value = -result.value;
+    return result;
+}
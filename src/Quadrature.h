@@ -0,0 +1,70 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef QUADRATURE_H_
+#define QUADRATURE_H_
+
+#include <cstddef>
+
+#include "Node.h"
+#include "CompiledExpression.h"
+#include "ThreadPool.h"
+
+
+/*!
+ * \brief adaptive numerical integration
+ *
+ * Every interval is integrated with the 15 point Gauss-Kronrod rule, the
+ * difference to the embedded 7 point Gauss rule serving as error estimate.
+ * Intervals whose error is too large are bisected; the halves are
+ * independent, so they are handed to the thread pool where idle workers
+ * can steal them.
+ */
+class Quadrature
+{
+public:
+    struct Result
+    {
+        FloatVal value;
+        FloatVal error;
+        size_t intervals;
+
+        //! false if the estimated error exceeds the tolerance
+        bool converged;
+    };
+
+    /*!
+     * \brief integrates a compiled function of one variable
+     *
+     * \param tolerance the accepted error relative to the size of the
+     *        integral, or absolute if the integral is smaller than one
+     *
+     * \throws ArithmeticException if the bounds or the function values
+     *         are not finite
+     */
+    static Result integrate(const CompiledExpression& function,
+                            FloatVal a, FloatVal b, FloatVal tolerance,
+                            ThreadPool& pool);
+};
+
+
+#endif // QUADRATURE_H_
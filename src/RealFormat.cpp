@@ -0,0 +1,336 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#include "RealFormat.h"
+#include "BigInteger.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+
+namespace
+{
+    //! the number <code>f * 2^e</code>
+    struct DiyFp
+    {
+        uint64_t f;
+        int e;
+    };
+
+    //! the range of <code>e</code> the digit generation works with
+    const int alpha = -60;
+    const int gamma = -32;
+
+    //! the decimal exponents covered by the cached powers of ten
+    const int minPower = -350;
+    const int maxPower = 350;
+
+    inline DiyFp makeDiyFp(uint64_t f, int e)
+    {
+        DiyFp x = { f, e };
+        return x;
+    }
+
+    //! the upper 64 bits of the product, rounded
+    inline DiyFp multiply(DiyFp x, DiyFp y)
+    {
+        unsigned __int128 product = (unsigned __int128) x.f * y.f;
+        uint64_t high = uint64_t(product >> 64);
+        uint64_t round = uint64_t(product >> 63) & 1;
+        return makeDiyFp(high + round, x.e + y.e + 64);
+    }
+
+    inline DiyFp normalize(DiyFp x)
+    {
+        while ((x.f >> 63) == 0) {
+            x.f <<= 1;
+            x.e--;
+        }
+        return x;
+    }
+
+    BigInteger powerOfTwo(size_t exponent)
+    {
+        BigInteger result(1);
+        BigInteger base(2);
+        while (exponent != 0) {
+            if (exponent & 1)
+                result = result * base;
+            exponent >>= 1;
+            if (exponent != 0)
+                base = base * base;
+        }
+        return result;
+    }
+
+    //! the number of bits of a positive number, starting near a guess
+    size_t getBitLength(const BigInteger& value, size_t guess)
+    {
+        size_t length = guess < 1 ? 1 : guess;
+        while (length > 1 && (value - powerOfTwo(length - 1)).isNegative())
+            length--;
+        while (!(value - powerOfTwo(length)).isNegative())
+            length++;
+        return length;
+    }
+
+    //! rounds a positive quotient to the nearest integer
+    BigInteger divideRounded(const BigInteger& a, const BigInteger& b)
+    {
+        return (a * BigInteger(2) + b) / (b * BigInteger(2));
+    }
+
+    //! converts a number in [2^63, 2^64] to a normalized significand
+    DiyFp makeSignificand(const BigInteger& value, int e)
+    {
+        BigInteger word = BigInteger::fromUnsigned(1ULL << 32);
+        BigInteger high = value / word;
+        long long h;
+        long long l;
+        high.toLongLong(h);
+        (value - high * word).toLongLong(l);
+        if (h == (1LL << 32))
+            return makeDiyFp(1ULL << 63, e + 1);
+        return makeDiyFp((uint64_t(h) << 32) | uint64_t(l), e);
+    }
+
+    /*!
+     * \brief the powers of ten from 10^minPower to 10^maxPower with
+     *        normalized 64 bit significands, computed exactly once
+     */
+    std::vector<DiyFp> computeCachedPowers(void)
+    {
+        const double log2of10 = 3.321928094887362;
+        std::vector<DiyFp> powers;
+        for (int k = minPower; k <= maxPower; k++) {
+            size_t magnitude = size_t(k < 0 ? -k : k);
+            BigInteger power = BigInteger::pow10(magnitude);
+            size_t length = getBitLength(power,
+                size_t(double(magnitude) * log2of10) + 1);
+
+            if (k < 0) {
+                // 2^s / 10^-k lies in (2^63, 2^64)
+                size_t s = length + 63;
+                powers.push_back(makeSignificand(
+                    divideRounded(powerOfTwo(s), power), -int(s)));
+            }
+            else if (length > 64) {
+                size_t shift = length - 64;
+                powers.push_back(makeSignificand(
+                    divideRounded(power, powerOfTwo(shift)), int(shift)));
+            }
+            else {
+                size_t shift = 64 - length;
+                powers.push_back(makeSignificand(
+                    power * powerOfTwo(shift), -int(shift)));
+            }
+        }
+        return powers;
+    }
+
+    /*!
+     * \brief finds a power of ten c with
+     *        <code>alpha <= c.e + e + 64 <= gamma</code>
+     *
+     * \param k receives the decimal exponent of the power
+     */
+    DiyFp getCachedPower(int e, int& k)
+    {
+        static const std::vector<DiyFp> powers = computeCachedPowers();
+        k = int(::ceil(double(alpha - e - 1) * 0.30102999566398114));
+        while (k < maxPower && powers[k - minPower].e + e + 64 < alpha)
+            k++;
+        while (k > minPower && powers[k - minPower].e + e + 64 > gamma)
+            k--;
+        return powers[k - minPower];
+    }
+
+    /*!
+     * \brief the number of decimal digits of n, which is not zero
+     *
+     * \param power receives 10 to the number of digits minus one
+     */
+    int countDigits(uint32_t n, uint32_t& power)
+    {
+        int digits = 1;
+        power = 1;
+        while (n / power >= 10) {
+            power *= 10;
+            digits++;
+        }
+        return digits;
+    }
+
+    //! moves the last digit closer to the exact value
+    void roundLastDigit(char* digits, int length, uint64_t distance,
+                        uint64_t delta, uint64_t rest, uint64_t ten)
+    {
+        while (rest < distance && delta - rest >= ten &&
+               (rest + ten < distance ||
+                distance - rest > rest + ten - distance)) {
+            digits[length - 1]--;
+            rest += ten;
+        }
+    }
+
+    /*!
+     * \brief writes the digits of a positive number
+     *
+     * \return the number of digits, the value being
+     *         <code>digits * 10^exponent</code>
+     */
+    int generateDigits(double value, char* digits, int& exponent)
+    {
+        uint64_t bits;
+        ::memcpy(&bits, &value, sizeof bits);
+        const uint64_t hiddenBit = 1ULL << 52;
+        uint64_t fraction = bits & (hiddenBit - 1);
+        int biased = int(bits >> 52);
+
+        DiyFp v = biased == 0 ? makeDiyFp(fraction, 1 - 1075) :
+            makeDiyFp(fraction | hiddenBit, biased - 1075);
+
+        // the halfway points to the neighbouring numbers
+        bool closerBelow = fraction == 0 && biased > 1;
+        DiyFp upper = normalize(makeDiyFp(2 * v.f + 1, v.e - 1));
+        DiyFp lower = closerBelow ? makeDiyFp(4 * v.f - 1, v.e - 2) :
+            makeDiyFp(2 * v.f - 1, v.e - 1);
+        lower = makeDiyFp(lower.f << (lower.e - upper.e), upper.e);
+        DiyFp w = normalize(v);
+
+        int k;
+        DiyFp power = getCachedPower(upper.e, k);
+        w = multiply(w, power);
+        upper = multiply(upper, power);
+        lower = multiply(lower, power);
+        // stay inside the interval despite the rounding of the products
+        upper.f--;
+        lower.f++;
+        exponent = -k;
+
+        uint64_t delta = upper.f - lower.f;
+        uint64_t distance = upper.f - w.f;
+        DiyFp one = makeDiyFp(1ULL << -upper.e, upper.e);
+        uint32_t integral = uint32_t(upper.f >> -one.e);
+        uint64_t fractional = upper.f & (one.f - 1);
+
+        int length = 0;
+        uint32_t power10;
+        int n = countDigits(integral, power10);
+        while (n > 0) {
+            digits[length++] = char('0' + integral / power10);
+            integral %= power10;
+            n--;
+            uint64_t rest = (uint64_t(integral) << -one.e) + fractional;
+            if (rest <= delta) {
+                exponent += n;
+                roundLastDigit(digits, length, distance, delta, rest,
+                               uint64_t(power10) << -one.e);
+                return length;
+            }
+            power10 /= 10;
+        }
+
+        while (true) {
+            fractional *= 10;
+            digits[length++] = char('0' + (fractional >> -one.e));
+            fractional &= one.f - 1;
+            exponent--;
+            delta *= 10;
+            distance *= 10;
+            if (fractional <= delta)
+                break;
+        }
+        roundLastDigit(digits, length, distance, delta, fractional, one.f);
+        return length;
+    }
+}
+
+
+size_t RealFormat::format(FloatVal value, char* out)
+{
+    char* start = out;
+    if (value != value) {
+        ::memcpy(out, "nan", 3);
+        return 3;
+    }
+    if (std::signbit(value)) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value == 0) {
+        *out++ = '0';
+        return size_t(out - start);
+    }
+    if (std::isinf(value)) {
+        ::memcpy(out, "inf", 3);
+        return size_t(out - start) + 3;
+    }
+
+    char digits[20];
+    int exponent;
+    int length = generateDigits(value, digits, exponent);
+
+    // the decimal point goes after the first point digits
+    int point = length + exponent;
+    if (point >= length && point <= 17) {
+        ::memcpy(out, digits, size_t(length));
+        out += length;
+        for (int i = length; i < point; i++)
+            *out++ = '0';
+    }
+    else if (point > 0 && point < length) {
+        ::memcpy(out, digits, size_t(point));
+        out += point;
+        *out++ = '.';
+        ::memcpy(out, digits + point, size_t(length - point));
+        out += length - point;
+    }
+    else if (point > -5 && point <= 0) {
+        *out++ = '0';
+        *out++ = '.';
+        for (int i = point; i < 0; i++)
+            *out++ = '0';
+        ::memcpy(out, digits, size_t(length));
+        out += length;
+    }
+    else {
+        *out++ = digits[0];
+        if (length > 1) {
+            *out++ = '.';
+            ::memcpy(out, digits + 1, size_t(length - 1));
+            out += length - 1;
+        }
+        int e = point - 1;
+        *out++ = 'e';
+        *out++ = e < 0 ? '-' : '+';
+        if (e < 0)
+            e = -e;
+        if (e >= 100)
+            *out++ = char('0' + e / 100);
+        *out++ = char('0' + e / 10 % 10);
+        *out++ = char('0' + e % 10);
+    }
+    return size_t(out - start);
+}
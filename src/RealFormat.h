@@ -0,0 +1,61 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+
+#ifndef REALFORMAT_H_
+#define REALFORMAT_H_
+
+#include <cstddef>
+
+#include "Node.h"
+
+
+/*!
+ * \brief formats floating point numbers with the fewest digits that read
+ *        back as the same value
+ *
+ * Uses Florian Loitsch's Grisu2 algorithm, which only needs 64 bit integer
+ * arithmetic and is many times faster than <code>printf("%.17g")</code>.
+ * The digits are always read back exactly, in rare cases they are not the
+ * shortest possible ones.
+ */
+class RealFormat
+{
+public:
+    //! the longest output, including the sign and exponent
+    static const size_t maxLength = 32;
+
+    /*!
+     * \brief writes a number without a terminating zero
+     *
+     * Numbers between 1e-5 and 1e17 are written without exponent,
+     * others like <code>1.5e-07</code>. Infinity and NaN are written
+     * like <code>printf</code> writes them.
+     *
+     * \param out room for at least \link maxLength characters
+     * \return the number of characters written
+     */
+    static size_t format(FloatVal value, char* out);
+};
+
+
+#endif // REALFORMAT_H_
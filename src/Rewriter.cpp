@@ -21,136 +21,974 @@
 
 #include "Rewriter.h"
 #include "FunctionNode.h"
+#include "Natives.h"
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstdio>
+
+
+RewriteRule::RewriteRule(const std::shared_ptr<ExpressionNode>& pattern,
+                         const std::shared_ptr<ExpressionNode>& replacement,
+                         bool canonical) :
+    pattern(canonical ? pattern : canonicalize(pattern)),
+    replacement(canonical ? replacement : canonicalize(replacement))
+{
+    resetStatistics();
+
+    std::vector<std::string> bound;
+    std::vector<std::string> used;
+    getPatternVariables(this->pattern.get(), bound);
+    getPatternVariables(this->replacement.get(), used);
+    for (size_t i = 0; i < used.size(); i++) {
+        if (std::find(bound.begin(), bound.end(), used[i]) == bound.end()) {
+            throw RuntimeException("pattern variable " + used[i] +
+                                   " is not bound by " +
+                                   this->pattern->getString());
+        }
+    }
+}
+
+
+std::string RewriteRule::getString(void) const
+{
+    return pattern->getString() + " -> " + replacement->getString();
+}
+
 
-AnyValue::AnyValue(bool defined) :
-	defined(defined)
+void RewriteRule::record(uint64_t attempts, uint64_t matches,
+                         uint64_t nanoseconds) const
 {
+    statistics.attempts.fetch_add(attempts, std::memory_order_relaxed);
+    statistics.matches.fetch_add(matches, std::memory_order_relaxed);
+    statistics.nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
 }
 
 
-std::string AnyValue::getString(void) const
+void RewriteRule::resetStatistics(void)
 {
-    return "";
+    statistics.attempts = 0;
+    statistics.matches = 0;
+    statistics.nanoseconds = 0;
 }
 
 
-bool AnyValue::isDefined(void) const
+namespace
 {
-	return defined;
+    //! matches the rest of a pattern, called after a part of it matched
+    typedef std::function<bool (void)> Continuation;
+
+    //! an operand of a sum or product
+    struct Operand
+    {
+        std::shared_ptr<ExpressionNode> value;
+        bool negative;
+    };
+
+    /*!
+     * \brief backtracking pattern matcher
+     *
+     * Every way a subpattern matches is passed on to a continuation that
+     * matches the rest of the pattern. If the continuation fails, the next
+     * way is tried, so a pattern variable bound in one operand of a sum can
+     * still be bound differently when a later operand does not fit. On
+     * failure, the bindings are left as they were.
+     */
+    class Matcher
+    {
+        RewriteRule::Bindings& bindings;
+
+        //! pairings of operands tried so far
+        size_t attempts;
+
+        /*!
+         * bounds the time spent pairing up the operands of large sums and
+         * products, beyond it a pattern does not match
+         */
+        static const size_t maxAttempts = 100000;
+    public:
+        inline Matcher(RewriteRule::Bindings& bindings) :
+            bindings(bindings), attempts(0) {}
+
+        bool match(const std::shared_ptr<ExpressionNode>& pattern,
+                   const std::shared_ptr<ExpressionNode>& expression,
+                   const Continuation& next);
+
+        /*!
+         * \param rest if not <code>nullptr</code>, operands of the
+         *        expression may be left over, they are joined into
+         *        <code>*rest</code>
+         */
+        bool matchCommutative(
+                const std::shared_ptr<ExpressionNode>& pattern,
+                const std::shared_ptr<ExpressionNode>& expression,
+                std::shared_ptr<ExpressionNode>* rest,
+                const Continuation& next);
+    private:
+        bool matchChildren(const std::shared_ptr<ExpressionNode>& pattern,
+                           const std::shared_ptr<ExpressionNode>& expression,
+                           size_t i, const Continuation& next);
+        bool assign(NodeKind kind, const std::vector<Operand>& patterns,
+                    size_t i, const std::vector<Operand>& operands,
+                    std::vector<bool>& used,
+                    std::shared_ptr<ExpressionNode>* rest,
+                    const Continuation& next);
+    };
 }
 
 
-bool AnyValue::matches(const std::shared_ptr<ExpressionNode>&)
+/*!
+ * \brief lists the operands of a sum or product, the folded number last
+ */
+static void getOperands(const ExpressionNode* node,
+                        std::vector<Operand>& operands)
 {
-	return true;
+    const SumNode* sum = dynamic_cast<const SumNode*>(node);
+    if (sum != nullptr) {
+        for (size_t i = 0; i < sum->getSummands().size(); i++) {
+            const SumNode::Summand& s = sum->getSummands()[i];
+            Operand operand = { s.value, s.negative };
+            operands.push_back(operand);
+        }
+        if (sum->getConstant()) {
+            Operand operand = { sum->getConstant(), false };
+            operands.push_back(operand);
+        }
+        return;
+    }
+
+    const ProductNode* product = dynamic_cast<const ProductNode*>(node);
+    for (size_t i = 0; i < product->getFactors().size(); i++) {
+        Operand operand = { product->getFactors()[i], false };
+        operands.push_back(operand);
+    }
+    if (product->getCoefficient()) {
+        Operand operand = { product->getCoefficient(), false };
+        operands.push_back(operand);
+    }
 }
 
 
-IntegerTemplate::IntegerTemplate(bool defined, long long value) :
-AnyValue(defined), value(value)
+/*!
+ * \brief orders the operands of a pattern: those without pattern
+ *        variables are the cheapest to check, bare pattern variables match
+ *        anything and go last
+ */
+static int getMatchOrder(const ExpressionNode* pattern)
 {
+    if (RewriteRule::isPatternVariable(pattern))
+        return 2;
+    std::vector<std::string> names;
+    RewriteRule::getPatternVariables(pattern, names);
+    return names.empty() ? 0 : 1;
 }
 
 
-bool IntegerTemplate::matches(const std::shared_ptr<ExpressionNode>& expression)
+bool Matcher::match(const std::shared_ptr<ExpressionNode>& pattern,
+                    const std::shared_ptr<ExpressionNode>& expression,
+                    const Continuation& next)
 {
-    IntegerNode* it = dynamic_cast<IntegerNode*> (expression.get());
-    if (it != 0) {
-        if (!defined || it->getValue() == value)
+    if (RewriteRule::isPatternVariable(pattern.get())) {
+        const VariableNode* var =
+            static_cast<const VariableNode*>(pattern.get());
+        for (size_t i = 0; i < bindings.size(); i++) {
+            if (bindings[i].find->getName() == var->getName())
+                return bindings[i].replace->equals(expression.get()) &&
+                    next();
+        }
+        bindings.push_back(SubstituteRule(var, expression));
+        if (next())
             return true;
+        bindings.pop_back();
+        return false;
     }
-    return false;
+
+    if (DiscriminationTree::isCommutative(pattern.get()))
+        return matchCommutative(pattern, expression, nullptr, next);
+    if (!RewriteRule::sameSymbol(pattern.get(), expression.get()))
+        return false;
+    return matchChildren(pattern, expression, 0, next);
 }
 
 
+bool Matcher::matchChildren(const std::shared_ptr<ExpressionNode>& pattern,
+                            const std::shared_ptr<ExpressionNode>& expression,
+                            size_t i, const Continuation& next)
+{
+    if (i == pattern->getChildCount())
+        return next();
+    return match(pattern->getChild(i), expression->getChild(i), [&] {
+        return matchChildren(pattern, expression, i + 1, next);
+    });
+}
+
 
-VariableTemplate::VariableTemplate(bool defined, const std::string& name) :
-AnyValue(defined), name(name)
+bool Matcher::matchCommutative(
+        const std::shared_ptr<ExpressionNode>& pattern,
+        const std::shared_ptr<ExpressionNode>& expression,
+        std::shared_ptr<ExpressionNode>* rest, const Continuation& next)
 {
+    if (expression->getKind() != pattern->getKind())
+        return false;
+
+    std::vector<Operand> patterns;
+    std::vector<Operand> operands;
+    getOperands(pattern.get(), patterns);
+    getOperands(expression.get(), operands);
+    if (rest == nullptr ? operands.size() != patterns.size() :
+            operands.size() < patterns.size())
+        return false;
+
+    std::stable_sort(patterns.begin(), patterns.end(),
+        [] (const Operand& a, const Operand& b) {
+            return getMatchOrder(a.value.get()) < getMatchOrder(b.value.get());
+        });
+    std::vector<bool> used(operands.size(), false);
+    return assign(pattern->getKind(), patterns, 0, operands, used, rest,
+                  next);
 }
 
 
-bool VariableTemplate::matches(const std::shared_ptr<ExpressionNode>& expression)
+bool Matcher::assign(NodeKind kind, const std::vector<Operand>& patterns,
+                     size_t i, const std::vector<Operand>& operands,
+                     std::vector<bool>& used,
+                     std::shared_ptr<ExpressionNode>* rest,
+                     const Continuation& next)
 {
-    VariableNode* vn = dynamic_cast<VariableNode*> (expression.get());
-    if (vn != 0) {
-        if (!defined || vn->getString() == name)
+    if (i == patterns.size()) {
+        if (rest == nullptr)
+            return next();
+
+        std::vector<SumNode::Summand> summands;
+        std::vector<std::shared_ptr<ExpressionNode> > factors;
+        for (size_t j = 0; j < operands.size(); j++) {
+            if (used[j])
+                continue;
+            SumNode::Summand s = { operands[j].value, operands[j].negative };
+            summands.push_back(s);
+            factors.push_back(operands[j].value);
+        }
+        if (factors.empty())
+            *rest = nullptr;
+        else if (kind == NodeKind::SUM)
+            *rest = SumNode::create(summands);
+        else
+            *rest = ProductNode::create(factors);
+        return next();
+    }
+
+    for (size_t j = 0; j < operands.size(); j++) {
+        if (used[j] || operands[j].negative != patterns[i].negative)
+            continue;
+        if (++attempts > maxAttempts)
+            return false;
+
+        used[j] = true;
+        bool matched = match(patterns[i].value, operands[j].value, [&] {
+            return assign(kind, patterns, i + 1, operands, used, rest, next);
+        });
+        used[j] = false;
+        if (matched)
             return true;
     }
     return false;
 }
 
 
-OperationTemplate::OperationTemplate(bool defined, AnyValue* left, AnyValue* right) :
-AnyValue(defined), left(left), right(right)
+bool RewriteRule::matches(const std::shared_ptr<ExpressionNode>& expression,
+                          Bindings& bindings,
+                          std::shared_ptr<ExpressionNode>& rest) const
 {
+    bindings.clear();
+    rest = nullptr;
+    Matcher matcher(bindings);
+    Continuation done = [] { return true; };
+    if (DiscriminationTree::isCommutative(pattern.get()))
+        return matcher.matchCommutative(pattern, expression, &rest, done);
+    return matcher.match(pattern, expression, done);
 }
 
 
-AdditionTemplate::AdditionTemplate(bool defined, AnyValue* left, AnyValue* right) :
-OperationTemplate(defined, left, right)
+std::shared_ptr<ExpressionNode> RewriteRule::apply(
+        const Bindings& bindings,
+        const std::shared_ptr<ExpressionNode>& rest) const
 {
+    std::shared_ptr<ExpressionNode> result = instantiate(replacement, bindings);
+    if (!rest)
+        return result;
+    if (pattern->getKind() == NodeKind::SUM) {
+        std::vector<SumNode::Summand> summands = { { result, false },
+                                                   { rest, false } };
+        return SumNode::create(summands);
+    }
+    return ProductNode::create(
+        std::vector<std::shared_ptr<ExpressionNode> > { result, rest });
 }
 
 
-bool AdditionTemplate::matches(const std::shared_ptr<ExpressionNode>& expression)
+bool RewriteRule::isPatternVariable(const ExpressionNode* node)
 {
-    AdditionNode* an = dynamic_cast<AdditionNode*> (expression.get());
-	if (an != 0) {
-        if (!defined || (left->matches(an->getLeft()) &&
-                         right->matches(an->getRight())))
-			return true;
-	}
-	return false;
+    if (node->getKind() != NodeKind::VARIABLE)
+        return false;
+    const std::string& name =
+        static_cast<const VariableNode*>(node)->getName();
+    return name.size() > 1 && name[name.size() - 1] == '_';
 }
 
 
-RewriteRule::RewriteRule(AnyValue* find,
-                         const std::shared_ptr<ExpressionNode>& replace) :
-    find(find), replace(replace)
+void RewriteRule::getPatternVariables(const ExpressionNode* expression,
+                                      std::vector<std::string>& names)
 {
+    if (isPatternVariable(expression)) {
+        const std::string& name =
+            static_cast<const VariableNode*>(expression)->getName();
+        if (std::find(names.begin(), names.end(), name) == names.end())
+            names.push_back(name);
+        return;
+    }
+    for (size_t i = 0; i < expression->getChildCount(); i++)
+        getPatternVariables(expression->getChild(i).get(), names);
 }
 
 
-std::shared_ptr<ExpressionNode> RewriteRule::getReplace(
-        const std::shared_ptr<ExpressionNode>& node)
+std::shared_ptr<ExpressionNode> RewriteRule::instantiate(
+        const std::shared_ptr<ExpressionNode>& expression,
+        const Bindings& bindings)
+{
+    if (isPatternVariable(expression.get())) {
+        const std::string& name =
+            static_cast<const VariableNode*>(expression.get())->getName();
+        for (size_t i = 0; i < bindings.size(); i++) {
+            if (bindings[i].find->getName() == name)
+                return bindings[i].replace;
+        }
+        throw RuntimeException("unbound pattern variable " + name);
+    }
+
+    size_t count = expression->getChildCount();
+    if (count == 0)
+        return expression;
+
+    std::vector<std::shared_ptr<ExpressionNode> > children;
+    children.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        children.push_back(instantiate(expression->getChild(i), bindings));
+    return expression->replaceChildren(children);
+}
+
+
+std::shared_ptr<ExpressionNode> RewriteRule::canonicalize(
+        const std::shared_ptr<ExpressionNode>& expression)
+{
+    size_t count = expression->getChildCount();
+    if (count == 0)
+        return expression;
+
+    std::vector<std::shared_ptr<ExpressionNode> > children;
+    children.reserve(count);
+    for (size_t i = 0; i < count; i++)
+        children.push_back(canonicalize(expression->getChild(i)));
+    return expression->replaceChildren(children);
+}
+
+
+bool RewriteRule::match(const std::shared_ptr<ExpressionNode>& pattern,
+                        const std::shared_ptr<ExpressionNode>& expression,
+                        Bindings& bindings)
+{
+    Matcher matcher(bindings);
+    return matcher.match(pattern, expression, [] { return true; });
+}
+
+
+bool RewriteRule::sameSymbol(const ExpressionNode* a, const ExpressionNode* b)
+{
+    return DiscriminationTree::getKey(a) == DiscriminationTree::getKey(b);
+}
+
+
+bool DiscriminationTree::Key::operator == (const Key& other) const
+{
+    return kind == other.kind && arity == other.arity && value == other.value;
+}
+
+
+size_t DiscriminationTree::KeyHash::operator () (const Key& key) const
+{
+    size_t h = std::hash<std::string>()(key.value);
+    h ^= (size_t(key.kind) * 0x9e3779b9) + (key.arity << 6) + (h >> 2);
+    return h;
+}
+
+
+DiscriminationTree::TrieNode::TrieNode(void) :
+    wildcard(nullptr)
+{
+}
+
+
+DiscriminationTree::TrieNode::~TrieNode(void)
+{
+    for (auto i = children.begin(); i != children.end(); i++)
+        delete i->second;
+    delete wildcard;
+}
+
+
+DiscriminationTree::Key DiscriminationTree::getKey(const ExpressionNode* node)
+{
+    Key key = { node->getKind(), node->getChildCount(), "" };
+
+    switch (key.kind) {
+    case NodeKind::INTEGER: {
+        long long int value = static_cast<const IntegerNode*>(node)->getValue();
+        key.value.assign(reinterpret_cast<const char*>(&value), sizeof value);
+        break;
+    }
+    case NodeKind::REAL: {
+        FloatVal value = static_cast<const RealNode*>(node)->getValue();
+        key.value.assign(reinterpret_cast<const char*>(&value), sizeof value);
+        break;
+    }
+    case NodeKind::VARIABLE:
+        key.value = static_cast<const VariableNode*>(node)->getName();
+        break;
+    case NodeKind::SUM: {
+        // the signs of the summands are not children, but distinguish sums
+        const SumNode* sum = dynamic_cast<const SumNode*>(node);
+        const std::vector<SumNode::Summand>& summands = sum->getSummands();
+        key.value.reserve(summands.size() + 1);
+        for (size_t i = 0; i < summands.size(); i++)
+            key.value += summands[i].negative ? '-' : '+';
+        if (sum->getConstant())
+            key.value += 'c';
+        break;
+    }
+    case NodeKind::PRODUCT:
+        if (dynamic_cast<const ProductNode*>(node)->getCoefficient())
+            key.value = "c";
+        break;
+    case NodeKind::COMPARISON:
+        key.value = dynamic_cast<const ComparisonNode*>(node)->getOperator();
+        break;
+    case NodeKind::OTHER:
+        // a native function matches the name it is bound to
+        if (dynamic_cast<const NativeFunction*>(node) != nullptr)
+            key.kind = NodeKind::VARIABLE;
+        if (key.arity == 0)
+            key.value = node->getString();
+        break;
+    default:
+        if (key.arity == 0)
+            key.value = node->getString();
+        break;
+    }
+    return key;
+}
+
+
+bool DiscriminationTree::isCommutative(const ExpressionNode* node)
+{
+    NodeKind kind = node->getKind();
+    return kind == NodeKind::SUM || kind == NodeKind::PRODUCT;
+}
+
+
+/*!
+ * \brief the trie label of a sum or product, which stands for all of its
+ *        operands
+ */
+static DiscriminationTree::Key getCommutativeKey(const ExpressionNode* node)
+{
+    DiscriminationTree::Key key = { node->getKind(), 0, "" };
+    return key;
+}
+
+
+void DiscriminationTree::add(const ExpressionNode* pattern, size_t index)
+{
+    TrieNode* node = &root;
+    std::vector<const ExpressionNode*> pending;
+    pending.push_back(pattern);
+
+    while (!pending.empty()) {
+        const ExpressionNode* term = pending.back();
+        pending.pop_back();
+
+        if (RewriteRule::isPatternVariable(term)) {
+            if (node->wildcard == nullptr)
+                node->wildcard = new TrieNode();
+            node = node->wildcard;
+            continue;
+        }
+
+        bool commutative = isCommutative(term);
+        TrieNode*& child = node->children[commutative ?
+            getCommutativeKey(term) : getKey(term)];
+        if (child == nullptr)
+            child = new TrieNode();
+        node = child;
+
+        // the operands of sums and products are left to the matcher
+        if (commutative)
+            continue;
+        for (size_t i = term->getChildCount(); i > 0; i--)
+            pending.push_back(term->getChild(i - 1).get());
+    }
+
+    node->rules.push_back(index);
+}
+
+
+void DiscriminationTree::clear(void)
+{
+    for (auto i = root.children.begin(); i != root.children.end(); i++)
+        delete i->second;
+    root.children.clear();
+    delete root.wildcard;
+    root.wildcard = nullptr;
+    root.rules.clear();
+}
+
+
+void DiscriminationTree::getCandidates(const ExpressionNode* expression,
+                                       std::vector<size_t>& candidates) const
+{
+    size_t first = candidates.size();
+    std::vector<const ExpressionNode*> pending;
+    pending.push_back(expression);
+    collect(&root, pending, candidates);
+    std::sort(candidates.begin() + first, candidates.end());
+}
+
+
+void DiscriminationTree::collect(const TrieNode* node,
+                                 std::vector<const ExpressionNode*>& pending,
+                                 std::vector<size_t>& candidates) const
+{
+    if (pending.empty()) {
+        candidates.insert(candidates.end(), node->rules.begin(),
+                          node->rules.end());
+        return;
+    }
+
+    const ExpressionNode* term = pending.back();
+    pending.pop_back();
+
+    // a wildcard swallows the whole subterm
+    if (node->wildcard != nullptr)
+        collect(node->wildcard, pending, candidates);
+
+    if (isCommutative(term)) {
+        auto child = node->children.find(getCommutativeKey(term));
+        if (child != node->children.end())
+            collect(child->second, pending, candidates);
+        pending.push_back(term);
+        return;
+    }
+
+    auto child = node->children.find(getKey(term));
+    if (child != node->children.end()) {
+        size_t size = pending.size();
+        for (size_t i = term->getChildCount(); i > 0; i--)
+            pending.push_back(term->getChild(i - 1).get());
+        collect(child->second, pending, candidates);
+        pending.resize(size);
+    }
+
+    pending.push_back(term);
+}
+
+
+/*!
+ * \brief creates a pattern variable, or a variable if the name has no
+ *        trailing underscore
+ */
+static std::shared_ptr<ExpressionNode> var(const std::string& name)
+{
+    return std::make_shared<VariableNode>(name);
+}
+
+
+static std::shared_ptr<ExpressionNode> integer(long long value)
+{
+    return std::make_shared<IntegerNode>(value);
+}
+
+
+static std::shared_ptr<ExpressionNode> call(const std::string& function,
+        const std::shared_ptr<ExpressionNode>& argument)
+{
+    return std::make_shared<FunctionCallNode>(var(function),
+        std::vector<std::shared_ptr<ExpressionNode> > { argument });
+}
+
+
+static std::shared_ptr<ExpressionNode> power(
+        const std::shared_ptr<ExpressionNode>& base,
+        const std::shared_ptr<ExpressionNode>& exponent)
+{
+    return std::make_shared<PowerNode>(base, exponent);
+}
+
+
+static std::shared_ptr<ExpressionNode> sum(
+        const std::shared_ptr<ExpressionNode>& a,
+        const std::shared_ptr<ExpressionNode>& b, bool subtract)
 {
-	if (find->matches(node)) {
-		return replace;
-	}
-	else {
-		return node;
-	}
+    std::vector<SumNode::Summand> summands = { { a, false }, { b, subtract } };
+    return SumNode::create(summands);
 }
 
 
-void RewriteRule::initializeRules(void)
+static std::shared_ptr<ExpressionNode> product(
+        const std::shared_ptr<ExpressionNode>& a,
+        const std::shared_ptr<ExpressionNode>& b)
 {
+    return ProductNode::create(
+        std::vector<std::shared_ptr<ExpressionNode> > { a, b });
 }
 
 
-/*const std::vector<RewriteRule*> RewriteRule::getRules(void)
+Rewriter::Rewriter(void) :
+    parallelCutoff(4096),
+    version(createStamp()),
+    profiling(false)
 {
-	return rules;
-}*/
+    std::shared_ptr<ExpressionNode> x = var("x_");
+
+    addRule(new RewriteRule(sum(x, x, true), integer(0)));
+    addRule(new RewriteRule(std::make_shared<DivisionNode>(x, x), integer(1)));
+    addRule(new RewriteRule(power(x, integer(0)), integer(1)));
+    addRule(new RewriteRule(power(x, integer(1)), x));
+    addRule(new RewriteRule(product(x, x), power(x, integer(2))));
+    addRule(new RewriteRule(call("ln", call("exp", x)), x));
+    addRule(new RewriteRule(call("exp", call("ln", x)), x));
+    addRule(new RewriteRule(sum(power(call("cos", x), integer(2)),
+                                power(call("sin", x), integer(2)), false),
+                            integer(1)));
+}
 
 
-Rewriter::Rewriter(void)
+Rewriter::~Rewriter(void)
 {
-    rules.push_back(new RewriteRule(new IntegerTemplate(true, 5),
-                                    std::make_shared<IntegerNode>(8)));
-    //AdditionNode* twice = new AdditionNode(new AnyValue(), new AdditionNode(new AnyValue(), new AnyValue()));
+    for (size_t i = 0; i < rules.size(); i++)
+        delete rules[i];
+}
+
+
+void Rewriter::addRule(RewriteRule* rule)
+{
+    index.add(rule->getPattern().get(), rules.size());
+    rules.push_back(rule);
+    version = createStamp();
 }
 
 
 std::shared_ptr<ExpressionNode> Rewriter::replace(
         const std::shared_ptr<ExpressionNode>& node)
 {
+    std::atomic<size_t> steps(0);
     std::shared_ptr<ExpressionNode> replaced = node;
-	for (size_t i = 0; i < rules.size(); i++) {
-        //std::shared_ptr<ExpressionNode> old = node;
-        replaced = rules[i]->getReplace(replaced);
-	}
-    return replaced;
+    while (true) {
+        std::shared_ptr<ExpressionNode> next = replaceOnce(replaced);
+        // a rule that reproduces its input is no progress
+        if (!next || next->equals(replaced.get()))
+            return replaced;
+        takeStep(steps);
+        replaced = next;
+    }
+}
+
+
+std::shared_ptr<ExpressionNode> Rewriter::replaceOnce(
+        const std::shared_ptr<ExpressionNode>& node)
+{
+    std::vector<size_t> candidates;
+    index.getCandidates(node.get(), candidates);
+
+    RewriteRule::Bindings bindings;
+    std::shared_ptr<ExpressionNode> rest;
+    for (size_t i = 0; i < candidates.size(); i++) {
+        const RewriteRule* rule = rules[candidates[i]];
+        if (!profiling) {
+            if (rule->matches(node, bindings, rest))
+                return rule->apply(bindings, rest);
+            continue;
+        }
+
+        typedef std::chrono::steady_clock Clock;
+        Clock::time_point start = Clock::now();
+        bool matched = rule->matches(node, bindings, rest);
+        std::shared_ptr<ExpressionNode> replaced;
+        if (matched)
+            replaced = rule->apply(bindings, rest);
+        rule->record(1, matched ? 1 : 0,
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                Clock::now() - start).count());
+        if (matched)
+            return replaced;
+    }
+    return nullptr;
+}
+
+
+void Rewriter::printStatistics(std::ostream& out) const
+{
+    std::vector<const RewriteRule*> sorted(rules.begin(), rules.end());
+    std::stable_sort(sorted.begin(), sorted.end(),
+        [] (const RewriteRule* a, const RewriteRule* b) {
+            return a->getStatistics().nanoseconds >
+                   b->getStatistics().nanoseconds;
+        });
+
+    out << std::setw(12) << "attempts" << std::setw(12) << "matches"
+        << std::setw(14) << "time [us]" << "  rule\n";
+    for (size_t i = 0; i < sorted.size(); i++) {
+        const RewriteRule::Statistics& st = sorted[i]->getStatistics();
+        out << std::setw(12) << st.attempts << std::setw(12) << st.matches
+            << std::setw(14) << std::fixed << std::setprecision(1)
+            << double(st.nanoseconds) / 1000.0
+            << "  " << sorted[i]->getString() << "\n";
+    }
+}
+
+
+namespace
+{
+    struct ProfileEntry
+    {
+        uint64_t attempts;
+        uint64_t matches;
+        uint64_t nanoseconds;
+    };
+}
+
+
+/*!
+ * \brief reads a profile written by \link Rewriter::saveProfile
+ *
+ * Each line holds the counters and the rule, separated by a tab.
+ */
+static bool readProfile(const std::string& path,
+                        std::unordered_map<std::string, ProfileEntry>& entries)
+{
+    std::ifstream in(path.c_str());
+    if (!in)
+        return false;
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t tab = line.find('\t');
+        if (tab == std::string::npos)
+            continue;
+        std::istringstream counters(line.substr(0, tab));
+        ProfileEntry entry;
+        if (!(counters >> entry.attempts >> entry.matches
+                       >> entry.nanoseconds))
+            continue;
+        ProfileEntry& stored = entries[line.substr(tab + 1)];
+        stored.attempts += entry.attempts;
+        stored.matches += entry.matches;
+        stored.nanoseconds += entry.nanoseconds;
+    }
+    return true;
+}
+
+
+void Rewriter::saveProfile(const std::string& path) const
+{
+    std::unordered_map<std::string, ProfileEntry> entries;
+    readProfile(path, entries);
+
+    std::vector<std::string> order;
+    for (size_t i = 0; i < rules.size(); i++) {
+        const RewriteRule::Statistics& st = rules[i]->getStatistics();
+        std::string rule = rules[i]->getString();
+        ProfileEntry& entry = entries[rule];
+        entry.attempts += st.attempts;
+        entry.matches += st.matches;
+        entry.nanoseconds += st.nanoseconds;
+        order.push_back(rule);
+    }
+    // keep rules that are not loaded right now
+    for (auto i = entries.begin(); i != entries.end(); i++) {
+        if (std::find(order.begin(), order.end(), i->first) == order.end())
+            order.push_back(i->first);
+    }
+
+    std::string temporary = path + ".tmp";
+    std::ofstream out(temporary.c_str());
+    out << "# attempts matches nanoseconds\trule\n";
+    for (size_t i = 0; i < order.size(); i++) {
+        const ProfileEntry& entry = entries[order[i]];
+        out << entry.attempts << " " << entry.matches << " "
+            << entry.nanoseconds << "\t" << order[i] << "\n";
+    }
+    out.close();
+    if (!out || std::rename(temporary.c_str(), path.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw RuntimeException("cannot write rule profile " + path);
+    }
+}
+
+
+bool Rewriter::applyProfile(const std::string& path)
+{
+    std::unordered_map<std::string, ProfileEntry> entries;
+    if (!readProfile(path, entries))
+        return false;
+
+    // trying the rules by descending matches per time minimizes the
+    // expected time until the first match
+    std::vector<std::pair<double, size_t> > scores;
+    scores.reserve(rules.size());
+    for (size_t i = 0; i < rules.size(); i++) {
+        auto entry = entries.find(rules[i]->getString());
+        double score = -1;
+        if (entry != entries.end() && entry->second.attempts > 0)
+            score = double(entry->second.matches) /
+                    double(entry->second.nanoseconds + 1);
+        scores.push_back(std::make_pair(score, i));
+    }
+    std::stable_sort(scores.begin(), scores.end(),
+        [] (const std::pair<double, size_t>& a,
+            const std::pair<double, size_t>& b) {
+            return a.first > b.first;
+        });
+
+    std::vector<RewriteRule*> reordered;
+    reordered.reserve(rules.size());
+    index.clear();
+    for (size_t i = 0; i < scores.size(); i++) {
+        RewriteRule* rule = rules[scores[i].second];
+        index.add(rule->getPattern().get(), reordered.size());
+        reordered.push_back(rule);
+    }
+    rules.swap(reordered);
+    version = createStamp();
+    return true;
+}
+
+
+std::shared_ptr<ExpressionNode> Rewriter::normalize(
+        const std::shared_ptr<ExpressionNode>& node)
+{
+    ThreadPool* pool = nullptr;
+    if (countNodes(node.get(), parallelCutoff) >= parallelCutoff)
+        pool = &ThreadPool::getDefault();
+    std::atomic<size_t> steps(0);
+    return normalize(node, pool, steps);
+}
+
+
+size_t Rewriter::countNodes(const ExpressionNode* node, size_t limit)
+{
+    size_t count = 0;
+    std::vector<const ExpressionNode*> pending;
+    pending.push_back(node);
+    while (!pending.empty() && count < limit) {
+        const ExpressionNode* current = pending.back();
+        pending.pop_back();
+        count++;
+        for (size_t i = 0; i < current->getChildCount(); i++)
+            pending.push_back(current->getChild(i).get());
+    }
+    return count;
+}
+
+
+std::shared_ptr<ExpressionNode> Rewriter::normalize(
+        const std::shared_ptr<ExpressionNode>& node, ThreadPool* pool,
+        std::atomic<size_t>& steps)
+{
+    if (node->isNormalFor(version))
+        return node;
+
+    std::shared_ptr<ExpressionNode> current =
+        normalizeChildren(node, pool, steps);
+    while (true) {
+        std::shared_ptr<ExpressionNode> next = replaceOnce(current);
+        // a rule that reproduces its input is no progress
+        if (!next || next->equals(current.get())) {
+            current->markNormal(version);
+            return current;
+        }
+        takeStep(steps);
+        // the replacement may contain new redexes below its root
+        current = normalizeChildren(next, pool, steps);
+    }
+}
+
+
+void Rewriter::takeStep(std::atomic<size_t>& steps)
+{
+    if (steps.fetch_add(1, std::memory_order_relaxed) >= maxSteps) {
+        throw RuntimeException("rules still apply after " +
+                               std::to_string(maxSteps) + " rewrites, they "
+                               "may contain a cycle");
+    }
+}
+
+
+std::shared_ptr<ExpressionNode> Rewriter::normalizeChildren(
+        const std::shared_ptr<ExpressionNode>& node, ThreadPool* pool,
+        std::atomic<size_t>& steps)
+{
+    size_t count = node->getChildCount();
+    if (count == 0)
+        return node;
+
+    std::vector<std::shared_ptr<ExpressionNode> > children(count);
+
+    if (pool == nullptr) {
+        for (size_t i = 0; i < count; i++)
+            children[i] = normalize(node->getChild(i), nullptr, steps);
+    }
+    else {
+        // large children become tasks of their own, small ones are
+        // batched until a batch is worth a task
+        TaskGroup group(*pool);
+        std::vector<size_t> batch;
+        size_t batchSize = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t size = countNodes(node->getChild(i).get(), parallelCutoff);
+            if (size >= parallelCutoff) {
+                group.run([this, &node, &children, pool, &steps, i] {
+                    children[i] = normalize(node->getChild(i), pool, steps);
+                });
+                continue;
+            }
+
+            batch.push_back(i);
+            batchSize += size;
+            if (batchSize >= parallelCutoff) {
+                group.run([this, &node, &children, &steps, batch] {
+                    for (size_t j = 0; j < batch.size(); j++) {
+                        children[batch[j]] = normalize(
+                            node->getChild(batch[j]), nullptr, steps);
+                    }
+                });
+                batch.clear();
+                batchSize = 0;
+            }
+        }
+        for (size_t j = 0; j < batch.size(); j++)
+            children[batch[j]] =
+                normalize(node->getChild(batch[j]), nullptr, steps);
+        group.wait();
+    }
+
+    bool changed = false;
+    for (size_t i = 0; i < count; i++)
+        changed = changed || children[i] != node->getChild(i);
+    return changed ? node->replaceChildren(children) : node;
 }
 
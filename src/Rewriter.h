@@ -24,9 +24,14 @@
 
 #include <string>
 #include <vector>
+#include <unordered_map>
+#include <atomic>
+#include <ostream>
 
 #include "Node.h"
 
+class ThreadPool;
+
 
 struct SubstituteRule
 {
@@ -41,105 +46,328 @@ struct SubstituteRule
 };
 
 
-// ==============
-// == OLD PART ==
-// ==============
-
-class AnyValue
+/*!
+ * \brief a rule replacing every match of a pattern by another expression
+ *
+ * Variables whose names end with an underscore, like <code>x_</code>, are
+ * pattern variables. They match any subexpression; if a variable occurs
+ * several times, all occurrences have to match equal subexpressions.
+ *
+ * The operands of sums and products, including the folded number, are
+ * matched in any order. At the root of an expression, a sum or product
+ * pattern also matches a part of the operands, the others are kept next to
+ * the replacement: <code>x_ - x_ -> 0</code> rewrites
+ * <code>w + z - z</code> to <code>w</code>.
+ */
+class RewriteRule
 {
-protected:
-	/*!
-	 * determines if the template represents one specific value,
-	 * or the whole type of value
-	 */
-	bool defined;
 public:
-	AnyValue(bool defined);
-    virtual std::string getString(void) const;
-    
-    bool isDefined(void) const;
-    
-    virtual bool matches(const std::shared_ptr<ExpressionNode>& expression);
-};
+    /*!
+     * \brief how often and how expensively a rule was tried
+     *
+     * Only recorded while the owning rewriter is profiling.
+     */
+    struct Statistics
+    {
+        std::atomic<uint64_t> attempts;
+        std::atomic<uint64_t> matches;
+        std::atomic<uint64_t> nanoseconds;
+    };
+private:
+    std::shared_ptr<ExpressionNode> pattern;
+    std::shared_ptr<ExpressionNode> replacement;
+    mutable Statistics statistics;
+public:
+    typedef std::vector<SubstituteRule> Bindings;
 
+    /*!
+     * \param canonical <code>true</code> if both expressions are known to
+     *        be in canonical order already, e.g. because they were loaded
+     *        from a rule cache
+     * \throws RuntimeException if the replacement contains a pattern
+     *         variable that the pattern does not bind
+     */
+    RewriteRule(const std::shared_ptr<ExpressionNode>& pattern,
+                const std::shared_ptr<ExpressionNode>& replacement,
+                bool canonical = false);
 
-class IntegerTemplate : public AnyValue
-{
-protected:
-    long long value;
-public:
-    IntegerTemplate(bool defined, long long value);
-    virtual bool matches(const std::shared_ptr<ExpressionNode>& expression);
-};
+    inline const std::shared_ptr<ExpressionNode>& getPattern(void) const
+    { return pattern; }
+    inline const std::shared_ptr<ExpressionNode>& getReplacement(void) const
+    { return replacement; }
 
+    /*!
+     * \return the rule as written in rule files
+     */
+    std::string getString(void) const;
 
-class VariableTemplate : public AnyValue
-{
-protected:
-    std::string name;
-public:
-    VariableTemplate(bool defined, const std::string& name);
-    virtual bool matches(const std::shared_ptr<ExpressionNode>& expression);
-};
+    inline const Statistics& getStatistics(void) const { return statistics; }
+    void record(uint64_t attempts, uint64_t matches,
+                uint64_t nanoseconds) const;
+    void resetStatistics(void);
 
+    /*!
+     * \brief matches the pattern against an expression
+     *
+     * \param bindings receives the subexpressions matched by the pattern
+     *        variables
+     * \param rest receives the operands of a sum or product the pattern
+     *        did not match, joined into one expression, or
+     *        <code>nullptr</code> if it matched all of them
+     */
+    bool matches(const std::shared_ptr<ExpressionNode>& expression,
+                 Bindings& bindings,
+                 std::shared_ptr<ExpressionNode>& rest) const;
 
-class OperationTemplate : public AnyValue
-{
-protected:
-	AnyValue* left;
-	AnyValue* right;
-public:
-	OperationTemplate(bool defined, AnyValue* left, AnyValue* right);
-	inline AnyValue* getLeft(void) { return left; }
-	inline AnyValue* getRight(void) { return right; }
-};
+    /*!
+     * \brief instantiates the replacement with the bound subexpressions
+     *        and adds or multiplies the unmatched operands
+     */
+    std::shared_ptr<ExpressionNode> apply(
+            const Bindings& bindings,
+            const std::shared_ptr<ExpressionNode>& rest) const;
 
+    static bool isPatternVariable(const ExpressionNode* node);
 
-class AdditionTemplate : public OperationTemplate
-{
-protected:
-public:
-	AdditionTemplate(bool defined, AnyValue* left, AnyValue* right);
-    virtual bool matches(const std::shared_ptr<ExpressionNode>& expression);
-};
+    /*!
+     * \brief collects the names of all pattern variables of an expression
+     */
+    static void getPatternVariables(const ExpressionNode* expression,
+                                    std::vector<std::string>& names);
 
+    /*!
+     * \brief replaces the pattern variables of an expression
+     */
+    static std::shared_ptr<ExpressionNode> instantiate(
+            const std::shared_ptr<ExpressionNode>& expression,
+            const Bindings& bindings);
 
-class IdentifierTemplate : public AnyValue
-{
-};
+    /*!
+     * \brief brings sums and products into the order evaluation produces
+     *
+     * Parsed patterns keep their operands in source order, which would
+     * never match an evaluated expression.
+     */
+    static std::shared_ptr<ExpressionNode> canonicalize(
+            const std::shared_ptr<ExpressionNode>& expression);
 
+    /*!
+     * \brief structural matching of a pattern
+     *
+     * Sums and products have to match all of their operands.
+     */
+    static bool match(const std::shared_ptr<ExpressionNode>& pattern,
+                      const std::shared_ptr<ExpressionNode>& expression,
+                      Bindings& bindings);
 
-class ReplaceIdentifier : public AnyValue
-{
+    /*!
+     * \return <code>true</code>, if two nodes have the same type, the same
+     *         number of operands and the same value, disregarding their
+     *         operands
+     */
+    static bool sameSymbol(const ExpressionNode* a, const ExpressionNode* b);
 };
 
 
-class RewriteRule
+/*!
+ * \brief index of rule patterns for fast retrieval of candidate rules
+ *
+ * Patterns are stored in a trie over their nodes in preorder. Each trie
+ * edge is labelled with the type, the number of operands and the value of
+ * a node, or is a wildcard for a pattern variable. Looking up the candidate
+ * rules for an expression walks the trie along the expression, which takes
+ * time proportional to the size of the patterns, not to the number of
+ * rules. Sums and products are only indexed by their kind, since their
+ * operands match in any order.
+ */
+class DiscriminationTree
 {
-	AnyValue* find;
-    const std::shared_ptr<ExpressionNode> replace;
-	
-	static std::vector<RewriteRule*> rules;
 public:
-    RewriteRule(AnyValue* find,
-                const std::shared_ptr<ExpressionNode>& replace);
-	
-    std::shared_ptr<ExpressionNode> getReplace(
-            const std::shared_ptr<ExpressionNode>& node);
-	
-	static void initializeRules(void);
-	//static const std::vector<RewriteRule*> getRules(void);
+    struct Key
+    {
+        NodeKind kind;
+        size_t arity;
+        std::string value;
+
+        bool operator == (const Key& other) const;
+    };
+
+    struct KeyHash
+    {
+        size_t operator () (const Key& key) const;
+    };
+
+private:
+    struct TrieNode
+    {
+        std::unordered_map<Key, TrieNode*, KeyHash> children;
+        TrieNode* wildcard;
+        std::vector<size_t> rules;
+
+        TrieNode(void);
+        ~TrieNode(void);
+    };
+
+    TrieNode root;
+public:
+    DiscriminationTree(void) = default;
+    DiscriminationTree(const DiscriminationTree&) = delete;
+    DiscriminationTree& operator = (const DiscriminationTree&) = delete;
+
+    static Key getKey(const ExpressionNode* node);
+
+    /*!
+     * \return <code>true</code> for sums and products, whose operands are
+     *         matched in any order
+     */
+    static bool isCommutative(const ExpressionNode* node);
+
+    /*!
+     * \brief stores a pattern under an index
+     */
+    void add(const ExpressionNode* pattern, size_t index);
+
+    void clear(void);
+
+    /*!
+     * \brief finds the indices of all patterns that may match an expression
+     *
+     * The indices are appended to the vector in ascending order. The
+     * candidates still have to be checked with \link RewriteRule::matches,
+     * since the trie does not know whether pattern variables occurring
+     * several times are bound consistently.
+     */
+    void getCandidates(const ExpressionNode* expression,
+                       std::vector<size_t>& candidates) const;
+private:
+    void collect(const TrieNode* node,
+                 std::vector<const ExpressionNode*>& pending,
+                 std::vector<size_t>& candidates) const;
 };
 
 
 class Rewriter
 {
+public:
+    //! bounds the work of one rewrite if the rules contain a cycle
+    static const size_t maxSteps = 100000;
+
+private:
     std::vector<RewriteRule*> rules;
+    DiscriminationTree index;
+
+    //! subtrees with fewer nodes are normalized by the thread reaching them
+    size_t parallelCutoff;
+
+    //! changes whenever a rule is added
+    uint64_t version;
+
+    bool profiling;
 public:
-	Rewriter(void);
-	
+    Rewriter(void);
+    ~Rewriter(void);
+    Rewriter(const Rewriter&) = delete;
+    Rewriter& operator = (const Rewriter&) = delete;
+
+    /*!
+     * \brief adds a rule, taking ownership of it
+     *
+     * Rules added earlier take precedence if several match.
+     */
+    void addRule(RewriteRule* rule);
+
+    inline const std::vector<RewriteRule*>& getRules(void) const
+    { return rules; }
+
+    /*!
+     * \brief rewrites the root of an expression until no rule matches
+     *
+     * \throws RuntimeException if the rules still apply after
+     *         \link maxSteps rewrites
+     */
     std::shared_ptr<ExpressionNode> replace(
             const std::shared_ptr<ExpressionNode>& node);
+
+    /*!
+     * \brief applies the first matching rule to the root of an expression
+     *
+     * \return the rewritten expression, or <code>nullptr</code> if no rule
+     *         matches
+     */
+    std::shared_ptr<ExpressionNode> replaceOnce(
+            const std::shared_ptr<ExpressionNode>& node);
+
+    /*!
+     * \brief rewrites an expression bottom-up until no rule matches any
+     *        subexpression
+     *
+     * Subtrees normalized before with the same rules are not visited
+     * again. Independent subtrees larger than the cutoff are normalized in
+     * parallel on the default \link ThreadPool. Since rules are applied to
+     * each subtree in the same order either way, the result does not depend
+     * on the number of threads.
+     *
+     * \throws RuntimeException if the rules still apply after
+     *         \link maxSteps rewrites in the whole expression
+     */
+    std::shared_ptr<ExpressionNode> normalize(
+            const std::shared_ptr<ExpressionNode>& node);
+
+    inline void setParallelCutoff(size_t nodes) { parallelCutoff = nodes; }
+
+    inline uint64_t getVersion(void) const { return version; }
+
+    /*!
+     * \brief enables counting attempts, matches and time spent per rule
+     */
+    inline void setProfiling(bool enabled) { profiling = enabled; }
+    inline bool isProfiling(void) const { return profiling; }
+
+    /*!
+     * \brief writes a table of the rule statistics, most expensive first
+     */
+    void printStatistics(std::ostream& out) const;
+
+    /*!
+     * \brief saves the rule statistics, adding up those already saved
+     *        in the file
+     */
+    void saveProfile(const std::string& path) const;
+
+    /*!
+     * \brief reorders the rules by the statistics in a saved profile
+     *
+     * Rules that matched often at little cost are tried first. Rules
+     * missing in the profile keep their order behind the others. If
+     * several rules match an expression, the reordering can change which
+     * one is applied.
+     *
+     * \return <code>false</code> if the profile could not be read
+     */
+    bool applyProfile(const std::string& path);
+
+    /*!
+     * \brief counts the nodes of an expression, stopping at a limit
+     */
+    static size_t countNodes(const ExpressionNode* node, size_t limit);
+
+private:
+    /*!
+     * \param steps the rewrites done so far, shared by all subtrees
+     */
+    std::shared_ptr<ExpressionNode> normalize(
+            const std::shared_ptr<ExpressionNode>& node, ThreadPool* pool,
+            std::atomic<size_t>& steps);
+    std::shared_ptr<ExpressionNode> normalizeChildren(
+            const std::shared_ptr<ExpressionNode>& node, ThreadPool* pool,
+            std::atomic<size_t>& steps);
+
+    /*!
+     * \brief counts a rewrite step
+     *
+     * \throws RuntimeException if the steps are used up
+     */
+    static void takeStep(std::atomic<size_t>& steps);
 };
 
 #endif // REWRITER_H_
@@ -0,0 +1,233 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "RootFinder.h"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <string>
+
+
+namespace
+{
+    inline FloatVal evaluate(const CompiledExpression& function, FloatVal x)
+    {
+        return function.evaluate(&x);
+    }
+
+
+    inline FloatVal evaluate(const CompiledExpression& function, FloatVal x,
+                             FloatVal& derivative)
+    {
+        return function.evaluate(&x, 0, derivative);
+    }
+
+
+    inline bool differentSigns(FloatVal a, FloatVal b)
+    {
+        return (a < 0) != (b < 0);
+    }
+
+
+    //! number of times a step is halved before giving up
+    const int maxHalvings = 40;
+}
+
+
+RootFinder::Result RootFinder::newton(const CompiledExpression& function,
+                                      FloatVal start, FloatVal tolerance)
+{
+    Result result;
+    FloatVal x = start;
+    FloatVal slope;
+    FloatVal value = evaluate(function, x, slope);
+
+    // an interval known to contain a root, once one is found
+    bool bracketed = false;
+    FloatVal low = 0;
+    FloatVal high = 0;
+    FloatVal lowValue = 0;
+
+    for (size_t i = 0; i < maxIterations; i++) {
+        result.root = x;
+        result.iterations = i;
+        if (value == 0)
+            return result;
+        if (!std::isfinite(value)) {
+            throw ArithmeticException("function is not finite at " +
+                                      std::to_string(x));
+        }
+
+        FloatVal step = value / slope;
+        FloatVal next = x - step;
+        if (bracketed && !(next > low && next < high)) {
+            Result refined = brent(function, low, high, tolerance);
+            refined.iterations += i;
+            return refined;
+        }
+        if (!std::isfinite(next)) {
+            throw ArithmeticException("derivative vanishes at " +
+                                      std::to_string(x));
+        }
+
+        FloatVal nextSlope;
+        FloatVal nextValue = evaluate(function, next, nextSlope);
+        for (int halvings = 0; !bracketed && halvings < maxHalvings &&
+                !differentSigns(value, nextValue) &&
+                !(std::abs(nextValue) < std::abs(value)); halvings++) {
+            step /= 2;
+            next = x - step;
+            nextValue = evaluate(function, next, nextSlope);
+        }
+
+        if (differentSigns(value, nextValue) && !bracketed) {
+            bracketed = true;
+            low = std::min(x, next);
+            high = std::max(x, next);
+            lowValue = low == x ? value : nextValue;
+        }
+        else if (bracketed) {
+            if (differentSigns(lowValue, nextValue))
+                high = next;
+            else {
+                low = next;
+                lowValue = nextValue;
+            }
+        }
+
+        if (std::abs(next - x) <=
+                tolerance * std::max(FloatVal(1), std::abs(next))) {
+            result.root = next;
+            result.iterations = i + 1;
+            return result;
+        }
+        x = next;
+        value = nextValue;
+        slope = nextSlope;
+    }
+
+    if (bracketed) {
+        Result refined = brent(function, low, high, tolerance);
+        refined.iterations += maxIterations;
+        return refined;
+    }
+    throw ArithmeticException("no root found near " + std::to_string(start));
+}
+
+
+RootFinder::Result RootFinder::brent(const CompiledExpression& function,
+                                     FloatVal a, FloatVal b,
+                                     FloatVal tolerance)
+{
+    const FloatVal epsilon = std::numeric_limits<FloatVal>::epsilon();
+    FloatVal fa = evaluate(function, a);
+    FloatVal fb = evaluate(function, b);
+    if (!std::isfinite(fa) || !std::isfinite(fb))
+        throw ArithmeticException("function is not finite at the bounds");
+    if (fa != 0 && fb != 0 && !differentSigns(fa, fb)) {
+        throw ArithmeticException("function has the same sign at " +
+            std::to_string(a) + " and " + std::to_string(b));
+    }
+
+    // b is the best guess, c the previous one, the root lies between b
+    // and c
+    FloatVal c = a;
+    FloatVal fc = fa;
+    FloatVal d = b - a;
+    FloatVal e = d;
+
+    Result result;
+    for (size_t i = 0; i < maxIterations; i++) {
+        if ((fb > 0 && fc > 0) || (fb < 0 && fc < 0)) {
+            c = a;
+            fc = fa;
+            d = b - a;
+            e = d;
+        }
+        if (std::abs(fc) < std::abs(fb)) {
+            a = b;
+            b = c;
+            c = a;
+            fa = fb;
+            fb = fc;
+            fc = fa;
+        }
+
+        FloatVal allowed = 2 * epsilon * std::abs(b) + tolerance / 2 *
+            std::max(FloatVal(1), std::abs(b));
+        FloatVal middle = (c - b) / 2;
+        if (std::abs(middle) <= allowed || fb == 0) {
+            result.root = b;
+            result.iterations = i;
+            return result;
+        }
+
+        if (std::abs(e) >= allowed && std::abs(fa) > std::abs(fb)) {
+            // interpolation: secant if only two points are distinct,
+            // inverse quadratic otherwise
+            FloatVal p;
+            FloatVal q;
+            FloatVal s = fb / fa;
+            if (a == c) {
+                p = 2 * middle * s;
+                q = 1 - s;
+            }
+            else {
+                FloatVal r = fb / fc;
+                q = fa / fc;
+                p = s * (2 * middle * q * (q - r) - (b - a) * (r - 1));
+                q = (q - 1) * (r - 1) * (s - 1);
+            }
+            if (p > 0)
+                q = -q;
+            else
+                p = -p;
+
+            if (2 * p < std::min(3 * middle * q - std::abs(allowed * q),
+                                 std::abs(e * q))) {
+                e = d;
+                d = p / q;
+            }
+            else {
+                d = middle;
+                e = d;
+            }
+        }
+        else {
+            d = middle;
+            e = d;
+        }
+
+        a = b;
+        fa = fb;
+        if (std::abs(d) > allowed)
+            b += d;
+        else
+            b += middle > 0 ? allowed : -allowed;
+        fb = evaluate(function, b);
+        if (!std::isfinite(fb)) {
+            throw ArithmeticException("function is not finite at " +
+                                      std::to_string(b));
+        }
+    }
+    throw ArithmeticException("root finding does not converge");
+}
@@ -0,0 +1,75 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef ROOTFINDER_H_
+#define ROOTFINDER_H_
+
+#include <cstddef>
+
+#include "Node.h"
+#include "CompiledExpression.h"
+
+
+/*!
+ * \brief finds zeros of compiled functions of one variable
+ */
+class RootFinder
+{
+public:
+    struct Result
+    {
+        FloatVal root;
+        size_t iterations;
+    };
+
+    //! iterations before giving up
+    static const size_t maxIterations = 200;
+
+    /*!
+     * \brief newton's method starting at <code>start</code>
+     *
+     * The derivative is computed by automatic differentiation. Steps that
+     * do not decrease the function value are halved. As soon as two
+     * iterates enclose a root, steps leaving the enclosing interval are
+     * replaced by \link brent.
+     *
+     * \param tolerance the accepted error relative to the root, or
+     *        absolute if the root is smaller than one
+     *
+     * \throws ArithmeticException if the iteration does not converge
+     */
+    static Result newton(const CompiledExpression& function,
+                         FloatVal start, FloatVal tolerance);
+
+    /*!
+     * \brief brent's method, combining bisection with secant steps and
+     *        inverse quadratic interpolation
+     *
+     * \throws ArithmeticException if the function has the same sign at
+     *         both ends of the interval
+     */
+    static Result brent(const CompiledExpression& function,
+                        FloatVal a, FloatVal b, FloatVal tolerance);
+};
+
+
+#endif // ROOTFINDER_H_
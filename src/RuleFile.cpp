@@ -0,0 +1,472 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "RuleFile.h"
+#include "sys.h"
+#include "Matrix.h"
+#include "ExpressionParser.h"
+
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+
+
+namespace
+{
+    const char cacheMagic[4] = { 'M', 'Y', 'R', 'C' };
+    const uint32_t cacheVersion = 1;
+
+    //! detects caches written on a machine with another byte order
+    const uint32_t byteOrderMark = 0x01020304;
+
+    class CacheReader
+    {
+        const char* position;
+        const char* end;
+    public:
+        inline CacheReader(const char* data, size_t size) :
+            position(data), end(data + size) {}
+
+        template<typename T>
+        T read(void)
+        {
+            if (size_t(end - position) < sizeof(T))
+                throw RuntimeException("rule cache is truncated");
+            T value;
+            std::memcpy(&value, position, sizeof(T));
+            position += sizeof(T);
+            return value;
+        }
+
+        std::string readString(void)
+        {
+            uint32_t length = read<uint32_t>();
+            if (size_t(end - position) < length)
+                throw RuntimeException("rule cache is truncated");
+            std::string value(position, length);
+            position += length;
+            return value;
+        }
+
+        /*!
+         * \brief reads the number of entries that follow
+         *
+         * Every entry takes at least one byte, so a count larger than the
+         * rest of the cache comes from a damaged file and would otherwise
+         * be used to reserve memory.
+         */
+        uint32_t readCount(void)
+        {
+            uint32_t count = read<uint32_t>();
+            if (size_t(end - position) < count)
+                throw RuntimeException("rule cache is damaged");
+            return count;
+        }
+
+        inline bool isAtEnd(void) const { return position == end; }
+    };
+}
+
+
+template<typename T>
+static void write(std::string& out, T value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+
+static void writeNode(std::string& out, const ExpressionNode* node)
+{
+    NodeKind kind = node->getKind();
+    write<uint8_t>(out, uint8_t(kind));
+
+    switch (kind) {
+    case NodeKind::INTEGER:
+        write<int64_t>(out,
+            static_cast<const IntegerNode*>(node)->getValue());
+        break;
+    case NodeKind::REAL:
+        write<double>(out, dynamic_cast<const RealNode*>(node)->getValue());
+        break;
+    case NodeKind::VARIABLE: {
+        const std::string& name =
+            static_cast<const VariableNode*>(node)->getName();
+        write<uint32_t>(out, uint32_t(name.size()));
+        out += name;
+        break;
+    }
+    case NodeKind::FUNCTION_CALL:
+    case NodeKind::LIST:
+        write<uint32_t>(out, uint32_t(node->getChildCount()));
+        for (size_t i = 0; i < node->getChildCount(); i++)
+            writeNode(out, node->getChild(i).get());
+        break;
+    case NodeKind::COMPARISON:
+        write<uint8_t>(out, uint8_t(
+            dynamic_cast<const ComparisonNode*>(node)->getRelation()));
+        writeNode(out, node->getChild(0).get());
+        writeNode(out, node->getChild(1).get());
+        break;
+    case NodeKind::ADDITION:
+    case NodeKind::SUBTRACTION:
+    case NodeKind::MULTIPLICATION:
+    case NodeKind::MODULO:
+    case NodeKind::DIVISION:
+    case NodeKind::POWER:
+    case NodeKind::AND:
+    case NodeKind::OR:
+    case NodeKind::XOR:
+        writeNode(out, node->getChild(0).get());
+        writeNode(out, node->getChild(1).get());
+        break;
+    case NodeKind::NOT:
+        writeNode(out, node->getChild(0).get());
+        break;
+    case NodeKind::SUM: {
+        const SumNode* sum = dynamic_cast<const SumNode*>(node);
+        const std::vector<SumNode::Summand>& summands = sum->getSummands();
+        write<uint32_t>(out, uint32_t(summands.size()));
+        for (size_t i = 0; i < summands.size(); i++) {
+            write<uint8_t>(out, summands[i].negative ? 1 : 0);
+            writeNode(out, summands[i].value.get());
+        }
+        write<uint8_t>(out, sum->getConstant() ? 1 : 0);
+        if (sum->getConstant())
+            writeNode(out, sum->getConstant().get());
+        break;
+    }
+    case NodeKind::PRODUCT: {
+        const ProductNode* product = dynamic_cast<const ProductNode*>(node);
+        const std::vector<std::shared_ptr<ExpressionNode> >& factors =
+            product->getFactors();
+        write<uint32_t>(out, uint32_t(factors.size()));
+        for (size_t i = 0; i < factors.size(); i++)
+            writeNode(out, factors[i].get());
+        write<uint8_t>(out, product->getCoefficient() ? 1 : 0);
+        if (product->getCoefficient())
+            writeNode(out, product->getCoefficient().get());
+        break;
+    }
+    default:
+        throw RuntimeException("rule contains an expression that cannot "
+                               "be compiled: " + node->getString());
+    }
+}
+
+
+static std::shared_ptr<ExpressionNode> readNode(CacheReader& in)
+{
+    NodeKind kind = NodeKind(in.read<uint8_t>());
+
+    switch (kind) {
+    case NodeKind::INTEGER:
+        return std::make_shared<IntegerNode>(
+            (long long int) in.read<int64_t>());
+    case NodeKind::REAL:
+        return std::make_shared<RealNode>(FloatVal(in.read<double>()));
+    case NodeKind::VARIABLE:
+        return std::make_shared<VariableNode>(in.readString());
+    case NodeKind::FUNCTION_CALL: {
+        uint32_t count = in.readCount();
+        if (count == 0)
+            throw RuntimeException("rule cache is damaged");
+        std::shared_ptr<ExpressionNode> function = readNode(in);
+        std::vector<std::shared_ptr<ExpressionNode> > arguments;
+        arguments.reserve(count - 1);
+        for (uint32_t i = 1; i < count; i++)
+            arguments.push_back(readNode(in));
+        return std::make_shared<FunctionCallNode>(function, arguments);
+    }
+    case NodeKind::LIST: {
+        uint32_t count = in.readCount();
+        std::vector<std::shared_ptr<ExpressionNode> > elements;
+        elements.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+            elements.push_back(readNode(in));
+        return std::make_shared<ListNode>(elements);
+    }
+    case NodeKind::COMPARISON: {
+        uint8_t relation = in.read<uint8_t>();
+        if (relation > uint8_t(ComparisonNode::Relation::NOT_EQUAL))
+            throw RuntimeException("rule cache is damaged");
+        std::shared_ptr<ExpressionNode> a = readNode(in);
+        std::shared_ptr<ExpressionNode> b = readNode(in);
+        return std::make_shared<ComparisonNode>(
+            ComparisonNode::Relation(relation), a, b);
+    }
+    case NodeKind::NOT:
+        return std::make_shared<NotNode>(readNode(in));
+    case NodeKind::ADDITION:
+    case NodeKind::SUBTRACTION:
+    case NodeKind::MULTIPLICATION:
+    case NodeKind::MODULO:
+    case NodeKind::DIVISION:
+    case NodeKind::POWER:
+    case NodeKind::AND:
+    case NodeKind::OR:
+    case NodeKind::XOR: {
+        std::shared_ptr<ExpressionNode> a = readNode(in);
+        std::shared_ptr<ExpressionNode> b = readNode(in);
+        switch (kind) {
+        case NodeKind::ADDITION:
+            return std::make_shared<AdditionNode>(a, b);
+        case NodeKind::SUBTRACTION:
+            return std::make_shared<SubtractionNode>(a, b);
+        case NodeKind::MULTIPLICATION:
+            return std::make_shared<MultiplicationNode>(a, b);
+        case NodeKind::MODULO:
+            return std::make_shared<ModuloNode>(a, b);
+        case NodeKind::DIVISION:
+            return std::make_shared<DivisionNode>(a, b);
+        case NodeKind::AND:
+            return std::make_shared<AndNode>(a, b);
+        case NodeKind::OR:
+            return std::make_shared<OrNode>(a, b);
+        case NodeKind::XOR:
+            return std::make_shared<XorNode>(a, b);
+        default:
+            return std::make_shared<PowerNode>(a, b);
+        }
+    }
+    case NodeKind::SUM: {
+        uint32_t count = in.read<uint32_t>();
+        std::vector<SumNode::Summand> summands;
+        summands.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            SumNode::Summand s;
+            s.negative = in.read<uint8_t>() != 0;
+            s.value = readNode(in);
+            summands.push_back(s);
+        }
+        std::shared_ptr<ExpressionNode> constant;
+        if (in.read<uint8_t>() != 0)
+            constant = readNode(in);
+        return std::make_shared<SumNode>(summands, constant);
+    }
+    case NodeKind::PRODUCT: {
+        uint32_t count = in.read<uint32_t>();
+        std::vector<std::shared_ptr<ExpressionNode> > factors;
+        factors.reserve(count);
+        for (uint32_t i = 0; i < count; i++)
+            factors.push_back(readNode(in));
+        std::shared_ptr<ExpressionNode> coefficient;
+        if (in.read<uint8_t>() != 0)
+            coefficient = readNode(in);
+        return std::make_shared<ProductNode>(factors, coefficient);
+    }
+    default:
+        throw RuntimeException("rule cache is damaged");
+    }
+}
+
+
+/*!
+ * \brief parses one side of a rule
+ */
+static std::shared_ptr<ExpressionNode> parseExpression(const std::string& text,
+                                                       size_t line)
+{
+    mathy::ParseResult parsed = mathy::ExpressionParser::parse(text);
+    if (parsed.hasErrors()) {
+        throw RuntimeException("in rule on line " + std::to_string(line) +
+                               ": " + parsed.errors[0].message);
+    }
+    if (!parsed.expression) {
+        throw RuntimeException("syntax error in rule on line " +
+                               std::to_string(line));
+    }
+    return parsed.expression;
+}
+
+
+void RuleFile::load(Rewriter& rewriter, const std::string& path,
+                    std::vector<std::string>& skipped)
+{
+    mathy::sys::MappedFile text(path);
+    if (!text.isOpen())
+        throw RuntimeException("cannot open rule file " + path);
+
+    uint64_t textHash = hash(text.getData(), text.getSize());
+    std::string cachePath = path + ".cache";
+
+    std::vector<RewriteRule*> rules;
+    bool cached = false;
+    {
+        mathy::sys::MappedFile cache(cachePath);
+        if (cache.isOpen())
+            cached = readCache(cache.getData(), cache.getSize(), textHash,
+                               rules);
+    }
+
+    if (!cached) {
+        rules = parse(text.getData(), text.getSize());
+
+        // the cache is an optimization, failing to write it is no error
+        std::string compiled;
+        try {
+            compiled = compile(rules, textHash);
+        } catch (RuntimeException&) {
+        }
+        if (!compiled.empty()) {
+            std::string temporary = cachePath + ".tmp";
+            std::ofstream out(temporary.c_str(),
+                              std::ios::out | std::ios::binary);
+            out.write(compiled.data(), std::streamsize(compiled.size()));
+            out.close();
+            if (!out || std::rename(temporary.c_str(), cachePath.c_str()) != 0)
+                std::remove(temporary.c_str());
+        }
+    }
+
+    for (size_t i = 0; i < rules.size(); i++) {
+        const RewriteRule* rule = rules[i];
+        if (rule->getPattern()->equals(rule->getReplacement().get())) {
+            skipped.push_back("skipped rule " + rule->getString() +
+                              ", it does not change what it matches");
+            delete rule;
+        }
+        else if (RewriteRule::isPatternVariable(rule->getPattern().get())) {
+            skipped.push_back("skipped rule " + rule->getString() +
+                              ", its pattern matches every expression");
+            delete rule;
+        }
+        else
+            rewriter.addRule(rules[i]);
+    }
+}
+
+
+std::vector<RewriteRule*> RuleFile::parse(const char* text, size_t length)
+{
+    std::vector<RewriteRule*> rules;
+    size_t lineNumber = 0;
+    size_t start = 0;
+    try {
+        while (start < length) {
+            size_t end = start;
+            while (end < length && text[end] != '\n')
+                end++;
+            std::string line(text + start, end - start);
+            start = end + 1;
+            lineNumber++;
+
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string::npos || line[first] == '#')
+                continue;
+
+            // the arrow separating the sides is the first one outside of
+            // parentheses
+            size_t arrow = std::string::npos;
+            int depth = 0;
+            for (size_t i = first; i + 1 < line.size(); i++) {
+                if (line[i] == '(')
+                    depth++;
+                else if (line[i] == ')')
+                    depth--;
+                else if (depth == 0 && line[i] == '-' && line[i + 1] == '>') {
+                    arrow = i;
+                    break;
+                }
+            }
+            if (arrow == std::string::npos) {
+                throw RuntimeException("expected pattern -> replacement on "
+                                       "line " + std::to_string(lineNumber));
+            }
+
+            std::shared_ptr<ExpressionNode> pattern =
+                parseExpression(line.substr(first, arrow - first),
+                                lineNumber);
+            std::shared_ptr<ExpressionNode> replacement =
+                parseExpression(line.substr(arrow + 2), lineNumber);
+            rules.push_back(new RewriteRule(pattern, replacement));
+        }
+    } catch (...) {
+        for (size_t i = 0; i < rules.size(); i++)
+            delete rules[i];
+        throw;
+    }
+    return rules;
+}
+
+
+std::string RuleFile::compile(const std::vector<RewriteRule*>& rules,
+                              uint64_t hash)
+{
+    std::string out;
+    out.append(cacheMagic, sizeof cacheMagic);
+    write<uint32_t>(out, cacheVersion);
+    write<uint32_t>(out, byteOrderMark);
+    write<uint64_t>(out, hash);
+    write<uint32_t>(out, uint32_t(rules.size()));
+    for (size_t i = 0; i < rules.size(); i++) {
+        writeNode(out, rules[i]->getPattern().get());
+        writeNode(out, rules[i]->getReplacement().get());
+    }
+    return out;
+}
+
+
+bool RuleFile::readCache(const char* data, size_t size, uint64_t hash,
+                         std::vector<RewriteRule*>& rules)
+{
+    if (size < sizeof cacheMagic ||
+            std::memcmp(data, cacheMagic, sizeof cacheMagic) != 0)
+        return false;
+
+    std::vector<RewriteRule*> read;
+    try {
+        CacheReader in(data + sizeof cacheMagic, size - sizeof cacheMagic);
+        if (in.read<uint32_t>() != cacheVersion ||
+                in.read<uint32_t>() != byteOrderMark ||
+                in.read<uint64_t>() != hash)
+            return false;
+
+        uint32_t count = in.readCount();
+        read.reserve(count);
+        for (uint32_t i = 0; i < count; i++) {
+            std::shared_ptr<ExpressionNode> pattern = readNode(in);
+            std::shared_ptr<ExpressionNode> replacement = readNode(in);
+            read.push_back(new RewriteRule(pattern, replacement, true));
+        }
+        if (!in.isAtEnd())
+            throw RuntimeException("rule cache is damaged");
+    } catch (std::exception&) {
+        // a damaged cache is rebuilt from the rule text
+        for (size_t i = 0; i < read.size(); i++)
+            delete read[i];
+        return false;
+    }
+
+    rules.insert(rules.end(), read.begin(), read.end());
+    return true;
+}
+
+
+uint64_t RuleFile::hash(const char* data, size_t length)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h ^= uint8_t(data[i]);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
@@ -0,0 +1,93 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef RULEFILE_H_
+#define RULEFILE_H_
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "Rewriter.h"
+
+
+/*!
+ * \brief loads rewrite rules from text files
+ *
+ * A rule file contains one rule per line, written in Mathy syntax as
+ * <code>pattern -> replacement</code>, e.g. <code>x_ - x_ -> 0</code>.
+ * Empty lines and lines starting with <code>#</code> are ignored. Lambdas
+ * inside a rule have to be parenthesized.
+ *
+ * The compiled rules are stored in a binary cache file next to the rule
+ * file, tagged with a hash of the rule text. Later runs map the cache into
+ * memory and rebuild the rules from it without running the parser.
+ */
+class RuleFile
+{
+public:
+    /*!
+     * \brief adds the rules of a file to a rewriter, using the cache if it
+     *        is up to date
+     *
+     * Rules that would rewrite forever are skipped: those whose pattern is
+     * a bare pattern variable, and those whose replacement equals their
+     * pattern. Folding neutral elements turns e.g. <code>x_ + 0 -> x_</code>
+     * into the latter.
+     *
+     * \param skipped receives a message for every skipped rule
+     * \throws RuntimeException if the file cannot be read or contains an
+     *         invalid rule
+     */
+    static void load(Rewriter& rewriter, const std::string& path,
+                     std::vector<std::string>& skipped);
+
+    /*!
+     * \brief parses rule text
+     *
+     * \return the rules, owned by the caller
+     */
+    static std::vector<RewriteRule*> parse(const char* text, size_t length);
+
+    /*!
+     * \brief serializes rules into the cache format
+     */
+    static std::string compile(const std::vector<RewriteRule*>& rules,
+                               uint64_t hash);
+
+    /*!
+     * \brief rebuilds rules from a cache
+     *
+     * \return <code>false</code> if the cache was built from different rule
+     *         text, by a different version, or is damaged
+     */
+    static bool readCache(const char* data, size_t size, uint64_t hash,
+                          std::vector<RewriteRule*>& rules);
+
+    /*!
+     * \brief 64 bit FNV-1a hash of the rule text
+     */
+    static uint64_t hash(const char* data, size_t length);
+};
+
+
+#endif // RULEFILE_H_
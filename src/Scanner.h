@@ -0,0 +1,101 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef SCANNER_H_
+#define SCANNER_H_
+
+#include <cstdio>
+#include <cstddef>
+
+
+#ifndef YY_TYPEDEF_YY_SCANNER_T
+#define YY_TYPEDEF_YY_SCANNER_T
+typedef void* yyscan_t;
+#endif
+
+namespace mathy
+{
+    class Scanner;
+}
+
+
+/*!
+ * \brief one instance of the reentrant scanner generated from tokens.l
+ *
+ * Every instance has its own input and state, so several threads or
+ * sessions can tokenize at the same time. The scanner stops at the end of
+ * every statement, so each call of <code>yyparse</code> reads one. In
+ * script mode, statements are separated by <code>TOKEN_SEPARATOR</code>
+ * instead and <code>yyparse_script</code> reads all of them at once.
+ *
+ * The implementation is part of tokens.l.
+ */
+class mathy::Scanner
+{
+public:
+    //! the part of the state the rules in tokens.l report to the owner
+    struct State
+    {
+        bool endOfFile;
+
+        //! the last token read ended a statement
+        bool endOfStatement;
+
+        //! return separators instead of stopping at the end of statements
+        bool script;
+
+        //! line of the next token, counting from 1
+        int line;
+    };
+private:
+    yyscan_t scanner;
+    State state;
+public:
+    /*!
+     * \brief reads the statements from a file
+     */
+    Scanner(::FILE* in);
+
+    /*!
+     * \brief scans a copy of an in-memory buffer
+     */
+    Scanner(const char* data, size_t length);
+    ~Scanner(void);
+
+    Scanner(const Scanner&) = delete;
+    Scanner& operator = (const Scanner&) = delete;
+
+    inline yyscan_t getHandle(void) const { return scanner; }
+
+    //! <code>true</code> once the whole input has been read
+    inline bool isEndOfFile(void) const { return state.endOfFile; }
+
+    inline void setScriptMode(bool script) { state.script = script; }
+
+    /*!
+     * \brief reads and drops the tokens up to the end of the current
+     *        statement, unless the last token read already ended it
+     */
+    void skipStatement(void);
+};
+
+
+#endif // SCANNER_H_
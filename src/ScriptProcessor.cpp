@@ -0,0 +1,98 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "ScriptProcessor.h"
+#include "Node.h"
+#include "Environment.h"
+#include "OutputBuffer.h"
+#include "sys.h"
+
+using mathy::ScriptProcessor;
+
+
+namespace
+{
+    //! number of statements parsed before they are executed
+    const size_t statementsPerList = 4096;
+}
+
+
+ScriptProcessor::ScriptProcessor(const std::string& path, ::FILE* out) :
+    InputProcessor(nullptr, out), path(path)
+{
+}
+
+
+int ScriptProcessor::run(void)
+{
+    Environment environment;
+    if (!initializeEnvironment(environment))
+        return 1;
+
+    mathy::sys::MappedFile file(path);
+    if (!file.isOpen()) {
+        printErrorMessage("cannot open " + path);
+        return 1;
+    }
+    // every page is read exactly once
+    file.adviseSequential();
+
+    OutputBuffer output(this->out);
+    ExpressionParser parser(file.getData(), file.getSize(), parserBackend);
+    while (true) {
+        std::vector<ParseResult> statements =
+            parser.parseStatements(statementsPerList);
+        if (statements.empty())
+            break;
+        execute(environment, statements, output);
+    }
+    finishEnvironment(environment);
+    output.flush();
+    return 0;
+}
+
+
+void ScriptProcessor::execute(Environment& environment,
+                              const std::vector<ParseResult>& statements,
+                              OutputBuffer& output)
+{
+    for (size_t i = 0; i < statements.size(); i++) {
+        const ParseResult& parsed = statements[i];
+        if (parsed.hasErrors()) {
+            output.flush();
+            printErrorMessage(parsed.errors[0].getString());
+        }
+        if (parsed.expression == nullptr)
+            continue;
+
+        try {
+            if (printsDirectly(parsed.expression.get()))
+                output.flush();
+            std::shared_ptr<ExpressionNode> evaluated =
+                    environment.evaluateExpression(parsed.expression);
+            output.appendExpression(*evaluated);
+            output.endLine();
+        } catch(std::exception& ex) {
+            output.flush();
+            printErrorMessage(ex.what());
+        }
+    }
+}
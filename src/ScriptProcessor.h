@@ -0,0 +1,72 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#ifndef SCRIPTPROCESSOR_H_
+#define SCRIPTPROCESSOR_H_
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "ConsoleInterface.h"
+
+
+class Environment;
+class OutputBuffer;
+
+
+namespace mathy
+{
+    class ScriptProcessor;
+}
+
+
+/*!
+ * \brief executes a script file given on the command line
+ *
+ * The file is mapped into memory and parsed in place. Statements are parsed
+ * into lists of a few thousand in one pass each, which are then executed
+ * in order, so memory use does not grow with the length of the script.
+ * With the hand-written parser, tokens point into the mapping, so apart
+ * from the nodes of the trees nothing is copied. Unlike piped input, the
+ * last statement is evaluated even if the file does not end with a
+ * newline.
+ */
+class mathy::ScriptProcessor : public InputProcessor
+{
+    std::string path;
+public:
+    ScriptProcessor(const std::string& path, ::FILE* out);
+
+    virtual int run(void);
+
+private:
+    /*!
+     * \brief evaluates parsed statements in order, printing their results
+     *        and errors
+     */
+    void execute(Environment& environment,
+                 const std::vector<ParseResult>& statements,
+                 OutputBuffer& output);
+};
+
+
+#endif // SCRIPTPROCESSOR_H_
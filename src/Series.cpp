@@ -0,0 +1,323 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "Series.h"
+#include "Polynomial.h"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+
+namespace
+{
+    //! number of terms evaluated as one batch
+    const size_t chunkSize = 8192;
+
+    inline FloatVal combine(Series::Reduction reduction, FloatVal a,
+                            FloatVal b)
+    {
+        return reduction == Series::Reduction::SUM ? a + b : a * b;
+    }
+
+    /*!
+     * \brief combines neighbours until one value is left
+     *
+     * Compared to a running sum, the rounding error grows with the
+     * logarithm of the number of values instead of linearly.
+     */
+    FloatVal combinePairwise(Series::Reduction reduction, FloatVal* values,
+                             size_t count)
+    {
+        if (count == 0)
+            return reduction == Series::Reduction::SUM ? 0 : 1;
+
+        while (count > 1) {
+            size_t half = count / 2;
+            for (size_t i = 0; i < half; i++)
+                values[i] = combine(reduction, values[2 * i],
+                                    values[2 * i + 1]);
+            if (count % 2 != 0)
+                values[half] = values[count - 1];
+            count = half + count % 2;
+        }
+        return values[0];
+    }
+
+    FloatVal reduceChunk(const CompiledExpression& function,
+                         Series::Reduction reduction, FloatVal from,
+                         size_t count)
+    {
+        std::vector<FloatVal> points(count);
+        std::vector<FloatVal> values(count);
+        for (size_t i = 0; i < count; i++)
+            points[i] = from + FloatVal(i);
+        function.evaluate(points.data(), count, values.data());
+        return combinePairwise(reduction, values.data(), count);
+    }
+
+    bool containsNode(const ExpressionNode* node, const ExpressionNode* part)
+    {
+        if (node->equals(part))
+            return true;
+        for (size_t i = 0; i < node->getChildCount(); i++) {
+            if (containsNode(node->getChild(i).get(), part))
+                return true;
+        }
+        return false;
+    }
+
+    //! a reduced fraction with a positive denominator
+    struct Fraction
+    {
+        BigInteger numerator;
+        BigInteger denominator;
+    };
+
+    Fraction makeFraction(const BigInteger& numerator,
+                          const BigInteger& denominator)
+    {
+        BigInteger common = BigInteger::gcd(numerator, denominator);
+        if (denominator.isNegative())
+            common = BigInteger(0) - common;
+        Fraction fraction = { numerator / common, denominator / common };
+        return fraction;
+    }
+
+    /*!
+     * \brief binomial coefficients, the row n of pascal's triangle
+     */
+    std::vector<BigInteger> getBinomials(size_t n)
+    {
+        std::vector<BigInteger> binomial(n + 1);
+        binomial[0] = 1;
+        for (size_t j = 1; j <= n; j++)
+            binomial[j] = binomial[j - 1] * BigInteger((long long) (n + 1 - j)) /
+                BigInteger((long long) j);
+        return binomial;
+    }
+
+    /*!
+     * \brief the bernoulli numbers with <code>B(1) = 1/2</code>
+     */
+    std::vector<Fraction> getBernoulliNumbers(size_t count)
+    {
+        std::vector<Fraction> bernoulli;
+        bernoulli.push_back(makeFraction(1, 1));
+        for (size_t m = 1; m < count; m++) {
+            std::vector<BigInteger> binomial = getBinomials(m + 1);
+            Fraction sum = makeFraction(0, 1);
+            for (size_t j = 0; j < m; j++) {
+                const Fraction& b = bernoulli[j];
+                sum = makeFraction(sum.numerator * b.denominator +
+                                   binomial[j] * b.numerator * sum.denominator,
+                                   sum.denominator * b.denominator);
+            }
+            bernoulli.push_back(makeFraction(BigInteger(0) - sum.numerator,
+                sum.denominator * BigInteger((long long) (m + 1))));
+        }
+        if (count > 1)
+            bernoulli[1].numerator = BigInteger(0) - bernoulli[1].numerator;
+        return bernoulli;
+    }
+
+    /*!
+     * \brief the coefficients of <code>1^p + 2^p + ... + n^p</code> as
+     *        polynomial in n, the j-th one belonging to
+     *        <code>n^(p + 1 - j)</code>
+     */
+    std::vector<Fraction> getPowerSum(size_t p,
+                                      const std::vector<Fraction>& bernoulli)
+    {
+        std::vector<BigInteger> binomial = getBinomials(p + 1);
+        std::vector<Fraction> coefficients;
+        for (size_t j = 0; j <= p; j++) {
+            coefficients.push_back(makeFraction(
+                binomial[j] * bernoulli[j].numerator,
+                bernoulli[j].denominator * BigInteger((long long) (p + 1))));
+        }
+        return coefficients;
+    }
+
+    bool getNumber(const ExpressionNode* node, FloatVal& value)
+    {
+        if (node->getKind() == NodeKind::INTEGER) {
+            value = FloatVal(static_cast<const IntegerNode*>(node)->getValue());
+            return true;
+        }
+        if (const RealNode* real = dynamic_cast<const RealNode*>(node)) {
+            value = real->getValue();
+            return true;
+        }
+        return false;
+    }
+}
+
+
+FloatVal Series::reduce(const CompiledExpression& function,
+                        Reduction reduction, FloatVal from, size_t count,
+                        ThreadPool& pool)
+{
+    size_t chunks = (count + chunkSize - 1) / chunkSize;
+    std::vector<FloatVal> partials(chunks);
+
+    if (chunks <= 1 || pool.getThreadCount() <= 1) {
+        for (size_t i = 0; i < chunks; i++) {
+            size_t start = i * chunkSize;
+            partials[i] = reduceChunk(function, reduction,
+                from + FloatVal(start), std::min(chunkSize, count - start));
+        }
+    }
+    else {
+        TaskGroup group(pool);
+        for (size_t i = 0; i < chunks; i++) {
+            group.run([&, i] {
+                size_t start = i * chunkSize;
+                partials[i] = reduceChunk(function, reduction,
+                    from + FloatVal(start),
+                    std::min(chunkSize, count - start));
+            });
+        }
+        group.wait();
+    }
+    return combinePairwise(reduction, partials.data(), chunks);
+}
+
+
+bool Series::reduceExactly(const CompiledExpression& function,
+        const std::function<bool (long long, long long&)>& exact,
+        Reduction reduction, long long from, size_t count,
+        long long& result)
+{
+    // doubles hold every integer up to 2^53 exactly
+    const FloatVal exactLimit = FloatVal(1ULL << 53);
+    const FloatVal range = FloatVal(1ULL << 63);
+
+    long long accumulated = reduction == Reduction::SUM ? 0 : 1;
+    std::vector<FloatVal> points;
+    std::vector<FloatVal> values;
+    for (size_t start = 0; start < count; start += chunkSize) {
+        size_t n = std::min(chunkSize, count - start);
+        points.resize(n);
+        values.resize(n);
+        for (size_t i = 0; i < n; i++)
+            points[i] = FloatVal(from + (long long) (start + i));
+        function.evaluate(points.data(), n, values.data());
+
+        for (size_t i = 0; i < n; i++) {
+            FloatVal value = values[i];
+            if (!(::fabs(value) < range) || value != ::floor(value))
+                return false;
+
+            long long term = (long long) value;
+            if (::fabs(value) > exactLimit &&
+                    (!exact(from + (long long) (start + i), term) ||
+                     FloatVal(term) != value))
+                return false;
+
+            bool overflow = reduction == Reduction::SUM ?
+                __builtin_add_overflow(accumulated, term, &accumulated) :
+                __builtin_mul_overflow(accumulated, term, &accumulated);
+            if (overflow)
+                return false;
+        }
+    }
+    result = accumulated;
+    return true;
+}
+
+
+std::shared_ptr<ExpressionNode> Series::closedSum(
+        const std::shared_ptr<ExpressionNode>& body,
+        const std::shared_ptr<ExpressionNode>& variable,
+        const std::shared_ptr<ExpressionNode>& from,
+        const std::shared_ptr<ExpressionNode>& to)
+{
+    FloatVal a;
+    FloatVal b;
+    bool fromNumeric = getNumber(from.get(), a);
+    bool toNumeric = getNumber(to.get(), b);
+    if ((fromNumeric && a != ::floor(a)) || (toNumeric && b != ::floor(b)))
+        return nullptr;
+
+    // empty ranges are left to the loop, which yields zero, while the
+    // formula would subtract
+    if (fromNumeric && toNumeric && b < a)
+        return nullptr;
+
+    // one ring for the summand and both bounds
+    SumNode::Summand parts[] = { { body, false }, { from, false },
+                                 { to, false } };
+    std::shared_ptr<PolynomialRing> ring = PolynomialRing::create(
+        std::make_shared<SumNode>(
+            std::vector<SumNode::Summand>(parts, parts + 3), nullptr));
+
+    size_t atom = ring->findAtom(variable.get());
+    for (size_t i = 0; i < ring->getAtomCount(); i++) {
+        if (i != atom && containsNode(ring->getAtom(i).get(), variable.get()))
+            return nullptr;
+    }
+
+    Polynomial polynomial = Polynomial::fromExpression(body, ring);
+    std::vector<Polynomial> coefficients;
+    if (atom == PolynomialRing::npos)
+        coefficients.push_back(polynomial);
+    else
+        coefficients = polynomial.collect(atom);
+    if (coefficients.size() > maxClosedDegree + 1)
+        return nullptr;
+
+    Polynomial lower = Polynomial::fromExpression(from, ring);
+    Polynomial upper = Polynomial::fromExpression(to, ring);
+    lower = lower - Polynomial::constant(ring, 1);
+
+    std::vector<Fraction> bernoulli =
+        getBernoulliNumbers(coefficients.size());
+    std::vector<std::vector<Fraction> > powerSums(coefficients.size());
+    BigInteger denominator = 1;
+    for (size_t p = 0; p < coefficients.size(); p++) {
+        if (coefficients[p].getTerms().empty())
+            continue;
+        powerSums[p] = getPowerSum(p, bernoulli);
+        for (size_t j = 0; j < powerSums[p].size(); j++) {
+            const BigInteger& d = powerSums[p][j].denominator;
+            denominator = denominator / BigInteger::gcd(denominator, d) * d;
+        }
+    }
+
+    // the sum times the common denominator has integer coefficients
+    Polynomial result(ring);
+    for (size_t p = 0; p < coefficients.size(); p++) {
+        if (coefficients[p].getTerms().empty())
+            continue;
+        Polynomial sum(ring);
+        for (size_t j = 0; j <= p; j++) {
+            const Fraction& f = powerSums[p][j];
+            if (f.numerator.isZero())
+                continue;
+            Polynomial weight = Polynomial::constant(ring,
+                Coefficient(f.numerator * (denominator / f.denominator)));
+            sum = sum + weight * (upper.pow(p + 1 - j) - lower.pow(p + 1 - j));
+        }
+        result = result + coefficients[p] * sum;
+    }
+    return result.toExpression(denominator);
+}
@@ -0,0 +1,106 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef SERIES_H_
+#define SERIES_H_
+
+#include <cstddef>
+#include <memory>
+#include <functional>
+
+#include "Node.h"
+#include "CompiledExpression.h"
+#include "ThreadPool.h"
+
+
+/*!
+ * \brief sums and products over ranges of integers
+ */
+class Series
+{
+public:
+    enum class Reduction
+    {
+        SUM,
+        PRODUCT,
+    };
+
+    //! highest degree of a polynomial that is summed in closed form
+    static const size_t maxClosedDegree = 20;
+
+    /*!
+     * \brief combines the values of a compiled function at
+     *        <code>from, from + 1, ..., from + count - 1</code>
+     *
+     * The range is cut into chunks of fixed size that are evaluated as
+     * batches on the thread pool. Within a chunk and between the chunks,
+     * values are combined pairwise in a fixed order, so the result does not
+     * depend on the number of threads.
+     */
+    static FloatVal reduce(const CompiledExpression& function,
+                           Reduction reduction, FloatVal from, size_t count,
+                           ThreadPool& pool);
+
+    /*!
+     * \brief combines integer values of a compiled function exactly
+     *
+     * The function is evaluated in batches on the calling thread. Values
+     * beyond 2^53, which a double may have rounded, are taken from
+     * <code>exact</code> instead, and only if it agrees with the compiled
+     * value.
+     *
+     * \param exact evaluates the term at an index without rounding,
+     *        returns <code>false</code> if that does not give an integer
+     *
+     * \return <code>false</code> if a value is not an integer or the result
+     *         does not fit into a <code>long long</code>
+     */
+    static bool reduceExactly(const CompiledExpression& function,
+            const std::function<bool (long long, long long&)>& exact,
+            Reduction reduction, long long from, size_t count,
+            long long& result);
+
+    /*!
+     * \brief sums a polynomial over a range with Faulhaber's formula
+     *
+     * Integer coefficients give exact fractions, e.g.
+     * <code>n^3/3 + n^2/2 + n/6</code> for the sum of
+     * <code>k^2</code> from 1 to n.
+     *
+     * \param body the evaluated summand
+     * \param variable the summation variable
+     * \param from, to evaluated bounds, which may be symbolic
+     *
+     * \return the expanded sum, or <code>nullptr</code> if the body is not
+     *         a polynomial in the variable of at most
+     *         \link maxClosedDegree, or a bound is a number that is not an
+     *         integer
+     */
+    static std::shared_ptr<ExpressionNode> closedSum(
+            const std::shared_ptr<ExpressionNode>& body,
+            const std::shared_ptr<ExpressionNode>& variable,
+            const std::shared_ptr<ExpressionNode>& from,
+            const std::shared_ptr<ExpressionNode>& to);
+};
+
+
+#endif // SERIES_H_
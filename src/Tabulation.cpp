@@ -0,0 +1,142 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "Tabulation.h"
+#include "RealFormat.h"
+
+#include <cstring>
+#include <cctype>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+
+
+namespace
+{
+    //! number of points evaluated and formatted as one task
+    const size_t chunkSize = 1 << 16;
+
+    //! longest line of a csv file
+    const size_t maxLineLength = 2 * RealFormat::maxLength + 2;
+
+    struct Grid
+    {
+        FloatVal from;
+        FloatVal to;
+        FloatVal step;
+        size_t count;
+
+        //! the last point is exactly the upper bound, unless it is the only one
+        inline FloatVal getPoint(size_t i) const
+        {
+            return i + 1 == count && count > 1 ? to :
+                from + FloatVal(i) * step;
+        }
+    };
+
+    void formatChunk(const CompiledExpression& function, const Grid& grid,
+                     size_t start, size_t count, Tabulation::Format format,
+                     std::string& buffer)
+    {
+        std::vector<FloatVal> points(count);
+        std::vector<FloatVal> values(count);
+        for (size_t i = 0; i < count; i++)
+            points[i] = grid.getPoint(start + i);
+        function.evaluate(points.data(), count, values.data());
+
+        if (format == Tabulation::Format::BINARY) {
+            buffer.resize(2 * count * sizeof(FloatVal));
+            char* out = &buffer[0];
+            for (size_t i = 0; i < count; i++) {
+                ::memcpy(out, &points[i], sizeof(FloatVal));
+                ::memcpy(out + sizeof(FloatVal), &values[i],
+                         sizeof(FloatVal));
+                out += 2 * sizeof(FloatVal);
+            }
+            return;
+        }
+
+        buffer.resize(count * maxLineLength);
+        char* out = &buffer[0];
+        for (size_t i = 0; i < count; i++) {
+            out += RealFormat::format(points[i], out);
+            *out++ = ',';
+            out += RealFormat::format(values[i], out);
+            *out++ = '\n';
+        }
+        buffer.resize(size_t(out - buffer.data()));
+    }
+}
+
+
+Tabulation::Format Tabulation::getFormat(const std::string& fileName)
+{
+    static const std::string extension = ".csv";
+    if (fileName.size() < extension.size())
+        return Format::BINARY;
+
+    std::string end = fileName.substr(fileName.size() - extension.size());
+    std::transform(end.begin(), end.end(), end.begin(), ::tolower);
+    return end == extension ? Format::CSV : Format::BINARY;
+}
+
+
+void Tabulation::write(const CompiledExpression& function, FloatVal from,
+                       FloatVal to, size_t count, const std::string& fileName,
+                       Format format, ThreadPool& pool)
+{
+    std::ofstream out(fileName.c_str(), std::ios::out | std::ios::binary);
+    if (!out)
+        throw RuntimeException("cannot open " + fileName);
+
+    Grid grid = { from, to, count > 1 ? (to - from) / FloatVal(count - 1) : 0,
+                  count };
+    size_t chunks = (count + chunkSize - 1) / chunkSize;
+
+    // enough chunks per round to keep all workers busy, their buffers are
+    // reused in the next round
+    size_t window = 2 * std::max<size_t>(pool.getThreadCount(), 1);
+    std::vector<std::string> buffers(std::min(window, chunks));
+
+    for (size_t first = 0; first < chunks; first += window) {
+        size_t last = std::min(first + window, chunks);
+        TaskGroup group(pool);
+        for (size_t i = first; i < last; i++) {
+            group.run([&, i] {
+                size_t start = i * chunkSize;
+                formatChunk(function, grid, start,
+                            std::min(chunkSize, count - start), format,
+                            buffers[i - first]);
+            });
+        }
+        group.wait();
+
+        for (size_t i = first; i < last; i++) {
+            const std::string& buffer = buffers[i - first];
+            out.write(buffer.data(), std::streamsize(buffer.size()));
+        }
+        if (!out)
+            throw RuntimeException("cannot write to " + fileName);
+    }
+    out.close();
+    if (!out)
+        throw RuntimeException("cannot write to " + fileName);
+}
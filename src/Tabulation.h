@@ -0,0 +1,75 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef TABULATION_H_
+#define TABULATION_H_
+
+#include <cstddef>
+#include <string>
+
+#include "Node.h"
+#include "CompiledExpression.h"
+#include "ThreadPool.h"
+
+
+/*!
+ * \brief writes the values of a function on an evenly spaced grid to a file
+ *
+ * The grid is cut into chunks, which are evaluated and formatted by the
+ * thread pool into reusable buffers. The buffers are written in order with
+ * one large write each.
+ */
+class Tabulation
+{
+public:
+    enum class Format
+    {
+        //! pairs of native <code>double</code> values, argument first
+        BINARY,
+
+        /*!
+         * one line <code>x,f(x)</code> per point, with the fewest digits
+         * that read back as the same numbers
+         */
+        CSV,
+    };
+
+    /*!
+     * \return \link Format::CSV for files ending in <code>.csv</code>,
+     *         otherwise \link Format::BINARY
+     */
+    static Format getFormat(const std::string& fileName);
+
+    /*!
+     * \brief evaluates a compiled function of one variable at
+     *        <code>count</code> points from <code>from</code> to
+     *        <code>to</code>, both included
+     *
+     * \throws RuntimeException if the file cannot be written
+     */
+    static void write(const CompiledExpression& function, FloatVal from,
+                      FloatVal to, size_t count, const std::string& fileName,
+                      Format format, ThreadPool& pool);
+};
+
+
+#endif // TABULATION_H_
@@ -0,0 +1,244 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+
+namespace
+{
+    //! pool the calling thread works for, if any
+    thread_local const ThreadPool* currentPool = nullptr;
+    thread_local size_t currentIndex = 0;
+}
+
+
+ThreadPool::ThreadPool(size_t threadCount) :
+    queued(0), stopping(false)
+{
+    if (threadCount == 0) {
+        unsigned hardware = std::thread::hardware_concurrency();
+        threadCount = hardware > 1 ? hardware - 1 : 1;
+    }
+    for (size_t i = 0; i <= threadCount; i++)
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    workers.reserve(threadCount);
+    for (size_t i = 0; i < threadCount; i++)
+        workers.push_back(std::thread(&ThreadPool::work, this, i));
+}
+
+
+ThreadPool::~ThreadPool(void)
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    available.notify_all();
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+
+ThreadPool& ThreadPool::getDefault(void)
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+
+void ThreadPool::submit(const Task& task)
+{
+    Queue& queue = *queues[getQueueIndex()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    queued++;
+
+    // taking the lock makes sure a worker checking for tasks either sees
+    // the new one or is already waiting for the notification
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        for (size_t i = 0; i < waiters.size(); i++)
+            waiters[i]->notify();
+    }
+    available.notify_one();
+}
+
+
+bool ThreadPool::runPending(void)
+{
+    Task task;
+    if (!takeTask(getQueueIndex(), task))
+        return false;
+    task();
+    return true;
+}
+
+
+size_t ThreadPool::getQueueIndex(void) const
+{
+    return currentPool == this ? currentIndex : workers.size();
+}
+
+
+bool ThreadPool::takeTask(size_t index, Task& task)
+{
+    if (queued == 0)
+        return false;
+
+    // newest own task first, it is the most likely to be small
+    {
+        Queue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task.swap(own.tasks.back());
+            own.tasks.pop_back();
+            queued--;
+            return true;
+        }
+    }
+
+    // then steal the oldest task of another queue
+    size_t count = queues.size();
+    for (size_t i = 1; i < count; i++) {
+        Queue& victim = *queues[(index + count - i) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task.swap(victim.tasks.front());
+            victim.tasks.pop_front();
+            queued--;
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void ThreadPool::work(size_t index)
+{
+    currentPool = this;
+    currentIndex = index;
+
+    while (true) {
+        Task task;
+        if (takeTask(index, task)) {
+            task();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        available.wait(lock, [this] {
+            return stopping || queued > 0;
+        });
+        if (stopping && queued == 0)
+            return;
+    }
+}
+
+
+void ThreadPool::addWaiter(TaskGroup* group)
+{
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    waiters.push_back(group);
+}
+
+
+void ThreadPool::removeWaiter(TaskGroup* group)
+{
+    std::lock_guard<std::mutex> lock(sleepMutex);
+    waiters.erase(std::find(waiters.begin(), waiters.end(), group));
+}
+
+
+TaskGroup::TaskGroup(ThreadPool& pool) :
+    pool(pool), pending(0)
+{
+}
+
+
+TaskGroup::~TaskGroup(void)
+{
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+
+void TaskGroup::run(const std::function<void(void)>& task)
+{
+    pending++;
+    pool.submit([this, task] {
+        try {
+            task();
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(errorMutex);
+            if (!error)
+                error = std::current_exception();
+        }
+
+        // the waiting thread returns only after seeing the count under the
+        // lock, so the group is not destroyed while this task still uses it
+        std::lock_guard<std::mutex> lock(mutex);
+        pending--;
+        changed.notify_all();
+    });
+}
+
+
+void TaskGroup::wait(void)
+{
+    bool finished = false;
+    while (!finished) {
+        if (pool.runPending())
+            continue;
+
+        pool.addWaiter(this);
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] {
+                return pending == 0 || pool.queued > 0;
+            });
+            finished = pending == 0;
+        }
+        pool.removeWaiter(this);
+    }
+
+    std::exception_ptr thrown;
+    {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        thrown = error;
+        error = nullptr;
+    }
+    if (thrown)
+        std::rethrow_exception(thrown);
+}
+
+
+void TaskGroup::notify(void)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    changed.notify_all();
+}
+
@@ -0,0 +1,158 @@
+// =============================================================================
+//
+// This file is part of the Mathy computer algebry system.
+//
+// Copyright (C) 2015-2016 Nicolas Winkler
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// =============================================================================
+
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+
+class TaskGroup;
+
+
+/*!
+ * \brief a fixed set of worker threads executing queued tasks
+ *
+ * Every worker owns a deque of tasks. Tasks submitted by a worker go to
+ * its own deque and are taken from the back again, so recursively split
+ * work stays on the thread that is likely to have its data in cache. Idle
+ * workers steal the oldest, and usually largest, tasks from the front of
+ * other deques. Tasks submitted from outside the pool are put into a
+ * shared queue.
+ */
+class ThreadPool
+{
+    typedef std::function<void(void)> Task;
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+
+    //! one queue per worker, the last one is shared by all other threads
+    std::vector<std::unique_ptr<Queue> > queues;
+
+    //! number of tasks in all queues
+    std::atomic<size_t> queued;
+
+    std::mutex sleepMutex;
+    std::condition_variable available;
+    bool stopping;
+
+    //! groups blocked in \link TaskGroup::wait, woken by every new task
+    std::vector<TaskGroup*> waiters;
+
+    friend class TaskGroup;
+public:
+    /*!
+     * \param threadCount the number of workers, or 0 to use one less than
+     *        the number of hardware threads, since the thread waiting for
+     *        the results helps executing tasks
+     */
+    explicit ThreadPool(size_t threadCount = 0);
+    ~ThreadPool(void);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator = (const ThreadPool&) = delete;
+
+    /*!
+     * \brief the pool shared by all parallel algorithms
+     */
+    static ThreadPool& getDefault(void);
+
+    inline size_t getThreadCount(void) const { return workers.size(); }
+
+    void submit(const Task& task);
+
+    /*!
+     * \brief executes one queued task in the calling thread
+     *
+     * \return <code>false</code> if no task was queued
+     */
+    bool runPending(void);
+
+private:
+    //! index of the calling thread's queue
+    size_t getQueueIndex(void) const;
+
+    bool takeTask(size_t index, Task& task);
+    void work(size_t index);
+
+    void addWaiter(TaskGroup* group);
+    void removeWaiter(TaskGroup* group);
+};
+
+
+/*!
+ * \brief a set of tasks that can be waited for
+ *
+ * A thread waiting for a group executes queued tasks in the meantime, so
+ * tasks may start and wait for groups themselves without exhausting the
+ * workers. When there is nothing to execute, it sleeps until one of the
+ * group's tasks finishes or a new task is queued.
+ */
+class TaskGroup
+{
+    ThreadPool& pool;
+    std::atomic<size_t> pending;
+    std::exception_ptr error;
+    std::mutex errorMutex;
+
+    //! guards the wake-ups of a waiting thread
+    std::mutex mutex;
+    std::condition_variable changed;
+public:
+    TaskGroup(ThreadPool& pool);
+
+    //! waits for all tasks, discarding their exceptions
+    ~TaskGroup(void);
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator = (const TaskGroup&) = delete;
+
+    void run(const std::function<void(void)>& task);
+
+    /*!
+     * \brief waits until all tasks have finished
+     *
+     * \throws the first exception thrown by a task
+     */
+    void wait(void);
+
+private:
+    friend class ThreadPool;
+
+    //! wakes the waiting thread, if any
+    void notify(void);
+};
+
+
+#endif // THREADPOOL_H_
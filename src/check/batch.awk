@@ -0,0 +1,57 @@
+# prints 200000 lines for make check-batch. Most of them are independent of
+# each other, every few hundred lines an assignment or a definition that
+# changes the environment ends a batch.
+
+function number()
+{
+    return int(rand() * 1000) - 300
+}
+
+function statement(kind,    a, b, c)
+{
+    a = number()
+    b = number()
+    c = number()
+    if (kind == 0)
+        return a " + " b " * " c " - " a " / " (b == 0 ? 7 : b)
+    if (kind == 1)
+        return "sin(" a ") * cos(" b ") + sqrt(" (c < 0 ? -c : c) ")"
+    if (kind == 2)
+        return "expand((x + " a ") ^ " (c % 5 + 5) " * (y - " b "))"
+    if (kind == 3)
+        return "digits(pi, " (a < 0 ? -a : a) ")"
+    if (kind == 4)
+        return "f(" a ") + g(" b ", " c ")"
+    if (kind == 5)
+        return "v * " a " + w"
+    if (kind == 6)
+        return "simplify(x * " a " + x * " b ")"
+    if (kind == 7)
+        return "[" a ", " b ", " c "] * " a
+    if (kind == 8)
+        return a " / (" b " - " b ")"
+    if (kind == 9)
+        return "unknown(" a ") +"
+    return "x < " a " and y > " b " or z == " c
+}
+
+BEGIN {
+    srand(2016)
+    print "f := !(x) -> x ^ 2 - 1"
+    print "g := !(x, y) -> if(x < y, x * y, x - y)"
+    print "v := 3"
+    print "w := v * 2"
+    for (i = 0; i < 200000; i++) {
+        r = int(rand() * 400)
+        if (r == 0)
+            print "v := " number()
+        else if (r == 1)
+            print "f := !(x) -> x * " number()
+        else if (r == 2)
+            print "h := !(x) -> (w := x)"
+        else if (r == 3)
+            print "h(" number() ")"
+        else
+            print statement(int(rand() * 11))
+    }
+}
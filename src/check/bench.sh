@@ -0,0 +1,42 @@
+#!/bin/sh
+# usage: bench.sh executable count < statements
+#
+# runs the statements read from standard input, repeating the last one count
+# times, and prints how long one repetition takes on average. A run with a
+# single repetition is subtracted, so start up and the other statements are
+# not counted. Every run is done three times and the fastest one is used.
+
+executable=$1
+count=${2:-100}
+directory=$(mktemp -d) || exit 1
+trap 'rm -rf "$directory"' EXIT
+
+cat > "$directory/once"
+tail -n 1 "$directory/once" > "$directory/last"
+cp "$directory/once" "$directory/repeated"
+i=1
+while [ $i -lt "$count" ]; do
+    cat "$directory/last" >> "$directory/repeated"
+    i=$((i + 1))
+done
+
+# prints the nanoseconds of the fastest of three runs on a file
+fastest()
+{
+    best=
+    for run in 1 2 3; do
+        start=$(date +%s%N)
+        "$executable" < "$1" > /dev/null 2>&1
+        time=$(($(date +%s%N) - start))
+        if [ -z "$best" ] || [ $time -lt $best ]; then
+            best=$time
+        fi
+    done
+    echo $best
+}
+
+once=$(fastest "$directory/once")
+repeated=$(fastest "$directory/repeated")
+awk -v ns=$((repeated - once)) -v count=$((count - 1)) \
+    -v text="$(cat "$directory/last")" \
+    'BEGIN { printf "%-40.40s %12.3f us\n", text, ns / count / 1000 }'
@@ -0,0 +1,44 @@
+# prints statements nested close to and beyond the depth at which the
+# generated parser runs out of stack, for make check-parser
+
+function repeat(text, count,    result)
+{
+    # doubling keeps 200000 repetitions fast
+    result = ""
+    for (; count > 0; count = int(count / 2)) {
+        if (count % 2)
+            result = result text
+        text = text text
+    }
+    return result
+}
+
+function nest(prefix, inner, suffix, count)
+{
+    print repeat(prefix, count) inner repeat(suffix, count)
+}
+
+BEGIN {
+    split("3000 3332 3333 3334 4999 5000 9997 9998 10000", depths, " ")
+    for (i = 1; i in depths; i++) {
+        n = depths[i]
+        nest("(", "1", ")", n)
+        nest("-", "1", "", n)
+        nest("not ", "x", "", n)
+        nest("[", "1", "]", n)
+        nest("f(", "1", ")", n)
+        nest("f(1, ", "x", ")", n)
+        nest("[1, ", "x", "]", n)
+        nest("1 + (", "1", ")", n)
+        nest("2 * (", "1", ")", n)
+        nest("x < (", "1", ")", n)
+        nest("a := ", "1", "", n)
+        nest("!(x) -> ", "x", "", n)
+        nest("!(x, y) -> ", "x", "", n)
+        nest("!() -> ", "1", "", n)
+        nest("-(f(1, [not ", "x", "]))", n)
+        nest("2 ^ ", "1", "", n)
+        nest("(", "1", "", n)
+    }
+    nest("(", "1", ")", 200000)
+}
@@ -0,0 +1,12 @@
+# stores a definition of 20000 terms and evaluates it again, for make bench.
+# Evaluating an unchanged definition should not walk its tree again. The
+# definition is compared with itself so that only a single number is
+# printed, printing all terms would take far longer than evaluating them.
+
+BEGIN {
+    line = "p := x1"
+    for (i = 2; i <= 20000; i++)
+        line = line " + x" i
+    print line
+    print "p == p"
+}
@@ -20,6 +20,10 @@
 // =============================================================================
 
 #include "ConsoleInterface.h"
+#include "CsvProcessor.h"
+#include "BatchProcessor.h"
+#include "ParserComparison.h"
+#include "ScriptProcessor.h"
 #include "sys.h"
 #include <cstdio>
 
@@ -28,15 +32,57 @@ int main(int argc, char** argv)
     using mathy::sys::OptionsParser;
     OptionsParser op(argc, argv);
 
+    mathy::ExpressionParser::Backend parser =
+        op.getParser() == "bison" ? mathy::ExpressionParser::Backend::BISON :
+                                    mathy::ExpressionParser::Backend::PRATT;
+
+    if (op.isParserCheck()) {
+        mathy::ParserComparison pc(stdin, stdout);
+        return pc.run();
+    }
+
+    if (!op.getCsvFile().empty()) {
+        mathy::CsvProcessor cp(op.getCsvFile(), op.getExpression(), stdout);
+        cp.setRulesFile(op.getRulesFile());
+        cp.setRuleProfile(op.getRuleProfile());
+        return cp.run();
+    }
+
+    if (!op.getScriptFile().empty()) {
+        mathy::ScriptProcessor sp(op.getScriptFile(), stdout);
+        sp.setRulesFile(op.getRulesFile());
+        sp.setRuleProfile(op.getRuleProfile());
+        sp.setParserBackend(parser);
+        return sp.run();
+    }
 
     // if run from terminal, provide better prompt
     if (mathy::sys::isRunInTerminal()) {
         mathy::ConsoleInterface ci(stdin, stdout);
+        ci.setRulesFile(op.getRulesFile());
+        ci.setRuleProfile(op.getRuleProfile());
+        ci.setParserBackend(parser);
+        ci.setParseCacheCapacity(op.getParseCacheCapacity());
+        ci.setParseStatistics(op.isParseStatistics());
         return ci.run();
     }
+    else if (op.isBatch()) {
+        mathy::BatchProcessor bp(stdin, stdout);
+        bp.setRulesFile(op.getRulesFile());
+        bp.setRuleProfile(op.getRuleProfile());
+        bp.setParserBackend(parser);
+        bp.setParseCacheCapacity(op.getParseCacheCapacity());
+        bp.setParseStatistics(op.isParseStatistics());
+        return bp.run();
+    }
     // if not run from terminal, just process raw input.
     else {
         mathy::InputProcessor ip(stdin, stdout);
+        ip.setRulesFile(op.getRulesFile());
+        ip.setRuleProfile(op.getRuleProfile());
+        ip.setParserBackend(parser);
+        ip.setParseCacheCapacity(op.getParseCacheCapacity());
+        ip.setParseStatistics(op.isParseStatistics());
         return ip.run();
     }
 }
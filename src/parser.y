@@ -23,30 +23,61 @@
 
 #include "Node.h"
 #include "FunctionNode.h"
+#include "LambdaNode.h"
 #include "Natives.h"
+#include "Matrix.h"
 #include <cstdlib>
+#include <algorithm>
 #include <exception>
 #include <memory>
 #include <cstdio>
 #include <iostream>
 
 
-/*! \brief root node of the AST */
-std::shared_ptr<ExpressionNode> expr;
-
-extern int yylex();
-void yyerror(const char *s)
-{
-    while(yylex());
-    throw "parse error";
-}
-
 template <typename T>
 using sp = std::shared_ptr<T>;
 
 
 %}
 
+%code requires {
+#include "Scanner.h"
+#include "ExpressionParser.h"
+}
+
+%code {
+extern int yylex(YYSTYPE* value, YYLTYPE* location, yyscan_t scanner);
+
+void yyerror(YYLTYPE* location, yyscan_t, mathy::ParseResult& result,
+             mathy::StatementList*, const char* message)
+{
+    mathy::ParseError error = {
+        message, size_t(location->first_line), size_t(location->first_column)
+    };
+    result.errors.push_back(error);
+}
+
+/* finishes a statement of a script */
+static bool addStatement(mathy::ParseResult& result,
+                         mathy::StatementList* list)
+{
+    list->statements.push_back(std::move(result));
+    result = mathy::ParseResult();
+    return list->statements.size() >= list->limit;
+}
+}
+
+/* the scanner is reentrant, its state is passed to every call and the
+   result is stored in the context instead of a global root node. Whole
+   scripts are collected in the statement list, which is nullptr when
+   parsing single statements. */
+%require "3.8"
+%define api.pure full
+%define parse.error custom
+%locations
+%param {yyscan_t scanner}
+%parse-param {mathy::ParseResult& result} {mathy::StatementList* list}
+
 /* %name-prefix "p" */
 /* %define api.prefix p */
 
@@ -77,21 +108,45 @@ using sp = std::shared_ptr<T>;
 
 
 /*
- * terminals
+ * terminals, the names in quotes appear in error messages
  */
-%token <string> TOKEN_IDENTIFIER TOKEN_INTEGER TOKEN_REAL
+%token END 0 "end of statement"
+%token <string> TOKEN_IDENTIFIER "identifier"
+%token <string> TOKEN_INTEGER "integer"
+%token <string> TOKEN_REAL "number"
+%token <string> TOKEN_STRING "string"
 
-%token <token> TOKEN_ERROR
+%token <token> TOKEN_ERROR "invalid character"
 %token <token> TOKEN_NEWLINE
-%token <token> TOKEN_LPAREN TOKEN_RPAREN TOKEN_LBRACE TOKEN_RBRACE TOKEN_COMMA
-%token <token> TOKEN_DOT TOKEN_COLON
-%token <token> TOKEN_BACKSLASH TOKEN_EXCLAMATION TOKEN_ARROW
+%token <token> TOKEN_SEPARATOR
+%token <token> TOKEN_LPAREN "(" TOKEN_RPAREN ")"
+%token <token> TOKEN_LBRACE "{" TOKEN_RBRACE "}" TOKEN_COMMA "comma"
+%token <token> TOKEN_LBRACKET "[" TOKEN_RBRACKET "]"
+%token <token> TOKEN_DOT "." TOKEN_COLON ":"
+%token <token> TOKEN_BACKSLASH "\\" TOKEN_EXCLAMATION "!"
+%token <token> TOKEN_ARROW "->"
+%token <token> TOKEN_LESS "<" TOKEN_LESS_EQUAL "<="
+%token <token> TOKEN_GREATER ">" TOKEN_GREATER_EQUAL ">="
+%token <token> TOKEN_EQUAL "==" TOKEN_NOT_EQUAL "!=" TOKEN_NOT "not"
 %token <string> TOKEN_OPERATOR
+%token <token> TOKEN_ASSIGNMENT ":="
+%token <token> TOKEN_OR "or" TOKEN_XOR "xor" TOKEN_AND "and"
+%token <token> TOKEN_PLUS "+" TOKEN_MINUS "-"
+%token <token> TOKEN_MUL "*" TOKEN_DIV "/" TOKEN_MOD "mod"
+%token <token> TOKEN_POW "^"
+
+/* values of discarded symbols are freed when a statement has errors */
+%destructor { delete $$; } <string> <expressionList> <lambdaArguments>
+%destructor { delete $$; } <expressionNode> <statementNode> <constantNode>
+%destructor { delete $$; } <integerNode> <realNode> <variableNode>
+%destructor { delete $$; } <functionCallNode> <functionNode>
+%destructor { delete $$; } <assignmentNode>
+%destructor { delete static_cast<ExpressionNode*>($$); } <operationNode>
 
 /*
  * non-terminals
  */
-%type <expressionNode> expression parenthExpr
+%type <expressionNode> expression parenthExpr list string
 %type <constantNode> constant
 %type <integerNode> integerConst
 %type <realNode> realConst
@@ -101,17 +156,22 @@ using sp = std::shared_ptr<T>;
 %type <expressionList> expressionList
 %type <lambdaArguments> lambdaArguments lambdaArgumentsPart
 
-%type <operationNode> operation
-%type <operationNode> addition subtraction multiplication modulo division power
-%type <operationNode> and or xor
+%type <expressionNode> operation addition subtraction multiplication
+%type <operationNode> modulo division power
+%type <operationNode> and or xor comparison
+%type <expressionNode> negation
 %type <assignmentNode> assignment
 %type <statementNode> statement
+%type <expressionNode> scriptStatementBody
 
 
 /* operator precedence */
 %right TOKEN_ASSIGNMENT
 %left TOKEN_OR TOKEN_XOR
 %left TOKEN_AND
+%right TOKEN_NOT
+%nonassoc TOKEN_LESS TOKEN_LESS_EQUAL TOKEN_GREATER TOKEN_GREATER_EQUAL
+%nonassoc TOKEN_EQUAL TOKEN_NOT_EQUAL
 %left TOKEN_PLUS TOKEN_MINUS
 %left TOKEN_MUL TOKEN_DIV TOKEN_MOD
 %left TOKEN_POW
@@ -120,19 +180,51 @@ using sp = std::shared_ptr<T>;
 %right "lambdaExpression"
 %right "parenthExpr"
 
-%start oneExpression
+/* yyparse reads one statement, yyparse_script a list of them */
+%start oneExpression script
 
 %%
 
 oneExpression:
     expression {
-        $<expressionNode>$ = $1;
-        expr = std::shared_ptr<ExpressionNode>($<expressionNode>$);
+        result.expression = std::shared_ptr<ExpressionNode>($1);
     }
     |
     /* empty */
     ;
 
+/* in script mode, the scanner returns separators instead of stopping at
+   the end of every statement */
+script:
+    /* empty */
+    |
+    script scriptStatement
+    ;
+
+scriptStatement:
+    scriptStatementBody TOKEN_SEPARATOR {
+        result.expression = std::shared_ptr<ExpressionNode>($1);
+        if (addStatement(result, list))
+            YYACCEPT;
+    }
+    |
+    error TOKEN_SEPARATOR {
+        // the error is recorded, continue with the next statement
+        yyerrok;
+        if (addStatement(result, list))
+            YYACCEPT;
+    };
+
+/* structured like oneExpression, so errors are reported the same way */
+scriptStatementBody:
+    expression {
+        $$ = $1;
+    }
+    |
+    /* empty */ {
+        $$ = nullptr;
+    };
+
 expression:
     constant {
         $$ = $1;
@@ -150,6 +242,14 @@ expression:
         $$ = $1;
     }
     |
+    list {
+        $$ = $1;
+    }
+    |
+    string {
+        $$ = $1;
+    }
+    |
     variable {
         $$ = $1;
     }
@@ -220,6 +320,26 @@ expressionList:
     |
     expressionList TOKEN_COMMA expression {
         $1->push_back(std::shared_ptr<ExpressionNode>($3));
+        $$ = $1;
+    };
+
+string:
+    TOKEN_STRING {
+        // strip the quotes
+        $$ = new StringNode($1->substr(1, $1->size() - 2));
+        delete $1;
+        $1 = 0;
+    };
+
+list:
+    TOKEN_LBRACKET expressionList TOKEN_RBRACKET {
+        $$ = new ListNode(*$2);
+        delete $2;
+        $2 = nullptr;
+    }
+    |
+    TOKEN_LBRACKET TOKEN_RBRACKET {
+        $$ = new ListNode(std::vector<std::shared_ptr<ExpressionNode> >());
     };
 
 functionCall:
@@ -236,7 +356,9 @@ functionCall:
 
 lambdaExpression:
     TOKEN_EXCLAMATION lambdaArguments TOKEN_ARROW expression {
-        $$ = new FunctionNode(*$2, std::shared_ptr<ExpressionNode> ($4));
+        std::shared_ptr<ExpressionNode> body($4);
+        FunctionCallNode::markTailCalls(body);
+        $$ = new LambdaNode(*$2, body);
         delete $2; $2 = nullptr;
     };
 
@@ -295,30 +417,29 @@ operation:
     |
     and {
         $$ = $1;
+    }
+    |
+    comparison {
+        $$ = $1;
+    }
+    |
+    negation {
+        $$ = $1;
     };
 
 addition:
     expression TOKEN_PLUS expression {
-        $$ = new AdditionNode(
-            std::shared_ptr<ExpressionNode>($1),
-            std::shared_ptr<ExpressionNode>($3)
-        );
+        $$ = SumNode::join($1, $3, false);
     };
 
 subtraction:
     expression TOKEN_MINUS expression {
-        $$ = new SubtractionNode(
-            std::shared_ptr<ExpressionNode>($1),
-            std::shared_ptr<ExpressionNode>($3)
-        );
+        $$ = SumNode::join($1, $3, true);
     };
 
 multiplication:
     expression TOKEN_MUL expression {
-        $$ = new MultiplicationNode(
-            std::shared_ptr<ExpressionNode>($1),
-            std::shared_ptr<ExpressionNode>($3)
-        );
+        $$ = ProductNode::join($1, $3);
     };
 
 modulo:
@@ -347,7 +468,7 @@ power:
 
 and:
     expression TOKEN_AND expression {
-        $$ = new PowerNode(
+        $$ = new AndNode(
             std::shared_ptr<ExpressionNode>($1),
             std::shared_ptr<ExpressionNode>($3)
         );
@@ -355,7 +476,7 @@ and:
 
 or:
     expression TOKEN_OR expression {
-        $$ = new PowerNode(
+        $$ = new OrNode(
             std::shared_ptr<ExpressionNode>($1),
             std::shared_ptr<ExpressionNode>($3)
         );
@@ -364,7 +485,55 @@ or:
 
 xor:
     expression TOKEN_XOR expression {
-        $$ = new PowerNode(
+        $$ = new XorNode(
+            std::shared_ptr<ExpressionNode>($1),
+            std::shared_ptr<ExpressionNode>($3)
+        );
+    };
+
+negation:
+    TOKEN_NOT expression {
+        $$ = new NotNode(std::shared_ptr<ExpressionNode>($2));
+    };
+
+comparison:
+    expression TOKEN_LESS expression {
+        $$ = new ComparisonNode(ComparisonNode::Relation::LESS,
+            std::shared_ptr<ExpressionNode>($1),
+            std::shared_ptr<ExpressionNode>($3)
+        );
+    }
+    |
+    expression TOKEN_LESS_EQUAL expression {
+        $$ = new ComparisonNode(ComparisonNode::Relation::LESS_EQUAL,
+            std::shared_ptr<ExpressionNode>($1),
+            std::shared_ptr<ExpressionNode>($3)
+        );
+    }
+    |
+    expression TOKEN_GREATER expression {
+        $$ = new ComparisonNode(ComparisonNode::Relation::GREATER,
+            std::shared_ptr<ExpressionNode>($1),
+            std::shared_ptr<ExpressionNode>($3)
+        );
+    }
+    |
+    expression TOKEN_GREATER_EQUAL expression {
+        $$ = new ComparisonNode(ComparisonNode::Relation::GREATER_EQUAL,
+            std::shared_ptr<ExpressionNode>($1),
+            std::shared_ptr<ExpressionNode>($3)
+        );
+    }
+    |
+    expression TOKEN_EQUAL expression {
+        $$ = new ComparisonNode(ComparisonNode::Relation::EQUAL,
+            std::shared_ptr<ExpressionNode>($1),
+            std::shared_ptr<ExpressionNode>($3)
+        );
+    }
+    |
+    expression TOKEN_NOT_EQUAL expression {
+        $$ = new ComparisonNode(ComparisonNode::Relation::NOT_EQUAL,
             std::shared_ptr<ExpressionNode>($1),
             std::shared_ptr<ExpressionNode>($3)
         );
@@ -379,4 +548,63 @@ parenthExpr:
 
 %%
 
+/* the separator of script mode is just another end of statement */
+static const char* getSymbolName(yysymbol_kind_t symbol)
+{
+    if (symbol == YYSYMBOL_TOKEN_SEPARATOR)
+        symbol = YYSYMBOL_YYEOF;
+    return yysymbol_name(symbol);
+}
 
+/* a state that shifts the error token is the start of a statement in a
+   script. bison uses no default reduction there, so the error is found
+   before the empty statement is reduced, unlike with yyparse */
+static bool isStatementStart(const yypcontext_t* context)
+{
+    int offset = yypact[*context->yyssp];
+    if (yypact_value_is_default(offset))
+        return false;
+    offset += YYSYMBOL_YYerror;
+    return 0 <= offset && offset <= YYLAST &&
+        yycheck[offset] == YYSYMBOL_YYerror;
+}
+
+/* builds the same messages as parse.error verbose */
+static int yyreport_syntax_error(const yypcontext_t* context, yyscan_t,
+                                 mathy::ParseResult& result,
+                                 mathy::StatementList*)
+{
+    std::string message = "syntax error";
+    yysymbol_kind_t token = yypcontext_token(context);
+    if (token != YYSYMBOL_YYEMPTY) {
+        message += ", unexpected ";
+        message += getSymbolName(token);
+
+        yysymbol_kind_t expected[YYNTOKENS];
+        int count = yypcontext_expected_tokens(context, expected, YYNTOKENS);
+        if (isStatementStart(context)) {
+            expected[0] = YYSYMBOL_TOKEN_SEPARATOR;
+            count = 1;
+        }
+        std::vector<std::string> names;
+        for (int i = 0; i < count; i++) {
+            std::string name = getSymbolName(expected[i]);
+            if (std::find(names.begin(), names.end(), name) == names.end())
+                names.push_back(name);
+        }
+        // longer lists would not help
+        if (names.size() <= 4) {
+            for (size_t i = 0; i < names.size(); i++) {
+                message += i == 0 ? ", expecting " : " or ";
+                message += names[i];
+            }
+        }
+    }
+
+    const YYLTYPE* location = yypcontext_location(context);
+    mathy::ParseError error = {
+        message, size_t(location->first_line), size_t(location->first_column)
+    };
+    result.errors.push_back(error);
+    return 0;
+}
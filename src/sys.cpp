@@ -21,29 +21,131 @@
 
 #include "sys.h"
 
+#include <cstdlib>
+
 
 // for posix systems
 #if defined(__APPLE__) || defined(__unix__) || defined(__linux__)
 
 #include <stdio.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 bool mathy::sys::isRunInTerminal(void)
 {
     return isatty(fileno(stdin));
 }
 
+
+mathy::sys::MappedFile::MappedFile(const std::string& path) :
+    data(nullptr), size(0), handle(-1), mapping(0)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+        return;
+
+    struct stat info;
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        return;
+    }
+
+    size = size_t(info.st_size);
+    // mapping an empty file fails, but an empty file is fine
+    if (size > 0) {
+        void* mapped = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            ::close(fd);
+            size = 0;
+            return;
+        }
+        data = static_cast<const char*>(mapped);
+    }
+    handle = fd;
+}
+
+
+mathy::sys::MappedFile::~MappedFile(void)
+{
+    if (data != nullptr)
+        ::munmap(const_cast<char*>(data), size);
+    if (handle != -1)
+        ::close(int(handle));
+}
+
+
+void mathy::sys::MappedFile::adviseSequential(void)
+{
+    if (data != nullptr)
+        ::madvise(const_cast<char*>(data), size, MADV_SEQUENTIAL);
+}
+
 // windows does everything a little bit differently
 #elif defined(_WIN32)
 
 
 #include <stdio.h>
 #include <io.h>
+#include <windows.h>
 bool mathy::sys::isRunInTerminal(void)
 {
     return _isatty(_fileno(stdin));
 }
 
 
+mathy::sys::MappedFile::MappedFile(const std::string& path) :
+    data(nullptr), size(0), handle(-1), mapping(0)
+{
+    HANDLE file = ::CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                                nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                                nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+
+    LARGE_INTEGER fileSize;
+    if (!::GetFileSizeEx(file, &fileSize)) {
+        ::CloseHandle(file);
+        return;
+    }
+
+    size = size_t(fileSize.QuadPart);
+    if (size > 0) {
+        HANDLE map = ::CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0,
+                                          nullptr);
+        void* view = map ? ::MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0) :
+                           nullptr;
+        if (view == nullptr) {
+            if (map)
+                ::CloseHandle(map);
+            ::CloseHandle(file);
+            size = 0;
+            return;
+        }
+        mapping = intptr_t(map);
+        data = static_cast<const char*>(view);
+    }
+    handle = intptr_t(file);
+}
+
+
+mathy::sys::MappedFile::~MappedFile(void)
+{
+    if (data != nullptr)
+        ::UnmapViewOfFile(data);
+    if (mapping != 0)
+        ::CloseHandle(HANDLE(mapping));
+    if (handle != -1)
+        ::CloseHandle(HANDLE(handle));
+}
+
+
+void mathy::sys::MappedFile::adviseSequential(void)
+{
+    // only a hint, windows is left to its own read-ahead
+}
+
+
 
 
 #endif
@@ -63,9 +165,56 @@ const std::string& mathy::sys::getProgramInfo(void)
 }
 
 
-mathy::sys::OptionsParser::OptionsParser(int argc, char** argv)
+mathy::sys::OptionsParser::OptionsParser(int argc, char** argv) :
+    parseCacheCapacity(4096), batch(false), parserCheck(false),
+    parseStatistics(false)
 {
-
+    const std::string rulesOption = "--rules";
+    const std::string profileOption = "--rule-profile";
+    const std::string csvOption = "--csv";
+    const std::string evalOption = "--eval";
+    const std::string parserOption = "--parser";
+    const std::string cacheOption = "--parse-cache";
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == rulesOption && i + 1 < argc)
+            rulesFile = argv[++i];
+        else if (arg.compare(0, rulesOption.size() + 1, rulesOption + "=") == 0)
+            rulesFile = arg.substr(rulesOption.size() + 1);
+        else if (arg == profileOption && i + 1 < argc)
+            ruleProfile = argv[++i];
+        else if (arg.compare(0, profileOption.size() + 1,
+                             profileOption + "=") == 0)
+            ruleProfile = arg.substr(profileOption.size() + 1);
+        else if (arg == csvOption && i + 1 < argc)
+            csvFile = argv[++i];
+        else if (arg.compare(0, csvOption.size() + 1, csvOption + "=") == 0)
+            csvFile = arg.substr(csvOption.size() + 1);
+        else if (arg == "--batch")
+            batch = true;
+        else if (arg == "--check-parser")
+            parserCheck = true;
+        else if (arg == parserOption && i + 1 < argc)
+            parser = argv[++i];
+        else if (arg.compare(0, parserOption.size() + 1,
+                             parserOption + "=") == 0)
+            parser = arg.substr(parserOption.size() + 1);
+        else if (arg == cacheOption && i + 1 < argc)
+            parseCacheCapacity = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg.compare(0, cacheOption.size() + 1,
+                             cacheOption + "=") == 0) {
+            parseCacheCapacity = std::strtoul(
+                arg.c_str() + cacheOption.size() + 1, nullptr, 10);
+        }
+        else if (arg == "--parse-stats")
+            parseStatistics = true;
+        else if (arg == evalOption && i + 1 < argc)
+            expression = argv[++i];
+        else if (arg.compare(0, evalOption.size() + 1, evalOption + "=") == 0)
+            expression = arg.substr(evalOption.size() + 1);
+        else if (arg.compare(0, 1, "-") != 0 && scriptFile.empty())
+            scriptFile = arg;
+    }
 }
 
 
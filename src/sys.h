@@ -23,6 +23,8 @@
 #define MATHY_PLATFORM_H_
 
 #include <string>
+#include <cstddef>
+#include <cstdint>
 
 namespace mathy
 {
@@ -36,10 +38,119 @@ namespace mathy
 
         class OptionsParser
         {
+            std::string rulesFile;
+            std::string ruleProfile;
+            std::string csvFile;
+            std::string expression;
+            std::string parser;
+            std::string scriptFile;
+            size_t parseCacheCapacity;
+            bool batch;
+            bool parserCheck;
+            bool parseStatistics;
         public:
             OptionsParser(int argc, char** argv);
 
             //const std::string getInput(void) const;
+
+            /*!
+             * \return the file given with <code>--rules</code>, or an empty
+             *         string
+             */
+            inline const std::string& getRulesFile(void) const
+            { return rulesFile; }
+
+            /*!
+             * \return the file given with <code>--rule-profile</code>, or
+             *         an empty string
+             */
+            inline const std::string& getRuleProfile(void) const
+            { return ruleProfile; }
+
+            /*!
+             * \return the file given with <code>--csv</code>, whose rows
+             *         are evaluated instead of reading the input, or an
+             *         empty string
+             */
+            inline const std::string& getCsvFile(void) const
+            { return csvFile; }
+
+            /*!
+             * \return the expression given with <code>--eval</code>
+             */
+            inline const std::string& getExpression(void) const
+            { return expression; }
+
+            /*!
+             * \return <code>true</code> if <code>--batch</code> was given,
+             *         which evaluates independent input lines in parallel
+             */
+            inline bool isBatch(void) const { return batch; }
+
+            /*!
+             * \return the script file given as first argument that is no
+             *         option, or an empty string
+             */
+            inline const std::string& getScriptFile(void) const
+            { return scriptFile; }
+
+            /*!
+             * \return the parser given with <code>--parser</code>, either
+             *         <code>pratt</code> or <code>bison</code>, or an
+             *         empty string
+             */
+            inline const std::string& getParser(void) const
+            { return parser; }
+
+            /*!
+             * \return <code>true</code> if <code>--check-parser</code> was
+             *         given, which compares the parsers on the input
+             */
+            inline bool isParserCheck(void) const { return parserCheck; }
+
+            /*!
+             * \return the number of input lines to keep parsed, given with
+             *         <code>--parse-cache</code>, 0 disables the cache
+             */
+            inline size_t getParseCacheCapacity(void) const
+            { return parseCacheCapacity; }
+
+            /*!
+             * \return <code>true</code> if <code>--parse-stats</code> was
+             *         given, which prints the hit rate of the parse cache
+             */
+            inline bool isParseStatistics(void) const
+            { return parseStatistics; }
+        };
+
+
+        /*!
+         * \brief a file mapped read-only into memory
+         *
+         * If the file cannot be opened or mapped, \link isOpen returns
+         * <code>false</code>.
+         */
+        class MappedFile
+        {
+            const char* data;
+            size_t size;
+            intptr_t handle;
+            intptr_t mapping;
+        public:
+            MappedFile(const std::string& path);
+            ~MappedFile(void);
+            MappedFile(const MappedFile&) = delete;
+            MappedFile& operator = (const MappedFile&) = delete;
+
+            inline bool isOpen(void) const { return handle != -1; }
+            inline const char* getData(void) const { return data; }
+            inline size_t getSize(void) const { return size; }
+
+            /*!
+             * \brief tells the system that the file is read from front to
+             *        back, so it reads ahead and drops pages early
+             */
+            void adviseSequential(void);
         };
     }
 }